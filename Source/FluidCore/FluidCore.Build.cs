@@ -0,0 +1,15 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+using UnrealBuildTool;
+
+//Numerics of the simulation in plain C++, so they build and run without the engine as well (see Standalone/CMakeLists.txt).
+//Core is only here for the module boilerplate; nothing under Public includes an engine header.
+public class FluidCore : ModuleRules
+{
+	public FluidCore(ReadOnlyTargetRules Target) : base(Target)
+	{
+		PCHUsage = PCHUsageMode.UseExplicitOrSharedPCHs;
+
+		PrivateDependencyModuleNames.AddRange(new string[] { "Core" });
+	}
+}
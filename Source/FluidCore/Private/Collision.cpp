@@ -0,0 +1,59 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FluidCore/Collision.h"
+#include <algorithm>
+
+namespace FluidCore
+{
+	bool ResolveContact(const FContact& contact, double radius, double restitutionCoefficient, double frictionCoefficient,
+		FVec3* position, FVec3* velocity)
+	{
+		if (!IsPenetrating(contact, *position, radius))
+		{
+			return false;
+		}
+
+		//Target point is the closest non-penetrating position from the current position
+		const FVec3 targetPoint = contact.point + radius * contact.normal;
+
+		//get new candidate relative velocity from the target point.
+		const FVec3 relativeVel = *velocity - contact.velocity;
+		const double normalDotRelativeVel = FVec3::Dot(contact.normal, relativeVel);
+		FVec3 relativeVelN = normalDotRelativeVel * contact.normal;
+		FVec3 relativeVelT = relativeVel - relativeVelN;
+
+		//Check if the velocity is facing opposite direction of the surface normal
+		if (normalDotRelativeVel < 0.0)
+		{
+			//Apply restitution coefficient to the surface normal component of the velocity
+			const FVec3 deltaRelativeVelN = (-restitutionCoefficient - 1.0) * relativeVelN;
+			relativeVelN *= -restitutionCoefficient;
+
+			//Apply friction to the tangential component of the velocity
+			// From Bridson et al., Robust Treatment of Collisions, Contact and
+			// Friction for Cloth Animation, 2002
+			// http://graphics.stanford.edu/papers/cloth-sig02/cloth.pdf
+			if (relativeVelT.SizeSquared() > 0.0)
+			{
+				const double frictionScale = std::max(1.0 - frictionCoefficient * deltaRelativeVelN.Size() / relativeVelT.Size(), 0.0);
+				relativeVelT *= frictionScale;
+			}
+
+			//Reassemble the components
+			*velocity = relativeVelN + relativeVelT + contact.velocity;
+		}
+
+		//Geometry fix
+		*position = targetPoint;
+		return true;
+	}
+
+	FContact PlaneContact(const FVec3& planePoint, const FVec3& normal, const FVec3& queryPoint)
+	{
+		FContact contact;
+		contact.point = queryPoint - FVec3::Dot(normal, queryPoint - planePoint) * normal;
+		contact.distance = FVec3::Distance(queryPoint, contact.point);
+		contact.normal = normal;
+		return contact;
+	}
+}
@@ -0,0 +1,99 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FluidCore/Lattice.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+namespace FluidCore
+{
+	namespace
+	{
+		//below this a thread costs more to start than the points take to write
+		constexpr size_t kMinNumOfPointsPerThread = 1 << 16;
+
+		int numAlong(double length, double offset, double spacing)
+		{
+			return (length >= offset) ? static_cast<int>(std::floor((length - offset) / spacing)) + 1 : 0;
+		}
+
+		bool isValidBox(const FVec3& size, double spacing)
+		{
+			return spacing > 0.0 && size.X >= 0.0 && size.Y >= 0.0 && size.Z >= 0.0;
+		}
+
+		//Sizes points once, then splits the layers into contiguous runs, one per thread. The calling thread takes the first run.
+		template <typename FLayout>
+		void fillLattice(const FLayout& layout, std::vector<FVec3>* points)
+		{
+			const size_t firstPoint = points->size();
+			const size_t numOfPoints = layout.GetNumOfPoints();
+			points->resize(firstPoint + numOfPoints);
+			FVec3* data = points->data() + firstPoint;
+
+			const int numOfLayers = layout.GetNumOfLayers();
+			const size_t maxNumOfThreads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+			const int numOfThreads = static_cast<int>(std::min({ maxNumOfThreads, numOfPoints / kMinNumOfPointsPerThread + 1, static_cast<size_t>(std::max(numOfLayers, 1)) }));
+			auto fillLayers = [&layout, data, numOfLayers, numOfThreads](int run) {
+				const int lastLayer = numOfLayers * (run + 1) / numOfThreads;
+				for (int k = numOfLayers * run / numOfThreads; k < lastLayer; k++)
+				{
+					layout.ForEachPointOfLayer(k, [data](size_t index, const FVec3& point) { data[index] = point; });
+				}
+			};
+
+			std::vector<std::thread> threads;
+			threads.reserve(numOfThreads - 1);
+			for (int run = 1; run < numOfThreads; run++)
+			{
+				threads.emplace_back(fillLayers, run);
+			}
+			fillLayers(0);
+			for (std::thread& thread : threads)
+			{
+				thread.join();
+			}
+		}
+	}
+
+	FBccLatticeLayout::FBccLatticeLayout(const FVec3& lowerCorner, const FVec3& upperCorner, double spacing)
+		: m_lowerCorner(lowerCorner), m_spacing(spacing)
+	{
+		const FVec3 size = upperCorner - lowerCorner;
+		if (!isValidBox(size, spacing))
+		{
+			return;
+		}
+
+		const double halfSpacing = spacing / 2.0;
+		m_numOfLayers = static_cast<int>(std::floor(size.Y / halfSpacing)) + 1;
+		m_numAlongX[0] = numAlong(size.X, 0.0, spacing);
+		m_numAlongZ[0] = numAlong(size.Z, 0.0, spacing);
+		m_numAlongX[1] = numAlong(size.X, halfSpacing, spacing);
+		m_numAlongZ[1] = numAlong(size.Z, halfSpacing, spacing);
+	}
+
+	FCubicLatticeLayout::FCubicLatticeLayout(const FVec3& lowerCorner, const FVec3& upperCorner, double spacing)
+		: m_lowerCorner(lowerCorner), m_spacing(spacing)
+	{
+		const FVec3 size = upperCorner - lowerCorner;
+		if (!isValidBox(size, spacing))
+		{
+			return;
+		}
+
+		m_numAlongX = numAlong(size.X, 0.0, spacing);
+		m_numAlongY = numAlong(size.Y, 0.0, spacing);
+		m_numOfLayers = numAlong(size.Z, 0.0, spacing);
+	}
+
+	void GenerateBccLattice(const FVec3& lowerCorner, const FVec3& upperCorner, double spacing, std::vector<FVec3>* points)
+	{
+		fillLattice(FBccLatticeLayout(lowerCorner, upperCorner, spacing), points);
+	}
+
+	void GenerateCubicLattice(const FVec3& lowerCorner, const FVec3& upperCorner, double spacing, std::vector<FVec3>* points)
+	{
+		fillLattice(FCubicLatticeLayout(lowerCorner, upperCorner, spacing), points);
+	}
+}
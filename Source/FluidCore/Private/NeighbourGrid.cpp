@@ -0,0 +1,72 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FluidCore/NeighbourGrid.h"
+#include <algorithm>
+#include <cmath>
+
+namespace FluidCore
+{
+	void FNeighbourGrid::Initialise(int32_t resolutionX, int32_t resolutionY, int32_t resolutionZ, double gridSpacing)
+	{
+		m_resolution[0] = resolutionX;
+		m_resolution[1] = resolutionY;
+		m_resolution[2] = resolutionZ;
+		m_gridSpacing = gridSpacing;
+	}
+
+	void FNeighbourGrid::Build(const FVec3* points, size_t num)
+	{
+		m_points.assign(points, points + num);
+		sortIntoBuckets();
+	}
+
+	int32_t FNeighbourGrid::getBucketIndex(double position) const
+	{
+		return static_cast<int32_t>(std::floor(position / m_gridSpacing));
+	}
+
+	int32_t FNeighbourGrid::wrapBucketIndex(int32_t bucketIndex, int axis) const
+	{
+		const int32_t wrappedIndex = bucketIndex % m_resolution[axis];
+		return (wrappedIndex < 0) ? wrappedIndex + m_resolution[axis] : wrappedIndex;
+	}
+
+	size_t FNeighbourGrid::getHashKeyFromPosition(const FVec3& position) const
+	{
+		return getHashKey(wrapBucketIndex(getBucketIndex(position.X), 0), wrapBucketIndex(getBucketIndex(position.Y), 1),
+			wrapBucketIndex(getBucketIndex(position.Z), 2));
+	}
+
+	void FNeighbourGrid::sortIntoBuckets()
+	{
+		const size_t n = m_points.size();
+		if (n == 0)
+		{
+			m_bucketStarts.clear();
+			m_bucketPoints.clear();
+			return;
+		}
+
+		//count the points of every bucket one slot ahead, so the scan turns the counts into starts
+		const size_t numOfBuckets = static_cast<size_t>(m_resolution[0]) * m_resolution[1] * m_resolution[2];
+		m_bucketStarts.assign(numOfBuckets + 1, 0);
+		for (const FVec3& position : m_points)
+		{
+			m_bucketStarts[getHashKeyFromPosition(position) + 1]++;
+		}
+		for (size_t k = 0; k < numOfBuckets; k++)
+		{
+			m_bucketStarts[k + 1] += m_bucketStarts[k];
+		}
+
+		//Filling a bucket moves its start to the start of the next one, so shifting the starts back one bucket restores them.
+		//Points stay in index order within a bucket.
+		m_bucketPoints.resize(n);
+		for (size_t i = 0; i < n; i++)
+		{
+			m_bucketPoints[m_bucketStarts[getHashKeyFromPosition(m_points[i])]++] = static_cast<int32_t>(i);
+		}
+		std::copy_backward(m_bucketStarts.begin(), m_bucketStarts.end() - 1, m_bucketStarts.end());
+		m_bucketStarts[0] = 0;
+	}
+}
@@ -0,0 +1,54 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FluidCore/SphStages.h"
+#include "FluidCore/Lattice.h"
+#include <cmath>
+#include <vector>
+
+namespace FluidCore
+{
+	double PressureFromEos(double density, double targetDensity, double eosScale, double eosExponent, double negativePressureScale)
+	{
+		double p = eosScale / eosExponent * (std::pow(density / targetDensity, eosExponent) - 1.0);
+
+		//Negative pressure scaling
+		if (p < 0)
+		{
+			p *= negativePressureScale;
+		}
+
+		return p;
+	}
+
+	double ComputePcisphDenominator(double kernelRadius, double targetSpacing)
+	{
+		std::vector<FVec3> points;
+		GenerateBccLattice(FVec3(-1.5 * kernelRadius), FVec3(1.5 * kernelRadius), targetSpacing, &points);
+
+		const FSpikyKernel kernel(kernelRadius);
+		FVec3 denom1;
+		double denom2 = 0;
+		for (const FVec3& point : points)
+		{
+			const double distanceSquared = point.SizeSquared();
+			if (distanceSquared < kernelRadius * kernelRadius)
+			{
+				const double distance = std::sqrt(distanceSquared);
+				const FVec3 direction = (distance > 0.0) ? point / distance : FVec3();
+
+				//grad(Wij)
+				const FVec3 gradWij = kernel.Gradient(distance, direction);
+				denom1 += gradWij;
+				denom2 += FVec3::Dot(gradWij, gradWij);
+			}
+		}
+		return FVec3::Dot(-denom1, denom1) - denom2;
+	}
+
+	double ComputePcisphDelta(double denominator, double mass, double targetDensity, double timeStep)
+	{
+		const double massTimeStepOverDensity = mass * timeStep / targetDensity;
+		const double beta = 2.0 * massTimeStepOverDensity * massTimeStepOverDensity;
+		return (std::abs(denominator) > 0.0) ? -1 / (beta * denominator) : 0.0;
+	}
+}
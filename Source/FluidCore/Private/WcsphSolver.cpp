@@ -0,0 +1,144 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FluidCore/WcsphSolver.h"
+#include "FluidCore/Collision.h"
+#include "FluidCore/Kernels.h"
+#include "FluidCore/Lattice.h"
+#include "FluidCore/SphStages.h"
+
+namespace FluidCore
+{
+	FWcsphSolver::FWcsphSolver(const FWcsphSettings& settings)
+		: m_settings(settings), m_kernelRadius(settings.targetSpacing * settings.kernelRadiusOverTargetSpacing)
+	{
+		m_grid.Initialise(settings.gridResolution, settings.gridResolution, settings.gridResolution, m_kernelRadius);
+	}
+
+	void FWcsphSolver::FillBox(const FVec3& lowerCorner, const FVec3& upperCorner)
+	{
+		std::vector<FVec3> points;
+		GenerateBccLattice(lowerCorner, upperCorner, m_settings.targetSpacing, &points);
+		for (const FVec3& point : points)
+		{
+			AddParticle(point, FVec3());
+		}
+	}
+
+	void FWcsphSolver::AddParticle(const FVec3& position, const FVec3& velocity)
+	{
+		m_positions.push_back(position);
+		m_velocities.push_back(velocity);
+		m_forces.push_back(FVec3());
+		m_densities.push_back(m_settings.targetDensity);
+		m_pressures.push_back(0.0);
+	}
+
+	void FWcsphSolver::Step(double timeStep)
+	{
+		buildNeighbourLists();
+		computeDensities();
+		computePressures();
+		accumulateForces();
+		integrate(timeStep);
+		resolveCollisions();
+	}
+
+	void FWcsphSolver::buildNeighbourLists()
+	{
+		const size_t n = m_positions.size();
+		m_grid.Build(m_positions.data(), n);
+
+		m_neighbourStarts.resize(n + 1);
+		m_neighbours.clear();
+		for (size_t i = 0; i < n; i++)
+		{
+			m_neighbourStarts[i] = static_cast<int32_t>(m_neighbours.size());
+			m_grid.ForEachNearbyPoint(m_positions[i], m_kernelRadius, [&](size_t j, const FVec3&) {
+				if (i != j)
+				{
+					m_neighbours.push_back(static_cast<int32_t>(j));
+				}
+			});
+		}
+		m_neighbourStarts[n] = static_cast<int32_t>(m_neighbours.size());
+	}
+
+	void FWcsphSolver::computeDensities()
+	{
+		const FStdKernel kernel(m_kernelRadius);
+		const double mass = m_settings.particleMass;
+		for (size_t i = 0; i < m_positions.size(); i++)
+		{
+			double sum = mass * kernel(0.0);
+			for (int32_t k = m_neighbourStarts[i]; k < m_neighbourStarts[i + 1]; k++)
+			{
+				sum += mass * kernel(FVec3::Distance(m_positions[i], m_positions[m_neighbours[k]]));
+			}
+			m_densities[i] = sum;
+		}
+	}
+
+	void FWcsphSolver::computePressures()
+	{
+		const double eosScale = m_settings.targetDensity * m_settings.speedOfSound * m_settings.speedOfSound;
+		for (size_t i = 0; i < m_positions.size(); i++)
+		{
+			m_pressures[i] = m_settings.pressureScale * PressureFromEos(m_densities[i], m_settings.targetDensity, eosScale,
+				m_settings.eosExponent, m_settings.negativePressureScale);
+		}
+	}
+
+	void FWcsphSolver::accumulateForces()
+	{
+		const FSpikyKernel kernel(m_kernelRadius);
+		const double mass = m_settings.particleMass;
+		for (size_t i = 0; i < m_positions.size(); i++)
+		{
+			FVec3 force = mass * m_settings.gravity;
+			const double pressureOverDensitySquared = m_pressures[i] / (m_densities[i] * m_densities[i]);
+			for (int32_t k = m_neighbourStarts[i]; k < m_neighbourStarts[i + 1]; k++)
+			{
+				const int32_t j = m_neighbours[k];
+				force += PressureForceTerm(mass, mass, pressureOverDensitySquared, m_pressures[j] / (m_densities[j] * m_densities[j]),
+					m_positions[i], m_positions[j], kernel);
+				force += ViscosityForceTerm(m_settings.viscosityCoefficient, mass, mass, m_velocities[i], m_velocities[j], m_densities[j],
+					FVec3::Distance(m_positions[i], m_positions[j]), kernel);
+			}
+			m_forces[i] = force;
+		}
+	}
+
+	void FWcsphSolver::integrate(double timeStep)
+	{
+		for (size_t i = 0; i < m_positions.size(); i++)
+		{
+			IntegrateParticle(m_positions[i], m_velocities[i], m_forces[i], m_settings.particleMass, timeStep, &m_positions[i], &m_velocities[i]);
+		}
+	}
+
+	void FWcsphSolver::resolveCollisions()
+	{
+		const FVec3& lower = m_settings.domainLower;
+		const FVec3& upper = m_settings.domainUpper;
+		const FVec3 wallPoints[6] = { lower, lower, lower, upper, upper, upper };
+		const FVec3 wallNormals[6] = { FVec3(1, 0, 0), FVec3(0, 1, 0), FVec3(0, 0, 1), FVec3(-1, 0, 0), FVec3(0, -1, 0), FVec3(0, 0, -1) };
+		for (size_t i = 0; i < m_positions.size(); i++)
+		{
+			for (int w = 0; w < 6; w++)
+			{
+				ResolveContact(PlaneContact(wallPoints[w], wallNormals[w], m_positions[i]), m_settings.particleRadius,
+					m_settings.restitutionCoefficient, m_settings.frictionCoefficient, &m_positions[i], &m_velocities[i]);
+			}
+		}
+	}
+
+	double FWcsphSolver::GetKineticEnergy() const
+	{
+		double energy = 0.0;
+		for (const FVec3& velocity : m_velocities)
+		{
+			energy += 0.5 * m_settings.particleMass * velocity.SizeSquared();
+		}
+		return energy;
+	}
+}
@@ -0,0 +1,37 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "FluidCore/Vec3.h"
+
+namespace FluidCore
+{
+	//Closest point of a collider surface to a particle, with the surface normal and velocity there
+	struct FContact
+	{
+		double distance{ 0.0 };
+		FVec3 point;
+		FVec3 normal{ 0.0, 0.0, 1.0 };
+		FVec3 velocity;
+	};
+
+	//If the position is on the other side of the surface OR closer to it than the particle's radius, the particle is colliding
+	inline bool IsPenetrating(const FContact& contact, const FVec3& position, double radius)
+	{
+		return FVec3::Dot(position - contact.point, contact.normal) < 0.0 || contact.distance < radius;
+	}
+
+	//Moves a penetrating particle to the closest non-penetrating position, and reflects the part of its velocity going into the
+	//surface with restitution and friction. Returns whether the particle was penetrating.
+	FLUIDCORE_API bool ResolveContact(const FContact& contact, double radius, double restitutionCoefficient, double frictionCoefficient,
+		FVec3* position, FVec3* velocity);
+
+	//Contact with the infinite plane through planePoint, for a query point on either side of it
+	FLUIDCORE_API FContact PlaneContact(const FVec3& planePoint, const FVec3& normal, const FVec3& queryPoint);
+
+	//Velocity of a point moving rigidly with a body
+	inline FVec3 RigidVelocityAt(const FVec3& linearVelocity, const FVec3& angularVelocity, const FVec3& centre, const FVec3& point)
+	{
+		return linearVelocity + FVec3::Cross(angularVelocity, point - centre);
+	}
+}
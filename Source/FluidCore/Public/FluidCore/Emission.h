@@ -0,0 +1,24 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "FluidCore/Vec3.h"
+#include <algorithm>
+
+namespace FluidCore
+{
+	//Time the k-th particle due in a step has been on its way by the end of the step. Particles come due at a constant rate,
+	//and pendingEmission of a particle had already built up when the step began. The last particle due can be 0 old.
+	inline double EmissionAge(int k, double pendingEmission, double particlesPerSecond, double timeStep)
+	{
+		const double dueTime = (k + 1 - pendingEmission) / particlesPerSecond;
+		return std::max(timeStep - dueTime, 0.0);
+	}
+
+	//Where a particle emitted from origin with the given velocity is by the end of the step, so the particles of one step
+	//come out as a stream instead of on top of each other
+	inline FVec3 EmissionPosition(const FVec3& origin, const FVec3& velocity, int k, double pendingEmission, double particlesPerSecond, double timeStep)
+	{
+		return origin + EmissionAge(k, pendingEmission, particlesPerSecond, timeStep) * velocity;
+	}
+}
@@ -0,0 +1,8 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+//The engine build defines the export macro of the module. The standalone build links the core statically.
+#ifndef FLUIDCORE_API
+#define FLUIDCORE_API
+#endif
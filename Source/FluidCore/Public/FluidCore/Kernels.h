@@ -0,0 +1,100 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "FluidCore/Vec3.h"
+
+namespace FluidCore
+{
+	constexpr double kPi = 3.14159265358979323846264338327950288;
+
+	//This Gaussian-like kernel (Mueller et al. 2003) will be used for the interpolation and field calculation
+	struct FStdKernel
+	{
+		//kernel radius
+		double h{ 0.0 }, h2{ 0.0 }, h3{ 0.0 }, h5{ 0.0 };
+
+		FStdKernel() = default;
+		explicit FStdKernel(double kernelRadius) : h(kernelRadius), h2(h * h), h3(h2 * h), h5(h2 * h3) {}
+
+		double operator()(double distance) const
+		{
+			//distance between particles (r)
+			if (distance * distance >= h2)
+			{
+				return 0.0;
+			}
+			const double x = 1.0 - distance * distance / h2;
+			return 315.0 / (64.0 * kPi * h3) * x * x * x;
+		}
+
+		double FirstDerivative(double distance) const
+		{
+			if (distance >= h)
+			{
+				return 0.0;
+			}
+			const double x = 1.0 - distance * distance / h2;
+			return -945.0 / (32.0 * kPi * h5) * distance * x * x;
+		}
+
+		double SecondDerivative(double distance) const
+		{
+			if (distance * distance >= h2)
+			{
+				return 0.0;
+			}
+			const double x = distance * distance / h2;
+			return 945.0 / (32.0 * kPi * h5) * (1 - x) * (5 * x - 1);
+		}
+
+		FVec3 Gradient(double distance, const FVec3& directionToCentre) const
+		{
+			return -FirstDerivative(distance) * directionToCentre;
+		}
+	};
+
+	//This Mueller's kernel will only be used for the gradient and Laplacian calculation
+	struct FSpikyKernel
+	{
+		double h{ 0.0 }, h2{ 0.0 }, h3{ 0.0 }, h4{ 0.0 }, h5{ 0.0 };
+
+		FSpikyKernel() = default;
+		explicit FSpikyKernel(double kernelRadius) : h(kernelRadius), h2(h * h), h3(h2 * h), h4(h2 * h2), h5(h3 * h2) {}
+
+		double operator()(double distance) const
+		{
+			if (distance >= h)
+			{
+				return 0.0;
+			}
+			const double x = 1.0 - distance / h;
+			return 15.0 / (kPi * h3) * x * x * x;
+		}
+
+		double FirstDerivative(double distance) const
+		{
+			if (distance >= h)
+			{
+				return 0.0;
+			}
+			const double x = 1.0 - distance / h;
+			return -45.0 / (kPi * h4) * x * x;
+		}
+
+		double SecondDerivative(double distance) const
+		{
+			if (distance >= h)
+			{
+				return 0.0;
+			}
+			const double x = 1.0 - distance / h;
+			return 90.0 / (kPi * h5) * x;
+		}
+
+		FVec3 Gradient(double distance, const FVec3& directionToCentre) const
+		{
+			return -FirstDerivative(distance) * directionToCentre;
+		}
+	};
+}
@@ -0,0 +1,91 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "FluidCore/Vec3.h"
+#include <cstddef>
+#include <vector>
+
+namespace FluidCore
+{
+	//Body-centred cubic points in the box: layers half a spacing apart along Y, and every other layer is offset by half a spacing
+	//on X and Z. Every layer knows where its points start, so the output is sized once and the layers are filled in parallel.
+	class FLUIDCORE_API FBccLatticeLayout
+	{
+		FVec3 m_lowerCorner;
+		double m_spacing{ 0.0 };
+		int m_numOfLayers{ 0 };
+		//points along X and rows along Z, of the even layers and of the offset odd ones
+		int m_numAlongX[2]{ 0, 0 };
+		int m_numAlongZ[2]{ 0, 0 };
+
+	public:
+		FBccLatticeLayout(const FVec3& lowerCorner, const FVec3& upperCorner, double spacing);
+
+		int GetNumOfLayers() const { return m_numOfLayers; }
+		size_t GetNumOfPoints() const { return GetFirstPointOfLayer(m_numOfLayers); }
+		size_t GetFirstPointOfLayer(int k) const
+		{
+			return static_cast<size_t>((k + 1) / 2) * m_numAlongX[0] * m_numAlongZ[0] + static_cast<size_t>(k / 2) * m_numAlongX[1] * m_numAlongZ[1];
+		}
+
+		//Layer k has GetNumAlongZ(k) rows of GetNumAlongX(k) points
+		int GetNumAlongX(int k) const { return m_numAlongX[k % 2]; }
+		int GetNumAlongZ(int k) const { return m_numAlongZ[k % 2]; }
+		FVec3 GetPoint(int i, int k, int j) const
+		{
+			const double offset = (k % 2) * 0.5 * m_spacing;
+			return FVec3(i * m_spacing + offset + m_lowerCorner.X, k * 0.5 * m_spacing + m_lowerCorner.Y, j * m_spacing + offset + m_lowerCorner.Z);
+		}
+
+		//Calls write(index, point) for every point of layer k. The index counts from the first point of the lattice.
+		template <typename FWritePoint>
+		void ForEachPointOfLayer(int k, FWritePoint&& write) const
+		{
+			size_t index = GetFirstPointOfLayer(k);
+			for (int j = 0; j < GetNumAlongZ(k); j++)
+			{
+				for (int i = 0; i < GetNumAlongX(k); i++)
+				{
+					write(index++, GetPoint(i, k, j));
+				}
+			}
+		}
+	};
+
+	//Points of a cubic grid in the box, in layers of constant Z
+	class FLUIDCORE_API FCubicLatticeLayout
+	{
+		FVec3 m_lowerCorner;
+		double m_spacing{ 0.0 };
+		int m_numAlongX{ 0 };
+		int m_numAlongY{ 0 };
+		int m_numOfLayers{ 0 };
+
+	public:
+		FCubicLatticeLayout(const FVec3& lowerCorner, const FVec3& upperCorner, double spacing);
+
+		int GetNumOfLayers() const { return m_numOfLayers; }
+		size_t GetNumOfPoints() const { return GetFirstPointOfLayer(m_numOfLayers); }
+		size_t GetFirstPointOfLayer(int k) const { return static_cast<size_t>(k) * m_numAlongX * m_numAlongY; }
+
+		//Calls write(index, point) for every point of layer k. The index counts from the first point of the lattice.
+		template <typename FWritePoint>
+		void ForEachPointOfLayer(int k, FWritePoint&& write) const
+		{
+			size_t index = GetFirstPointOfLayer(k);
+			for (int j = 0; j < m_numAlongY; j++)
+			{
+				for (int i = 0; i < m_numAlongX; i++)
+				{
+					write(index++, m_lowerCorner + FVec3(i, j, k) * m_spacing);
+				}
+			}
+		}
+	};
+
+	//Appended to points. Large lattices are filled by several threads, one run of layers each.
+	//The game module's BCCLatticePointsGenerator and CubicLatticePointsGenerator fill the same layouts with ParallelFor.
+	FLUIDCORE_API void GenerateBccLattice(const FVec3& lowerCorner, const FVec3& upperCorner, double spacing, std::vector<FVec3>* points);
+	FLUIDCORE_API void GenerateCubicLattice(const FVec3& lowerCorner, const FVec3& upperCorner, double spacing, std::vector<FVec3>* points);
+}
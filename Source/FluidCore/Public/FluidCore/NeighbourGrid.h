@@ -0,0 +1,142 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "FluidCore/Vec3.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace FluidCore
+{
+	/**
+	 * Grid based hashing for the fixed radius neighbour queries. Buckets are wrapped into a grid of resolution buckets per axis,
+	 * so far away points can share a bucket and a query checks the distance to every point of the buckets it visits.
+	 * The buckets are a counting sort into flat arrays, which keep their memory between builds.
+	 */
+	class FLUIDCORE_API FNeighbourGrid
+	{
+		double m_gridSpacing{ 2.0 };
+		int32_t m_resolution[3]{ 64, 64, 64 };
+		//bucket k holds m_bucketPoints[m_bucketStarts[k], m_bucketStarts[k + 1])
+		std::vector<int32_t> m_bucketStarts;
+		std::vector<int32_t> m_bucketPoints;
+		std::vector<FVec3> m_points;
+
+		//sorts the points in m_points into the buckets
+		void sortIntoBuckets();
+
+		int32_t getBucketIndex(double position) const;
+		//wraps a bucket index into [0, resolution) of the axis
+		int32_t wrapBucketIndex(int32_t bucketIndex, int axis) const;
+		size_t getHashKeyFromPosition(const FVec3& position) const;
+		size_t getHashKey(int32_t x, int32_t y, int32_t z) const
+		{
+			return static_cast<size_t>((y * m_resolution[2] + z) * m_resolution[0] + x);
+		}
+		//calls visitBucket(first, end) with the range in m_bucketPoints of every bucket the box overlaps, each once
+		template <typename VisitBucket>
+		void forEachBucketInBox(const FVec3& lower, const FVec3& upper, VisitBucket&& visitBucket) const;
+
+	public:
+		void Initialise(int32_t resolutionX, int32_t resolutionY, int32_t resolutionZ, double gridSpacing);
+
+		//getPosition(i) returns the position of point i as an FVec3
+		template <typename GetPosition>
+		void Build(size_t num, GetPosition&& getPosition);
+		void Build(const FVec3* points, size_t num);
+
+		//Calls callback(index, position) for every point within radius of origin (inclusive), visiting each point once.
+		//Every bucket the query sphere overlaps is visited, so the radius doesn't need to be related to the grid spacing.
+		template <typename Callback>
+		void ForEachNearbyPoint(const FVec3& origin, double radius, Callback&& callback) const;
+		//Calls callback(index, position) for every point inside the box (inclusive), visiting each point once
+		template <typename Callback>
+		void ForEachPointInBox(const FVec3& lower, const FVec3& upper, Callback&& callback) const;
+
+		//Point indices sorted by bucket, so points next to each other in it are mostly close in space too
+		const std::vector<int32_t>& GetPointsInBucketOrder() const { return m_bucketPoints; }
+
+		size_t GetNumOfPoints() const { return m_points.size(); }
+		const FVec3& GetPoint(size_t i) const { return m_points[i]; }
+		double GetGridSpacing() const { return m_gridSpacing; }
+	};
+
+	template <typename GetPosition>
+	void FNeighbourGrid::Build(size_t num, GetPosition&& getPosition)
+	{
+		//resize only constructs the points past the old size, so a warmed up grid doesn't allocate
+		m_points.resize(num);
+		for (size_t i = 0; i < num; i++)
+		{
+			m_points[i] = getPosition(i);
+		}
+		sortIntoBuckets();
+	}
+
+	template <typename VisitBucket>
+	void FNeighbourGrid::forEachBucketInBox(const FVec3& lower, const FVec3& upper, VisitBucket&& visitBucket) const
+	{
+		if (m_bucketStarts.empty())
+		{
+			return;
+		}
+
+		//bucket range of the box per axis. A range as wide as the grid visits every wrapped bucket once.
+		int32_t first[3];
+		int32_t num[3];
+		const double lowerCorner[3] = { lower.X, lower.Y, lower.Z };
+		const double upperCorner[3] = { upper.X, upper.Y, upper.Z };
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const int32_t lowerBucket = getBucketIndex(lowerCorner[axis]);
+			const int32_t upperBucket = getBucketIndex(upperCorner[axis]);
+			num[axis] = (upperBucket - lowerBucket + 1 < m_resolution[axis]) ? upperBucket - lowerBucket + 1 : m_resolution[axis];
+			first[axis] = wrapBucketIndex(lowerBucket, axis);
+		}
+
+		for (int32_t j = 0, y = first[1]; j < num[1]; j++, y = (y + 1 == m_resolution[1]) ? 0 : y + 1)
+		{
+			for (int32_t k = 0, z = first[2]; k < num[2]; k++, z = (z + 1 == m_resolution[2]) ? 0 : z + 1)
+			{
+				for (int32_t i = 0, x = first[0]; i < num[0]; i++, x = (x + 1 == m_resolution[0]) ? 0 : x + 1)
+				{
+					const size_t key = getHashKey(x, y, z);
+					visitBucket(m_bucketStarts[key], m_bucketStarts[key + 1]);
+				}
+			}
+		}
+	}
+
+	template <typename Callback>
+	void FNeighbourGrid::ForEachNearbyPoint(const FVec3& origin, double radius, Callback&& callback) const
+	{
+		const double queryRadiusSquared = radius * radius;
+		forEachBucketInBox(origin - FVec3(radius), origin + FVec3(radius), [&](int32_t first, int32_t end) {
+			for (int32_t p = first; p < end; ++p)
+			{
+				const size_t pointIndex = static_cast<size_t>(m_bucketPoints[p]);
+				if (FVec3::DistSquared(m_points[pointIndex], origin) <= queryRadiusSquared)
+				{
+					callback(pointIndex, m_points[pointIndex]);
+				}
+			}
+		});
+	}
+
+	template <typename Callback>
+	void FNeighbourGrid::ForEachPointInBox(const FVec3& lower, const FVec3& upper, Callback&& callback) const
+	{
+		forEachBucketInBox(lower, upper, [&](int32_t first, int32_t end) {
+			for (int32_t p = first; p < end; ++p)
+			{
+				const size_t pointIndex = static_cast<size_t>(m_bucketPoints[p]);
+				const FVec3& point = m_points[pointIndex];
+				if (point.X >= lower.X && point.Y >= lower.Y && point.Z >= lower.Z && point.X <= upper.X && point.Y <= upper.Y && point.Z <= upper.Z)
+				{
+					callback(pointIndex, point);
+				}
+			}
+		});
+	}
+}
@@ -0,0 +1,46 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "FluidCore/Kernels.h"
+
+namespace FluidCore
+{
+	//Pressure of a particle from its density, with negative pressures scaled by negativePressureScale.
+	//See Murnaghan-Tait equation of state from https://en.wikipedia.org/wiki/Tait_equation
+	FLUIDCORE_API double PressureFromEos(double density, double targetDensity, double eosScale, double eosExponent, double negativePressureScale);
+
+	//Pressure force on particle i from neighbour j, symmetric so the pair conserves momentum. Zero for coincident particles.
+	inline FVec3 PressureForceTerm(double massI, double massJ, double pressureOverDensitySquaredI, double pressureOverDensitySquaredJ,
+		const FVec3& positionI, const FVec3& positionJ, const FSpikyKernel& kernel)
+	{
+		const double dist = FVec3::Distance(positionI, positionJ);
+		if (dist > 0.0)
+		{
+			const FVec3 dir = (positionJ - positionI) / dist;
+			return -(massI * massJ * (pressureOverDensitySquaredI + pressureOverDensitySquaredJ)) * kernel.Gradient(dist, dir);
+		}
+		return FVec3();
+	}
+
+	//Viscosity force on particle i from neighbour j
+	inline FVec3 ViscosityForceTerm(double viscosityCoefficient, double massI, double massJ, const FVec3& velocityI, const FVec3& velocityJ,
+		double densityJ, double dist, const FSpikyKernel& kernel)
+	{
+		return viscosityCoefficient * massI * massJ * (velocityJ - velocityI) / densityJ * kernel.SecondDerivative(dist);
+	}
+
+	//Semi-implicit Euler: the velocity is integrated first and moves the position
+	inline void IntegrateParticle(const FVec3& position, const FVec3& velocity, const FVec3& force, double mass, double timeStep,
+		FVec3* newPosition, FVec3* newVelocity)
+	{
+		*newVelocity = velocity + timeStep * force / mass;
+		*newPosition = position + timeStep * *newVelocity;
+	}
+
+	//Sum over a full BCC neighbourhood of the gradient terms in the PCISPH scaling factor (Solenthaler and Pajarola 2009).
+	//Depends only on the kernel radius and the spacing, so callers cache it.
+	FLUIDCORE_API double ComputePcisphDenominator(double kernelRadius, double targetSpacing);
+	//Maps a density error to the pressure that cancels it, for a particle of the given mass. Zero when the denominator is.
+	FLUIDCORE_API double ComputePcisphDelta(double denominator, double mass, double targetDensity, double timeStep);
+}
@@ -0,0 +1,47 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "FluidCore/FluidCoreConfig.h"
+#include <cmath>
+
+namespace FluidCore
+{
+	//Vector of the core, in double precision like the rest of the numerics. The engine's FVector converts to and from it.
+	struct FVec3
+	{
+		double X{ 0.0 };
+		double Y{ 0.0 };
+		double Z{ 0.0 };
+
+		FVec3() = default;
+		FVec3(double x, double y, double z) : X(x), Y(y), Z(z) {}
+		explicit FVec3(double value) : X(value), Y(value), Z(value) {}
+
+		FVec3 operator+(const FVec3& other) const { return FVec3(X + other.X, Y + other.Y, Z + other.Z); }
+		FVec3 operator-(const FVec3& other) const { return FVec3(X - other.X, Y - other.Y, Z - other.Z); }
+		FVec3 operator-() const { return FVec3(-X, -Y, -Z); }
+		FVec3 operator*(double scale) const { return FVec3(X * scale, Y * scale, Z * scale); }
+		FVec3 operator/(double scale) const { return FVec3(X / scale, Y / scale, Z / scale); }
+		FVec3& operator+=(const FVec3& other) { X += other.X; Y += other.Y; Z += other.Z; return *this; }
+		FVec3& operator-=(const FVec3& other) { X -= other.X; Y -= other.Y; Z -= other.Z; return *this; }
+		FVec3& operator*=(double scale) { X *= scale; Y *= scale; Z *= scale; return *this; }
+		FVec3& operator/=(double scale) { X /= scale; Y /= scale; Z /= scale; return *this; }
+
+		double SizeSquared() const { return X * X + Y * Y + Z * Z; }
+		double Size() const { return std::sqrt(SizeSquared()); }
+		//Zero for the zero vector instead of NaNs
+		FVec3 GetSafeNormal() const
+		{
+			const double size = Size();
+			return (size > 0.0) ? *this / size : FVec3();
+		}
+
+		static double Dot(const FVec3& a, const FVec3& b) { return a.X * b.X + a.Y * b.Y + a.Z * b.Z; }
+		static FVec3 Cross(const FVec3& a, const FVec3& b) { return FVec3(a.Y * b.Z - a.Z * b.Y, a.Z * b.X - a.X * b.Z, a.X * b.Y - a.Y * b.X); }
+		static double DistSquared(const FVec3& a, const FVec3& b) { return (a - b).SizeSquared(); }
+		static double Distance(const FVec3& a, const FVec3& b) { return (a - b).Size(); }
+	};
+
+	inline FVec3 operator*(double scale, const FVec3& vector) { return vector * scale; }
+}
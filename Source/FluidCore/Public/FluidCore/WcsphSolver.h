@@ -0,0 +1,81 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "FluidCore/NeighbourGrid.h"
+#include "FluidCore/Vec3.h"
+#include <cstdint>
+#include <vector>
+
+namespace FluidCore
+{
+	//Defaults match the game mode and AParticleSystemSolver, so a run here steps like a WCSPH scene in the game
+	struct FWcsphSettings
+	{
+		double targetDensity{ 1.0 };
+		double targetSpacing{ 1.0 };
+		double kernelRadiusOverTargetSpacing{ 1.8 };
+		double particleMass{ 1.0 };
+		double particleRadius{ 1.0 };
+		double speedOfSound{ 100.0 };
+		double eosExponent{ 1.0 };
+		double negativePressureScale{ 0.0 };
+		//the game scales its WCSPH pressures down by this
+		double pressureScale{ 0.01 };
+		double viscosityCoefficient{ 3.0 };
+		double restitutionCoefficient{ 0.0 };
+		double frictionCoefficient{ 0.0 };
+		FVec3 gravity{ 0.0, 0.0, -9.8 };
+		//the particles are kept inside this box by its six walls
+		FVec3 domainLower{ -10.0 };
+		FVec3 domainUpper{ 10.0 };
+		int32_t gridResolution{ 64 };
+	};
+
+	/**
+	 * Single threaded weakly compressible SPH on plain arrays, with the same stages as AParticleSystemSolver:
+	 * neighbour lists, densities, EOS pressures, pressure and viscosity forces, semi-implicit integration and collisions.
+	 * For the standalone tests and benchmarks. The arrays keep their memory, so steps don't allocate once warmed up.
+	 */
+	class FLUIDCORE_API FWcsphSolver
+	{
+		FWcsphSettings m_settings;
+		double m_kernelRadius{ 1.8 };
+
+		std::vector<FVec3> m_positions;
+		std::vector<FVec3> m_velocities;
+		std::vector<FVec3> m_forces;
+		std::vector<double> m_densities;
+		std::vector<double> m_pressures;
+
+		FNeighbourGrid m_grid;
+		//neighbours of particle i are m_neighbours[m_neighbourStarts[i], m_neighbourStarts[i + 1])
+		std::vector<int32_t> m_neighbourStarts;
+		std::vector<int32_t> m_neighbours;
+
+		void buildNeighbourLists();
+		void computeDensities();
+		void computePressures();
+		void accumulateForces();
+		void integrate(double timeStep);
+		void resolveCollisions();
+
+	public:
+		explicit FWcsphSolver(const FWcsphSettings& settings = FWcsphSettings());
+
+		//Fills the box with particles at rest on a BCC lattice of the target spacing
+		void FillBox(const FVec3& lowerCorner, const FVec3& upperCorner);
+		void AddParticle(const FVec3& position, const FVec3& velocity);
+		void Step(double timeStep);
+
+		size_t GetNumOfParticles() const { return m_positions.size(); }
+		size_t GetNumOfNeighbourPairs() const { return m_neighbours.size(); }
+		double GetKernelRadius() const { return m_kernelRadius; }
+		const FWcsphSettings& GetSettings() const { return m_settings; }
+		const std::vector<FVec3>& GetPositions() const { return m_positions; }
+		const std::vector<FVec3>& GetVelocities() const { return m_velocities; }
+		const std::vector<double>& GetDensities() const { return m_densities; }
+		const std::vector<double>& GetPressures() const { return m_pressures; }
+		double GetKineticEnergy() const;
+	};
+}
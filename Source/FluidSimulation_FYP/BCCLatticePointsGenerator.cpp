@@ -2,51 +2,36 @@
 
 
 #include "BCCLatticePointsGenerator.h"
+#include "FluidCoreTypes.h"
+#include "FluidCore/Lattice.h"
+#include "Runtime/Core/Public/Async/ParallelFor.h"
 
 void BCCLatticePointsGenerator::generate(const FVector& lowercorner, const FVector& uppercorner, double spacing, TArray<FVector>* points) const
 {
-	//Looks like we have an infinite recursive loop. 
-	ForEachPoint(lowercorner, uppercorner, spacing, [&points](const FVector& point) {
-		if (points->Num() > 1000)
-		{
-			UE_LOG(LogTemp, Warning, TEXT("Points array has more than 1000 items in it. ABORT ERROR!"));
-			return false;
-		}
-		points->Add(point);
-		return true;
+	//The layout is the core's, so the game and the standalone build spawn the same points.
+	//Every layer knows where its points start, so the layers are filled in parallel straight into the array.
+	const FluidCore::FBccLatticeLayout layout(ToCore(lowercorner), ToCore(uppercorner), spacing);
+	const int32 firstPoint = points->Num();
+	points->AddUninitialized(static_cast<int32>(layout.GetNumOfPoints()));
+	FVector* data = points->GetData() + firstPoint;
+	ParallelFor(layout.GetNumOfLayers(), [&layout, data](int32 k) {
+		layout.ForEachPointOfLayer(k, [data](size_t index, const FluidCore::FVec3& point) { data[index] = FromCore(point); });
 		});
 }
 
 void BCCLatticePointsGenerator::ForEachPoint(const FVector& lowercorner, const FVector& uppercorner, double spacing, const ForEachBBCCallback& callback) const
 {
-	double halfSpacing = spacing / 2.0;
-	double boxWidth = uppercorner.X - lowercorner.X;
-	double boxHeight = uppercorner.Z - lowercorner.Z;
-	double boxDepth = uppercorner.Y - lowercorner.Y;
-
-	//Sometimes the dimensions are not generated correctly. 
-	//UE_LOG(LogTemp, Warning, TEXT("Box Width: %f, Box Height: %f, Box Depth: %f"), boxWidth, boxHeight, boxDepth); //The box has dimension of 5.4 on all axis.
-
-	FVector position;
-	bool hasOffset = false;
-	bool shouldQuit = false;
-	for (int k = 0; k * halfSpacing <= boxDepth && !shouldQuit; ++k) {
-		position.Y = k * halfSpacing + lowercorner.Y;
-
-		double offset = (hasOffset) ? halfSpacing : 0.0;
-
-		for (int j = 0; j * spacing + offset <= boxHeight && !shouldQuit; ++j) {
-			position.Z = j * spacing + offset + lowercorner.Z;
-
-			for (int i = 0; i * spacing + offset <= boxWidth; ++i) {
-				position.X = i * spacing + offset + lowercorner.X;
-				if (!callback(position)) {
-					shouldQuit = true;
-					break;
-				}
+	const FluidCore::FBccLatticeLayout layout(ToCore(lowercorner), ToCore(uppercorner), spacing);
+	for (int32 k = 0; k < layout.GetNumOfLayers(); k++)
+	{
+		for (int32 j = 0; j < layout.GetNumAlongZ(k); j++)
+		{
+			for (int32 i = 0; i < layout.GetNumAlongX(k); i++)
+			{
+				//points are made one at a time, so stopping early skips the rest of the lattice
+				if (!callback(FromCore(layout.GetPoint(i, k, j))))
+					return;
 			}
 		}
-
-		hasOffset = !hasOffset;
 	}
 }
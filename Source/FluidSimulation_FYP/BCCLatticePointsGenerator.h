@@ -19,7 +19,7 @@ public:
 	BCCLatticePointsGenerator() = default;
 	~BCCLatticePointsGenerator() = default;
 
-	//Generates points inside given range with spacing as the target point.
+	//Generates points inside given range with spacing as the target point. The points are appended to the array.
 	void generate(const FVector& lowercorner, const FVector& uppercorner, double spacing, TArray<FVector>* points) const;
 
 	//Invokes callback for each BCC-lattice points inside the bounds where spacing is the size of the unit cell of BCC structure.
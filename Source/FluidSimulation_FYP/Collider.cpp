@@ -2,6 +2,9 @@
 
 
 #include "Collider.h"
+#include "Engine/StaticMesh.h"
+#include "StaticMeshResources.h"
+#include "Misc/Paths.h"
 
 // Sets default values
 ACollider::ACollider()
@@ -15,94 +18,194 @@ ACollider::ACollider()
 	//m_location = m_mesh->GetComponentTransform().GetLocation();
 }
 
-void ACollider::ResolveCollision(double radius, double restitutionCoefficient, FVector* newPosition, FVector* newVelocity)
+void ACollider::UpdateSnapshot(double timeIntervalInSeconds)
 {
-	ColliderQueryResult colliderPoint;
-
-	GetQueryResult(*newPosition, &colliderPoint);
-
-	//Check if the new position is penetrating the surface
-	if (IsPenetrating(colliderPoint, *newPosition, radius))
+	FColliderSnapshot snapshot;
+	snapshot.transform = m_mesh->GetComponentTransform();
+	snapshot.transform.SetScale3D(FVector(1.0f));
+	snapshot.inverseTransform = snapshot.transform.Inverse();
+	snapshot.normal = m_mesh->GetUpVector();
+	snapshot.frictionCoefficient = m_frictionCoefficient;
+	snapshot.distanceField = m_distanceField.IsValid() ? &m_distanceField : nullptr;
+
+	//Kinematic colliders: the velocities come from how far the transform moved since the previous step
+	if (m_hasSnapshot && timeIntervalInSeconds > 0.0)
 	{
-		//Target point is the closest non-penetrating position from the current position
-		FVector targetNormal = colliderPoint.normal;
-		FVector targetPoint = colliderPoint.point + radius * targetNormal;
-		FVector colliderVelAtTargetPoint = colliderPoint.velocity;
-
-		//get new candidate relative velocity from the target point.
-		FVector relativeVel = *newVelocity - colliderVelAtTargetPoint;
-		double normalDotRelativeVel = FVector::DotProduct(targetNormal, relativeVel);
-		FVector relativeVelN = normalDotRelativeVel * targetNormal;
-		FVector relativeVelT = relativeVel - relativeVelN;
-
-		//Check if the velocity is facing opposite direction of the surface normal
-		if (normalDotRelativeVel < 0.0)
-		{
-			//Apply restitution coefficient to the surface normal component of the velocity
-			FVector deltaRelativeVelN = (-restitutionCoefficient - 1.0) * relativeVelN;
-			relativeVelN *= -restitutionCoefficient;
-
-			//Apply friction to the tangential component of the velocity
-			// From Bridson et al., Robust Treatment of Collisions, Contact and
-			// Friction for Cloth Animation, 2002
-			// http://graphics.stanford.edu/papers/cloth-sig02/cloth.pdf
-			if (relativeVelT.SizeSquared() > 0.0f)
-			{
-				double frictionScale = FMath::Max(1.0 - m_frictionCoefficient * deltaRelativeVelN.Size() / relativeVelT.Size(), 0.0);
-				relativeVelT *= frictionScale;
-			}
+		snapshot.linearVelocity = (snapshot.transform.GetTranslation() - m_snapshot.transform.GetTranslation()) / timeIntervalInSeconds;
 
-			//Reassemble the components
-			*newVelocity = relativeVelN + relativeVelT + colliderVelAtTargetPoint;
+		FQuat deltaRotation = snapshot.transform.GetRotation() * m_snapshot.transform.GetRotation().Inverse();
+		if (deltaRotation.W < 0.0f)
+		{
+			//take the short way round
+			deltaRotation = deltaRotation * -1.0f;
 		}
-
-		//Geometry fix
-		*newPosition = targetPoint;
+		FVector axis;
+		float angle;
+		deltaRotation.ToAxisAndAngle(axis, angle);
+		snapshot.angularVelocity = axis * angle / timeIntervalInSeconds;
 	}
-}
 
-FVector ACollider::VelocityAt(const FVector& point) const
-{
-	FVector r = point - m_mesh->GetComponentTransform().GetTranslation(); //if we have to use the relative location we would use m_mesh->GetRelativeLocation();
-	return m_linearVelocity + FVector::CrossProduct(m_angularVelocity, r);
+	m_snapshot = snapshot;
+	m_hasSnapshot = true;
 }
 
-double ACollider::ClosestDistance(const FVector& point) const
+void ACollider::BeginPlay()
 {
-	//get closest distance to the surface
-	return FVector::Distance(point, ClosestPoint(point));
+	Super::BeginPlay();
+
+	InitialiseDistanceField();
+	UpdateSnapshot(0.0);
 }
 
-FVector ACollider::ClosestPoint(const FVector& point) const
+void ACollider::InitialiseDistanceField()
 {
-	//get closest point in the surface. This is causing some crashes. It might be because it's constantly refering to the mesh pointer.
-	FVector r = point - m_location;
-	FCriticalSection Mutex;
-	Mutex.Lock();
-	FVector closestPointResult = r - FVector::DotProduct(m_mesh->GetUpVector(), r) * m_mesh->GetUpVector() + m_mesh->GetComponentLocation();
-	Mutex.Unlock();
-	return closestPointResult;
+	if (!m_useMeshDistanceField || m_isDistanceFieldInitialised)
+	{
+		return;
+	}
+	m_isDistanceFieldInitialised = true;
+
+	UStaticMesh* staticMesh = m_mesh->GetStaticMesh();
+	if (staticMesh == nullptr)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Collider %s has no static mesh to build a distance field from"), *GetName());
+		return;
+	}
+
+	//The scale is baked into the field so that its distances are in world units
+	const FVector scale = m_mesh->GetComponentScale();
+
+	const uint32 sourceKey = HashCombine(HashCombine(GetTypeHash(staticMesh->GetPathName()), GetTypeHash(scale)), GetTypeHash(m_distanceFieldResolution));
+	const FString cacheFile = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("DistanceFields"),
+		m_distanceFieldCacheFile.IsEmpty() ? staticMesh->GetName() + TEXT(".sdf") : m_distanceFieldCacheFile);
+
+	if (m_distanceField.LoadFromFile(cacheFile) && m_distanceField.GetSourceKey() == sourceKey)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Loaded distance field for %s from %s"), *GetName(), *cacheFile);
+		return;
+	}
+
+	TArray<FVector> vertices;
+	TArray<uint32> indices;
+	if (!getMeshTriangles(&vertices, &indices))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Couldn't read the triangles of %s. Enable Allow CPU Access on the mesh or ship its distance field cache"), *staticMesh->GetName());
+		m_distanceField = FSignedDistanceField();
+		return;
+	}
+	for (FVector& vertex : vertices)
+	{
+		vertex *= scale;
+	}
+
+	const double startTime = FPlatformTime::Seconds();
+	const double cellSize = FBox(vertices).GetSize().GetMax() / m_distanceFieldResolution;
+	m_distanceField.Bake(vertices, indices, cellSize, 3, sourceKey);
+	UE_LOG(LogTemp, Warning, TEXT("Baked distance field for %s (%i triangles) in %f s"), *GetName(), indices.Num() / 3, FPlatformTime::Seconds() - startTime);
+
+	if (!m_distanceField.SaveToFile(cacheFile))
+		UE_LOG(LogTemp, Warning, TEXT("Couldn't write the distance field cache %s"), *cacheFile);
 }
 
-void ACollider::GetQueryResult(const FVector& queryPoint, ColliderQueryResult* result)
+void ACollider::SampleBoundaryParticles(double spacing, TArray<FVector>* points)
 {
-	result->distance = ClosestDistance(queryPoint); //Get closest distance from querypoint to the mesh
-	result->point = ClosestPoint(queryPoint); //get the closest point on the mesh to the querypoint
-	result->normal = m_mesh->GetUpVector(); //get the normal
-	m_linearVelocity = (result->normal == FVector(0, 0, 1)) ? FVector(0.0) : result->normal;
-	result->velocity = VelocityAt(queryPoint); 
+	InitialiseDistanceField();
+	UStaticMesh* staticMesh = m_mesh->GetStaticMesh();
+
+	if (!m_distanceField.IsValid())
+	{
+		//The plane is infinite for collisions, but only the extent of its mesh can be sampled
+		if (staticMesh == nullptr)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Collider %s has no mesh to sample boundary particles from"), *GetName());
+			return;
+		}
+		const FTransform& transform = m_mesh->GetComponentTransform();
+		const FBox localBounds = staticMesh->GetBoundingBox();
+		const FVector size = localBounds.GetSize() * transform.GetScale3D().GetAbs();
+		const int32 numX = FMath::Max(FMath::CeilToInt(size.X / spacing), 1);
+		const int32 numY = FMath::Max(FMath::CeilToInt(size.Y / spacing), 1);
+		for (int32 y = 0; y <= numY; y++)
+		{
+			for (int32 x = 0; x <= numX; x++)
+			{
+				const FVector localPoint(FMath::Lerp(localBounds.Min.X, localBounds.Max.X, static_cast<float>(x) / numX),
+					FMath::Lerp(localBounds.Min.Y, localBounds.Max.Y, static_cast<float>(y) / numY), 0.0f);
+				points->Add(transform.TransformPosition(localPoint));
+			}
+		}
+		return;
+	}
+
+	//Project the lattice points close to the surface onto it, dropping the ones that land too close to an accepted point
+	FTransform fieldTransform = m_mesh->GetComponentTransform();
+	fieldTransform.SetScale3D(FVector(1.0f));
+	const FBox fieldBounds = m_distanceField.GetBounds();
+	const double minDistance = 0.5 * spacing;
+	TMap<FIntVector, TArray<FVector>> acceptedPoints;
+	const FIntVector numOfSamples = FIntVector(FMath::CeilToInt(fieldBounds.GetSize().X / spacing), FMath::CeilToInt(fieldBounds.GetSize().Y / spacing), FMath::CeilToInt(fieldBounds.GetSize().Z / spacing));
+	for (int32 z = 0; z <= numOfSamples.Z; z++)
+	{
+		for (int32 y = 0; y <= numOfSamples.Y; y++)
+		{
+			for (int32 x = 0; x <= numOfSamples.X; x++)
+			{
+				const FVector samplePoint = fieldBounds.Min + FVector(x, y, z) * spacing;
+				double distance;
+				FVector gradient;
+				if (!m_distanceField.Sample(samplePoint, &distance, &gradient) || FMath::Abs(distance) >= minDistance || gradient.IsNearlyZero())
+					continue;
+
+				const FVector surfacePoint = samplePoint - distance * gradient.GetSafeNormal();
+				const FIntVector cell(FMath::FloorToInt(surfacePoint.X / minDistance), FMath::FloorToInt(surfacePoint.Y / minDistance), FMath::FloorToInt(surfacePoint.Z / minDistance));
+				bool isTooClose = false;
+				for (int32 k = 0; k < 27 && !isTooClose; k++)
+				{
+					const TArray<FVector>* cellPoints = acceptedPoints.Find(cell + FIntVector(k % 3 - 1, (k / 3) % 3 - 1, k / 9 - 1));
+					if (cellPoints == nullptr)
+						continue;
+					for (const FVector& point : *cellPoints)
+					{
+						isTooClose = isTooClose || FVector::DistSquared(point, surfacePoint) < minDistance * minDistance;
+					}
+				}
+				if (isTooClose)
+					continue;
+
+				acceptedPoints.FindOrAdd(cell).Add(surfacePoint);
+				points->Add(fieldTransform.TransformPositionNoScale(surfacePoint));
+			}
+		}
+	}
 }
 
-bool ACollider::IsPenetrating(const ColliderQueryResult& colliderPoint, const FVector& position, double radius)
+void ACollider::InitialiseMeshCollider(UStaticMesh* staticMesh, const FVector& size)
 {
-	//If the new candidate position of the particle is on the other side of the surface OR the new distance to the
-	//surface is less than the particle's radius, this particle is in colliding state.
-	return FVector::DotProduct((position - colliderPoint.point), colliderPoint.normal) < 0.0f || colliderPoint.distance < radius;
+	const FVector meshSize = staticMesh->GetBoundingBox().GetSize();
+	m_mesh->SetStaticMesh(staticMesh);
+	m_mesh->SetWorldScale3D(size / meshSize.ComponentMax(FVector(KINDA_SMALL_NUMBER)));
+	m_useMeshDistanceField = true;
+	m_isDistanceFieldInitialised = false;
+	InitialiseDistanceField();
+	UpdateSnapshot(0.0);
 }
 
-void ACollider::BeginPlay()
+bool ACollider::getMeshTriangles(TArray<FVector>* vertices, TArray<uint32>* indices) const
 {
-	Super::BeginPlay();
+	const UStaticMesh* staticMesh = m_mesh->GetStaticMesh();
+	if (staticMesh->RenderData == nullptr || staticMesh->RenderData->LODResources.Num() == 0)
+	{
+		return false;
+	}
+
+	const FStaticMeshLODResources& lod = staticMesh->RenderData->LODResources[0];
+	const FPositionVertexBuffer& positions = lod.VertexBuffers.PositionVertexBuffer;
+	vertices->SetNumUninitialized(positions.GetNumVertices());
+	for (uint32 i = 0; i < positions.GetNumVertices(); i++)
+	{
+		(*vertices)[i] = positions.VertexPosition(i);
+	}
+	lod.IndexBuffer.GetCopy(*indices);
 
-	m_location = m_mesh->GetComponentLocation();
+	return vertices->Num() > 0 && indices->Num() >= 3;
 }
@@ -5,6 +5,8 @@
 #include "CoreMinimal.h"
 #include "GameFramework/Actor.h"
 #include "Components/ActorComponent.h"
+#include "SignedDistanceField.h"
+#include "ColliderSnapshot.h"
 #include "Collider.generated.h"
 
 UCLASS()
@@ -16,30 +18,45 @@ class FLUIDSIMULATION_FYP_API ACollider : public AActor
 	class UStaticMeshComponent* m_mesh;
 
 	double m_frictionCoefficient{ 0.0 };
-	FVector m_linearVelocity = FVector(0.0f, 0.0f, 0.0f);
-	FVector m_angularVelocity = FVector(0.0f, 0.0f, 0.0f);
-	FVector m_location;
+
+	//state published for the current simulation step
+	FColliderSnapshot m_snapshot;
+	bool m_hasSnapshot{ false };
+
+	//Mesh colliders (like the teapot) collide against a signed distance field of their mesh instead of the infinite plane
+	UPROPERTY(EditAnywhere, Category = "FluidSimulation")
+	bool m_useMeshDistanceField{ false };
+
+	//Samples along the longest side of the mesh bounds
+	UPROPERTY(EditAnywhere, Category = "FluidSimulation", meta = (ClampMin = "8", ClampMax = "256"))
+	int32 m_distanceFieldResolution{ 48 };
+
+	//Cache file in Saved/DistanceFields. Defaults to the mesh name.
+	UPROPERTY(EditAnywhere, Category = "FluidSimulation")
+	FString m_distanceFieldCacheFile;
+
+	FSignedDistanceField m_distanceField;
+	bool m_isDistanceFieldInitialised{ false };
+
+	bool getMeshTriangles(TArray<FVector>* vertices, TArray<uint32>* indices) const;
 	
 public:	
 	// Sets default values for this actor's properties
 	ACollider();
 
-	void ResolveCollision(double radius, double restitutionCoefficient, FVector* newPosition, FVector* newVelocity);
-	FVector VelocityAt(const FVector& point) const;
-	double ClosestDistance(const FVector& point) const;
-	FVector ClosestPoint(const FVector& point) const;
-
-protected:
-	struct ColliderQueryResult {
-		double distance;
-		FVector point;
-		FVector normal;
-		FVector velocity;
-	};
+	//Publishes the transform and velocities for the next step. Must be called on the game thread, once per step.
+	void UpdateSnapshot(double timeIntervalInSeconds);
+	//Collision queries go through the snapshot, which is safe to read from worker threads
+	const FColliderSnapshot& GetSnapshot() const { return m_snapshot; }
 
-	void GetQueryResult(const FVector& queryPoint, ColliderQueryResult* result);
-	bool IsPenetrating(const ColliderQueryResult& colliderPoint, const FVector& position, double radius);
+	//Bakes or loads the distance field of mesh colliders. Safe to call more than once.
+	void InitialiseDistanceField();
+	//Turns a spawned collider into a mesh collider with the mesh scaled to this size, for colliders that aren't placed in the level
+	void InitialiseMeshCollider(class UStaticMesh* staticMesh, const FVector& size);
+	//Samples the collider surface with points roughly spacing apart, for boundary particles
+	void SampleBoundaryParticles(double spacing, TArray<FVector>* points);
 
+protected:
 	//Called when the game starts or when spawned
 	virtual void BeginPlay() override;
 };
\ No newline at end of file
@@ -0,0 +1,96 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ColliderBVH.h"
+#include <algorithm>
+
+const int32 FColliderBVH::kMaxPrimitivesPerLeaf = 2;
+
+void FColliderBVH::Build(const TArray<FBox>& bounds)
+{
+	m_bounds = bounds;
+	m_nodes.Reset();
+	m_primitives.Reset();
+
+	if (m_bounds.Num() == 0)
+	{
+		return;
+	}
+
+	m_primitives.SetNumUninitialized(m_bounds.Num());
+	for (int32 i = 0; i < m_bounds.Num(); i++)
+	{
+		m_primitives[i] = i;
+	}
+
+	//a binary tree has at most 2n - 1 nodes, so reserving keeps node references valid while building
+	m_nodes.Reserve(2 * m_bounds.Num() - 1);
+	m_nodes.AddDefaulted();
+	buildNode(0, 0, m_bounds.Num());
+}
+
+void FColliderBVH::buildNode(int32 nodeIndex, int32 first, int32 count)
+{
+	FBox nodeBounds(ForceInit);
+	for (int32 i = first; i < first + count; i++)
+	{
+		nodeBounds += m_bounds[m_primitives[i]];
+	}
+	m_nodes[nodeIndex].bounds = nodeBounds;
+
+	if (count <= kMaxPrimitivesPerLeaf)
+	{
+		m_nodes[nodeIndex].first = first;
+		m_nodes[nodeIndex].count = count;
+		return;
+	}
+
+	//Median split of the centres along the longest axis
+	const FVector extent = nodeBounds.GetSize();
+	const int32 axis = (extent.X >= extent.Y && extent.X >= extent.Z) ? 0 : ((extent.Y >= extent.Z) ? 1 : 2);
+	int32* primitives = m_primitives.GetData() + first;
+	const int32 half = count / 2;
+	std::nth_element(primitives, primitives + half, primitives + count, [&](int32 a, int32 b) {
+		return m_bounds[a].GetCenter()[axis] < m_bounds[b].GetCenter()[axis];
+		});
+
+	const int32 leftChild = m_nodes.Num();
+	m_nodes.AddDefaulted(2);
+	m_nodes[nodeIndex].first = leftChild;
+	m_nodes[nodeIndex].count = 0;
+
+	buildNode(leftChild, first, half);
+	buildNode(leftChild + 1, first + half, count - half);
+}
+
+void FColliderBVH::ForEachOverlap(FVector point, ForEachOverlapCallback callback) const
+{
+	if (m_nodes.Num() == 0)
+	{
+		return;
+	}
+
+	TArray<int32, TInlineAllocator<32>> stack;
+	stack.Push(0);
+	while (stack.Num() > 0)
+	{
+		const FNode& node = m_nodes[stack.Pop(false)];
+		if (!node.bounds.IsInsideOrOn(point))
+			continue;
+
+		if (node.count == 0)
+		{
+			stack.Push(node.first);
+			stack.Push(node.first + 1);
+			continue;
+		}
+
+		for (int32 i = node.first; i < node.first + node.count; i++)
+		{
+			if (m_bounds[m_primitives[i]].IsInsideOrOn(point))
+			{
+				callback(m_primitives[i]);
+			}
+		}
+	}
+}
@@ -0,0 +1,40 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Small bounding volume hierarchy over collider bounds, used as the broad phase of particle collisions.
+ * Each particle only runs the narrow phase against the colliders whose bounds contain it.
+ */
+class FLUIDSIMULATION_FYP_API FColliderBVH
+{
+	struct FNode
+	{
+		FBox bounds;
+		//leaves reference m_primitives[first, first + count), inner nodes have count 0 and their children at first and first + 1
+		int32 first;
+		int32 count;
+	};
+
+	static const int32 kMaxPrimitivesPerLeaf;
+
+	TArray<FNode> m_nodes;
+	TArray<FBox> m_bounds;
+	TArray<int32> m_primitives;
+
+	void buildNode(int32 nodeIndex, int32 first, int32 count);
+
+public:
+	typedef TFunctionRef<void(int32)> ForEachOverlapCallback;
+
+	FColliderBVH() = default;
+	~FColliderBVH() = default;
+
+	//Primitives are referenced by their index in the bounds array
+	void Build(const TArray<FBox>& bounds);
+	//The point is copied, so callbacks can move the position it was taken from while the traversal goes on
+	void ForEachOverlap(FVector point, ForEachOverlapCallback callback) const;
+	int32 GetNumOfPrimitives() const { return m_bounds.Num(); }
+};
@@ -0,0 +1,115 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ColliderSnapshot.h"
+#include "SignedDistanceField.h"
+#include "FluidCoreTypes.h"
+#include "FluidCore/Collision.h"
+
+bool FColliderSnapshot::ResolveCollision(double radius, double restitutionCoefficient, FVector* newPosition, FVector* newVelocity) const
+{
+	FQueryResult colliderPoint;
+
+	GetQueryResult(*newPosition, &colliderPoint);
+
+	//Check if the new position is penetrating the surface
+	if (!IsPenetrating(colliderPoint, *newPosition, radius))
+	{
+		return false;
+	}
+
+	//the response is FluidCore::ResolveContact; only penetrating particles pay for the conversions
+	FluidCore::FContact contact;
+	contact.distance = colliderPoint.distance;
+	contact.point = ToCore(colliderPoint.point);
+	contact.normal = ToCore(colliderPoint.normal);
+	contact.velocity = ToCore(colliderPoint.velocity);
+	FluidCore::FVec3 position = ToCore(*newPosition);
+	FluidCore::FVec3 velocity = ToCore(*newVelocity);
+	FluidCore::ResolveContact(contact, radius, restitutionCoefficient, frictionCoefficient, &position, &velocity);
+	*newPosition = FromCore(position);
+	*newVelocity = FromCore(velocity);
+	return true;
+}
+
+FVector FColliderSnapshot::VelocityAt(const FVector& point) const
+{
+	FVector r = point - transform.GetTranslation();
+	return linearVelocity + FVector::CrossProduct(angularVelocity, r);
+}
+
+double FColliderSnapshot::ClosestDistance(const FVector& point) const
+{
+	if (distanceField != nullptr)
+	{
+		FQueryResult result;
+		GetQueryResult(point, &result);
+		return FMath::Abs(result.distance);
+	}
+
+	//get closest distance to the surface
+	return FVector::Distance(point, ClosestPoint(point));
+}
+
+FVector FColliderSnapshot::ClosestPoint(const FVector& point) const
+{
+	if (distanceField != nullptr)
+	{
+		FQueryResult result;
+		GetQueryResult(point, &result);
+		return result.point;
+	}
+
+	//get closest point in the plane
+	FVector r = point - transform.GetTranslation();
+	return point - FVector::DotProduct(normal, r) * normal;
+}
+
+bool FColliderSnapshot::GetCollisionBounds(FBox* bounds) const
+{
+	if (distanceField == nullptr)
+	{
+		return false;
+	}
+	*bounds = distanceField->GetBounds().TransformBy(transform);
+	return true;
+}
+
+void FColliderSnapshot::GetQueryResult(const FVector& queryPoint, FQueryResult* result) const
+{
+	if (distanceField == nullptr)
+	{
+		result->point = ClosestPoint(queryPoint); //get the closest point on the plane to the querypoint
+		result->distance = FVector::Distance(queryPoint, result->point);
+		result->normal = normal;
+		result->velocity = VelocityAt(queryPoint);
+		return;
+	}
+
+	//Lock-free: only the baked field is read
+	const FVector localPoint = inverseTransform.TransformPositionNoScale(queryPoint);
+	double distance;
+	FVector gradient;
+	if (!distanceField->Sample(localPoint, &distance, &gradient) || gradient.IsNearlyZero())
+	{
+		//outside the field there is nothing to collide with
+		result->distance = TNumericLimits<double>::Max();
+		result->point = queryPoint;
+		result->normal = FVector::UpVector;
+		result->velocity = FVector(0.0f);
+		return;
+	}
+
+	//the distance is signed, so IsPenetrating catches points inside the mesh through distance < radius
+	result->normal = transform.TransformVectorNoScale(gradient.GetSafeNormal());
+	result->distance = distance;
+	result->point = queryPoint - distance * result->normal;
+	result->velocity = VelocityAt(queryPoint);
+}
+
+bool FColliderSnapshot::IsPenetrating(const FQueryResult& colliderPoint, const FVector& position, double radius) const
+{
+	//If the new candidate position of the particle is on the other side of the surface OR the new distance to the
+	//surface is less than the particle's radius, this particle is in colliding state.
+	return FVector::DotProduct((position - colliderPoint.point), colliderPoint.normal) < 0.0f || colliderPoint.distance < radius;
+}
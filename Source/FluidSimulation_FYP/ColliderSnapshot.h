@@ -0,0 +1,45 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class FSignedDistanceField;
+
+/**
+ * Immutable state of a collider for one simulation step, published by ACollider on the game thread.
+ * The collision maths only reads snapshots, so worker threads never touch UObjects.
+ */
+struct FLUIDSIMULATION_FYP_API FColliderSnapshot
+{
+	struct FQueryResult
+	{
+		double distance;
+		FVector point;
+		FVector normal;
+		FVector velocity;
+	};
+
+	//rigid transform of the collider (the scale is baked into the distance field)
+	FTransform transform;
+	FTransform inverseTransform;
+	//plane colliders are the infinite plane through the collider location with this normal
+	FVector normal{ FVector::UpVector };
+	//derived from the transform delta between two steps
+	FVector linearVelocity{ FVector(0.0f) };
+	FVector angularVelocity{ FVector(0.0f) };
+	double frictionCoefficient{ 0.0 };
+	//mesh colliders only. Owned by the collider and never modified after baking.
+	const FSignedDistanceField* distanceField{ nullptr };
+
+	//Returns whether the particle was penetrating the collider
+	bool ResolveCollision(double radius, double restitutionCoefficient, FVector* newPosition, FVector* newVelocity) const;
+	FVector VelocityAt(const FVector& point) const;
+	double ClosestDistance(const FVector& point) const;
+	FVector ClosestPoint(const FVector& point) const;
+	//World bounds outside of which the collider can't touch a particle. Returns false for infinite planes.
+	bool GetCollisionBounds(FBox* bounds) const;
+
+	void GetQueryResult(const FVector& queryPoint, FQueryResult* result) const;
+	bool IsPenetrating(const FQueryResult& colliderPoint, const FVector& position, double radius) const;
+};
@@ -0,0 +1,19 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "CubicLatticePointsGenerator.h"
+#include "FluidCoreTypes.h"
+#include "FluidCore/Lattice.h"
+#include "Runtime/Core/Public/Async/ParallelFor.h"
+
+void CubicLatticePointsGenerator::generate(const FVector& lowercorner, const FVector& uppercorner, double spacing, TArray<FVector>* points) const
+{
+	//one layer of constant Z per task, written straight into the array
+	const FluidCore::FCubicLatticeLayout layout(ToCore(lowercorner), ToCore(uppercorner), spacing);
+	const int32 firstPoint = points->Num();
+	points->AddUninitialized(static_cast<int32>(layout.GetNumOfPoints()));
+	FVector* data = points->GetData() + firstPoint;
+	ParallelFor(layout.GetNumOfLayers(), [&layout, data](int32 k) {
+		layout.ForEachPointOfLayer(k, [data](size_t index, const FluidCore::FVec3& point) { data[index] = FromCore(point); });
+		});
+}
@@ -0,0 +1,20 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * 
+ */
+class FLUIDSIMULATION_FYP_API CubicLatticePointsGenerator
+{
+	//Simple cubic lattice points generator. Sparser than the BCC lattice for the same spacing (one point per unit cell instead of two).
+
+public:
+	CubicLatticePointsGenerator() = default;
+	~CubicLatticePointsGenerator() = default;
+
+	//Generates points inside given range with spacing as the distance between neighbouring points. The points are appended to the array.
+	void generate(const FVector& lowercorner, const FVector& uppercorner, double spacing, TArray<FVector>* points) const;
+};
@@ -0,0 +1,565 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FLIP_Solver.h"
+#include "FluidSimulation_FYPGameModeBase.h"
+#include "FluidParticle.h"
+
+namespace
+{
+	const FIntVector kAxes[3] = { FIntVector(1, 0, 0), FIntVector(0, 1, 0), FIntVector(0, 0, 1) };
+	//elements per task of the reductions in the pressure solve
+	constexpr int32 kReductionChunkSize = 4096;
+
+	//Copies into the destination's memory, which an assignment frees and allocates again whenever the size changes
+	template <typename T>
+	void copyArray(const TArray<T>& source, TArray<T>& destination)
+	{
+		destination.SetNumUninitialized(source.Num(), false);
+		FMemory::Memcpy(destination.GetData(), source.GetData(), source.Num() * sizeof(T));
+	}
+}
+
+AFLIP_Solver::AFLIP_Solver()
+{
+	PrimaryActorTick.bCanEverTick = false;
+}
+
+FIntVector AFLIP_Solver::getFaceGridSize(int32 axis) const
+{
+	return m_gridSize + kAxes[axis];
+}
+
+int32 AFLIP_Solver::getFaceIndex(int32 axis, const FIntVector& face) const
+{
+	const FIntVector size = getFaceGridSize(axis);
+	return (face.Z * size.Y + face.Y) * size.X + face.X;
+}
+
+int32 AFLIP_Solver::getCellIndex(const FIntVector& cell) const
+{
+	return (cell.Z * m_gridSize.Y + cell.Y) * m_gridSize.X + cell.X;
+}
+
+bool AFLIP_Solver::isValidCell(const FIntVector& cell) const
+{
+	return cell.X >= 0 && cell.Y >= 0 && cell.Z >= 0 && cell.X < m_gridSize.X && cell.Y < m_gridSize.Y && cell.Z < m_gridSize.Z;
+}
+
+FVector AFLIP_Solver::getFacePosition(int32 axis, const FIntVector& face) const
+{
+	//faces of axis a are at the centre of the cells in the other two axes
+	return m_gridOrigin + (FVector(face) + FVector(0.5f) - 0.5f * FVector(kAxes[axis])) * m_cellSize;
+}
+
+template <typename Body>
+void AFLIP_Solver::forEachFaceWeight(int32 axis, const FVector& point, Body&& body) const
+{
+	const FVector local = (point - m_gridOrigin) / m_cellSize - FVector(0.5f) + 0.5f * FVector(kAxes[axis]);
+	const FIntVector base(FMath::FloorToInt(local.X), FMath::FloorToInt(local.Y), FMath::FloorToInt(local.Z));
+	const FVector fraction = local - FVector(base);
+	const FIntVector size = getFaceGridSize(axis);
+	for (int32 corner = 0; corner < 8; corner++)
+	{
+		const FIntVector offset(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1);
+		const FIntVector face = base + offset;
+		if (face.X < 0 || face.Y < 0 || face.Z < 0 || face.X >= size.X || face.Y >= size.Y || face.Z >= size.Z)
+			continue;
+		//trilinear weight of the face and its derivative along each axis
+		const FVector w(offset.X ? fraction.X : 1.0f - fraction.X, offset.Y ? fraction.Y : 1.0f - fraction.Y, offset.Z ? fraction.Z : 1.0f - fraction.Z);
+		const FVector dw(offset.X ? 1.0f : -1.0f, offset.Y ? 1.0f : -1.0f, offset.Z ? 1.0f : -1.0f);
+		const FVector gradient = FVector(dw.X * w.Y * w.Z, w.X * dw.Y * w.Z, w.X * w.Y * dw.Z) / m_cellSize;
+		body(getFaceIndex(axis, face), w.X * w.Y * w.Z, gradient);
+	}
+}
+
+void AFLIP_Solver::accumulateForces(double timeStepInSeconds)
+{
+	//no viscosity term: the transfers to the grid and back already smooth the velocities
+	accumulateExternalForces(timeStepInSeconds);
+
+	const double startTime = FPlatformTime::Seconds();
+	buildGrid(timeStepInSeconds);
+	if (m_sortedParticles.Num() == 0)
+	{
+		return;
+	}
+	transferToGrid();
+	markCells();
+	const int32 numOfIterations = solvePressure(timeStepInSeconds);
+	applyPressureGradient(timeStepInSeconds);
+	extrapolateVelocities();
+	transferToParticles(timeStepInSeconds);
+
+	if (m_showDebugText)
+		UE_LOG(LogTemp, Warning, TEXT("FLIP step: %f ms for %i particles, %ix%ix%i cells (%i fluid), %i pressure iterations"),
+			(FPlatformTime::Seconds() - startTime) * 1000.0, m_sortedParticles.Num(), m_gridSize.X, m_gridSize.Y, m_gridSize.Z, m_fluidCells.Num(), numOfIterations);
+}
+
+void AFLIP_Solver::buildGrid(double timeStepInSeconds)
+{
+	FLUID_STAGE_SCOPE(m_gameMode->GetStageTimings(), Transfer);
+
+	//the grid follows the fluid, with two cells of air around it for the surface and the extrapolation
+	const int32 n = m_ptrParticles->Num();
+	FBox bounds(ForceInit);
+	for (int32 i = 0; i < n; i++)
+	{
+		if (!(*m_ptrParticles)[i]->IsParticleDead())
+			bounds += (*m_ptrParticles)[i]->GetParticlePosition();
+	}
+	m_sortedParticles.Reset();
+	if (!bounds.IsValid)
+	{
+		return;
+	}
+
+	m_cellSize = m_gameMode->GetTargetSpacing() * m_cellSizeOverTargetSpacing;
+	do
+	{
+		//the origin is on a multiple of the cell size so the cells don't shift as the fluid moves
+		m_gridOrigin = FVector(FMath::FloorToFloat(bounds.Min.X / m_cellSize) - 2.0f, FMath::FloorToFloat(bounds.Min.Y / m_cellSize) - 2.0f,
+			FMath::FloorToFloat(bounds.Min.Z / m_cellSize) - 2.0f) * m_cellSize;
+		const FVector size = (bounds.Max - m_gridOrigin) / m_cellSize;
+		m_gridSize = FIntVector(FMath::CeilToInt(size.X) + 2, FMath::CeilToInt(size.Y) + 2, FMath::CeilToInt(size.Z) + 2);
+		if (static_cast<int64>(m_gridSize.X) * m_gridSize.Y * m_gridSize.Z <= kMaxNumOfCells)
+			break;
+		m_cellSize *= 2.0;
+		UE_LOG(LogTemp, Warning, TEXT("The particles are spread too far for the FLIP grid. Coarsening its cells to %f"), m_cellSize);
+	} while (true);
+	const int32 numOfCells = m_gridSize.X * m_gridSize.Y * m_gridSize.Z;
+
+	//counting sort of the live particles by cell
+	m_particleCells.SetNumUninitialized(n, false);
+	parallelFor(n, [&](int32 i) {
+		const AFluidParticle* particle = (*m_ptrParticles)[i];
+		if (particle->IsParticleDead())
+		{
+			m_particleCells[i] = INDEX_NONE;
+			return;
+		}
+		const FVector local = (particle->GetParticlePosition() - m_gridOrigin) / m_cellSize;
+		m_particleCells[i] = getCellIndex(FIntVector(FMath::FloorToInt(local.X), FMath::FloorToInt(local.Y), FMath::FloorToInt(local.Z)));
+		});
+	m_cellStarts.Reset();
+	m_cellStarts.SetNumZeroed(numOfCells + 1);
+	for (int32 cell : m_particleCells)
+	{
+		if (cell != INDEX_NONE)
+			m_cellStarts[cell + 1]++;
+	}
+	for (int32 c = 0; c < numOfCells; c++)
+	{
+		m_cellStarts[c + 1] += m_cellStarts[c];
+	}
+	const int32 numOfLiveParticles = m_cellStarts[numOfCells];
+	TArrayView<int32> cellFill = m_scratch.Allocate<int32>(numOfCells);
+	FMemory::Memcpy(cellFill.GetData(), m_cellStarts.GetData(), numOfCells * sizeof(int32));
+	m_sortedParticles.SetNumUninitialized(numOfLiveParticles, false);
+	for (int32 i = 0; i < n; i++)
+	{
+		if (m_particleCells[i] != INDEX_NONE)
+			m_sortedParticles[cellFill[m_particleCells[i]]++] = i;
+	}
+
+	//the velocity transferred is the one after gravity and drag
+	m_sortedPositions.SetNumUninitialized(numOfLiveParticles, false);
+	m_sortedVelocities.SetNumUninitialized(numOfLiveParticles, false);
+	m_sortedMasses.SetNumUninitialized(numOfLiveParticles, false);
+	for (TArray<FVector>& affineVelocities : m_sortedAffineVelocities)
+	{
+		affineVelocities.SetNumUninitialized(numOfLiveParticles, false);
+	}
+	parallelFor(numOfLiveParticles, [&](int32 k) {
+		const AFluidParticle* particle = (*m_ptrParticles)[m_sortedParticles[k]];
+		m_sortedPositions[k] = particle->GetParticlePosition();
+		m_sortedMasses[k] = particle->GetParticleMass();
+		m_sortedVelocities[k] = particle->GetParticleVelocity() + timeStepInSeconds * particle->GetParticleForce() / particle->GetParticleMass();
+		for (int32 axis = 0; axis < 3; axis++)
+		{
+			m_sortedAffineVelocities[axis][k] = particle->GetParticleAffineVelocity(axis);
+		}
+		});
+}
+
+void AFLIP_Solver::transferToGrid()
+{
+	FLUID_STAGE_SCOPE(m_gameMode->GetStageTimings(), Transfer);
+
+	//Every face gathers from the particles in the cells its trilinear stencil reaches, so no two tasks write to the same face
+	for (int32 axis = 0; axis < 3; axis++)
+	{
+		const FIntVector size = getFaceGridSize(axis);
+		m_velocities[axis].SetNumUninitialized(size.X * size.Y * size.Z, false);
+		m_validFaces[axis].SetNumUninitialized(size.X * size.Y * size.Z, false);
+		parallelFor(size.Y * size.Z, [&](int32 row) {
+			const int32 y = row % size.Y;
+			const int32 z = row / size.Y;
+			for (int32 x = 0; x < size.X; x++)
+			{
+				const FIntVector face(x, y, z);
+				const FVector facePosition = getFacePosition(axis, face);
+				//a face reaches half a cell further along its own axis than along the others
+				const FIntVector minCell(FMath::Max(x - 1, 0), FMath::Max(y - 1, 0), FMath::Max(z - 1, 0));
+				const FIntVector maxCell(FMath::Min(x + 1 - kAxes[axis].X, m_gridSize.X - 1), FMath::Min(y + 1 - kAxes[axis].Y, m_gridSize.Y - 1),
+					FMath::Min(z + 1 - kAxes[axis].Z, m_gridSize.Z - 1));
+				double momentum = 0.0;
+				double mass = 0.0;
+				for (int32 cz = minCell.Z; cz <= maxCell.Z; cz++)
+				{
+					for (int32 cy = minCell.Y; cy <= maxCell.Y; cy++)
+					{
+						const int32 first = m_cellStarts[getCellIndex(FIntVector(minCell.X, cy, cz))];
+						const int32 last = m_cellStarts[getCellIndex(FIntVector(maxCell.X, cy, cz)) + 1];
+						for (int32 k = first; k < last; k++)
+						{
+							const FVector distance = (facePosition - m_sortedPositions[k]) / m_cellSize;
+							const float weight = FMath::Max(1.0f - FMath::Abs(distance.X), 0.0f) * FMath::Max(1.0f - FMath::Abs(distance.Y), 0.0f) *
+								FMath::Max(1.0f - FMath::Abs(distance.Z), 0.0f);
+							if (weight <= 0.0f)
+								continue;
+							//APIC: the particle's velocity around it is affine, not constant
+							const double velocity = m_sortedVelocities[k][axis] + FVector::DotProduct(m_sortedAffineVelocities[axis][k], facePosition - m_sortedPositions[k]);
+							momentum += weight * m_sortedMasses[k] * velocity;
+							mass += weight * m_sortedMasses[k];
+						}
+					}
+				}
+				const int32 index = getFaceIndex(axis, face);
+				m_velocities[axis][index] = mass > 0.0 ? momentum / mass : 0.0f;
+				m_validFaces[axis][index] = mass > 0.0 ? 1 : 0;
+			}
+			}, 1);
+		copyArray(m_velocities[axis], m_transferredVelocities[axis]);
+	}
+}
+
+void AFLIP_Solver::markCells()
+{
+	FLUID_STAGE_SCOPE(m_gameMode->GetStageTimings(), Pressure);
+
+	const int32 numOfCells = m_gridSize.X * m_gridSize.Y * m_gridSize.Z;
+	m_cellTypes.SetNumUninitialized(numOfCells, false);
+	m_solidVelocities.SetNumUninitialized(numOfCells, false);
+	parallelFor(numOfCells, [&](int32 c) {
+		const FIntVector cell(c % m_gridSize.X, (c / m_gridSize.X) % m_gridSize.Y, c / (m_gridSize.X * m_gridSize.Y));
+		const FVector centre = m_gridOrigin + (FVector(cell) + FVector(0.5f)) * m_cellSize;
+		FVector colliderVelocity(0.0f);
+		if (isInsideCollider(centre, &colliderVelocity))
+		{
+			m_cellTypes[c] = EFLIPCellType::Solid;
+			m_solidVelocities[c] = colliderVelocity;
+		}
+		else
+		{
+			m_cellTypes[c] = m_cellStarts[c + 1] > m_cellStarts[c] ? EFLIPCellType::Fluid : EFLIPCellType::Air;
+			m_solidVelocities[c] = FVector(0.0f);
+		}
+		});
+
+	//the fluid can't flow into a collider faster than it moves
+	for (int32 axis = 0; axis < 3; axis++)
+	{
+		const FIntVector size = getFaceGridSize(axis);
+		parallelFor(size.Y * size.Z, [&](int32 row) {
+			const int32 y = row % size.Y;
+			const int32 z = row / size.Y;
+			for (int32 x = 0; x < size.X; x++)
+			{
+				const FIntVector face(x, y, z);
+				const FIntVector cells[2] = { face - kAxes[axis], face };
+				for (const FIntVector& cell : cells)
+				{
+					if (isValidCell(cell) && m_cellTypes[getCellIndex(cell)] == EFLIPCellType::Solid)
+					{
+						const int32 index = getFaceIndex(axis, face);
+						m_velocities[axis][index] = m_solidVelocities[getCellIndex(cell)][axis];
+						m_validFaces[axis][index] = 1;
+						break;
+					}
+				}
+			}
+			}, 1);
+	}
+
+	//rows of the pressure system
+	//sized for every cell once, so a step with more fluid cells than the ones before doesn't grow it
+	m_fluidCells.Reset();
+	m_fluidCells.Reserve(numOfCells);
+	m_cellRows.SetNumUninitialized(numOfCells, false);
+	for (int32 c = 0; c < numOfCells; c++)
+	{
+		m_cellRows[c] = m_cellTypes[c] == EFLIPCellType::Fluid ? m_fluidCells.Add(c) : INDEX_NONE;
+	}
+}
+
+int32 AFLIP_Solver::solvePressure(double timeStepInSeconds)
+{
+	FLUID_STAGE_SCOPE(m_gameMode->GetStageTimings(), Pressure);
+
+	//Laplacian(p) = density / dt * div(u), with p = 0 in the air and no flow through the colliders.
+	//Scaled by -dx^2 it is symmetric positive definite with small integers in it.
+	const int32 numOfRows = m_fluidCells.Num();
+	const double scale = m_gameMode->GetTargetDensity() * m_cellSize / timeStepInSeconds;
+	m_diagonals.SetNumUninitialized(numOfRows, false);
+	m_rowNeighbours.SetNumUninitialized(6 * numOfRows, false);
+	m_rhs.SetNumUninitialized(numOfRows, false);
+	parallelFor(numOfRows, [&](int32 r) {
+		const int32 c = m_fluidCells[r];
+		const FIntVector cell(c % m_gridSize.X, (c / m_gridSize.X) % m_gridSize.Y, c / (m_gridSize.X * m_gridSize.Y));
+		uint8 diagonal = 0;
+		double divergence = 0.0;
+		for (int32 axis = 0; axis < 3; axis++)
+		{
+			divergence += m_velocities[axis][getFaceIndex(axis, cell + kAxes[axis])] - m_velocities[axis][getFaceIndex(axis, cell)];
+			for (int32 side = 0; side < 2; side++)
+			{
+				const FIntVector neighbour = side == 0 ? cell - kAxes[axis] : cell + kAxes[axis];
+				const int32 n = isValidCell(neighbour) ? getCellIndex(neighbour) : INDEX_NONE;
+				const EFLIPCellType type = n != INDEX_NONE ? m_cellTypes[n] : EFLIPCellType::Air;
+				m_rowNeighbours[6 * r + 2 * axis + side] = type == EFLIPCellType::Fluid ? m_cellRows[n] : INDEX_NONE;
+				if (type != EFLIPCellType::Solid)
+					diagonal++;
+			}
+		}
+		m_diagonals[r] = diagonal;
+		m_rhs[r] = -scale * divergence;
+		});
+
+	//Conjugate gradients with a Jacobi preconditioner, which is as parallel as the rest of the solve
+	m_pressures.Reset();
+	m_pressures.SetNumZeroed(numOfRows);
+	copyArray(m_rhs, m_residuals);
+	const double tolerance = m_tolerance * maxAbsolute(m_rhs);
+	if (numOfRows == 0 || maxAbsolute(m_residuals) <= tolerance)
+	{
+		return 0;
+	}
+
+	m_preconditioned.SetNumUninitialized(numOfRows, false);
+	auto precondition = [&]() {
+		parallelFor(numOfRows, [&](int32 r) {
+			m_preconditioned[r] = m_diagonals[r] > 0 ? m_residuals[r] / m_diagonals[r] : 0.0;
+			});
+	};
+	precondition();
+	copyArray(m_preconditioned, m_searchDirections);
+	double sigma = dotProduct(m_preconditioned, m_residuals);
+
+	int32 iteration = 0;
+	while (iteration < m_maxNumOfIterations)
+	{
+		iteration++;
+		multiplyMatrix(m_searchDirections, &m_products);
+		const double denominator = dotProduct(m_searchDirections, m_products);
+		if (denominator <= 0.0)
+			break;
+		const double alpha = sigma / denominator;
+		parallelFor(numOfRows, [&](int32 r) {
+			m_pressures[r] += alpha * m_searchDirections[r];
+			m_residuals[r] -= alpha * m_products[r];
+			});
+		if (maxAbsolute(m_residuals) <= tolerance)
+			break;
+
+		precondition();
+		const double newSigma = dotProduct(m_preconditioned, m_residuals);
+		const double beta = newSigma / sigma;
+		sigma = newSigma;
+		parallelFor(numOfRows, [&](int32 r) {
+			m_searchDirections[r] = m_preconditioned[r] + beta * m_searchDirections[r];
+			});
+	}
+
+	SET_DWORD_STAT(STAT_FluidPressureIterations, iteration);
+	if (iteration >= m_maxNumOfIterations && m_showDebugText)
+		UE_LOG(LogTemp, Warning, TEXT("FLIP pressure solve stopped at %i iterations with a residual of %f"), iteration, maxAbsolute(m_residuals));
+	return iteration;
+}
+
+void AFLIP_Solver::applyPressureGradient(double timeStepInSeconds)
+{
+	FLUID_STAGE_SCOPE(m_gameMode->GetStageTimings(), Pressure);
+
+	//u -= dt / density * grad(p) on every face next to the fluid. The faces of colliders keep their velocity.
+	const double scale = timeStepInSeconds / (m_gameMode->GetTargetDensity() * m_cellSize);
+	auto getPressure = [&](const FIntVector& cell) {
+		return isValidCell(cell) && m_cellRows[getCellIndex(cell)] != INDEX_NONE ? m_pressures[m_cellRows[getCellIndex(cell)]] : 0.0;
+	};
+	auto getType = [&](const FIntVector& cell) {
+		return isValidCell(cell) ? m_cellTypes[getCellIndex(cell)] : EFLIPCellType::Air;
+	};
+	for (int32 axis = 0; axis < 3; axis++)
+	{
+		const FIntVector size = getFaceGridSize(axis);
+		parallelFor(size.Y * size.Z, [&](int32 row) {
+			const int32 y = row % size.Y;
+			const int32 z = row / size.Y;
+			for (int32 x = 0; x < size.X; x++)
+			{
+				const FIntVector face(x, y, z);
+				const FIntVector back = face - kAxes[axis];
+				const EFLIPCellType backType = getType(back);
+				const EFLIPCellType frontType = getType(face);
+				const int32 index = getFaceIndex(axis, face);
+				if (backType == EFLIPCellType::Solid || frontType == EFLIPCellType::Solid)
+					continue;
+				if (backType == EFLIPCellType::Fluid || frontType == EFLIPCellType::Fluid)
+				{
+					m_velocities[axis][index] -= scale * (getPressure(face) - getPressure(back));
+					m_validFaces[axis][index] = 1;
+				}
+				else
+				{
+					//air on both sides, filled in by the extrapolation
+					m_validFaces[axis][index] = 0;
+				}
+			}
+			}, 1);
+	}
+
+	//the pressure is kept on the particles for probes and exports
+	parallelFor(m_sortedParticles.Num(), [&](int32 k) {
+		AFluidParticle* particle = (*m_ptrParticles)[m_sortedParticles[k]];
+		const int32 row = m_cellRows[m_particleCells[m_sortedParticles[k]]];
+		particle->SetParticlePressure(row != INDEX_NONE ? m_pressures[row] : 0.0);
+		FLUID_PROBE(m_probes, particle, Pressure, particle->GetParticlePressure());
+		});
+}
+
+void AFLIP_Solver::extrapolateVelocities()
+{
+	FLUID_STAGE_SCOPE(m_gameMode->GetStageTimings(), Transfer);
+
+	//Each layer gives the faces without a velocity the average of their neighbours that have one
+	for (int32 axis = 0; axis < 3; axis++)
+	{
+		const FIntVector size = getFaceGridSize(axis);
+		for (int32 layer = 0; layer < m_numOfExtrapolationLayers; layer++)
+		{
+			copyArray(m_velocities[axis], m_extrapolatedVelocities);
+			copyArray(m_validFaces[axis], m_extrapolatedFaces);
+			parallelFor(size.Y * size.Z, [&](int32 row) {
+				const int32 y = row % size.Y;
+				const int32 z = row / size.Y;
+				for (int32 x = 0; x < size.X; x++)
+				{
+					const FIntVector face(x, y, z);
+					const int32 index = getFaceIndex(axis, face);
+					if (m_validFaces[axis][index])
+						continue;
+					double sum = 0.0;
+					int32 count = 0;
+					for (int32 k = 0; k < 6; k++)
+					{
+						const FIntVector neighbour = (k & 1) ? face + kAxes[k / 2] : face - kAxes[k / 2];
+						if (neighbour.X < 0 || neighbour.Y < 0 || neighbour.Z < 0 || neighbour.X >= size.X || neighbour.Y >= size.Y || neighbour.Z >= size.Z)
+							continue;
+						const int32 neighbourIndex = getFaceIndex(axis, neighbour);
+						if (m_validFaces[axis][neighbourIndex])
+						{
+							sum += m_velocities[axis][neighbourIndex];
+							count++;
+						}
+					}
+					if (count > 0)
+					{
+						m_extrapolatedVelocities[index] = sum / count;
+						m_extrapolatedFaces[index] = 1;
+					}
+				}
+				}, 1);
+			Swap(m_velocities[axis], m_extrapolatedVelocities);
+			Swap(m_validFaces[axis], m_extrapolatedFaces);
+		}
+	}
+}
+
+void AFLIP_Solver::transferToParticles(double timeStepInSeconds)
+{
+	FLUID_STAGE_SCOPE(m_gameMode->GetStageTimings(), Transfer);
+
+	parallelFor(m_sortedParticles.Num(), [&](int32 k) {
+		AFluidParticle* particle = (*m_ptrParticles)[m_sortedParticles[k]];
+		FVector picVelocity(0.0f);
+		FVector velocityChange(0.0f);
+		for (int32 axis = 0; axis < 3; axis++)
+		{
+			FVector affineVelocity(0.0f);
+			forEachFaceWeight(axis, m_sortedPositions[k], [&](int32 face, float weight, const FVector& gradient) {
+				picVelocity[axis] += weight * m_velocities[axis][face];
+				velocityChange[axis] += weight * (m_velocities[axis][face] - m_transferredVelocities[axis][face]);
+				affineVelocity += gradient * m_velocities[axis][face];
+				});
+			particle->SetParticleAffineVelocity(axis, affineVelocity);
+		}
+
+		//the FLIP update keeps the detail of the particle's own velocity, the APIC one is stable
+		const FVector flipVelocity = m_sortedVelocities[k] + velocityChange;
+		const FVector newVelocity = FMath::Lerp(picVelocity, flipVelocity, static_cast<float>(m_flipRatio));
+		FLUID_PROBE(m_probes, particle, PressureForce, particle->GetParticleMass() * velocityChange / timeStepInSeconds);
+
+		//the grid keeps the fluid at its rest density
+		particle->SetParticleDensity(m_gameMode->GetTargetDensity());
+		//the time integration turns this back into the new velocity
+		particle->SetParticleForce(particle->GetParticleMass() * (newVelocity - particle->GetParticleVelocity()) / timeStepInSeconds);
+		});
+}
+
+void AFLIP_Solver::multiplyMatrix(const TArray<double>& x, TArray<double>* result) const
+{
+	const int32 numOfRows = x.Num();
+	result->SetNumUninitialized(numOfRows, false);
+	parallelFor(numOfRows, [&](int32 r) {
+		double sum = m_diagonals[r] * x[r];
+		for (int32 k = 0; k < 6; k++)
+		{
+			const int32 neighbour = m_rowNeighbours[6 * r + k];
+			if (neighbour != INDEX_NONE)
+				sum -= x[neighbour];
+		}
+		(*result)[r] = sum;
+		});
+}
+
+double AFLIP_Solver::dotProduct(const TArray<double>& a, const TArray<double>& b)
+{
+	const int32 numOfChunks = FMath::DivideAndRoundUp(a.Num(), kReductionChunkSize);
+	m_chunkResults.SetNumUninitialized(numOfChunks, false);
+	parallelFor(numOfChunks, [&](int32 chunk) {
+		const int32 end = FMath::Min((chunk + 1) * kReductionChunkSize, a.Num());
+		double sum = 0.0;
+		for (int32 i = chunk * kReductionChunkSize; i < end; i++)
+		{
+			sum += a[i] * b[i];
+		}
+		m_chunkResults[chunk] = sum;
+		}, 1);
+	double sum = 0.0;
+	for (double chunkSum : m_chunkResults)
+	{
+		sum += chunkSum;
+	}
+	return sum;
+}
+
+double AFLIP_Solver::maxAbsolute(const TArray<double>& a)
+{
+	const int32 numOfChunks = FMath::DivideAndRoundUp(a.Num(), kReductionChunkSize);
+	m_chunkResults.SetNumUninitialized(numOfChunks, false);
+	parallelFor(numOfChunks, [&](int32 chunk) {
+		const int32 end = FMath::Min((chunk + 1) * kReductionChunkSize, a.Num());
+		double maximum = 0.0;
+		for (int32 i = chunk * kReductionChunkSize; i < end; i++)
+		{
+			maximum = FMath::Max(maximum, FMath::Abs(a[i]));
+		}
+		m_chunkResults[chunk] = maximum;
+		}, 1);
+	double maximum = 0.0;
+	for (double chunkMaximum : m_chunkResults)
+	{
+		maximum = FMath::Max(maximum, chunkMaximum);
+	}
+	return maximum;
+}
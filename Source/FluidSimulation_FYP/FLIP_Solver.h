@@ -0,0 +1,109 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ParticleSystemSolver.h"
+#include "FLIP_Solver.generated.h"
+
+enum class EFLIPCellType : uint8
+{
+	Air,
+	Fluid,
+	Solid
+};
+
+/**
+ * Particle-in-cell solver for large bodies of water (FLIP blended with APIC).
+ * Particle velocities are moved onto a MAC grid, made divergence free with a pressure solve on the grid and moved back.
+ * The pressure costs one unknown per fluid cell instead of a sum over neighbours per particle, and the solver needs
+ * neither neighbour lists nor densities, so the game mode skips building them.
+ * Colliders, the emitter, kill volumes and the vector fields all work as with the SPH solvers.
+ */
+UCLASS()
+class FLUIDSIMULATION_FYP_API AFLIP_Solver : public AParticleSystemSolver
+{
+	GENERATED_BODY()
+
+	//Blend between the APIC velocity (0) and the FLIP update (1). A bit of APIC keeps the particles from getting noisy.
+	double m_flipRatio{ 0.97 };
+	//A cubic lattice puts about 8 particles in a fluid cell this size
+	double m_cellSizeOverTargetSpacing{ 2.0 };
+	int32 m_maxNumOfIterations{ 200 };
+	//the solve stops when the largest residual is this fraction of the largest divergence
+	double m_tolerance{ 1e-4 };
+	//Layers of air faces that get velocities from the fluid ones, for particles near the surface
+	int32 m_numOfExtrapolationLayers{ 2 };
+	//The cells are made wider rather than going past this
+	static constexpr int64 kMaxNumOfCells = 1 << 24;
+
+	//MAC grid: velocity component a is stored on the faces normal to axis a
+	FVector m_gridOrigin{ FVector(0.0f) };
+	double m_cellSize{ 2.0 };
+	FIntVector m_gridSize{ FIntVector(0) };
+	TArray<EFLIPCellType> m_cellTypes;
+	TArray<FVector> m_solidVelocities;
+	TArray<float> m_velocities[3];
+	//velocities straight after the transfer, for the FLIP update
+	TArray<float> m_transferredVelocities[3];
+	TArray<uint8> m_validFaces[3];
+	//scratch for the extrapolation
+	TArray<float> m_extrapolatedVelocities;
+	TArray<uint8> m_extrapolatedFaces;
+
+	//Snapshot of the live particles sorted by cell, so the transfers to the grid are gathers
+	TArray<int32> m_cellStarts;
+	TArray<int32> m_particleCells;
+	TArray<int32> m_sortedParticles;
+	TArray<FVector> m_sortedPositions;
+	TArray<FVector> m_sortedVelocities;
+	TArray<FVector> m_sortedAffineVelocities[3];
+	TArray<float> m_sortedMasses;
+
+	//Pressure system with a row per fluid cell. Rows only store their diagonal and their fluid neighbours, the other
+	//entries of the 7 point Laplacian being -1.
+	TArray<int32> m_fluidCells;
+	TArray<int32> m_cellRows;
+	TArray<uint8> m_diagonals;
+	TArray<int32> m_rowNeighbours;
+	TArray<double> m_pressures;
+	TArray<double> m_rhs;
+	TArray<double> m_residuals;
+	TArray<double> m_preconditioned;
+	TArray<double> m_searchDirections;
+	TArray<double> m_products;
+	//per chunk sums and maxima of the reductions
+	TArray<double> m_chunkResults;
+
+	FIntVector getFaceGridSize(int32 axis) const;
+	int32 getFaceIndex(int32 axis, const FIntVector& face) const;
+	int32 getCellIndex(const FIntVector& cell) const;
+	bool isValidCell(const FIntVector& cell) const;
+	FVector getFacePosition(int32 axis, const FIntVector& face) const;
+	//Calls body(face index, weight, weight gradient) for the 8 faces of the axis around the point
+	template <typename Body>
+	void forEachFaceWeight(int32 axis, const FVector& point, Body&& body) const;
+
+	void buildGrid(double timeStepInSeconds);
+	void transferToGrid();
+	void markCells();
+	int32 solvePressure(double timeStepInSeconds);
+	void applyPressureGradient(double timeStepInSeconds);
+	void extrapolateVelocities();
+	void transferToParticles(double timeStepInSeconds);
+
+	void multiplyMatrix(const TArray<double>& x, TArray<double>* result) const;
+	double dotProduct(const TArray<double>& a, const TArray<double>& b);
+	double maxAbsolute(const TArray<double>& a);
+
+protected:
+	//Gravity and drag act on the particles and the grid makes their velocities divergence free. The result is handed to
+	//the time integration as the force that gives the new velocity.
+	void accumulateForces(double timeStepInSeconds) override;
+
+public:
+	AFLIP_Solver();
+	~AFLIP_Solver() = default;
+
+	bool NeedsNeighbourLists() const override { return false; }
+};
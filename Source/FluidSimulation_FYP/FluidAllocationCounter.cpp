@@ -0,0 +1,103 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FluidAllocationCounter.h"
+#include "HAL/MemoryBase.h"
+
+#if WITH_FLUID_ALLOCATION_CHECKS
+namespace
+{
+	thread_local bool t_isCounting = false;
+	TAtomic<uint64> g_numOfAllocations(0);
+	bool g_isInstalled = false;
+
+	//Hands everything to the allocator it was put in front of, counting the allocations of threads that are counting
+	class FFluidCountingMalloc final : public FMalloc
+	{
+		FMalloc* m_inner;
+
+		static void countAllocation(SIZE_T size)
+		{
+			if (size > 0 && t_isCounting)
+				g_numOfAllocations++;
+		}
+
+	public:
+		explicit FFluidCountingMalloc(FMalloc* inner) : m_inner(inner) {}
+
+		virtual void* Malloc(SIZE_T count, uint32 alignment) override { countAllocation(count); return m_inner->Malloc(count, alignment); }
+		virtual void* TryMalloc(SIZE_T count, uint32 alignment) override { countAllocation(count); return m_inner->TryMalloc(count, alignment); }
+		//growing or shrinking in place still goes to the allocator, so it counts too
+		virtual void* Realloc(void* original, SIZE_T count, uint32 alignment) override { countAllocation(count); return m_inner->Realloc(original, count, alignment); }
+		virtual void* TryRealloc(void* original, SIZE_T count, uint32 alignment) override { countAllocation(count); return m_inner->TryRealloc(original, count, alignment); }
+		virtual void Free(void* original) override { m_inner->Free(original); }
+
+		virtual SIZE_T QuantizeSize(SIZE_T count, uint32 alignment) override { return m_inner->QuantizeSize(count, alignment); }
+		virtual bool GetAllocationSize(void* original, SIZE_T& sizeOut) override { return m_inner->GetAllocationSize(original, sizeOut); }
+		virtual void Trim(bool trimThreadCaches) override { m_inner->Trim(trimThreadCaches); }
+		virtual void SetupTLSCachesOnCurrentThread() override { m_inner->SetupTLSCachesOnCurrentThread(); }
+		virtual void ClearAndDisableTLSCachesOnCurrentThread() override { m_inner->ClearAndDisableTLSCachesOnCurrentThread(); }
+		virtual void InitializeStatsMetadata() override { m_inner->InitializeStatsMetadata(); }
+		virtual bool IsInternallyThreadSafe() const override { return m_inner->IsInternallyThreadSafe(); }
+		virtual bool ValidateHeap() override { return m_inner->ValidateHeap(); }
+		virtual void UpdateStats() override { m_inner->UpdateStats(); }
+		virtual void GetAllocatorStats(FGenericMemoryStats& outStats) override { m_inner->GetAllocatorStats(outStats); }
+		virtual void DumpAllocatorStats(FOutputDevice& ar) override { m_inner->DumpAllocatorStats(ar); }
+		virtual const TCHAR* GetDescriptiveName() override { return m_inner->GetDescriptiveName(); }
+		virtual void OnMallocInitialized() override { m_inner->OnMallocInitialized(); }
+	};
+}
+
+void FFluidAllocationCounter::Install()
+{
+	check(IsInGameThread());
+	if (g_isInstalled)
+	{
+		return;
+	}
+	//FMalloc news itself with the system allocator, and memory allocated before this is freed by the same allocator as before
+	GMalloc = new FFluidCountingMalloc(GMalloc);
+	g_isInstalled = true;
+}
+
+bool FFluidAllocationCounter::IsInstalled()
+{
+	return g_isInstalled;
+}
+
+uint64 FFluidAllocationCounter::GetNumOfAllocations()
+{
+	return g_numOfAllocations.Load();
+}
+
+FFluidAllocationScope::FFluidAllocationScope(bool isCounting)
+	: m_wasCounting(t_isCounting)
+{
+	t_isCounting = isCounting;
+}
+
+FFluidAllocationScope::~FFluidAllocationScope()
+{
+	t_isCounting = m_wasCounting;
+}
+
+bool FFluidAllocationScope::IsCounting()
+{
+	return t_isCounting;
+}
+#else
+void FFluidAllocationCounter::Install()
+{
+	UE_LOG(LogTemp, Warning, TEXT("Allocation checks are compiled out of this build"));
+}
+
+bool FFluidAllocationCounter::IsInstalled()
+{
+	return false;
+}
+
+uint64 FFluidAllocationCounter::GetNumOfAllocations()
+{
+	return 0;
+}
+#endif
@@ -0,0 +1,46 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+//Allocation checks are compiled out of shipping builds unless the target defines this
+#ifndef WITH_FLUID_ALLOCATION_CHECKS
+#define WITH_FLUID_ALLOCATION_CHECKS !UE_BUILD_SHIPPING
+#endif
+
+/**
+ * Counts the heap allocations the simulation makes during its steps, so a warmed up step can be checked to make none.
+ * Once installed, a proxy in front of GMalloc counts what threads allocate inside a counting scope. What the engine allocates
+ * on behalf of the simulation, like the tasks that run its loops and the actors it moves, is left out by scopes that pause the count.
+ * Platforms that call their allocator without going through GMalloc aren't counted.
+ */
+class FLUIDSIMULATION_FYP_API FFluidAllocationCounter
+{
+public:
+	//Puts the counting proxy in front of GMalloc, which stays there for the rest of the run. Game thread only.
+	static void Install();
+	static bool IsInstalled();
+	//Allocations made inside counting scopes since the proxy was installed, by every thread
+	static uint64 GetNumOfAllocations();
+};
+
+//Counts the allocations of this thread until the end of the scope, or pauses the count when isCounting is false
+class FLUIDSIMULATION_FYP_API FFluidAllocationScope
+{
+#if WITH_FLUID_ALLOCATION_CHECKS
+	bool m_wasCounting;
+
+public:
+	explicit FFluidAllocationScope(bool isCounting);
+	~FFluidAllocationScope();
+
+	//Whether the thread is inside a counting scope, for work it hands to other threads
+	static bool IsCounting();
+#else
+public:
+	explicit FFluidAllocationScope(bool isCounting) {}
+
+	static bool IsCounting() { return false; }
+#endif
+};
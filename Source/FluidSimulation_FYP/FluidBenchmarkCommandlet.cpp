@@ -0,0 +1,330 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FluidBenchmarkCommandlet.h"
+#include "FluidSimulation_FYPGameModeBase.h"
+#include "FluidParticle.h"
+#include "Engine/World.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+namespace
+{
+	const TCHAR* kCubeMeshPath = TEXT("/Engine/BasicShapes/Cube.Cube");
+	const TCHAR* kSphereMeshPath = TEXT("/Engine/BasicShapes/Sphere.Sphere");
+	//ManyColliders spreads this many pillars along each side of its field
+	const int32 kNumOfPillarsPerSide = 8;
+}
+
+UFluidBenchmarkCommandlet::UFluidBenchmarkCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = false;
+	LogToConsole = true;
+}
+
+FBox UFluidBenchmarkCommandlet::getBoxForParticles(const FVector& origin, const FVector& aspect, int32 numOfParticles, double spacing)
+{
+	const double scale = FMath::Pow(numOfParticles / (aspect.X * aspect.Y * aspect.Z), 1.0 / 3.0) * spacing;
+	return FBox(origin, origin + aspect * scale);
+}
+
+bool UFluidBenchmarkCommandlet::makeScenario(const FString& name, int32 numOfParticles, const FVector& origin, double spacing, double simulatedTime, FFluidScenario* scenario)
+{
+	scenario->name = name;
+	scenario->maxNumOfParticles = numOfParticles;
+	scenario->isViscous = false;
+
+	if (name == TEXT("DamBreak"))
+	{
+		//a water column twice as tall as it is wide collapsing across the floor
+		scenario->fluidVolumes.Add(getBoxForParticles(origin, FVector(1.0f, 1.0f, 2.0f), numOfParticles, spacing));
+	}
+	else if (name == TEXT("TeapotPour"))
+	{
+		//the scene starts empty and the emitter pours every particle during the first half of the run
+		scenario->emissionRate = FMath::CeilToInt(numOfParticles / (0.5 * simulatedTime));
+		scenario->maxNumOfEmittedParticles = numOfParticles;
+	}
+	else if (name == TEXT("DropIntoPool"))
+	{
+		//a quarter of the particles fall into a shallow pool holding the rest
+		const FBox pool = getBoxForParticles(origin, FVector(4.0f, 4.0f, 1.0f), numOfParticles - numOfParticles / 4, spacing);
+		const FBox drop = getBoxForParticles(FVector(0.0f), FVector(1.0f), numOfParticles / 4, spacing);
+		const FVector dropOrigin(pool.GetCenter().X - 0.5f * drop.Max.X, pool.GetCenter().Y - 0.5f * drop.Max.Y, pool.Max.Z + pool.GetSize().Z);
+		scenario->fluidVolumes.Add(pool);
+		scenario->fluidVolumes.Add(drop.ShiftBy(dropOrigin));
+	}
+	else if (name == TEXT("ViscousBlob"))
+	{
+		//a cube dropped from its own height that should ooze rather than splash
+		const FBox blob = getBoxForParticles(FVector(0.0f), FVector(1.0f), numOfParticles, spacing);
+		scenario->fluidVolumes.Add(blob.ShiftBy(origin + FVector(0.0f, 0.0f, blob.Max.Z)));
+		scenario->isViscous = true;
+	}
+	else if (name == TEXT("ManyColliders"))
+	{
+		//a dam break running into a field of pillars, so every particle is near a few of the colliders and far from the rest
+		const FBox column = getBoxForParticles(origin, FVector(1.0f, 1.0f, 2.0f), numOfParticles, spacing);
+		scenario->fluidVolumes.Add(column);
+		const double cellSize = 0.25 * column.GetSize().X;
+		const FVector pillarSize(0.6 * cellSize, 0.6 * cellSize, 0.5 * column.GetSize().Z);
+		const FVector fieldOrigin(column.Max.X + 2.0 * spacing, origin.Y, origin.Z);
+		for (int32 j = 0; j < kNumOfPillarsPerSide; j++)
+		{
+			for (int32 i = 0; i < kNumOfPillarsPerSide; i++)
+			{
+				const FVector centre = fieldOrigin + FVector((i + 0.5) * cellSize, (j + 0.5) * cellSize, 0.5 * pillarSize.Z);
+				scenario->colliders.Emplace(kCubeMeshPath, FBox(centre - 0.5f * pillarSize, centre + 0.5f * pillarSize));
+			}
+		}
+	}
+	else if (name == TEXT("MeshCollider"))
+	{
+		//a cube of fluid dropped onto a ball twice its width, so the particles pour around the curved distance field
+		const FBox block = getBoxForParticles(FVector(0.0f), FVector(1.0f), numOfParticles, spacing);
+		const FVector ballSize(2.0f * block.Max.X);
+		const FBox ball(origin, origin + ballSize);
+		scenario->colliders.Emplace(kSphereMeshPath, ball);
+		const FVector blockOrigin(ball.GetCenter().X - 0.5f * block.Max.X, ball.GetCenter().Y - 0.5f * block.Max.Y, ball.Max.Z + 2.0 * spacing);
+		scenario->fluidVolumes.Add(block.ShiftBy(blockOrigin));
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+void UFluidBenchmarkCommandlet::measureSampling(AFluidSimulation_FYPGameModeBase* gameMode, int32 numOfQueries, double* buildMs, double* queriesPerSecond)
+{
+	if (numOfQueries <= 0)
+	{
+		return;
+	}
+
+	double startTime = FPlatformTime::Seconds();
+	const FFluidFieldSampler& sampler = gameMode->GetFieldSampler();
+	*buildMs = (FPlatformTime::Seconds() - startTime) * 1000.0;
+
+	//density at random points around the fluid, in no particular order so the query sorting is part of the cost
+	const TArray<AFluidParticle*>& particles = *gameMode->GetParticleArrayPtr();
+	TArray<double> densities;
+	densities.SetNumUninitialized(particles.Num());
+	for (int32 i = 0; i < particles.Num(); i++)
+	{
+		densities[i] = particles[i]->GetParticleDensity();
+	}
+	const FBox bounds = sampler.GetBounds().ExpandBy(gameMode->GetKernelRadius());
+	FRandomStream random(numOfQueries);
+	TArray<FVector> points;
+	points.SetNumUninitialized(numOfQueries);
+	for (FVector& point : points)
+	{
+		point = bounds.Min + FVector(random.FRand(), random.FRand(), random.FRand()) * bounds.GetSize();
+	}
+	TArray<double> results;
+	results.SetNumUninitialized(numOfQueries);
+
+	startTime = FPlatformTime::Seconds();
+	sampler.Sample<double>(points, densities, results);
+	const double sampleTime = FPlatformTime::Seconds() - startTime;
+	*queriesPerSecond = sampleTime > 0.0 ? numOfQueries / sampleTime : 0.0;
+}
+
+int32 UFluidBenchmarkCommandlet::Main(const FString& Params)
+{
+	FString mapName = TEXT("/Game/Levels/TestLevel");
+	int32 numOfSteps = 200;
+	int32 numOfWarmupSteps = 20;
+	float timeStep = 1.0f / 60.0f;
+	FString countsParam = TEXT("1000,10000,100000,1000000");
+	FString scenariosParam = TEXT("DamBreak,TeapotPour,DropIntoPool,ViscousBlob,ManyColliders,MeshCollider");
+	FString solversParam = TEXT("WCSPH,PCISPH,FLIP");
+	FString pipelinesParam = TEXT("ParallelFor,Overlapped,TaskGraph");
+	FString outputName = TEXT("Benchmark");
+	int32 numOfSampleQueries = 1000000;
+	FParse::Value(*Params, TEXT("Map="), mapName);
+	FParse::Value(*Params, TEXT("Steps="), numOfSteps);
+	FParse::Value(*Params, TEXT("Warmup="), numOfWarmupSteps);
+	FParse::Value(*Params, TEXT("DeltaTime="), timeStep);
+	FParse::Value(*Params, TEXT("Counts="), countsParam, false);
+	FParse::Value(*Params, TEXT("Scenarios="), scenariosParam, false);
+	FParse::Value(*Params, TEXT("Solvers="), solversParam, false);
+	FParse::Value(*Params, TEXT("Pipelines="), pipelinesParam, false);
+	FParse::Value(*Params, TEXT("Output="), outputName);
+	FParse::Value(*Params, TEXT("SampleQueries="), numOfSampleQueries);
+	const bool isCheckingAllocations = FParse::Param(*Params, TEXT("CheckAllocations"));
+	const bool isBalancingNeighbourWork = !FParse::Param(*Params, TEXT("Unbalanced"));
+
+	TArray<FString> counts;
+	TArray<FString> scenarioNames;
+	TArray<FString> solvers;
+	TArray<FString> pipelines;
+	countsParam.ParseIntoArray(counts, TEXT(","));
+	scenariosParam.ParseIntoArray(scenarioNames, TEXT(","));
+	solversParam.ParseIntoArray(solvers, TEXT(","));
+	pipelinesParam.ParseIntoArray(pipelines, TEXT(","));
+
+	UWorld* world = loadWorld(mapName);
+	if (world == nullptr)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Couldn't load %s"), *mapName);
+		return 1;
+	}
+	AFluidSimulation_FYPGameModeBase* gameMode = world->GetAuthGameMode<AFluidSimulation_FYPGameModeBase>();
+	if (gameMode == nullptr)
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s doesn't use the fluid simulation game mode"), *mapName);
+		unloadWorld(world);
+		return 1;
+	}
+	if (isCheckingAllocations)
+		gameMode->EnableAllocationChecks();
+
+	//the scenarios are built from the corner of the level's own fluid volume, which is known to sit inside its colliders
+	const FVector origin = gameMode->GetFluidVolumes().Num() > 0 ? gameMode->GetFluidVolumes()[0].Min : FVector(0.0f);
+	const double simulatedTime = (numOfWarmupSteps + numOfSteps) * timeStep;
+
+	const int32 numOfStages = static_cast<int32>(EFluidStage::NumOfStages);
+	FString csv = TEXT("scenario,solver,pipeline,colliderBVH,multiRate,requestedParticles,particles,steps,stepsPerSecond,msPerStep,wallSecondsPerSimulatedSecond,multiRateSpeedup,meanIdleMsPerCore,busyImbalance,stolenChunksPerStep,neighbourSearchOverlap,allocationsPerStep,unexpectedAllocations,samplerBuildMs,sampleQueries,queriesPerSecond");
+	for (int32 s = 0; s < numOfStages; s++)
+	{
+		csv += FString::Printf(TEXT(",%sMs"), FFluidStageTimings::GetStageName(static_cast<EFluidStage>(s)));
+	}
+	csv += TEXT("\n");
+	TArray<FString> jsonRuns;
+	int32 numOfUnexpectedAllocations = 0;
+
+	for (const FString& pipeline : pipelines)
+	{
+		for (const FString& solver : solvers)
+		{
+			//the other solvers would only repeat their ParallelFor runs. FLIP has no neighbour search to overlap.
+			if ((pipeline == TEXT("TaskGraph") && solver != TEXT("WCSPH")) || (pipeline == TEXT("Overlapped") && solver == TEXT("FLIP")))
+				continue;
+
+			for (const FString& scenarioName : scenarioNames)
+			{
+				for (const FString& count : counts)
+				{
+					const int32 numOfParticles = FCString::Atoi(*count);
+					FFluidScenario scenario;
+					if (numOfParticles <= 0 || !makeScenario(scenarioName, numOfParticles, origin, gameMode->GetTargetSpacing(), simulatedTime, &scenario))
+					{
+						UE_LOG(LogTemp, Warning, TEXT("Skipping unknown scenario %s with %s particles"), *scenarioName, *count);
+						continue;
+					}
+					scenario.usePCISPHsolver = solver == TEXT("PCISPH");
+					scenario.useFLIPsolver = solver == TEXT("FLIP");
+					scenario.useTaskGraph = pipeline == TEXT("TaskGraph");
+					scenario.overlapNeighbourSearch = pipeline == TEXT("Overlapped");
+					scenario.balanceNeighbourWork = isBalancingNeighbourWork;
+					//scenes with colliders of their own are run again with every particle checking every collider, and pours
+					//with multi-rate stepping. Only WCSPH steps at more than one rate, which the task graph doesn't do.
+					TArray<FFluidScenario, TInlineAllocator<2>> runs;
+					runs.Add(scenario);
+					if (scenario.colliders.Num() > 0)
+						runs.Add_GetRef(scenario).useColliderBVH = false;
+					if (scenario.emissionRate > 0 && solver == TEXT("WCSPH") && pipeline != TEXT("TaskGraph"))
+						runs.Add_GetRef(scenario).useMultiRateStepping = true;
+					double globalWallSecondsPerSimulatedSecond = 0.0;
+
+					for (const FFluidScenario& run : runs)
+					{
+						gameMode->ApplyScenario(run);
+
+						for (int32 step = 0; step < numOfWarmupSteps; step++)
+						{
+							world->Tick(LEVELTICK_All, timeStep);
+						}
+						gameMode->GetStageTimings().Reset();
+						gameMode->GetWorkerTimings().Reset();
+
+						const double startTime = FPlatformTime::Seconds();
+						int64 numOfStepAllocations = 0;
+						for (int32 step = 0; step < numOfSteps; step++)
+						{
+							world->Tick(LEVELTICK_All, timeStep);
+							numOfStepAllocations += gameMode->GetNumOfStepAllocations();
+						}
+						const double totalTime = FPlatformTime::Seconds() - startTime;
+						const double stepsPerSecond = totalTime > 0.0 ? numOfSteps / totalTime : 0.0;
+						const double msPerStep = totalTime * 1000.0 / FMath::Max(numOfSteps, 1);
+						//the solvers are compared by what a second of fluid costs, as they may not be stable at the same time step
+						const double wallSecondsPerSimulatedSecond = totalTime / FMath::Max(numOfSteps * timeStep, SMALL_NUMBER);
+						//the multi-rate run comes after the one with a global time step of the same scene
+						if (!run.useMultiRateStepping)
+							globalWallSecondsPerSimulatedSecond = wallSecondsPerSimulatedSecond;
+						const double multiRateSpeedup = run.useMultiRateStepping && wallSecondsPerSimulatedSecond > 0.0 ? globalWallSecondsPerSimulatedSecond / wallSecondsPerSimulatedSecond : 1.0;
+						const FFluidStageTimings& timings = gameMode->GetStageTimings();
+						//ParallelFor runs are the baseline for the idle time the task graph saves. Stages that don't go through either
+						//(the surface, the FLIP grid) count as idle time.
+						const FFluidWorkerTimings& workerTimings = gameMode->GetWorkerTimings();
+						const double meanIdleMsPerCore = workerTimings.GetMeanIdleMillisecondsPerStep();
+						//the busiest worker over the mean shows how evenly the chunks were split
+						const double busyImbalance = workerTimings.GetBusyImbalance();
+						const double stolenChunksPerStep = workerTimings.GetStolenChunksPerStep();
+						FString idleJson;
+						FString busyJson;
+						for (int32 worker = 0; worker < workerTimings.GetNumOfWorkers(); worker++)
+						{
+							idleJson += FString::Printf(TEXT("%s%f"), worker > 0 ? TEXT(", ") : TEXT(""), workerTimings.GetIdleMillisecondsPerStep(worker));
+							busyJson += FString::Printf(TEXT("%s%f"), worker > 0 ? TEXT(", ") : TEXT(""), workerTimings.GetBusyMillisecondsPerStep(worker));
+						}
+						const int32 numOfLiveParticles = gameMode->GetNumberOfLiveParticles();
+						//0 without CheckAllocations
+						const double allocationsPerStep = static_cast<double>(numOfStepAllocations) / FMath::Max(numOfSteps, 1);
+						const int32 unexpectedAllocations = gameMode->GetNumOfUnexpectedAllocations();
+						numOfUnexpectedAllocations += unexpectedAllocations;
+
+						double samplerBuildMs = 0.0;
+						double queriesPerSecond = 0.0;
+						measureSampling(gameMode, numOfSampleQueries, &samplerBuildMs, &queriesPerSecond);
+
+						FString stageLog;
+						FString stageJson;
+						csv += FString::Printf(TEXT("%s,%s,%s,%i,%i,%i,%i,%i,%f,%f,%f,%f,%f,%f,%f,%f,%f,%i,%f,%i,%f"), *scenarioName, *solver, *pipeline, run.useColliderBVH ? 1 : 0, run.useMultiRateStepping ? 1 : 0, numOfParticles, numOfLiveParticles, numOfSteps, stepsPerSecond, msPerStep,
+							wallSecondsPerSimulatedSecond, multiRateSpeedup, meanIdleMsPerCore, busyImbalance, stolenChunksPerStep, timings.GetAsyncOverlap(), allocationsPerStep, unexpectedAllocations, samplerBuildMs, numOfSampleQueries, queriesPerSecond);
+						for (int32 s = 0; s < numOfStages; s++)
+						{
+							const EFluidStage stage = static_cast<EFluidStage>(s);
+							csv += FString::Printf(TEXT(",%f"), timings.GetMillisecondsPerStep(stage));
+							stageLog += FString::Printf(TEXT(" %s %.3f"), FFluidStageTimings::GetStageName(stage), timings.GetMillisecondsPerStep(stage));
+							stageJson += FString::Printf(TEXT("%s\"%s\": %f"), s > 0 ? TEXT(", ") : TEXT(""), FFluidStageTimings::GetStageName(stage), timings.GetMillisecondsPerStep(stage));
+						}
+						csv += TEXT("\n");
+						jsonRuns.Add(FString::Printf(TEXT("\t\t{ \"scenario\": \"%s\", \"solver\": \"%s\", \"pipeline\": \"%s\", \"colliderBVH\": %s, \"multiRate\": %s, \"requestedParticles\": %i, \"particles\": %i, \"steps\": %i, ")
+							TEXT("\"stepsPerSecond\": %f, \"msPerStep\": %f, \"wallSecondsPerSimulatedSecond\": %f, \"multiRateSpeedup\": %f, \"meanIdleMsPerCore\": %f, \"idleMsPerCore\": [ %s ], ")
+							TEXT("\"busyMsPerCore\": [ %s ], \"busyImbalance\": %f, \"stolenChunksPerStep\": %f, \"neighbourSearchOverlap\": %f, ")
+							TEXT("\"allocationsPerStep\": %f, \"unexpectedAllocations\": %i, \"samplerBuildMs\": %f, \"sampleQueries\": %i, \"queriesPerSecond\": %f, \"stageMs\": { %s } }"),
+							*scenarioName, *solver, *pipeline, run.useColliderBVH ? TEXT("true") : TEXT("false"), run.useMultiRateStepping ? TEXT("true") : TEXT("false"), numOfParticles, numOfLiveParticles, numOfSteps, stepsPerSecond, msPerStep,
+							wallSecondsPerSimulatedSecond, multiRateSpeedup, meanIdleMsPerCore, *idleJson,
+							*busyJson, busyImbalance, stolenChunksPerStep, timings.GetAsyncOverlap(),
+							allocationsPerStep, unexpectedAllocations, samplerBuildMs, numOfSampleQueries, queriesPerSecond, *stageJson));
+
+						const FString speedupLog = run.useMultiRateStepping ? FString::Printf(TEXT(" (%f times faster than the global time step)"), multiRateSpeedup) : FString();
+						UE_LOG(LogTemp, Display, TEXT("%s %s %s%s%s %i particles: %f steps/s, %f ms per step, %f s per simulated second%s, %f ms idle per core, busiest worker %f times the mean. Stage ms:%s. Field sampling: %f ms build, %f queries/s"),
+							*scenarioName, *solver, *pipeline, run.useColliderBVH ? TEXT("") : TEXT(" without the collider BVH"), run.useMultiRateStepping ? TEXT(" multi-rate") : TEXT(""), numOfLiveParticles,
+							stepsPerSecond, msPerStep, wallSecondsPerSimulatedSecond, *speedupLog, meanIdleMsPerCore, busyImbalance, *stageLog, samplerBuildMs, queriesPerSecond);
+					}
+				}
+			}
+		}
+	}
+
+	const FString json = FString::Printf(TEXT("{\n\t\"map\": \"%s\",\n\t\"steps\": %i,\n\t\"warmupSteps\": %i,\n\t\"deltaTime\": %f,\n\t\"balancedNeighbourWork\": %s,\n\t\"runs\": [\n%s\n\t]\n}\n"),
+		*mapName, numOfSteps, numOfWarmupSteps, timeStep, isBalancingNeighbourWork ? TEXT("true") : TEXT("false"), *FString::Join(jsonRuns, TEXT(",\n")));
+	const FString basePath = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Stats"), outputName);
+	if (!FFileHelper::SaveStringToFile(csv, *(basePath + TEXT(".csv"))) || !FFileHelper::SaveStringToFile(json, *(basePath + TEXT(".json"))))
+		UE_LOG(LogTemp, Warning, TEXT("Couldn't write the benchmark results to %s"), *basePath);
+
+	unloadWorld(world);
+	if (numOfUnexpectedAllocations > 0)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Warmed up steps made %i heap allocations"), numOfUnexpectedAllocations);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,46 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FluidSimulationCommandlet.h"
+#include "FluidBenchmarkCommandlet.generated.h"
+
+/**
+ * Runs the benchmark scenarios (DamBreak, TeapotPour, DropIntoPool, ViscousBlob, ManyColliders, MeshCollider) at several particle counts with each solver
+ * and writes steps per second, the time of every stage of the step and the time every core was busy and sat idle.
+ * UE4Editor-Cmd FluidSimulation_FYP.uproject -run=FluidBenchmark -Map=/Game/Levels/TestLevel [-Steps=200] [-Warmup=20] [-DeltaTime=0.0166]
+ *     [-Counts=1000,10000,100000,1000000] [-Scenarios=DamBreak,TeapotPour] [-Solvers=WCSPH,PCISPH,FLIP] [-Pipelines=ParallelFor,Overlapped,TaskGraph]
+ *     [-Output=Benchmark] [-SampleQueries=1000000] [-CheckAllocations] [-Unbalanced]
+ * Pipelines run the step as ParallelFor stages with barriers in between, the same with the neighbour search of the next step
+ * running between frames (Overlapped, not FLIP), or as a graph of chunked tasks (TaskGraph, WCSPH only).
+ * After each run the density is sampled at SampleQueries random points with the batched field sampler (0 skips it).
+ * Unbalanced splits the neighbour loops into equal ranges of particles instead of chunks of equal cost, for comparing the busy
+ * time of the workers with and without the balancing.
+ * ManyColliders spawns 64 mesh colliders in the way of a dam break and is run with the collider BVH on and off, for the
+ * Collision stage time of the broad phase against every particle checking every collider. MeshCollider drops the fluid onto
+ * a ball that collides through its signed distance field, for the Collision stage time of the distance field lookups at
+ * 100k particles and the other counts.
+ * Scenes that pour from the emitter (TeapotPour) are run again by WCSPH with multi-rate time stepping, outside the task graph.
+ * Both runs report the wall time per simulated second and the multi-rate one its speedup over the global time step.
+ * CheckAllocations counts the heap allocations of every step. The commandlet fails if a step made any once the steps of a run
+ * had warmed up with an unchanged particle count.
+ * Results go to Saved/Stats/<Output>.csv and Saved/Stats/<Output>.json. TeapotPour needs an emitter in the level.
+ */
+UCLASS()
+class FLUIDSIMULATION_FYP_API UFluidBenchmarkCommandlet : public UFluidSimulationCommandlet
+{
+	GENERATED_BODY()
+
+	//Box with the proportions of the aspect that a cubic lattice fills with about this many particles
+	static FBox getBoxForParticles(const FVector& origin, const FVector& aspect, int32 numOfParticles, double spacing);
+	//Simulated time is needed to pour every particle of TeapotPour in the first half of the run
+	static bool makeScenario(const FString& name, int32 numOfParticles, const FVector& origin, double spacing, double simulatedTime, struct FFluidScenario* scenario);
+	//Builds the field sampler and times sampling the density at random points around the fluid
+	static void measureSampling(class AFluidSimulation_FYPGameModeBase* gameMode, int32 numOfQueries, double* buildMs, double* queriesPerSecond);
+
+public:
+	UFluidBenchmarkCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+};
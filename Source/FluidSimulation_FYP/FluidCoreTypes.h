@@ -0,0 +1,17 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FluidCore/Vec3.h"
+
+//Conversions between the engine's vectors and the vectors of the engine independent core (Source/FluidCore)
+FORCEINLINE FluidCore::FVec3 ToCore(const FVector& vector)
+{
+	return FluidCore::FVec3(vector.X, vector.Y, vector.Z);
+}
+
+FORCEINLINE FVector FromCore(const FluidCore::FVec3& vector)
+{
+	return FVector(static_cast<float>(vector.X), static_cast<float>(vector.Y), static_cast<float>(vector.Z));
+}
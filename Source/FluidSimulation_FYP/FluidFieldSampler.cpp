@@ -0,0 +1,121 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FluidFieldSampler.h"
+#include "FluidParticle.h"
+
+#define kPId 3.14159265358979323846264338327950288
+
+FIntVector FFluidFieldSampler::getCell(const FVector& point) const
+{
+	const FVector local = (point - m_origin) / m_cellSize;
+	return FIntVector(FMath::FloorToInt(local.X), FMath::FloorToInt(local.Y), FMath::FloorToInt(local.Z));
+}
+
+void FFluidFieldSampler::Build(const TArray<AFluidParticle*>& particles, double kernelRadius)
+{
+	m_positions.Reset();
+	m_kernelRadiiSquared.Reset();
+	m_kernelScales.Reset();
+	m_particleIndices.Reset();
+	m_cellStarts.Reset();
+	m_numOfCells = FIntVector(0);
+
+	//dead particles and ones without a density yet don't contribute
+	TArray<int32> liveParticles;
+	liveParticles.Reserve(particles.Num());
+	double maxKernelRadius = 0.0;
+	FBox bounds(ForceInit);
+	for (int32 i = 0; i < particles.Num(); i++)
+	{
+		if (particles[i]->IsParticleDead() || particles[i]->GetParticleDensity() <= 0.0)
+			continue;
+		liveParticles.Add(i);
+		maxKernelRadius = FMath::Max(maxKernelRadius, kernelRadius * particles[i]->GetParticleScale());
+		bounds += particles[i]->GetParticlePosition();
+	}
+	const int32 n = liveParticles.Num();
+	if (n == 0)
+	{
+		return;
+	}
+
+	//A dense grid with a cell per smoothing length. Cells are made wider when the particles are spread out so the grid stays
+	//in proportion to the particles, which is still correct as every cell covers a smoothing length.
+	m_origin = bounds.Min - FVector(maxKernelRadius);
+	m_cellSize = maxKernelRadius;
+	const FVector size = bounds.GetSize() + FVector(2.0 * maxKernelRadius);
+	const int64 maxNumOfCells = 8 * static_cast<int64>(n) + 4096;
+	do
+	{
+		m_numOfCells = FIntVector(FMath::CeilToInt(size.X / m_cellSize) + 1, FMath::CeilToInt(size.Y / m_cellSize) + 1, FMath::CeilToInt(size.Z / m_cellSize) + 1);
+		if (static_cast<int64>(m_numOfCells.X) * m_numOfCells.Y * m_numOfCells.Z <= maxNumOfCells)
+			break;
+		m_cellSize *= 2.0;
+	} while (true);
+	const int32 numOfCells = m_numOfCells.X * m_numOfCells.Y * m_numOfCells.Z;
+
+	//counting sort of the particles by cell
+	TArray<int32> particleCells;
+	particleCells.SetNumUninitialized(n);
+	ParallelFor(n, [&](int32 k) {
+		const FIntVector cell = getCell(particles[liveParticles[k]]->GetParticlePosition());
+		particleCells[k] = (cell.Z * m_numOfCells.Y + cell.Y) * m_numOfCells.X + cell.X;
+		});
+	m_cellStarts.SetNumZeroed(numOfCells + 1);
+	for (int32 cell : particleCells)
+	{
+		m_cellStarts[cell + 1]++;
+	}
+	for (int32 c = 0; c < numOfCells; c++)
+	{
+		m_cellStarts[c + 1] += m_cellStarts[c];
+	}
+	TArray<int32> cellFill(m_cellStarts.GetData(), numOfCells);
+	m_particleIndices.SetNumUninitialized(n);
+	for (int32 k = 0; k < n; k++)
+	{
+		m_particleIndices[cellFill[particleCells[k]]++] = liveParticles[k];
+	}
+
+	m_positions.SetNumUninitialized(n);
+	m_kernelRadiiSquared.SetNumUninitialized(n);
+	m_kernelScales.SetNumUninitialized(n);
+	ParallelFor(n, [&](int32 k) {
+		const AFluidParticle* particle = particles[m_particleIndices[k]];
+		//the standard kernel, 315 / (64 pi h^3) (1 - r^2 / h^2)^3, with the particle's volume folded in
+		const double h = kernelRadius * particle->GetParticleScale();
+		m_positions[k] = particle->GetParticlePosition();
+		m_kernelRadiiSquared[k] = h * h;
+		m_kernelScales[k] = particle->GetParticleMass() / particle->GetParticleDensity() * 315.0 / (64.0 * kPId * h * h * h);
+		});
+}
+
+void FFluidFieldSampler::sortQueries(TArrayView<const FVector> points, TArray<int32>* order) const
+{
+	const int32 numOfCells = m_numOfCells.X * m_numOfCells.Y * m_numOfCells.Z;
+	const int32 n = points.Num();
+	TArray<int32> queryCells;
+	queryCells.SetNumUninitialized(n);
+	ParallelFor(n, [&](int32 q) {
+		const FIntVector cell = getCell(points[q]);
+		const bool isInside = cell.X >= 0 && cell.Y >= 0 && cell.Z >= 0 && cell.X < m_numOfCells.X && cell.Y < m_numOfCells.Y && cell.Z < m_numOfCells.Z;
+		queryCells[q] = isInside ? (cell.Z * m_numOfCells.Y + cell.Y) * m_numOfCells.X + cell.X : numOfCells;
+		});
+
+	TArray<int32> starts;
+	starts.SetNumZeroed(numOfCells + 2);
+	for (int32 cell : queryCells)
+	{
+		starts[cell + 1]++;
+	}
+	for (int32 c = 0; c <= numOfCells; c++)
+	{
+		starts[c + 1] += starts[c];
+	}
+	order->SetNumUninitialized(n);
+	for (int32 q = 0; q < n; q++)
+	{
+		(*order)[starts[queryCells[q]]++] = q;
+	}
+}
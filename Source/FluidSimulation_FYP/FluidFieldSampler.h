@@ -0,0 +1,139 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/ParallelFor.h"
+
+/**
+ * Evaluates particle fields at many points at once, for volume export, probes and analysis.
+ * Build takes a snapshot of the particles and sorts them into a dense grid of cells one smoothing length wide.
+ * Queries are sorted by cell too, so a batch walks the particles cell by cell instead of hashing every point on its own.
+ * Sampling only reads the snapshot, so it can run while the particles move on.
+ */
+class FLUIDSIMULATION_FYP_API FFluidFieldSampler
+{
+	//Particles in cell order. The standard kernel of particle k is kernelScales[k] * (1 - r^2 / kernelRadiiSquared[k])^3,
+	//with its mass / density folded into the scale.
+	TArray<FVector> m_positions;
+	TArray<float> m_kernelRadiiSquared;
+	TArray<float> m_kernelScales;
+	//index of each sorted particle in the particle array, which is what the values are indexed by
+	TArray<int32> m_particleIndices;
+
+	FVector m_origin{ FVector(0.0f) };
+	double m_cellSize{ 1.0 };
+	FIntVector m_numOfCells{ FIntVector(0) };
+	TArray<int32> m_cellStarts;
+
+	//queries that sample the same cells are handed to the same task
+	static constexpr int32 kQueriesPerTask = 1024;
+
+	FIntVector getCell(const FVector& point) const;
+	//sorts the queries by the cell they are in. Queries outside the grid go last.
+	void sortQueries(TArrayView<const FVector> points, TArray<int32>* order) const;
+
+	template <typename Body>
+	void forEachParticleNear(const FVector& point, Body&& body) const;
+
+public:
+	FFluidFieldSampler() = default;
+	~FFluidFieldSampler() = default;
+
+	//Takes a snapshot of the live particles. Kernel radius is the one of a particle of scale 1.
+	void Build(const TArray<class AFluidParticle*>& particles, double kernelRadius);
+
+	//SPH interpolation of a value per particle (sum of mass / density * W * value) at every point.
+	//T is anything that can be scaled and added and constructed from 0, like double or FVector.
+	template <typename T>
+	void Sample(TArrayView<const FVector> points, TArrayView<const T> values, TArrayView<T> results) const;
+
+	//Samples the nodes origin + (x, y, z) * spacing, with x changing fastest
+	template <typename T>
+	void SampleGrid(const FVector& origin, const FIntVector& resolution, double spacing, TArrayView<const T> values, TArray<T>* results) const;
+
+	int32 GetNumOfParticles() const { return m_positions.Num(); }
+	//Bounds of the particle centres
+	FBox GetBounds() const { return FBox(m_positions); }
+};
+
+template <typename Body>
+void FFluidFieldSampler::forEachParticleNear(const FVector& point, Body&& body) const
+{
+	//cells are as wide as the largest smoothing length, so the 27 cells around the point hold every particle that reaches it
+	const FIntVector cell = getCell(point);
+	const int32 minX = FMath::Max(cell.X - 1, 0);
+	const int32 maxX = FMath::Min(cell.X + 1, m_numOfCells.X - 1);
+	if (minX > maxX)
+	{
+		return;
+	}
+	for (int32 z = FMath::Max(cell.Z - 1, 0); z <= FMath::Min(cell.Z + 1, m_numOfCells.Z - 1); z++)
+	{
+		for (int32 y = FMath::Max(cell.Y - 1, 0); y <= FMath::Min(cell.Y + 1, m_numOfCells.Y - 1); y++)
+		{
+			//the cells of a row are next to each other, so they are one range of particles
+			const int32 rowIndex = (z * m_numOfCells.Y + y) * m_numOfCells.X;
+			const int32 first = m_cellStarts[rowIndex + minX];
+			const int32 last = m_cellStarts[rowIndex + maxX + 1];
+			for (int32 k = first; k < last; k++)
+			{
+				const float distanceSquared = FVector::DistSquared(point, m_positions[k]);
+				if (distanceSquared < m_kernelRadiiSquared[k])
+				{
+					const float x = 1.0f - distanceSquared / m_kernelRadiiSquared[k];
+					body(m_particleIndices[k], m_kernelScales[k] * x * x * x);
+				}
+			}
+		}
+	}
+}
+
+template <typename T>
+void FFluidFieldSampler::Sample(TArrayView<const FVector> points, TArrayView<const T> values, TArrayView<T> results) const
+{
+	check(results.Num() == points.Num());
+	if (m_positions.Num() == 0)
+	{
+		for (T& result : results)
+		{
+			result = T(0);
+		}
+		return;
+	}
+
+	TArray<int32> order;
+	sortQueries(points, &order);
+	const int32 numOfTasks = FMath::DivideAndRoundUp(points.Num(), kQueriesPerTask);
+	ParallelFor(numOfTasks, [&](int32 task) {
+		const int32 end = FMath::Min((task + 1) * kQueriesPerTask, points.Num());
+		for (int32 k = task * kQueriesPerTask; k < end; k++)
+		{
+			const int32 q = order[k];
+			T sum = T(0);
+			forEachParticleNear(points[q], [&](int32 i, float weight) {
+				sum += weight * values[i];
+				});
+			results[q] = sum;
+		}
+		});
+}
+
+template <typename T>
+void FFluidFieldSampler::SampleGrid(const FVector& origin, const FIntVector& resolution, double spacing, TArrayView<const T> values, TArray<T>* results) const
+{
+	const int32 numOfNodes = resolution.X * resolution.Y * resolution.Z;
+	TArray<FVector> points;
+	points.SetNumUninitialized(numOfNodes);
+	ParallelFor(resolution.Z, [&](int32 z) {
+		for (int32 y = 0; y < resolution.Y; y++)
+		{
+			for (int32 x = 0; x < resolution.X; x++)
+			{
+				points[(z * resolution.Y + y) * resolution.X + x] = origin + FVector(x, y, z) * spacing;
+			}
+		}
+		});
+	results->SetNumUninitialized(numOfNodes);
+	Sample<T>(points, values, *results);
+}
@@ -0,0 +1,26 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Neighbour lists of every particle in two flat arrays: the neighbours of particle i are indices[starts[i], starts[i + 1]).
+ * The arrays are views into a scratch arena of the game mode, so they are only valid until that arena is reset.
+ */
+struct FFluidNeighbourLists
+{
+	TArrayView<int32> starts;
+	TArrayView<int32> indices;
+
+	int32 Num() const { return starts.Num() > 0 ? starts.Num() - 1 : 0; }
+	int32 NumOf(int32 i) const { return starts[i + 1] - starts[i]; }
+	int32 GetNumOfPairs() const { return starts.Num() > 0 ? starts.Last() : 0; }
+	TArrayView<const int32> operator[](int32 i) const { return TArrayView<const int32>(indices.GetData() + starts[i], NumOf(i)); }
+
+	void Reset()
+	{
+		starts = TArrayView<int32>();
+		indices = TArrayView<int32>();
+	}
+};
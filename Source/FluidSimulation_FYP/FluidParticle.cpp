@@ -8,7 +8,7 @@ const double AFluidParticle::kRadius = 1.0; //this should be 1e-3
 const double AFluidParticle::kMass = 1.0; //this should be 1e-3
 
 // Sets default values
-AFluidParticle::AFluidParticle()
+AFluidParticle::AFluidParticle() : m_mass(kMass), m_radius(kRadius)
 {
  	// Set this actor to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
 	PrimaryActorTick.bCanEverTick = false;
@@ -23,4 +23,29 @@ void AFluidParticle::BeginPlay()
 {
 	Super::BeginPlay();
 	
-}
\ No newline at end of file
+}
+
+void AFluidParticle::SetParticleMass(double _mass)
+{
+	m_mass = _mass;
+	m_radius = kRadius * FMath::Pow(m_mass / kMass, 1.0 / 3.0);
+	SetActorScale3D(FVector(GetParticleScale()));
+}
+void AFluidParticle::ResetParticle(const FVector& _position, const FVector& _velocity, double _mass)
+{
+	m_position = _position;
+	m_velocity = _velocity;
+	m_force = FVector(0.0f);
+	m_density = 0.0;
+	m_pressure = 0.0;
+	m_age = 0.0;
+	m_isDead = false;
+	m_isEmitted = false;
+	m_probeId = INDEX_NONE;
+	for (FVector& gradient : m_affineVelocity)
+	{
+		gradient = FVector(0.0f);
+	}
+	SetParticleMass(_mass);
+	SetActorLocation(_position);
+}
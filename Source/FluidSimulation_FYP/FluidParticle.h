@@ -19,8 +19,21 @@ class FLUIDSIMULATION_FYP_API AFluidParticle : public AActor
 	FVector m_force{ 0.0f };
 	double m_density{ 0.0 };
 	double m_pressure{ 0.0 };
+	//particles can be split or merged, so they don't all share kMass and kRadius
+	double m_mass;
+	double m_radius;
+	//seconds since the particle was spawned
+	double m_age{ 0.0 };
+	//dead particles are left out of the simulation until the next compaction returns them to the pool
+	bool m_isDead{ false };
+	bool m_isEmitted{ false };
+	//id the probe recorder reports this particle's values under, INDEX_NONE when it isn't probed
+	int32 m_probeId{ INDEX_NONE };
+	//gradient of each velocity component around the particle, carried between steps by the APIC transfers
+	FVector m_affineVelocity[3]{ FVector(0.0f), FVector(0.0f), FVector(0.0f) };
 	
 public:	
+	//mass and radius of a particle at the base resolution
 	static const double kRadius;
 	static const double kMass;
 
@@ -33,6 +46,15 @@ public:
 	void SetParticleForce(const FVector& _force) { m_force = _force; }
 	void SetParticleDensity(double _density) { m_density = _density; }
 	void SetParticlePressure(double _pressure) { m_pressure = _pressure; }
+	//The radius follows the mass so that the particle keeps the base density
+	void SetParticleMass(double _mass);
+	void SetParticleAge(double _age) { m_age = _age; }
+	void SetParticleDead(bool _isDead) { m_isDead = _isDead; }
+	void SetParticleEmitted(bool _isEmitted) { m_isEmitted = _isEmitted; }
+	void SetParticleProbeId(int32 _probeId) { m_probeId = _probeId; }
+	void SetParticleAffineVelocity(int32 axis, const FVector& _gradient) { m_affineVelocity[axis] = _gradient; }
+	//Clears the simulation state so a pooled particle can be reused
+	void ResetParticle(const FVector& _position, const FVector& _velocity, double _mass);
 
 	//Getters
 	const FVector& GetParticlePosition() const { return m_position; }
@@ -40,6 +62,16 @@ public:
 	const FVector& GetParticleForce() const { return m_force; }
 	double GetParticleDensity() const { return m_density; }
 	double GetParticlePressure() const { return m_pressure; }
+	double GetParticleMass() const { return m_mass; }
+	double GetParticleRadius() const { return m_radius; }
+	//Ratio between this particle's radius and the base one. Smoothing lengths are scaled by it.
+	double GetParticleScale() const { return m_radius / kRadius; }
+	double GetParticleAge() const { return m_age; }
+	bool IsParticleDead() const { return m_isDead; }
+	//Whether the particle came out of an emitter
+	bool IsParticleEmitted() const { return m_isEmitted; }
+	int32 GetParticleProbeId() const { return m_probeId; }
+	const FVector& GetParticleAffineVelocity(int32 axis) const { return m_affineVelocity[axis]; }
 
 protected:
 	// Called when the game starts or when spawned
@@ -0,0 +1,217 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FluidProbes.h"
+#include "HAL/RunnableThread.h"
+#include "HAL/PlatformFilemanager.h"
+#include "Misc/Paths.h"
+
+namespace
+{
+	TAtomic<uint32> g_numOfRecorders{ 0 };
+}
+
+FFluidProbeRecorder::FFluidProbeRecorder()
+	: m_recorderId(++g_numOfRecorders)
+{
+}
+
+FFluidProbeRecorder::~FFluidProbeRecorder()
+{
+	Close();
+}
+
+bool FFluidProbeRecorder::Open(const FString& filename, int32 ringCapacity)
+{
+	Close();
+
+	if (!filename.IsEmpty())
+	{
+		IPlatformFile& platformFile = FPlatformFileManager::Get().GetPlatformFile();
+		platformFile.CreateDirectoryTree(*FPaths::GetPath(filename));
+		m_file.Reset(platformFile.OpenWrite(*filename));
+		if (!m_file)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Couldn't create the probe file %s"), *filename);
+			return false;
+		}
+		const FTCHARToUTF8 header(TEXT("step,probe,value,x,y,z\n"));
+		m_file->Write(reinterpret_cast<const uint8*>(header.Get()), header.Length());
+	}
+	m_filename = filename;
+
+	//rings that threads registered with an earlier Open are still theirs, so they are emptied rather than freed
+	{
+		FScopeLock lock(&m_ringsLock);
+		if (m_rings.Num() == 0)
+			m_ringCapacity = FMath::RoundUpToPowerOfTwo(FMath::Max(ringCapacity, 16));
+		for (TUniquePtr<FRing>& ring : m_rings)
+		{
+			ring->tail = ring->head.Load();
+			ring->numOfDroppedSamples = 0;
+		}
+	}
+	m_numOfDrainedSamples = 0;
+
+	m_isStopping = false;
+	m_drainEvent = FPlatformProcess::GetSynchEventFromPool();
+	m_thread = FRunnableThread::Create(this, TEXT("FluidProbeRecorder"));
+	return m_thread != nullptr;
+}
+
+void FFluidProbeRecorder::Close()
+{
+	if (m_thread == nullptr)
+	{
+		return;
+	}
+
+	//Run drains the rings before returning
+	Stop();
+	m_thread->WaitForCompletion();
+	delete m_thread;
+	m_thread = nullptr;
+	FPlatformProcess::ReturnSynchEventToPool(m_drainEvent);
+	m_drainEvent = nullptr;
+	m_file.Reset();
+
+	uint32 numOfDroppedSamples = 0;
+	{
+		FScopeLock lock(&m_ringsLock);
+		for (const TUniquePtr<FRing>& ring : m_rings)
+		{
+			numOfDroppedSamples += ring->numOfDroppedSamples.Load();
+		}
+	}
+	UE_LOG(LogTemp, Warning, TEXT("Probes recorded %llu samples from %i threads, %u dropped"), m_numOfDrainedSamples, m_rings.Num(), numOfDroppedSamples);
+}
+
+FFluidProbeRecorder::FRing* FFluidProbeRecorder::getThreadRing()
+{
+	static thread_local FRing* t_ring = nullptr;
+	static thread_local uint32 t_recorderId = 0;
+	if (t_recorderId != m_recorderId)
+	{
+		//first sample of this thread, the only time it takes the lock
+		TUniquePtr<FRing> ring = MakeUnique<FRing>();
+		FScopeLock lock(&m_ringsLock);
+		ring->samples.SetNumUninitialized(m_ringCapacity);
+		t_ring = ring.Get();
+		t_recorderId = m_recorderId;
+		m_rings.Add(MoveTemp(ring));
+	}
+	return t_ring;
+}
+
+void FFluidProbeRecorder::Record(int32 probeId, EFluidProbeValue type, const FVector& value)
+{
+	FRing* ring = getThreadRing();
+	const uint32 head = ring->head.Load(EMemoryOrder::Relaxed);
+	if (head - ring->tail.Load() >= m_ringCapacity)
+	{
+		ring->numOfDroppedSamples++;
+		return;
+	}
+
+	FFluidProbeSample& sample = ring->samples[head & (m_ringCapacity - 1)];
+	sample.value = value;
+	sample.step = m_step.Load(EMemoryOrder::Relaxed);
+	sample.probeId = probeId;
+	sample.type = type;
+	//publishes the sample to the drain thread
+	ring->head = head + 1;
+}
+
+void FFluidProbeRecorder::drain()
+{
+	FScopeLock lock(&m_ringsLock);
+	for (TUniquePtr<FRing>& ring : m_rings)
+	{
+		const uint32 head = ring->head.Load();
+		uint32 tail = ring->tail.Load(EMemoryOrder::Relaxed);
+		for (; tail != head; tail++)
+		{
+			const FFluidProbeSample& sample = ring->samples[tail & (m_ringCapacity - 1)];
+			if (m_file)
+			{
+				m_lines += FString::Printf(TEXT("%u,%i,%s,%f,%f,%f\n"), sample.step, sample.probeId, GetValueName(sample.type), sample.value.X, sample.value.Y, sample.value.Z);
+			}
+			else if (IsVectorValue(sample.type))
+			{
+				UE_LOG(LogTemp, Warning, TEXT("Probe %i step %u %s: %s"), sample.probeId, sample.step, GetValueName(sample.type), *sample.value.ToString());
+			}
+			else
+			{
+				UE_LOG(LogTemp, Warning, TEXT("Probe %i step %u %s: %f"), sample.probeId, sample.step, GetValueName(sample.type), sample.value.X);
+			}
+			m_numOfDrainedSamples++;
+		}
+		//hands the slots back to the worker thread
+		ring->tail = tail;
+	}
+
+	if (m_file && m_lines.Len() > 0)
+	{
+		const FTCHARToUTF8 lines(*m_lines);
+		m_file->Write(reinterpret_cast<const uint8*>(lines.Get()), lines.Length());
+		m_lines.Reset();
+	}
+}
+
+uint32 FFluidProbeRecorder::Run()
+{
+	while (!m_isStopping)
+	{
+		//samples are only written in batches, a probe isn't worth waking up for
+		m_drainEvent->Wait(100);
+		drain();
+	}
+	drain();
+	return 0;
+}
+
+void FFluidProbeRecorder::Stop()
+{
+	m_isStopping = true;
+	if (m_drainEvent)
+		m_drainEvent->Trigger();
+}
+
+const TCHAR* FFluidProbeRecorder::GetValueName(EFluidProbeValue type)
+{
+	switch (type)
+	{
+	case EFluidProbeValue::NeighbourCount: return TEXT("NeighbourCount");
+	case EFluidProbeValue::Density: return TEXT("Density");
+	case EFluidProbeValue::Pressure: return TEXT("Pressure");
+	case EFluidProbeValue::PressureForce: return TEXT("PressureForce");
+	case EFluidProbeValue::ViscosityForce: return TEXT("ViscosityForce");
+	case EFluidProbeValue::VectorField: return TEXT("VectorField");
+	case EFluidProbeValue::ExternalForce: return TEXT("ExternalForce");
+	case EFluidProbeValue::NewVelocity: return TEXT("NewVelocity");
+	case EFluidProbeValue::NewPosition: return TEXT("NewPosition");
+	case EFluidProbeValue::PredictedVelocity: return TEXT("PredictedVelocity");
+	case EFluidProbeValue::PredictedPosition: return TEXT("PredictedPosition");
+	case EFluidProbeValue::PredictedDensity: return TEXT("PredictedDensity");
+	case EFluidProbeValue::DensityError: return TEXT("DensityError");
+	case EFluidProbeValue::PredictedPressure: return TEXT("PredictedPressure");
+	case EFluidProbeValue::PredictedPressureForce: return TEXT("PredictedPressureForce");
+	default: return TEXT("Unknown");
+	}
+}
+
+bool FFluidProbeRecorder::IsVectorValue(EFluidProbeValue type)
+{
+	switch (type)
+	{
+	case EFluidProbeValue::NeighbourCount:
+	case EFluidProbeValue::Density:
+	case EFluidProbeValue::Pressure:
+	case EFluidProbeValue::PredictedDensity:
+	case EFluidProbeValue::DensityError:
+	case EFluidProbeValue::PredictedPressure:
+		return false;
+	default:
+		return true;
+	}
+}
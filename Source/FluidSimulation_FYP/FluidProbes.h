@@ -0,0 +1,115 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/Runnable.h"
+#include "HAL/ThreadSafeBool.h"
+#include "HAL/Event.h"
+#include "Templates/Atomic.h"
+
+class FRunnableThread;
+class IFileHandle;
+
+//Probes are compiled out of shipping builds unless the target defines this
+#ifndef WITH_FLUID_PROBES
+#define WITH_FLUID_PROBES !UE_BUILD_SHIPPING
+#endif
+
+//Values the stages of the step can record for a probed particle
+enum class EFluidProbeValue : uint8
+{
+	NeighbourCount,
+	Density,
+	Pressure,
+	PressureForce,
+	ViscosityForce,
+	VectorField,
+	ExternalForce,
+	NewVelocity,
+	NewPosition,
+	PredictedVelocity,
+	PredictedPosition,
+	PredictedDensity,
+	DensityError,
+	PredictedPressure,
+	PredictedPressureForce,
+	NumOfValues
+};
+
+struct FFluidProbeSample
+{
+	//scalars only use X
+	FVector value;
+	uint32 step;
+	int32 probeId;
+	EFluidProbeValue type;
+};
+
+/**
+ * Collects the values recorded for probed particles and writes them out on its own thread.
+ * Every worker thread records into its own ring, so recording never takes a lock or waits for the log.
+ * When a ring is full, new samples are dropped.
+ */
+class FLUIDSIMULATION_FYP_API FFluidProbeRecorder : public FRunnable
+{
+	//Only the worker thread that owns the ring moves the head, only the drain thread moves the tail
+	struct FRing
+	{
+		TArray<FFluidProbeSample> samples;
+		TAtomic<uint32> head{ 0 };
+		TAtomic<uint32> tail{ 0 };
+		TAtomic<uint32> numOfDroppedSamples{ 0 };
+	};
+
+	TArray<TUniquePtr<FRing>> m_rings;
+	FCriticalSection m_ringsLock;
+	//power of two, so the ring indices can wrap around
+	uint32 m_ringCapacity{ 4096 };
+	//threads keep a pointer to their ring, which is only valid for the recorder that made it
+	uint32 m_recorderId;
+	TAtomic<uint32> m_step{ 0 };
+
+	TUniquePtr<IFileHandle> m_file;
+	FString m_filename;
+	FEvent* m_drainEvent{ nullptr };
+	FRunnableThread* m_thread{ nullptr };
+	FThreadSafeBool m_isStopping{ false };
+
+	//only touched by the drain thread
+	FString m_lines;
+	uint64 m_numOfDrainedSamples{ 0 };
+
+	FRing* getThreadRing();
+	void drain();
+
+public:
+	FFluidProbeRecorder();
+	~FFluidProbeRecorder();
+
+	//Starts the drain thread. Samples go to a CSV file, or to the log when the filename is empty.
+	bool Open(const FString& filename, int32 ringCapacity);
+	//Writes out what's left in the rings and stops the drain thread
+	void Close();
+	bool IsOpen() const { return m_thread != nullptr; }
+
+	//Step that the following samples belong to. Game thread only.
+	void BeginStep(uint32 step) { m_step = step; }
+	//Safe to call from any thread
+	void Record(int32 probeId, EFluidProbeValue type, const FVector& value);
+	void Record(int32 probeId, EFluidProbeValue type, double value) { Record(probeId, type, FVector(value, 0.0f, 0.0f)); }
+
+	static const TCHAR* GetValueName(EFluidProbeValue type);
+	static bool IsVectorValue(EFluidProbeValue type);
+
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+};
+
+#if WITH_FLUID_PROBES
+//Records a value of the particle if it's probed. Costs a load and a branch per particle, and the value is only evaluated for probed particles.
+#define FLUID_PROBE(Recorder, Particle, Type, Value) \
+	do { if ((Particle)->GetParticleProbeId() != INDEX_NONE && (Recorder) != nullptr) (Recorder)->Record((Particle)->GetParticleProbeId(), EFluidProbeValue::Type, Value); } while (0)
+#else
+#define FLUID_PROBE(Recorder, Particle, Type, Value) do { } while (0)
+#endif
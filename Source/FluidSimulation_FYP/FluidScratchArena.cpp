@@ -0,0 +1,29 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FluidScratchArena.h"
+
+FFluidScratchArena::~FFluidScratchArena()
+{
+	for (FBlock& block : m_blocks)
+	{
+		FMemory::Free(block.data);
+	}
+}
+
+void* FFluidScratchArena::getBlock(SIZE_T size)
+{
+	if (m_numOfBlocksInUse == m_blocks.Num())
+		m_blocks.Add({ nullptr, 0 });
+
+	FBlock& block = m_blocks[m_numOfBlocksInUse++];
+	if (block.size < size)
+	{
+		//half as much again, so a buffer that grows a little every step doesn't need a new block every step
+		FMemory::Free(block.data);
+		block.size = FMath::Max(size, block.size + block.size / 2);
+		block.data = FMemory::Malloc(block.size, PLATFORM_CACHE_LINE_SIZE);
+		m_numOfBlockAllocations++;
+	}
+	return block.data;
+}
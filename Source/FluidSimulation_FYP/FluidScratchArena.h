@@ -0,0 +1,61 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Memory for the temporaries of a step. Buffers are handed out in the order they are asked for, and Reset takes all of them
+ * back at the start of the next step. Steps ask for their buffers in the same order, so the n-th buffer gets the block it had
+ * the step before, and a block only grows when a step needs more than every step before it.
+ * Blocks are cache line aligned, so two cores never share a line where a buffer starts.
+ * Buffers are asked for by one thread at a time, between the parallel loops that fill them.
+ */
+class FLUIDSIMULATION_FYP_API FFluidScratchArena
+{
+	struct FBlock
+	{
+		void* data;
+		SIZE_T size;
+	};
+
+	TArray<FBlock, TInlineAllocator<16>> m_blocks;
+	int32 m_numOfBlocksInUse{ 0 };
+	int32 m_numOfBlockAllocations{ 0 };
+
+	void* getBlock(SIZE_T size);
+
+public:
+	FFluidScratchArena() = default;
+	~FFluidScratchArena();
+	FFluidScratchArena(const FFluidScratchArena&) = delete;
+	FFluidScratchArena& operator=(const FFluidScratchArena&) = delete;
+
+	//Takes every buffer back. The views handed out before are invalid from here on.
+	void Reset() { m_numOfBlocksInUse = 0; }
+
+	//Buffer of num uninitialised elements until the next Reset, with room for capacity of them so that a later step
+	//with more particles can have the same block
+	template <typename T>
+	TArrayView<T> Allocate(int32 num, int32 capacity = 0);
+	template <typename T>
+	TArrayView<T> AllocateZeroed(int32 num, int32 capacity = 0);
+
+	//Times a block had to grow, which stops once the steps have warmed up
+	int32 GetNumOfBlockAllocations() const { return m_numOfBlockAllocations; }
+};
+
+template <typename T>
+TArrayView<T> FFluidScratchArena::Allocate(int32 num, int32 capacity)
+{
+	static_assert(TIsTriviallyDestructible<T>::Value, "Nothing destructs the elements of scratch buffers");
+	return TArrayView<T>(static_cast<T*>(getBlock(FMath::Max(num, capacity) * sizeof(T))), num);
+}
+
+template <typename T>
+TArrayView<T> FFluidScratchArena::AllocateZeroed(int32 num, int32 capacity)
+{
+	TArrayView<T> buffer = Allocate<T>(num, capacity);
+	FMemory::Memzero(buffer.GetData(), num * sizeof(T));
+	return buffer;
+}
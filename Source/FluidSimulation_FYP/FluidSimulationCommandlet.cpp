@@ -0,0 +1,134 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FluidSimulationCommandlet.h"
+#include "FluidSimulation_FYPGameModeBase.h"
+#include "Engine/Engine.h"
+#include "Engine/GameInstance.h"
+#include "Engine/World.h"
+#include "EngineUtils.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+UFluidSimulationCommandlet::UFluidSimulationCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = false;
+	LogToConsole = true;
+}
+
+int32 UFluidSimulationCommandlet::Main(const FString& Params)
+{
+	FString mapName = TEXT("/Game/Levels/TestLevel");
+	int32 numOfSteps = 1000;
+	float timeStep = 1.0f / 60.0f;
+	FString statsFile;
+	FString cacheFile;
+	FParse::Value(*Params, TEXT("Map="), mapName);
+	FParse::Value(*Params, TEXT("Steps="), numOfSteps);
+	FParse::Value(*Params, TEXT("DeltaTime="), timeStep);
+	FParse::Value(*Params, TEXT("Stats="), statsFile);
+	FParse::Value(*Params, TEXT("Cache="), cacheFile);
+
+	UWorld* world = loadWorld(mapName);
+	if (world == nullptr)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Couldn't load %s"), *mapName);
+		return 1;
+	}
+	AFluidSimulation_FYPGameModeBase* gameMode = world->GetAuthGameMode<AFluidSimulation_FYPGameModeBase>();
+	if (gameMode == nullptr)
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s doesn't use the fluid simulation game mode"), *mapName);
+		unloadWorld(world);
+		return 1;
+	}
+	if (!cacheFile.IsEmpty())
+		gameMode->StartRecordingParticleCache(cacheFile);
+
+	const int32 numOfInitialParticles = gameMode->GetNumberOfLiveParticles();
+	TArray<double> stepTimes;
+	stepTimes.Reserve(numOfSteps);
+	const double startTime = FPlatformTime::Seconds();
+	for (int32 step = 0; step < numOfSteps; step++)
+	{
+		const double stepStartTime = FPlatformTime::Seconds();
+		world->Tick(LEVELTICK_All, timeStep);
+		stepTimes.Add(FPlatformTime::Seconds() - stepStartTime);
+
+		if ((step + 1) % 100 == 0)
+			UE_LOG(LogTemp, Display, TEXT("Step %i/%i, %i particles, %f ms per step"), step + 1, numOfSteps, gameMode->GetNumberOfLiveParticles(), stepTimes.Last() * 1000.0);
+	}
+	const double totalTime = FPlatformTime::Seconds() - startTime;
+	gameMode->StopRecordingParticleCache();
+
+	double minStepTime = TNumericLimits<double>::Max();
+	double maxStepTime = 0.0;
+	for (double t : stepTimes)
+	{
+		minStepTime = FMath::Min(minStepTime, t);
+		maxStepTime = FMath::Max(maxStepTime, t);
+	}
+	const double stepsPerSecond = totalTime > 0.0 ? numOfSteps / totalTime : 0.0;
+	UE_LOG(LogTemp, Display, TEXT("%i steps of %f s in %f s: %f steps/s, %f ms per step (min %f, max %f), %i -> %i particles"),
+		numOfSteps, timeStep, totalTime, stepsPerSecond, totalTime * 1000.0 / FMath::Max(numOfSteps, 1), minStepTime * 1000.0, maxStepTime * 1000.0,
+		numOfInitialParticles, gameMode->GetNumberOfLiveParticles());
+
+	if (!statsFile.IsEmpty())
+	{
+		const FString stats = FString::Printf(TEXT("{\n\t\"map\": \"%s\",\n\t\"steps\": %i,\n\t\"deltaTime\": %f,\n\t\"totalSeconds\": %f,\n\t\"stepsPerSecond\": %f,\n")
+			TEXT("\t\"meanStepMs\": %f,\n\t\"minStepMs\": %f,\n\t\"maxStepMs\": %f,\n\t\"initialParticles\": %i,\n\t\"finalParticles\": %i\n}\n"),
+			*mapName, numOfSteps, timeStep, totalTime, stepsPerSecond, totalTime * 1000.0 / FMath::Max(numOfSteps, 1), minStepTime * 1000.0, maxStepTime * 1000.0,
+			numOfInitialParticles, gameMode->GetNumberOfLiveParticles());
+		const FString path = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Stats"), statsFile);
+		if (!FFileHelper::SaveStringToFile(stats, *path))
+			UE_LOG(LogTemp, Warning, TEXT("Couldn't write %s"), *path);
+	}
+
+	unloadWorld(world);
+	return 0;
+}
+
+UWorld* UFluidSimulationCommandlet::loadWorld(const FString& mapName)
+{
+	UPackage* package = LoadPackage(nullptr, *mapName, LOAD_None);
+	UWorld* world = package ? UWorld::FindWorldInPackage(package) : nullptr;
+	if (world == nullptr)
+	{
+		return nullptr;
+	}
+
+	world->WorldType = EWorldType::Game;
+	world->AddToRoot();
+	UGameInstance* gameInstance = NewObject<UGameInstance>(GEngine);
+	FWorldContext& worldContext = GEngine->CreateNewWorldContext(EWorldType::Game);
+	worldContext.OwningGameInstance = gameInstance;
+	worldContext.SetCurrentWorld(world);
+	world->SetGameInstance(gameInstance);
+
+	if (!world->bIsWorldInitialized)
+	{
+		world->InitWorld(UWorld::InitializationValues().AllowAudioPlayback(false).RequiresHitProxies(false).CreatePhysicsScene(true).ShouldSimulatePhysics(false));
+	}
+	world->UpdateWorldComponents(true, false);
+
+	//the game mode comes from the world settings or the project's default game mode, like in a packaged game
+	FURL url;
+	world->SetGameMode(url);
+	world->InitializeActorsForPlay(url);
+	world->BeginPlay();
+	return world;
+}
+
+void UFluidSimulationCommandlet::unloadWorld(UWorld* world)
+{
+	//waits for the simulation's background writers before the world goes away
+	for (TActorIterator<AActor> it(world); it; ++it)
+	{
+		it->RouteEndPlay(EEndPlayReason::Quit);
+	}
+	GEngine->DestroyWorldContext(world);
+	world->DestroyWorld(false);
+	world->RemoveFromRoot();
+}
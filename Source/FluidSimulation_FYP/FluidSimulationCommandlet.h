@@ -0,0 +1,29 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "FluidSimulationCommandlet.generated.h"
+
+/**
+ * Runs a level's fluid simulation for a number of fixed steps with no rendering, then writes the timings and exits.
+ * UE4Editor-Cmd FluidSimulation_FYP.uproject -run=FluidSimulation -Map=/Game/Levels/TestLevel -Steps=1000 -DeltaTime=0.0166
+ *     [-Stats=FluidStats.json] [-Cache=Run.fpc]
+ * Stats go to Saved/Stats and caches to Saved/ParticleCaches. Commandlets don't create a renderer, so this works on headless machines.
+ */
+UCLASS()
+class FLUIDSIMULATION_FYP_API UFluidSimulationCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UFluidSimulationCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+
+protected:
+	//Loads the level and begins play on it like a standalone game would
+	class UWorld* loadWorld(const FString& mapName);
+	void unloadWorld(class UWorld* world);
+};
@@ -0,0 +1,59 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FluidSimulationStats.h"
+
+DEFINE_STAT(STAT_FluidStep);
+DEFINE_STAT(STAT_FluidSolverStep);
+DEFINE_STAT(STAT_FluidGridBuild);
+DEFINE_STAT(STAT_FluidNeighbourLists);
+DEFINE_STAT(STAT_FluidDensity);
+DEFINE_STAT(STAT_FluidPressure);
+DEFINE_STAT(STAT_FluidPCISPHIteration);
+DEFINE_STAT(STAT_FluidViscosity);
+DEFINE_STAT(STAT_FluidExternalForces);
+DEFINE_STAT(STAT_FluidIntegration);
+DEFINE_STAT(STAT_FluidCollision);
+DEFINE_STAT(STAT_FluidParticleRemoval);
+DEFINE_STAT(STAT_FluidAdaptiveResolution);
+DEFINE_STAT(STAT_FluidEmission);
+DEFINE_STAT(STAT_FluidCacheRecord);
+DEFINE_STAT(STAT_FluidCachePlayback);
+DEFINE_STAT(STAT_FluidSurface);
+DEFINE_STAT(STAT_FluidTransfer);
+DEFINE_STAT(STAT_FluidNeighbourSearchWait);
+
+DEFINE_STAT(STAT_FluidParticles);
+DEFINE_STAT(STAT_FluidNeighbourPairs);
+DEFINE_STAT(STAT_FluidPCISPHIterations);
+DEFINE_STAT(STAT_FluidPressureIterations);
+DEFINE_STAT(STAT_FluidCollisions);
+DEFINE_STAT(STAT_FluidRemeshedBlocks);
+DEFINE_STAT(STAT_FluidNeighbourSearchOverlap);
+
+void FFluidStageTimings::AddSeconds(const FFluidStageTimings& other)
+{
+	for (int32 s = 0; s < static_cast<int32>(EFluidStage::NumOfStages); s++)
+	{
+		seconds[s] += other.seconds[s];
+	}
+	asyncSeconds += other.asyncSeconds;
+	asyncWaitSeconds += other.asyncWaitSeconds;
+}
+
+const TCHAR* FFluidStageTimings::GetStageName(EFluidStage stage)
+{
+	switch (stage)
+	{
+	case EFluidStage::GridBuild: return TEXT("GridBuild");
+	case EFluidStage::NeighbourLists: return TEXT("NeighbourLists");
+	case EFluidStage::Density: return TEXT("Density");
+	case EFluidStage::Pressure: return TEXT("Pressure");
+	case EFluidStage::Viscosity: return TEXT("Viscosity");
+	case EFluidStage::ExternalForces: return TEXT("ExternalForces");
+	case EFluidStage::Integration: return TEXT("Integration");
+	case EFluidStage::Collision: return TEXT("Collision");
+	case EFluidStage::Transfer: return TEXT("Transfer");
+	default: return TEXT("Unknown");
+	}
+}
@@ -0,0 +1,97 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Stats/Stats.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+
+//stat FluidSimulation
+DECLARE_STATS_GROUP(TEXT("FluidSimulation"), STATGROUP_FluidSimulation, STATCAT_Advanced);
+
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Step"), STAT_FluidStep, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Solver step"), STAT_FluidSolverStep, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Grid build"), STAT_FluidGridBuild, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Neighbour lists"), STAT_FluidNeighbourLists, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Density"), STAT_FluidDensity, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Pressure"), STAT_FluidPressure, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("PCISPH iteration"), STAT_FluidPCISPHIteration, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Viscosity"), STAT_FluidViscosity, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("External forces"), STAT_FluidExternalForces, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Integration"), STAT_FluidIntegration, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Collision"), STAT_FluidCollision, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Particle removal"), STAT_FluidParticleRemoval, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Adaptive resolution"), STAT_FluidAdaptiveResolution, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Emission"), STAT_FluidEmission, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Cache record"), STAT_FluidCacheRecord, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Cache playback"), STAT_FluidCachePlayback, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Surface"), STAT_FluidSurface, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Grid transfer"), STAT_FluidTransfer, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Neighbour search wait"), STAT_FluidNeighbourSearchWait, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Particles"), STAT_FluidParticles, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Neighbour pairs"), STAT_FluidNeighbourPairs, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("PCISPH iterations"), STAT_FluidPCISPHIterations, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Pressure solver iterations"), STAT_FluidPressureIterations, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Collisions resolved"), STAT_FluidCollisions, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Surface blocks remeshed"), STAT_FluidRemeshedBlocks, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+DECLARE_FLOAT_COUNTER_STAT_EXTERN(TEXT("Neighbour search overlap (%)"), STAT_FluidNeighbourSearchOverlap, STATGROUP_FluidSimulation, FLUIDSIMULATION_FYP_API);
+
+//Cycle counter and Insights trace scope for a part of the step. Both compile out in builds without stats and tracing.
+#define FLUID_SCOPE(Name) \
+	SCOPE_CYCLE_COUNTER(STAT_Fluid##Name); \
+	TRACE_CPUPROFILER_EVENT_SCOPE(Fluid##Name)
+
+//Same as FLUID_SCOPE, and also adds the time to the stage timings that the benchmarks read
+#define FLUID_STAGE_SCOPE(Timings, Stage) \
+	FLUID_SCOPE(Stage); \
+	FFluidStageScope fluidStageScope_##Stage(Timings, EFluidStage::Stage)
+
+//Stages of a simulation step, in the order they run
+enum class EFluidStage : uint8
+{
+	GridBuild,
+	NeighbourLists,
+	Density,
+	Pressure,
+	Viscosity,
+	ExternalForces,
+	Integration,
+	Collision,
+	//particle to grid transfers of the FLIP solver
+	Transfer,
+	NumOfStages
+};
+
+//Wall time spent in every stage since the last reset
+struct FLUIDSIMULATION_FYP_API FFluidStageTimings
+{
+	double seconds[static_cast<int32>(EFluidStage::NumOfStages)] = {};
+	int32 numOfSteps{ 0 };
+	//Neighbour searches run between frames, and the part of them the game thread had to wait for
+	double asyncSeconds{ 0.0 };
+	double asyncWaitSeconds{ 0.0 };
+
+	void Reset() { *this = FFluidStageTimings(); }
+	//Adds the times of the other timings, but not their steps
+	void AddSeconds(const FFluidStageTimings& other);
+	double GetSeconds(EFluidStage stage) const { return seconds[static_cast<int32>(stage)]; }
+	//Average per step, in milliseconds
+	double GetMillisecondsPerStep(EFluidStage stage) const { return numOfSteps > 0 ? GetSeconds(stage) * 1000.0 / numOfSteps : 0.0; }
+	//Share of the asynchronous neighbour search hidden behind other work, from 0 to 1
+	double GetAsyncOverlap() const { return asyncSeconds > 0.0 ? FMath::Clamp(1.0 - asyncWaitSeconds / asyncSeconds, 0.0, 1.0) : 0.0; }
+
+	static const TCHAR* GetStageName(EFluidStage stage);
+};
+
+//Adds the time until the end of the scope to a stage
+class FFluidStageScope
+{
+	FFluidStageTimings& m_timings;
+	EFluidStage m_stage;
+	double m_startTime;
+
+public:
+	FFluidStageScope(FFluidStageTimings& timings, EFluidStage stage) : m_timings(timings), m_stage(stage), m_startTime(FPlatformTime::Seconds()) {}
+	~FFluidStageScope() { m_timings.seconds[static_cast<int32>(m_stage)] += FPlatformTime::Seconds() - m_startTime; }
+};
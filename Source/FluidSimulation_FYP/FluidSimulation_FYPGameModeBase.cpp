@@ -6,9 +6,32 @@
 #include "NeighbourSearch.h"
 #include "ParticleSystemSolver.h"
 #include "PCISPH_Solver.h"
+#include "FLIP_Solver.h"
 #include "Kernels.h"
+#include "Collider.h"
+#include "PointParticleEmitter.h"
+#include "BCCLatticePointsGenerator.h"
+#include "CubicLatticePointsGenerator.h"
+#include "SimulationCheckpoint.h"
+#include "FluidSurface.h"
+#include "Kismet/GameplayStatics.h"
+#include "Engine/StaticMesh.h"
+#include "Misc/Paths.h"
 #include "Async/Async.h"
 
+namespace
+{
+	//turns the counts one slot ahead of every list into the starts of the lists
+	void scanNeighbourCounts(TArrayView<int32> starts)
+	{
+		starts[0] = 0;
+		for (int32 i = 1; i < starts.Num(); i++)
+		{
+			starts[i] += starts[i - 1];
+		}
+	}
+}
+
 AFluidSimulation_FYPGameModeBase::AFluidSimulation_FYPGameModeBase()
 {
 	PrimaryActorTick.bCanEverTick = true;
@@ -17,105 +40,587 @@ AFluidSimulation_FYPGameModeBase::AFluidSimulation_FYPGameModeBase()
 	UE_LOG(LogTemp, Warning, TEXT("Kernel radius: %f"), m_kernelRadius);
 
 	m_neighbourSearcher = CreateDefaultSubobject<UNeighbourSearch>("NeighbourSearcher");
-	if (m_usePCISPHsolver)
+	m_boundarySearcher = CreateDefaultSubobject<UNeighbourSearch>("BoundarySearcher");
+}
+
+void AFluidSimulation_FYPGameModeBase::createPhysicsSolver()
+{
+	if (m_physicsSolver)
+		m_physicsSolver->Destroy();
+
+	if (m_useFLIPsolver)
+		m_physicsSolver = GetWorld()->SpawnActor<AFLIP_Solver>();
+	else if (m_usePCISPHsolver)
+		m_physicsSolver = GetWorld()->SpawnActor<APCISPH_Solver>();
+	else
+		m_physicsSolver = GetWorld()->SpawnActor<AParticleSystemSolver>();
+}
+
+void AFluidSimulation_FYPGameModeBase::ApplyScenario(const FFluidScenario& scenario)
+{
+	WaitForNeighbourSearch();
+	m_isNeighbourSearchReady = false;
+	m_isNeighbourGridCurrent = false;
+	m_neighbourSearchTimings.Reset();
+
+	//the particles of the previous scenario are reused instead of respawned
+	for (AFluidParticle* particle : m_particles)
 	{
-		m_physicsSolver = CreateDefaultSubobject<APCISPH_Solver>("PhysicsSolver");
+		particle->SetActorHiddenInGame(true);
 	}
-	else
+	m_freeParticles.Append(m_particles);
+	m_particles.Reset();
+	m_neighbourLists.Reset();
+	m_boundaryNeighbourLists.Reset();
+	m_workPartition.Reset();
+
+	m_fluidVolumes = scenario.fluidVolumes;
+	m_numOfParticles = scenario.maxNumOfParticles;
+	m_usePCISPHsolver = scenario.usePCISPHsolver;
+	m_useFLIPsolver = scenario.useFLIPsolver;
+	m_useTaskGraph = scenario.useTaskGraph;
+	m_overlapNeighbourSearch = scenario.overlapNeighbourSearch;
+	m_balanceNeighbourWork = scenario.balanceNeighbourWork;
+	m_isFluidViscous = scenario.isViscous;
+	m_useColliderBVH = scenario.useColliderBVH;
+	m_useMultiRateStepping = scenario.useMultiRateStepping;
+	m_simulationTime = 0.0;
+
+	//the solver finds the colliders in the level, so the scenario's have to be there before it's created
+	for (ACollider* collider : m_scenarioColliders)
+	{
+		if (collider != nullptr)
+			collider->Destroy();
+	}
+	m_scenarioColliders.Reset();
+	for (const TPair<FString, FBox>& collider : scenario.colliders)
 	{
-		m_physicsSolver = CreateDefaultSubobject<AParticleSystemSolver>("PhysicsSolver");
+		UStaticMesh* staticMesh = LoadObject<UStaticMesh>(nullptr, *collider.Key);
+		if (staticMesh == nullptr)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Scenario %s: couldn't load the collider mesh %s"), *scenario.name, *collider.Key);
+			continue;
+		}
+		ACollider* spawnedCollider = GetWorld()->SpawnActor<ACollider>(collider.Value.GetCenter(), FRotator::ZeroRotator);
+		spawnedCollider->InitialiseMeshCollider(staticMesh, collider.Value.GetSize());
+		m_scenarioColliders.Add(spawnedCollider);
 	}
+
+	createPhysicsSolver();
+	initSimulation();
+	m_physicsSolver->initPhysicsSolver(&m_particles, this);
+	if (APointParticleEmitter* emitter = m_physicsSolver->GetEmitter())
+	{
+		emitter->SetEmission(scenario.emissionRate, scenario.maxNumOfEmittedParticles);
+		ReserveParticles(m_particles.Num() + scenario.maxNumOfEmittedParticles);
+	}
+	else if (scenario.emissionRate > 0)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Scenario %s pours from an emitter but the level doesn't have one"), *scenario.name);
+	}
+	m_stageTimings.Reset();
+	m_workerTimings.Reset();
+	m_numOfSteadySteps = 0;
+	m_numOfUnexpectedAllocations = 0;
+
+	UE_LOG(LogTemp, Warning, TEXT("Scenario %s: %i particles, %s solver%s, %i spawned colliders%s"), *scenario.name, m_particles.Num(), m_useFLIPsolver ? TEXT("FLIP") : (m_usePCISPHsolver ? TEXT("PCISPH") : TEXT("WCSPH")),
+		m_physicsSolver->IsUsingTaskGraph() ? TEXT(" on the task graph") : TEXT(""), m_scenarioColliders.Num(), m_useColliderBVH ? TEXT("") : TEXT(" without the BVH"));
 }
 
-//The default initialisation will have 1000 particles in an area of 100 by 100 from the origin.
+//Fills the fluid volumes with lattice points and adds a particle at each of them
 void AFluidSimulation_FYPGameModeBase::initSimulation()
 {
-	resize(GetNumberOfParticles());
+	const double startTime = FPlatformTime::Seconds();
+
+	TArray<FVector> points;
+	for (const FBox& volume : m_fluidVolumes)
+	{
+		if (m_fluidVolumeLattice == EFluidLatticeType::BCC)
+			BCCLatticePointsGenerator().generate(volume.Min, volume.Max, m_targetSpacing, &points);
+		else
+			CubicLatticePointsGenerator().generate(volume.Min, volume.Max, m_targetSpacing, &points);
+	}
+	if (points.Num() > m_numOfParticles)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("The fluid volumes hold %i particles, only the first %i are used"), points.Num(), m_numOfParticles);
+		points.SetNum(m_numOfParticles, false);
+	}
+	const double latticeTime = FPlatformTime::Seconds() - startTime;
+
+	SpawnParticles(points, FVector(0.0f), AFluidParticle::kMass);
+
+	UE_LOG(LogTemp, Warning, TEXT("Initialised %i particles in %f s (%f s generating the lattice)"), m_particles.Num(), FPlatformTime::Seconds() - startTime, latticeTime);
+}
+
+void AFluidSimulation_FYPGameModeBase::resize(size_t newNumberOfParticles)
+{
+	ReserveParticles(newNumberOfParticles);
+}
+
+void AFluidSimulation_FYPGameModeBase::ReserveParticles(int32 capacity)
+{
+	m_particles.Reserve(capacity);
+	m_freeParticles.Reserve(capacity);
+
+	const int32 numToSpawn = capacity - m_particles.Num() - m_freeParticles.Num();
+	for (int32 i = 0; i < numToSpawn; i++)
+	{
+		AFluidParticle* newParticle = GetWorld()->SpawnActor<AFluidParticle>(ParticleBP, FVector(0.0f), FRotator().ZeroRotator);
+		newParticle->SetActorHiddenInGame(true);
+		m_freeParticles.Push(newParticle);
+	}
+}
+
+AFluidParticle* AFluidSimulation_FYPGameModeBase::SpawnParticle(const FVector& position, const FVector& velocity, double mass)
+{
+	//moving actors in and out of the pool is the engine's work, not the step's
+	FFluidAllocationScope actorScope(false);
+	AFluidParticle* newParticle;
+	if (m_freeParticles.Num() > 0)
+	{
+		newParticle = m_freeParticles.Pop(false);
+		newParticle->SetActorHiddenInGame(!m_areParticlesVisible);
+	}
+	else
+	{
+		if (IsShowingDebugText())
+			UE_LOG(LogTemp, Warning, TEXT("Particle pool is empty, spawning particle %i"), m_particles.Num());
+		newParticle = GetWorld()->SpawnActor<AFluidParticle>(ParticleBP, position, FRotator().ZeroRotator);
+		newParticle->SetActorHiddenInGame(!m_areParticlesVisible);
+	}
+	newParticle->ResetParticle(position, velocity, mass);
+	m_particles.Push(newParticle);
+	m_numOfSpawnedParticles++;
+	return newParticle;
+}
+
+int32 AFluidSimulation_FYPGameModeBase::SpawnParticles(TArrayView<const FVector> positions, const FVector& velocity, double mass)
+{
+	FFluidAllocationScope actorScope(false);
+	ReserveParticles(m_particles.Num() + positions.Num());
+
+	//the pool now holds enough particles, so they can be moved over in one block
+	const int32 firstParticle = m_particles.Num();
+	const int32 firstFreeParticle = m_freeParticles.Num() - positions.Num();
+	m_particles.Append(m_freeParticles.GetData() + firstFreeParticle, positions.Num());
+	m_freeParticles.SetNum(firstFreeParticle, false);
+
+	for (int32 i = 0; i < positions.Num(); i++)
+	{
+		AFluidParticle* newParticle = m_particles[firstParticle + i];
+		newParticle->SetActorHiddenInGame(!m_areParticlesVisible);
+		newParticle->ResetParticle(positions[i], velocity, mass);
+	}
+	m_numOfSpawnedParticles += positions.Num();
+	return firstParticle;
+}
+
+void AFluidSimulation_FYPGameModeBase::SaveCheckpoint(const FString& fileName)
+{
+	if (m_checkpointSave.IsValid() && !m_checkpointSave.IsReady())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("The previous checkpoint is still being written, skipping %s"), *fileName);
+		return;
+	}
+
+	//Only the copy happens on the game thread. The particles keep simulating while the file is written.
+	WaitForNeighbourSearch();
+	FSimulationCheckpoint checkpoint;
+	checkpoint.header.isPCISPH = m_usePCISPHsolver ? 1 : 0;
+	checkpoint.header.targetDensity = m_targetDensity;
+	checkpoint.header.targetSpacing = m_targetSpacing;
+	checkpoint.header.kernelRadius = m_kernelRadius;
+	m_physicsSolver->SaveCheckpointState(&checkpoint.header);
+
+	checkpoint.SetNumOfParticles(m_particles.Num());
+	ParallelFor(m_particles.Num(), [&](int32 i) {
+		const AFluidParticle* particle = m_particles[i];
+		checkpoint.positions[i] = particle->GetParticlePosition();
+		checkpoint.velocities[i] = particle->GetParticleVelocity();
+		checkpoint.forces[i] = particle->GetParticleForce();
+		checkpoint.densities[i] = particle->GetParticleDensity();
+		checkpoint.pressures[i] = particle->GetParticlePressure();
+		checkpoint.masses[i] = particle->GetParticleMass();
+		checkpoint.ages[i] = particle->GetParticleAge();
+		checkpoint.flags[i] = (particle->IsParticleDead() ? FSimulationCheckpoint::Dead : 0) | (particle->IsParticleEmitted() ? FSimulationCheckpoint::Emitted : 0);
+		});
+
+	const FString path = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Checkpoints"), fileName);
+	m_checkpointSave = Async(EAsyncExecution::ThreadPool, [checkpoint = MoveTemp(checkpoint), path]() {
+		const double startTime = FPlatformTime::Seconds();
+		const bool isSaved = checkpoint.SaveToFile(path);
+		if (isSaved)
+			UE_LOG(LogTemp, Warning, TEXT("Saved %i particles to %s in %f s"), checkpoint.positions.Num(), *path, FPlatformTime::Seconds() - startTime);
+		else
+			UE_LOG(LogTemp, Warning, TEXT("Couldn't write the checkpoint %s"), *path);
+		return isSaved;
+		});
+}
+
+void AFluidSimulation_FYPGameModeBase::LoadCheckpoint(const FString& fileName)
+{
+	restoreCheckpoint(fileName);
+}
+
+bool AFluidSimulation_FYPGameModeBase::restoreCheckpoint(const FString& fileName)
+{
+	//a search or a grid for the particles being replaced is of no use
+	WaitForNeighbourSearch();
+	m_isNeighbourSearchReady = false;
+	m_isNeighbourGridCurrent = false;
+	const double startTime = FPlatformTime::Seconds();
+	const FString path = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Checkpoints"), fileName);
+	FMappedSimulationCheckpoint checkpoint;
+	if (!checkpoint.Open(path))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s isn't a valid checkpoint"), *path);
+		return false;
+	}
+
+	const FSimulationCheckpointHeader& header = checkpoint.GetHeader();
+	if ((header.isPCISPH != 0) != m_usePCISPHsolver || header.targetDensity != m_targetDensity || header.targetSpacing != m_targetSpacing || header.kernelRadius != m_kernelRadius)
+		UE_LOG(LogTemp, Warning, TEXT("Checkpoint %s was saved with different solver settings, the simulation may jump"), *fileName);
+
+	//Every live particle goes back to the pool before the checkpoint particles are taken out of it
+	for (AFluidParticle* particle : m_particles)
+	{
+		particle->SetActorHiddenInGame(true);
+		m_freeParticles.Push(particle);
+	}
+	m_particles.Reset();
+	m_neighbourLists.Reset();
+	m_boundaryNeighbourLists.Reset();
+
+	const TArrayView<const double> masses = checkpoint.GetMasses();
+	SpawnParticles(checkpoint.GetPositions(), FVector(0.0f), AFluidParticle::kMass);
+	for (int32 i = 0; i < m_particles.Num(); i++)
+	{
+		//the scale of the actor follows the mass, so only resized particles need the game thread
+		if (masses[i] != AFluidParticle::kMass)
+			m_particles[i]->SetParticleMass(masses[i]);
+	}
 
-	//return;
+	const TArrayView<const FVector> velocities = checkpoint.GetVelocities();
+	const TArrayView<const FVector> forces = checkpoint.GetForces();
+	const TArrayView<const double> densities = checkpoint.GetDensities();
+	const TArrayView<const double> pressures = checkpoint.GetPressures();
+	const TArrayView<const double> ages = checkpoint.GetAges();
+	const TArrayView<const uint8> flags = checkpoint.GetFlags();
+	ParallelFor(m_particles.Num(), [&](int32 i) {
+		AFluidParticle* particle = m_particles[i];
+		particle->SetParticleVelocity(velocities[i]);
+		particle->SetParticleForce(forces[i]);
+		particle->SetParticleDensity(densities[i]);
+		particle->SetParticlePressure(pressures[i]);
+		particle->SetParticleAge(ages[i]);
+		particle->SetParticleDead((flags[i] & FSimulationCheckpoint::Dead) != 0);
+		particle->SetParticleEmitted((flags[i] & FSimulationCheckpoint::Emitted) != 0);
+		});
+	//Dead particles wait for the next compaction as they did when saved. Spawning showed them, and actors can only be hidden
+	//on the game thread.
+	for (int32 i = 0; i < m_particles.Num(); i++)
+	{
+		if ((flags[i] & FSimulationCheckpoint::Dead) != 0)
+			m_particles[i]->SetActorHiddenInGame(true);
+	}
+	m_physicsSolver->RestoreCheckpointState(header);
+
+	UE_LOG(LogTemp, Warning, TEXT("Restored %i particles from %s in %f s"), m_particles.Num(), *path, FPlatformTime::Seconds() - startTime);
+	return true;
+}
+
+int32 AFluidSimulation_FYPGameModeBase::CompactParticles(int32* numOfRemovedEmittedParticles)
+{
+	const double startTime = FPlatformTime::Seconds();
+	const int32 n = m_particles.Num();
 
-	static FVector newParticleLocation;
-	int particleLimitX = m_simulationDimensions.X / kParticleRadius;
-	int numColumn = 0;
-	int numLevel = 1;
-	int indexToResetPosition = 0;
+	//Stream compaction: count the live particles of each chunk, scan the counts, then every chunk writes its own range
+	const int32 numOfChunks = FMath::Clamp(n / 1024, 1, FPlatformMisc::NumberOfCoresIncludingHyperthreads());
+	const int32 chunkSize = FMath::DivideAndRoundUp(n, numOfChunks);
+	m_compactionChunkOffsets.SetNumZeroed(numOfChunks + 1, false);
+	FluidParallelFor(numOfChunks, 1, &m_workerTimings, [&](int32 c) {
+		const int32 end = FMath::Min(n, (c + 1) * chunkSize);
+		int32 numAlive = 0;
+		for (int32 i = c * chunkSize; i < end; i++)
+		{
+			numAlive += m_particles[i]->IsParticleDead() ? 0 : 1;
+		}
+		m_compactionChunkOffsets[c + 1] = numAlive;
+		});
+	for (int32 c = 0; c < numOfChunks; c++)
+	{
+		m_compactionChunkOffsets[c + 1] += m_compactionChunkOffsets[c];
+	}
 
-	for (size_t i = 0; i < 4000; i++)
+	const int32 numAlive = m_compactionChunkOffsets[numOfChunks];
+	*numOfRemovedEmittedParticles = 0;
+	if (numAlive == n)
 	{
-		if (kParticleRadius * (i - indexToResetPosition - (particleLimitX * numColumn)) > m_simulationDimensions.X)
+		return 0;
+	}
+
+	m_compactionRemap.SetNumUninitialized(n, false);
+	m_compactedParticles.SetNumUninitialized(numAlive, false);
+	FluidParallelFor(numOfChunks, 1, &m_workerTimings, [&](int32 c) {
+		const int32 end = FMath::Min(n, (c + 1) * chunkSize);
+		int32 writeIndex = m_compactionChunkOffsets[c];
+		for (int32 i = c * chunkSize; i < end; i++)
 		{
-			//move to new column
-			numColumn++;
+			if (m_particles[i]->IsParticleDead())
+			{
+				m_compactionRemap[i] = INDEX_NONE;
+				continue;
+			}
+			m_compactionRemap[i] = writeIndex;
+			m_compactedParticles[writeIndex++] = m_particles[i];
 		}
-		if (kParticleRadius * numColumn > m_simulationDimensions.Y)
+		});
+
+	//Actors can only be hidden on the game thread
+	{
+		FFluidAllocationScope actorScope(false);
+		for (int32 i = 0; i < n; i++)
 		{
-			//move to a new level
-			numLevel++;
-			numColumn = 0;
-			indexToResetPosition = i - 1;
+			AFluidParticle* particle = m_particles[i];
+			if (m_compactionRemap[i] != INDEX_NONE)
+				continue;
+			*numOfRemovedEmittedParticles += particle->IsParticleEmitted() ? 1 : 0;
+			particle->SetActorHiddenInGame(true);
+			m_freeParticles.Push(particle);
 		}
-		//10.0f on X and Y moves the particles more to the middle, 2.0f on Z is to make them float a bit
-		newParticleLocation = FVector(kParticleRadius * (i - indexToResetPosition - (particleLimitX * numColumn)) + 10.0f, kParticleRadius * numColumn + 10.0f, kParticleRadius * numLevel + 4.0f);
+	}
+	Swap(m_particles, m_compactedParticles);
 
-		AFluidParticle* newParticle = GetWorld()->SpawnActor<AFluidParticle>(ParticleBP, newParticleLocation, FRotator().ZeroRotator);
-		newParticle->SetParticlePosition(newParticleLocation);
-		m_particles.Push(newParticle);
+	//The lists stay valid until the next rebuild: drop the dead neighbours and renumber the rest
+	const bool hasNeighbourLists = m_neighbourLists.Num() == n;
+	const bool hasBoundaryNeighbourLists = m_boundaryNeighbourLists.Num() == n;
+	if (hasNeighbourLists || hasBoundaryNeighbourLists)
+	{
+		m_neighbourListArena = 1 - m_neighbourListArena;
+		if (hasNeighbourLists)
+			compactNeighbourLists(&m_neighbourLists, &m_neighbourListArenas[m_neighbourListArena], numAlive, true);
+		if (hasBoundaryNeighbourLists)
+			compactNeighbourLists(&m_boundaryNeighbourLists, &m_boundaryNeighbourListArenas[m_neighbourListArena], numAlive, false);
 	}
+
 	if (IsShowingDebugText())
-		UE_LOG(LogTemp, Warning, TEXT("particles in the array at the end: %i"), m_particles.Num());
+		UE_LOG(LogTemp, Warning, TEXT("Compacted %i dead particles in %f ms, %i particles alive, %i pooled"), n - numAlive, (FPlatformTime::Seconds() - startTime) * 1000.0, numAlive, m_freeParticles.Num());
+
+	return n - numAlive;
 }
 
-void AFluidSimulation_FYPGameModeBase::resize(size_t newNumberOfParticles)
+void AFluidSimulation_FYPGameModeBase::compactNeighbourLists(FFluidNeighbourLists* lists, FFluidScratchArena* arena, int32 numAlive, bool isRemappingNeighbours)
+{
+	//the old lists are in the other arena, so the lists of the live particles are copied over in parallel
+	const FFluidNeighbourLists oldLists = *lists;
+	arena->Reset();
+	FFluidNeighbourLists newLists;
+	newLists.starts = arena->Allocate<int32>(numAlive + 1, GetParticleCapacity() + 1);
+	auto isKept = [&](int32 j) { return !isRemappingNeighbours || m_compactionRemap[j] != INDEX_NONE; };
+
+	FluidParallelFor(oldLists.Num(), m_taskChunkSize, &m_workerTimings, [&](int32 i) {
+		const int32 newIndex = m_compactionRemap[i];
+		if (newIndex == INDEX_NONE)
+			return;
+		int32 numOfKept = 0;
+		for (int32 j : oldLists[i])
+		{
+			numOfKept += isKept(j) ? 1 : 0;
+		}
+		newLists.starts[newIndex + 1] = numOfKept;
+		});
+	scanNeighbourCounts(newLists.starts);
+
+	newLists.indices = arena->Allocate<int32>(newLists.GetNumOfPairs());
+	FluidParallelFor(oldLists.Num(), m_taskChunkSize, &m_workerTimings, [&](int32 i) {
+		const int32 newIndex = m_compactionRemap[i];
+		if (newIndex == INDEX_NONE)
+			return;
+		int32 writeIndex = newLists.starts[newIndex];
+		for (int32 j : oldLists[i])
+		{
+			if (isKept(j))
+				newLists.indices[writeIndex++] = isRemappingNeighbours ? m_compactionRemap[j] : j;
+		}
+		});
+	*lists = newLists;
+}
+
+double AFluidSimulation_FYPGameModeBase::GetMaxKernelRadius() const
+{
+	if (!m_useAdaptiveResolution)
+	{
+		return m_kernelRadius;
+	}
+	return m_kernelRadius * FMath::Pow(FMath::Max(m_maxParticleMassRatio, 1.0), 1.0 / 3.0);
+}
+
+double AFluidSimulation_FYPGameModeBase::GetKernelRadius(const AFluidParticle* a, const AFluidParticle* b) const
 {
-	m_particles.Reserve(newNumberOfParticles);
+	return 0.5 * m_kernelRadius * (a->GetParticleScale() + b->GetParticleScale());
 }
 
 void AFluidSimulation_FYPGameModeBase::BuildNeighbourSearcher()
 {
-	m_neighbourSearcher->initialiseNeighbourSearcher(kDefaultHashGridResolution, m_kernelRadius); //I used to have 2 * kParticleRadius
+	if (m_isNeighbourGridCurrent)
+	{
+		m_isNeighbourGridCurrent = false;
+		return;
+	}
+	FLUID_STAGE_SCOPE(m_neighbourSearchTimings, GridBuild);
+	m_neighbourSearcher->initialiseNeighbourSearcher(kDefaultHashGridResolution, GetMaxKernelRadius()); //I used to have 2 * kParticleRadius
 	m_neighbourSearcher->build(m_particles);
 }
 
 void AFluidSimulation_FYPGameModeBase::BuildNeighbourLists()
 {
-	m_neighbourLists.Reserve(GetNumberOfParticles());
-	m_neighbourLists.SetNumZeroed(GetNumberOfParticles());
-
-	auto particles = m_particles;
-	size_t n = particles.Num();
-	ParallelFor(n, [&](size_t i) {
-		FVector origin = particles[i]->GetParticlePosition();
-		m_neighbourLists[i].Empty();
+	FLUID_STAGE_SCOPE(m_neighbourSearchTimings, NeighbourLists);
+	PrepareNeighbourLists();
+	ParallelForNeighbourLoop(m_particles.Num(), [this](int32 i) {
+		CountNeighbours(i);
+		});
+	AllocateNeighbourLists();
+	ParallelForNeighbourLoop(m_particles.Num(), [this](int32 i) {
+		BuildNeighbourList(i);
+		});
+	UpdateNeighbourPairStat();
+}
 
-		m_neighbourSearcher->forEachNearbyPoint(origin, m_kernelRadius, [&](size_t j, const FVector&) {
-			if (i != j)
-			{
-				m_neighbourLists[i].Add(j);
-				if (IsShowingDebugText())
-				{
-					if (i == 723)
-						UE_LOG(LogTemp, Warning, TEXT("Particle %i has this particle as neighbour: %i"), i, j);
-				}
-			}
+void AFluidSimulation_FYPGameModeBase::PrepareNeighbourLists()
+{
+	//The lists still hold the previous step's neighbours, remapped by the compactions since. New particles cost the least.
+	const int32 n = m_particles.Num();
+	const bool hasBoundaryNeighbourLists = HasBoundaryParticles();
+	if (m_balanceNeighbourWork)
+	{
+		const FFluidNeighbourLists& previousLists = m_neighbourLists;
+		const FFluidNeighbourLists& previousBoundaryLists = m_boundaryNeighbourLists;
+		m_workPartition.Build(n, FMath::DivideAndRoundUp(n, m_taskChunkSize), &m_workerTimings, [&](int32 i) {
+			return 1 + (i < previousLists.Num() ? previousLists.NumOf(i) : 0) + (i < previousBoundaryLists.Num() ? previousBoundaryLists.NumOf(i) : 0);
 			});
-		if (IsShowingDebugText())
+	}
+
+	//particles can be emitted, split or merged, so the starts are sized by the live particles with room for the pooled ones
+	m_neighbourListArena = 1 - m_neighbourListArena;
+	FFluidScratchArena& arena = m_neighbourListArenas[m_neighbourListArena];
+	arena.Reset();
+	m_neighbourLists.starts = arena.Allocate<int32>(n + 1, GetParticleCapacity() + 1);
+	m_neighbourLists.indices = TArrayView<int32>();
+	if (hasBoundaryNeighbourLists)
+	{
+		FFluidScratchArena& boundaryArena = m_boundaryNeighbourListArenas[m_neighbourListArena];
+		boundaryArena.Reset();
+		m_boundaryNeighbourLists.starts = boundaryArena.Allocate<int32>(n + 1, GetParticleCapacity() + 1);
+		m_boundaryNeighbourLists.indices = TArrayView<int32>();
+	}
+	else
+	{
+		m_boundaryNeighbourLists.Reset();
+	}
+}
+
+void AFluidSimulation_FYPGameModeBase::ParallelForNeighbourLoop(int32 num, TFunctionRef<void(int32)> body)
+{
+	if (m_balanceNeighbourWork && m_workPartition.IsValidFor(num))
+		FluidParallelFor(m_workPartition, &m_workerTimings, body);
+	else
+		FluidParallelFor(num, m_taskChunkSize, &m_workerTimings, body);
+}
+
+template <typename Callback>
+void AFluidSimulation_FYPGameModeBase::forEachNewNeighbour(int32 i, Callback callback) const
+{
+	const AFluidParticle* particle = m_particles[i];
+	//dead particles wait for the next compaction without interacting with anything
+	if (particle->IsParticleDead())
+		return;
+
+	//the pair uses the mean smoothing length, so search as far as the largest neighbour could reach
+	const FVector origin = particle->GetParticlePosition();
+	const double queryRadius = 0.5 * (m_kernelRadius * particle->GetParticleScale() + GetMaxKernelRadius());
+	m_neighbourSearcher->forEachNearbyPoint(origin, queryRadius, [&](size_t j, const FVector& neighbourPos) {
+		if (static_cast<size_t>(i) != j && !m_particles[j]->IsParticleDead() && FVector::DistSquared(origin, neighbourPos) < FMath::Square(GetKernelRadius(particle, m_particles[j])))
 		{
-			if (i == 723)
-				UE_LOG(LogTemp, Warning, TEXT("Particle %i has %i particle neighbours"), i, m_neighbourLists[i].Num());
+			callback(static_cast<int32>(j));
 		}
 		});
 }
 
+template <typename Callback>
+void AFluidSimulation_FYPGameModeBase::forEachNewBoundaryNeighbour(int32 i, Callback callback) const
+{
+	const AFluidParticle* particle = m_particles[i];
+	if (particle->IsParticleDead())
+		return;
+
+	//the boundary grid is static, so this is only a query
+	m_boundarySearcher->forEachNearbyPoint(particle->GetParticlePosition(), m_kernelRadius * particle->GetParticleScale(), [&](size_t b, const FVector&) {
+		callback(static_cast<int32>(b));
+		});
+}
+
+void AFluidSimulation_FYPGameModeBase::CountNeighbours(int32 i)
+{
+	//counted one slot ahead, for the scan in AllocateNeighbourLists
+	int32 numOfNeighbours = 0;
+	forEachNewNeighbour(i, [&](int32) { numOfNeighbours++; });
+	m_neighbourLists.starts[i + 1] = numOfNeighbours;
+	FLUID_PROBE(m_probeRecorder, m_particles[i], NeighbourCount, static_cast<double>(numOfNeighbours));
+
+	if (HasBoundaryParticles())
+	{
+		int32 numOfBoundaryNeighbours = 0;
+		forEachNewBoundaryNeighbour(i, [&](int32) { numOfBoundaryNeighbours++; });
+		m_boundaryNeighbourLists.starts[i + 1] = numOfBoundaryNeighbours;
+	}
+}
+
+void AFluidSimulation_FYPGameModeBase::AllocateNeighbourLists()
+{
+	scanNeighbourCounts(m_neighbourLists.starts);
+	m_neighbourLists.indices = m_neighbourListArenas[m_neighbourListArena].Allocate<int32>(m_neighbourLists.GetNumOfPairs());
+	if (HasBoundaryParticles())
+	{
+		scanNeighbourCounts(m_boundaryNeighbourLists.starts);
+		m_boundaryNeighbourLists.indices = m_boundaryNeighbourListArenas[m_neighbourListArena].Allocate<int32>(m_boundaryNeighbourLists.GetNumOfPairs());
+	}
+}
+
+void AFluidSimulation_FYPGameModeBase::BuildNeighbourList(int32 i)
+{
+	//the grid is unchanged since the count, so the neighbours exactly fill the list
+	int32 writeIndex = m_neighbourLists.starts[i];
+	forEachNewNeighbour(i, [&](int32 j) { m_neighbourLists.indices[writeIndex++] = j; });
+	check(writeIndex == m_neighbourLists.starts[i + 1]);
+
+	if (HasBoundaryParticles())
+	{
+		int32 boundaryWriteIndex = m_boundaryNeighbourLists.starts[i];
+		forEachNewBoundaryNeighbour(i, [&](int32 b) { m_boundaryNeighbourLists.indices[boundaryWriteIndex++] = b; });
+		check(boundaryWriteIndex == m_boundaryNeighbourLists.starts[i + 1]);
+	}
+}
+
+void AFluidSimulation_FYPGameModeBase::UpdateNeighbourPairStat()
+{
+#if STATS
+	//only worth the extra pass while someone is looking at the stats
+	if (FThreadStats::IsCollectingData())
+	{
+		SET_DWORD_STAT(STAT_FluidNeighbourPairs, m_neighbourLists.GetNumOfPairs());
+	}
+#endif
+}
+
 FVector AFluidSimulation_FYPGameModeBase::Interpolate(const FVector& origin, const TArray<FVector>& values) const
 {
-	FVector sum;
-	FSphStdKernel kernel(m_kernelRadius);
-	const double mass = m_particles[0]->kMass;
+	FVector sum(0.0f);
 
-	m_neighbourSearcher->forEachNearbyPoint(origin, m_kernelRadius, [&](size_t i, const FVector& neighbourPos) {
+	m_neighbourSearcher->forEachNearbyPoint(origin, GetMaxKernelRadius(), [&](size_t i, const FVector& neighbourPos) {
 		double dist = FVector::Distance(origin, neighbourPos);
+		FSphStdKernel kernel(m_kernelRadius * m_particles[i]->GetParticleScale());
 		//more weight the closer to the origin.
-		double weight = mass / m_particles[i]->GetParticleDensity() * kernel(dist);
+		double weight = m_particles[i]->GetParticleMass() / m_particles[i]->GetParticleDensity() * kernel(dist);
 		sum += weight * values[i];
 		});
 
@@ -125,39 +630,106 @@ FVector AFluidSimulation_FYPGameModeBase::Interpolate(const FVector& origin, con
 double AFluidSimulation_FYPGameModeBase::Interpolate(const FVector& origin, const TArray<double>& values) const
 {
 	double sum = 0.0;
-	FSphStdKernel kernel(m_kernelRadius);
-	const double mass = m_particles[0]->kMass;
 
-	m_neighbourSearcher->forEachNearbyPoint(origin, m_kernelRadius, [&](size_t i, const FVector& neighbourPos) {
+	m_neighbourSearcher->forEachNearbyPoint(origin, GetMaxKernelRadius(), [&](size_t i, const FVector& neighbourPos) {
 		double dist = FVector::Distance(origin, neighbourPos);
+		FSphStdKernel kernel(m_kernelRadius * m_particles[i]->GetParticleScale());
 		//more weight the closer to the origin.
-		double weight = mass * kernel(dist);
-		sum += weight;
+		double weight = m_particles[i]->GetParticleMass() / m_particles[i]->GetParticleDensity() * kernel(dist);
+		sum += weight * values[i];
 		});
 
 	return sum;
 }
 
+const FFluidFieldSampler& AFluidSimulation_FYPGameModeBase::GetFieldSampler()
+{
+	WaitForNeighbourSearch();
+	//rebuilt at most once per step. Playback moves the particles without stepping.
+	if (m_fieldSamplerStep != m_numOfSteps || IsPlayingBack() || m_fieldSampler.GetNumOfParticles() == 0)
+	{
+		m_fieldSampler.Build(m_particles, m_kernelRadius);
+		m_fieldSamplerStep = m_numOfSteps;
+	}
+	return m_fieldSampler;
+}
+
 //helper function to remove the infinite recursion from the function above.
 //this function needs to be called first to initialise the densities
 void AFluidSimulation_FYPGameModeBase::UpdateDensities()
 {
-	//Async(EAsyncExecution::Thread, [&]() {
-	size_t n = m_particles.Num();
-	FCriticalSection Mutex;
-	ParallelFor(n, [&](size_t i) {
-	//for (size_t i = 0; i < n; i++)		
-		double sum = sumOfKernelNearby(m_particles[i]->GetParticlePosition());
-		Mutex.Lock();
-		m_particles[i]->SetParticleDensity(m_particles[i]->kMass * sum);
-		Mutex.Unlock();
-		if (IsShowingDebugText())
-		{
-			if (i == 723)
-				UE_LOG(LogTemp, Warning, TEXT("Particle 723 DENSITY: %f. The sumOfKernelNearby is: %f"), m_particles[i]->GetParticleDensity(), sum);
-		}
-		
-	});
+	FLUID_STAGE_SCOPE(m_neighbourSearchTimings, Density);
+	ParallelForNeighbourLoop(m_particles.Num(), [this](int32 i) {
+		UpdateDensity(i);
+		});
+}
+
+void AFluidSimulation_FYPGameModeBase::UpdateDensity(int32 i)
+{
+	//only particle i is written, so chunks of particles can run at the same time
+	const double density = DensityAt(i);
+	m_particles[i]->SetParticleDensity(density);
+	FLUID_PROBE(m_probeRecorder, m_particles[i], Density, density);
+}
+
+//density of particle i from its current neighbour list. Each pair uses its mean smoothing length.
+double AFluidSimulation_FYPGameModeBase::DensityAt(size_t i) const
+{
+	const AFluidParticle* particle = m_particles[i];
+	const FVector& origin = particle->GetParticlePosition();
+	double sum = particle->GetParticleMass() * FSphStdKernel(m_kernelRadius * particle->GetParticleScale())(0.0);
+
+	for (size_t j : m_neighbourLists[i])
+	{
+		const AFluidParticle* neighbour = m_particles[j];
+		FSphStdKernel kernel(GetKernelRadius(particle, neighbour));
+		sum += neighbour->GetParticleMass() * kernel(FVector::Distance(origin, neighbour->GetParticlePosition()));
+	}
+	return sum + BoundaryDensityAt(i, origin);
+}
+
+double AFluidSimulation_FYPGameModeBase::BoundaryDensityAt(size_t i, const FVector& position) const
+{
+	if (!HasBoundaryParticles())
+	{
+		return 0.0;
+	}
+
+	double sum = 0.0;
+	const FSphStdKernel kernel(m_kernelRadius * m_particles[i]->GetParticleScale());
+	for (size_t b : m_boundaryNeighbourLists[i])
+	{
+		sum += m_boundaryPsi[b] * kernel(FVector::Distance(position, m_boundaryPositions[b]));
+	}
+	return sum;
+}
+
+void AFluidSimulation_FYPGameModeBase::InitBoundaryParticles(const TArray<ACollider*>& colliders)
+{
+	m_boundaryPositions.Reset();
+	for (ACollider* c : colliders)
+	{
+		if (c != nullptr)
+			c->SampleBoundaryParticles(m_targetSpacing, &m_boundaryPositions);
+	}
+
+	m_boundarySearcher->initialiseNeighbourSearcher(kDefaultHashGridResolution, GetMaxKernelRadius());
+	m_boundarySearcher->build(m_boundaryPositions);
+
+	//The volume of a boundary particle is the inverse of the boundary number density around it, which
+	//corrects for uneven sampling and for boundaries sampled with more than one layer
+	const FSphStdKernel kernel(m_kernelRadius);
+	const size_t n = m_boundaryPositions.Num();
+	m_boundaryPsi.SetNumUninitialized(n);
+	ParallelFor(n, [&](size_t b) {
+		double sum = 0.0;
+		m_boundarySearcher->forEachNearbyPoint(m_boundaryPositions[b], m_kernelRadius, [&](size_t, const FVector& neighbourPos) {
+			sum += kernel(FVector::Distance(m_boundaryPositions[b], neighbourPos));
+			});
+		m_boundaryPsi[b] = m_targetDensity / sum;
+		});
+
+	UE_LOG(LogTemp, Warning, TEXT("Sampled %i boundary particles from %i colliders"), m_boundaryPositions.Num(), colliders.Num());
 }
 
 double AFluidSimulation_FYPGameModeBase::sumOfKernelNearby(const FVector& origin) const
@@ -174,10 +746,9 @@ double AFluidSimulation_FYPGameModeBase::sumOfKernelNearby(const FVector& origin
 //returns the symmetric gradient for the input values for a given particle with index i
 FVector AFluidSimulation_FYPGameModeBase::GradientAt(size_t i, const TArray<double>& values) const
 {
-	FVector sum;
-	const TArray<size_t>& neighbours = m_neighbourLists[i];
+	FVector sum(0.0f);
+	const TArrayView<const int32> neighbours = m_neighbourLists[i];
 	FVector origin = m_particles[i]->GetParticlePosition();
-	FSphSpikyKernel kernel(m_kernelRadius);
 
 	for (size_t j : neighbours)
 	{
@@ -185,8 +756,9 @@ FVector AFluidSimulation_FYPGameModeBase::GradientAt(size_t i, const TArray<doub
 		double dist = FVector::Distance(origin, neighbourPos);
 		if (dist > 0.0)
 		{
+			FSphSpikyKernel kernel(GetKernelRadius(m_particles[i], m_particles[j]));
 			FVector dir = (neighbourPos - origin) / dist;
-			sum += m_particles[i]->GetParticleDensity() * m_particles[i]->kMass * 
+			sum += m_particles[i]->GetParticleDensity() * m_particles[j]->GetParticleMass() * 
 				((values[i] / (m_particles[i]->GetParticleDensity() * m_particles[i]->GetParticleDensity())) +
 				values[j] / (m_particles[j]->GetParticleDensity() * m_particles[j]->GetParticleDensity())) * kernel.Gradient(dist, dir);
 		}
@@ -198,15 +770,15 @@ FVector AFluidSimulation_FYPGameModeBase::GradientAt(size_t i, const TArray<doub
 double AFluidSimulation_FYPGameModeBase::LaplacianAt(size_t i, const TArray<double>& values) const
 {
 	double sum = 0.0;
-	const TArray<size_t>& neighbours = m_neighbourLists[i];
+	const TArrayView<const int32> neighbours = m_neighbourLists[i];
 	FVector origin = m_particles[i]->GetParticlePosition();
-	FSphSpikyKernel kernel(m_kernelRadius);
 
 	for (size_t j : neighbours)
 	{
 		FVector neighbourPos = m_particles[j]->GetParticlePosition();
 		double dist = FVector::Distance(origin, neighbourPos);
-		sum += m_particles[j]->kMass * (values[j] - values[i]) / m_particles[j]->GetParticleDensity() * kernel.SecondDerivative(dist);		
+		FSphSpikyKernel kernel(GetKernelRadius(m_particles[i], m_particles[j]));
+		sum += m_particles[j]->GetParticleMass() * (values[j] - values[i]) / m_particles[j]->GetParticleDensity() * kernel.SecondDerivative(dist);		
 	}
 
 	return sum;
@@ -215,23 +787,376 @@ double AFluidSimulation_FYPGameModeBase::LaplacianAt(size_t i, const TArray<doub
 void AFluidSimulation_FYPGameModeBase::Tick(float DeltaTime)
 {
 	Super::Tick(DeltaTime);
+	FLUID_SCOPE(Step);
 
 	//STAGE 1 - MEASURE DENSITY WITH PARTICLES' CURRENT LOCATIONS
 
-	BuildNeighbourSearcher();
-	BuildNeighbourLists();
-	UpdateDensities();
+	const double stepStartTime = FPlatformTime::Seconds();
+
+	//playback doesn't need the solver at all
+	if (m_cacheReader)
+	{
+		advancePlayback(DeltaTime);
+		if (m_fluidSurface)
+		{
+			buildNeighbourGridForSurface();
+			m_fluidSurface->UpdateSurface(this);
+		}
+		return;
+	}
+
+	//Counts from the search the step uses to the particles it moves. Debug text and stats allocate, so steps that show them
+	//aren't checked.
+	const int32 numOfParticlesAtStart = m_particles.Num();
+	{
+		FFluidAllocationScope allocationScope(true);
+
+		//the search launched by the previous frame already began this step's probes
+		WaitForNeighbourSearch();
+		if (m_probeRecorder && !m_isNeighbourSearchReady)
+			m_probeRecorder->BeginStep(m_numOfSteps);
+		//the grid solver finds its particles through its own grid, and the task graph builds the lists as part of its step
+		if (!m_physicsSolver->NeedsNeighbourLists())
+		{
+			m_neighbourLists.Reset();
+		}
+		else if (!m_physicsSolver->IsUsingTaskGraph() && !m_isNeighbourSearchReady)
+		{
+			buildNeighbourSearcherOnThisThread();
+			BuildNeighbourLists();
+			UpdateDensities();
+		}
+		m_isNeighbourSearchReady = false;
+
+		m_physicsSolver->OnAdvanceTimeStep(DeltaTime);
+	}
+	checkStepAllocations(numOfParticlesAtStart);
+	m_workerTimings.AddStep(FPlatformTime::Seconds() - stepStartTime);
+	addNeighbourSearchTimings();
+	m_simulationTime += DeltaTime;
+	m_stageTimings.numOfSteps++;
+	m_numOfSteps++;
+	SET_DWORD_STAT(STAT_FluidParticles, m_particles.Num());
+
+	if (m_cacheWriter)
+		recordCacheFrame();
+
+	//the surface needs the grid of these positions, so it is built before the search that reads it starts
+	if (m_fluidSurface)
+		buildNeighbourGridForSurface();
 
-	m_physicsSolver->OnAdvanceTimeStep(DeltaTime);
+	//the particles are where the next step starts from, and nothing until then writes what the search reads
+	if (m_overlapNeighbourSearch && m_physicsSolver->NeedsNeighbourLists() && !m_physicsSolver->IsUsingTaskGraph())
+		launchNeighbourSearch();
+
+	//meshed from the positions the step just produced, so the surface matches what is simulated. The search only reads the grid too.
+	if (m_fluidSurface)
+		m_fluidSurface->UpdateSurface(this);
+
+	if (IsShowingDebugText())
+		UE_LOG(LogTemp, Warning, TEXT("Step time: %f ms for %i particles"), (FPlatformTime::Seconds() - stepStartTime) * 1000.0, m_particles.Num());
 	//UE_LOG(LogTemp, Warning, TEXT("DeltaTime: %f"), DeltaTime);
 
 	//PrintCalcData();
 }
 
+void AFluidSimulation_FYPGameModeBase::launchNeighbourSearch()
+{
+	if (m_probeRecorder)
+		m_probeRecorder->BeginStep(m_numOfSteps);
+	m_isNeighbourSearchReady = true;
+	m_neighbourSearchTask = FFunctionGraphTask::CreateAndDispatchWhenReady([this]() {
+		//part of the next step, so it counts towards that step's allocations
+		FFluidAllocationScope allocationScope(true);
+		const double startTime = FPlatformTime::Seconds();
+		buildNeighbourSearcherOnThisThread();
+		BuildNeighbourLists();
+		UpdateDensities();
+		m_neighbourSearchTimings.asyncSeconds += FPlatformTime::Seconds() - startTime;
+		}, TStatId(), nullptr, ENamedThreads::AnyThread);
+}
+
+void AFluidSimulation_FYPGameModeBase::WaitForNeighbourSearch()
+{
+	if (!m_neighbourSearchTask.IsValid())
+	{
+		return;
+	}
+
+	FLUID_SCOPE(NeighbourSearchWait);
+	FFluidAllocationScope waitScope(false);
+	const double startTime = FPlatformTime::Seconds();
+	FTaskGraphInterface::Get().WaitUntilTaskCompletes(m_neighbourSearchTask, ENamedThreads::GameThread);
+	m_neighbourSearchTask = nullptr;
+	const double waitSeconds = FPlatformTime::Seconds() - startTime;
+	m_neighbourSearchTimings.asyncWaitSeconds += waitSeconds;
+	SET_FLOAT_STAT(STAT_FluidNeighbourSearchOverlap, 100.0 * FMath::Clamp(1.0 - waitSeconds / FMath::Max(m_neighbourSearchTimings.asyncSeconds, SMALL_NUMBER), 0.0, 1.0));
+}
+
+void AFluidSimulation_FYPGameModeBase::EnableAllocationChecks()
+{
+	m_checkStepAllocations = true;
+	FFluidAllocationCounter::Install();
+	m_numOfCountedAllocations = FFluidAllocationCounter::GetNumOfAllocations();
+	m_numOfSteadySteps = 0;
+}
+
+void AFluidSimulation_FYPGameModeBase::checkStepAllocations(int32 numOfParticlesAtStart)
+{
+	if (!m_checkStepAllocations || !FFluidAllocationCounter::IsInstalled())
+	{
+		m_numOfStepAllocations = 0;
+		return;
+	}
+
+	//the search for the next step hasn't been launched yet, so nothing else is counting
+	const uint64 numOfAllocations = FFluidAllocationCounter::GetNumOfAllocations();
+	m_numOfStepAllocations = static_cast<int32>(numOfAllocations - m_numOfCountedAllocations);
+	m_numOfCountedAllocations = numOfAllocations;
+
+	//emitting, splitting, merging and removing particles grow the buffers, which starts the warm up again
+	bool isSteady = numOfParticlesAtStart == m_particles.Num() && !IsShowingDebugText();
+#if STATS
+	isSteady &= !FThreadStats::IsCollectingData();
+#endif
+	if (!isSteady)
+	{
+		m_numOfSteadySteps = 0;
+		return;
+	}
+
+	if (m_numOfSteadySteps >= m_allocationWarmUpSteps && m_numOfStepAllocations > 0)
+	{
+		m_numOfUnexpectedAllocations += m_numOfStepAllocations;
+		ensureMsgf(false, TEXT("Step %u made %i heap allocations after %i steps without a change in the particles"), m_numOfSteps, m_numOfStepAllocations, m_numOfSteadySteps);
+	}
+	m_numOfSteadySteps++;
+}
+
+void AFluidSimulation_FYPGameModeBase::addNeighbourSearchTimings()
+{
+	m_stageTimings.AddSeconds(m_neighbourSearchTimings);
+	m_neighbourSearchTimings.Reset();
+}
+
+void AFluidSimulation_FYPGameModeBase::buildNeighbourGridForSurface()
+{
+	m_isNeighbourGridCurrent = false;
+	buildNeighbourSearcherOnThisThread();
+	m_isNeighbourGridCurrent = true;
+}
+
+void AFluidSimulation_FYPGameModeBase::buildNeighbourSearcherOnThisThread()
+{
+	const uint64 startCycles = FPlatformTime::Cycles64();
+	BuildNeighbourSearcher();
+	m_workerTimings.AddBusyCycles(FPlatformTime::Cycles64() - startCycles);
+}
+
+void AFluidSimulation_FYPGameModeBase::StartRecordingParticleCache(const FString& fileName)
+{
+	StopRecordingParticleCache();
+	m_numOfParticlesInCacheFrame = INDEX_NONE;
+	m_cacheWriter = MakeUnique<FParticleCacheWriter>();
+	if (!m_cacheWriter->Open(FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("ParticleCaches"), fileName),
+		m_quantiseParticleCache, m_particleCacheKeyFrameInterval, m_particleCacheQueueLength))
+		m_cacheWriter.Reset();
+}
+
+void AFluidSimulation_FYPGameModeBase::StopRecordingParticleCache()
+{
+	if (m_cacheWriter)
+	{
+		m_cacheWriter->Close();
+		m_cacheWriter.Reset();
+	}
+}
+
+void AFluidSimulation_FYPGameModeBase::recordCacheFrame()
+{
+	FLUID_SCOPE(CacheRecord);
+	FParticleCacheFrame* frame = m_cacheWriter->BeginFrame();
+	if (frame == nullptr)
+	{
+		if (IsShowingDebugText())
+			UE_LOG(LogTemp, Warning, TEXT("Particle cache writer is behind, dropping the frame at %f s"), m_simulationTime);
+		return;
+	}
+
+	//Dead particles are still in the array until the next compaction, so they are left out here
+	const int32 n = m_particles.Num();
+	int32 numAlive = 0;
+	m_cacheFrameIndices.SetNumUninitialized(n, false);
+	for (int32 i = 0; i < n; i++)
+	{
+		m_cacheFrameIndices[i] = m_particles[i]->IsParticleDead() ? INDEX_NONE : numAlive++;
+	}
+
+	frame->header.time = m_simulationTime;
+	frame->header.isMembershipChanged = m_numOfSpawnedParticles != m_numOfSpawnedParticlesAtCacheFrame || numAlive != m_numOfParticlesInCacheFrame;
+	m_numOfSpawnedParticlesAtCacheFrame = m_numOfSpawnedParticles;
+	m_numOfParticlesInCacheFrame = numAlive;
+	frame->SetNumOfParticles(numAlive);
+	float* values = frame->values.GetData();
+	ParallelFor(n, [&](int32 i) {
+		const int32 k = m_cacheFrameIndices[i];
+		if (k == INDEX_NONE)
+			return;
+		const AFluidParticle* particle = m_particles[i];
+		const FVector& position = particle->GetParticlePosition();
+		const FVector& velocity = particle->GetParticleVelocity();
+		values[FParticleCacheFrameHeader::PositionX * numAlive + k] = position.X;
+		values[FParticleCacheFrameHeader::PositionY * numAlive + k] = position.Y;
+		values[FParticleCacheFrameHeader::PositionZ * numAlive + k] = position.Z;
+		values[FParticleCacheFrameHeader::VelocityX * numAlive + k] = velocity.X;
+		values[FParticleCacheFrameHeader::VelocityY * numAlive + k] = velocity.Y;
+		values[FParticleCacheFrameHeader::VelocityZ * numAlive + k] = velocity.Z;
+		values[FParticleCacheFrameHeader::Density * numAlive + k] = particle->GetParticleDensity();
+		});
+	m_cacheWriter->SubmitFrame(frame);
+}
+
+void AFluidSimulation_FYPGameModeBase::ProbeParticle(int32 index)
+{
+	WaitForNeighbourSearch();
+	if (!m_probeRecorder)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Probes are compiled out of this build"));
+		return;
+	}
+	if (!m_particles.IsValidIndex(index))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("There's no particle %i to probe"), index);
+		return;
+	}
+	if (!m_probeRecorder->IsOpen())
+	{
+		const FString probeFile = m_probeFile.IsEmpty() ? FString() : FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Probes"), m_probeFile);
+		m_probeRecorder->Open(probeFile, 4096);
+	}
+	m_particles[index]->SetParticleProbeId(index);
+}
+
+void AFluidSimulation_FYPGameModeBase::ClearProbes()
+{
+	WaitForNeighbourSearch();
+	for (AFluidParticle* particle : m_particles)
+	{
+		particle->SetParticleProbeId(INDEX_NONE);
+	}
+	if (m_probeRecorder)
+		m_probeRecorder->Close();
+}
+
+void AFluidSimulation_FYPGameModeBase::SeekParticleCache(float timeInSeconds)
+{
+	if (m_cacheReader)
+		m_playbackTime = FMath::Clamp<double>(timeInSeconds, 0.0, m_cacheReader->GetDuration());
+}
+
+void AFluidSimulation_FYPGameModeBase::advancePlayback(double timeIntervalInSeconds)
+{
+	FLUID_SCOPE(CachePlayback);
+	//the cache loops
+	m_playbackTime += timeIntervalInSeconds;
+	if (m_playbackTime > m_cacheReader->GetDuration())
+		m_playbackTime = m_cacheReader->GetFrameTime(0);
+
+	const int32 k = m_cacheReader->FindFrame(m_playbackTime);
+	const FParticleCacheReader::FFramePtr frame = m_cacheReader->GetFrame(k);
+	if (!frame.IsValid())
+	{
+		return;
+	}
+	const int32 nextFrameIndex = FMath::Min(k + 1, m_cacheReader->GetNumOfFrames() - 1);
+	FParticleCacheReader::FFramePtr nextFrame = (m_interpolatePlayback && nextFrameIndex != k) ? m_cacheReader->GetFrame(nextFrameIndex) : nullptr;
+	//Frames with different particles can't be blended: particle i of one frame isn't particle i of the next,
+	//even when emission and removal kept the count the same
+	if (nextFrame.IsValid() && (nextFrame->header.isMembershipChanged || nextFrame->header.numOfParticles != frame->header.numOfParticles))
+		nextFrame.Reset();
+	//ask the reader to keep decoding from the current frame, not the one after it
+	m_cacheReader->GetFrame(k);
+
+	//Match the live particles to the frame
+	const int32 n = frame->header.numOfParticles;
+	if (m_particles.Num() > n)
+	{
+		for (int32 i = n; i < m_particles.Num(); i++)
+		{
+			m_particles[i]->SetActorHiddenInGame(true);
+			m_freeParticles.Push(m_particles[i]);
+		}
+		m_particles.SetNum(n, false);
+	}
+	else if (m_particles.Num() < n)
+	{
+		//the positions are set below
+		TArray<FVector> newPositions;
+		newPositions.SetNumZeroed(n - m_particles.Num());
+		SpawnParticles(newPositions, FVector(0.0f), AFluidParticle::kMass);
+	}
+
+	//Cubic Hermite between the frames, using the cached velocities as tangents
+	const double frameInterval = nextFrame.IsValid() ? nextFrame->header.time - frame->header.time : 0.0;
+	const double alpha = frameInterval > 0.0 ? FMath::Clamp((m_playbackTime - frame->header.time) / frameInterval, 0.0, 1.0) : 0.0;
+	const double alpha2 = alpha * alpha;
+	const double alpha3 = alpha2 * alpha;
+	ParallelFor(n, [&](int32 i) {
+		AFluidParticle* particle = m_particles[i];
+		FVector position = frame->GetPosition(i);
+		FVector velocity = frame->GetVelocity(i);
+		double density = frame->GetValue(FParticleCacheFrameHeader::Density, i);
+		if (nextFrame.IsValid())
+		{
+			const FVector nextPosition = nextFrame->GetPosition(i);
+			const FVector nextVelocity = nextFrame->GetVelocity(i);
+			position = (2.0 * alpha3 - 3.0 * alpha2 + 1.0) * position + (alpha3 - 2.0 * alpha2 + alpha) * frameInterval * velocity +
+				(-2.0 * alpha3 + 3.0 * alpha2) * nextPosition + (alpha3 - alpha2) * frameInterval * nextVelocity;
+			velocity = FMath::Lerp(velocity, nextVelocity, static_cast<float>(alpha));
+			density = FMath::Lerp(density, static_cast<double>(nextFrame->GetValue(FParticleCacheFrameHeader::Density, i)), alpha);
+		}
+		particle->SetParticlePosition(position);
+		particle->SetParticleVelocity(velocity);
+		particle->SetParticleDensity(density);
+		});
+
+	//Actors can only be moved on the game thread
+	for (AFluidParticle* particle : m_particles)
+	{
+		particle->SetActorLocation(particle->GetParticlePosition());
+	}
+
+	if (IsShowingDebugText())
+		UE_LOG(LogTemp, Warning, TEXT("Playback at %f s (frame %i, %i particles, %i prefetch misses)"), m_playbackTime, k, n, m_cacheReader->GetNumOfPrefetchMisses());
+}
+
 void AFluidSimulation_FYPGameModeBase::EndPlay(EEndPlayReason::Type EndPlayReason)
 {
 	Super::EndPlay(EndPlayReason);
 
+	WaitForNeighbourSearch();
+
+	if (m_checkpointSave.IsValid())
+		m_checkpointSave.Wait();
+	StopRecordingParticleCache();
+	if (m_cacheReader)
+		m_cacheReader->Close();
+	if (m_probeRecorder)
+		m_probeRecorder->Close();
+
+	if (IsShowingDebugText() && m_workerTimings.GetNumOfSteps() > 0)
+	{
+		for (int32 worker = 0; worker < m_workerTimings.GetNumOfWorkers(); worker++)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Worker %i: %f ms busy, %f ms idle per step"), worker,
+				m_workerTimings.GetBusyMillisecondsPerStep(worker), m_workerTimings.GetIdleMillisecondsPerStep(worker));
+		}
+		UE_LOG(LogTemp, Warning, TEXT("Mean idle time per core: %f ms per step with the %s"), m_workerTimings.GetMeanIdleMillisecondsPerStep(),
+			m_useTaskGraph ? TEXT("task graph") : TEXT("ParallelFor stages"));
+		UE_LOG(LogTemp, Warning, TEXT("Busiest worker: %f times the mean busy time, %f chunks stolen per step"), m_workerTimings.GetBusyImbalance(),
+			m_workerTimings.GetStolenChunksPerStep());
+	}
+
 	if (m_currentRunningThread && m_baseThread)
 	{
 		//this simulates a mutex
@@ -261,8 +1186,47 @@ void AFluidSimulation_FYPGameModeBase::BeginPlay()
 {
 	Super::BeginPlay();
 
-	initSimulation();
+#if WITH_FLUID_PROBES
+	//the solver keeps a pointer to the recorder, so it has to exist before the solver is initialised
+	m_probeRecorder = MakeUnique<FFluidProbeRecorder>();
+#endif
+
+	//the first surface in the level is drawn, for playback too
+	m_fluidSurface = Cast<AFluidSurface>(UGameplayStatics::GetActorOfClass(GetWorld(), AFluidSurface::StaticClass()));
+	if (m_fluidSurface)
+		m_areParticlesVisible = !m_fluidSurface->IsHidingParticles();
+
+	if (!m_playbackParticleCache.IsEmpty())
+	{
+		m_cacheReader = MakeUnique<FParticleCacheReader>();
+		if (m_cacheReader->Open(FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("ParticleCaches"), m_playbackParticleCache), m_playbackReadAheadFrames))
+		{
+			m_playbackTime = m_cacheReader->GetFrameTime(0);
+			UE_LOG(LogTemp, Warning, TEXT("Playing back %i frames from %s"), m_cacheReader->GetNumOfFrames(), *m_playbackParticleCache);
+			return;
+		}
+		m_cacheReader.Reset();
+	}
+
+	if (m_checkStepAllocations)
+		EnableAllocationChecks();
+
+	createPhysicsSolver();
+	const bool isRestoring = !m_startupCheckpoint.IsEmpty();
+	if (!isRestoring)
+		initSimulation();
 	m_physicsSolver->initPhysicsSolver(&m_particles, this);
+	//the solver has to know its emitter before its counters can be restored
+	if (isRestoring && !restoreCheckpoint(m_startupCheckpoint))
+		initSimulation();
+
+	if (m_recordParticleCache)
+		StartRecordingParticleCache(m_particleCacheFile);
+
+	for (int32 index : m_probedParticles)
+	{
+		ProbeParticle(index);
+	}
 
 	//InitThreadCalculations(50);
 }
@@ -7,8 +7,48 @@
 #include "BaseThread.h"
 #include "HAL/Runnable.h"
 #include "HAL/RunnableThread.h"
+#include "Async/Future.h"
+#include "ParticleCacheWriter.h"
+#include "ParticleCacheReader.h"
+#include "FluidSimulationStats.h"
+#include "FluidProbes.h"
+#include "FluidFieldSampler.h"
+#include "FluidTaskGraph.h"
+#include "FluidAllocationCounter.h"
+#include "FluidScratchArena.h"
+#include "FluidNeighbourLists.h"
 #include "FluidSimulation_FYPGameModeBase.generated.h"
 
+//Arrangement of the particles that fill the fluid volumes at the start
+UENUM()
+enum class EFluidLatticeType : uint8
+{
+	Cubic,
+	BCC
+};
+
+//A benchmark setup: what fills the scene, with which solver, and how the level's emitter pours
+struct FFluidScenario
+{
+	FString name;
+	TArray<FBox> fluidVolumes;
+	int32 maxNumOfParticles{ 0 };
+	bool usePCISPHsolver{ false };
+	bool useFLIPsolver{ false };
+	bool useTaskGraph{ true };
+	bool overlapNeighbourSearch{ true };
+	bool balanceNeighbourWork{ true };
+	bool isViscous{ true };
+	bool useMultiRateStepping{ false };
+	//particles per second and live cap of the level's emitter. A zero rate keeps the emitter off.
+	int32 emissionRate{ 0 };
+	int32 maxNumOfEmittedParticles{ 0 };
+	//Mesh colliders spawned for the scenario on top of the level's own, each mesh scaled to fill its box
+	TArray<TPair<FString, FBox>> colliders;
+	//Without the BVH every particle runs the narrow phase against every collider
+	bool useColliderBVH{ true };
+};
+
 /**
  FOR NOW I WILL USE THE GAME MODE AS THE PARTICLE SYSTEM DATA MANAGER
  AND THE MAIN SIMULATION THREAD
@@ -23,11 +63,89 @@ private:
 	const FIntVector kDefaultHashGridResolution{ FIntVector(64) }; //this was set to 10 before
 
 	TArray<class AFluidParticle*> m_particles;
+	//Particles that are spawned but hidden and not simulated. Emitting and splitting take from here instead of spawning actors.
+	TArray<class AFluidParticle*> m_freeParticles;
+	//Scratch buffers for compacting the particle array, kept between compactions
+	TArray<class AFluidParticle*> m_compactedParticles;
+	TArray<int32> m_compactionRemap;
+	TArray<int32> m_compactionChunkOffsets;
 	UPROPERTY()
 	class AParticleSystemSolver* m_physicsSolver;
 	UPROPERTY()
 	class UNeighbourSearch* m_neighbourSearcher;
-	TArray<TArray<size_t>> m_neighbourLists;
+	FFluidNeighbourLists m_neighbourLists;
+	//The lists are built in one arena of each pair while the other still holds the lists of the previous step, which the work
+	//partition reads. Compactions copy the lists over to the other arena the same way.
+	FFluidScratchArena m_neighbourListArenas[2];
+	FFluidScratchArena m_boundaryNeighbourListArenas[2];
+	//the arenas holding the current lists
+	int32 m_neighbourListArena{ 0 };
+	//Time spent in every stage of the step, for the benchmarks
+	FFluidStageTimings m_stageTimings;
+	//Time every worker spent on the step, for the idle time per core
+	FFluidWorkerTimings m_workerTimings;
+	//Chunks of the neighbour loops, balanced by the neighbour counts of the previous step
+	FFluidWorkPartition m_workPartition;
+
+	//ASYNCHRONOUS NEIGHBOUR SEARCH
+	//The grid, neighbour lists and densities of the next step are built on a worker once a step has moved the particles,
+	//so they are ready when the next frame starts instead of being built at the start of it
+	FGraphEventRef m_neighbourSearchTask;
+	bool m_isNeighbourSearchReady{ false };
+	//Stage times of the neighbour search, which can run between frames. They are added to the step that uses the search.
+	FFluidStageTimings m_neighbourSearchTimings;
+
+	void launchNeighbourSearch();
+	void addNeighbourSearchTimings();
+	//The grid build runs on its own thread outside the ParallelFor loops, so its busy time is added here. The task graph does it in Launch.
+	void buildNeighbourSearcherOnThisThread();
+	//The surface finds its particles through the grid, so it is built from the positions a step produced right after the step.
+	//Nothing moves the particles before the next step starts, so that step uses this grid instead of building it again.
+	bool m_isNeighbourGridCurrent{ false };
+	void buildNeighbourGridForSurface();
+
+	//ALLOCATION CHECKS
+	//Once the steps have warmed up, a step that keeps its particle count shouldn't allocate at all
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
+	bool m_checkStepAllocations{ false };
+
+	//Steps with an unchanged particle count before an allocation counts as unexpected
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation", meta = (ClampMin = "0"))
+	int32 m_allocationWarmUpSteps{ 10 };
+
+	uint64 m_numOfCountedAllocations{ 0 };
+	int32 m_numOfStepAllocations{ 0 };
+	int32 m_numOfSteadySteps{ 0 };
+	int32 m_numOfUnexpectedAllocations{ 0 };
+
+	void checkStepAllocations(int32 numOfParticlesAtStart);
+	//Copies the lists of the particles that survive a compaction into the arena, dropping the dead neighbours and renumbering
+	//the rest when isRemappingNeighbours
+	void compactNeighbourLists(FFluidNeighbourLists* lists, FFluidScratchArena* arena, int32 numAlive, bool isRemappingNeighbours);
+	//Calls callback(j) for every neighbour of particle i in the grid, or callback(b) for every boundary particle near it
+	template <typename Callback>
+	void forEachNewNeighbour(int32 i, Callback callback) const;
+	template <typename Callback>
+	void forEachNewBoundaryNeighbour(int32 i, Callback callback) const;
+
+	//The solver is picked when play begins, so a blueprint's choice is the one that's used
+	void createPhysicsSolver();
+
+	//Colliders spawned by the current scenario, destroyed when the next one is applied
+	UPROPERTY()
+	TArray<class ACollider*> m_scenarioColliders;
+
+	//Particles only run the narrow phase against the colliders whose bounds contain them
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
+	bool m_useColliderBVH{ true };
+
+	//Static boundary particles sampled from the colliders (Akinci et al. 2012). Their grid is built once and never rebuilt.
+	UPROPERTY()
+	class UNeighbourSearch* m_boundarySearcher;
+	TArray<FVector> m_boundaryPositions;
+	//rest density times the volume of each boundary particle
+	TArray<double> m_boundaryPsi;
+	FFluidNeighbourLists m_boundaryNeighbourLists;
 
 	//water density in kg/m^3
 	double m_targetDensity{ 1.0 }; //this should be 1000.0 but the pressure computation keeps returning negative values TEMPORARY HACK FIX IS 1.0
@@ -37,20 +155,161 @@ private:
 	double m_kernelRadius;
 	double m_kernelRadiusOverTargetSpacing{ 1.8 };
 
-	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
+	//Most particles the fluid volumes are filled with
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation", meta = (ClampMin = "0"))
 	int32 m_numOfParticles{ 6000 };
 
+	//Boxes filled with particles target spacing apart when the simulation starts
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
+	TArray<FBox> m_fluidVolumes{ FBox(FVector(11.0f, 10.0f, 5.0f), FVector(50.0f, 20.0f, 13.0f)) };
+
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
+	EFluidLatticeType m_fluidVolumeLattice{ EFluidLatticeType::Cubic };
+
 	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
 	bool m_usePCISPHsolver{ false };
 
+	//Grid based FLIP/APIC solver for large volumes of water. Used instead of the SPH solvers when set.
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
+	bool m_useFLIPsolver{ false };
+
 	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
 	bool m_isFluidViscous{ true };
 
+	//The SPH step runs as a graph of chunked tasks instead of a ParallelFor with a barrier after every stage
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
+	bool m_useTaskGraph{ true };
+
+	//Particles per task. Smaller chunks balance better, bigger ones cost less to schedule.
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation", meta = (ClampMin = "16"))
+	int32 m_taskChunkSize{ 256 };
+
+	//Loops over the neighbour lists split the particles into chunks of equal cost instead of equal size, and idle cores take
+	//chunks from busy ones. Only the task chunk size is used otherwise.
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
+	bool m_balanceNeighbourWork{ true };
+
+	//The next step's neighbour search runs while the frame is drawn. The task graph does its own search inside the step instead.
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
+	bool m_overlapNeighbourSearch{ true };
+
+	//Splashing particles advance with smaller time steps than the calm bulk (power-of-two levels from the local CFL condition)
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
+	bool m_useMultiRateStepping{ false };
+
+	//The finest level advances 2^m_maxTimeStepLevel times per frame
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation", meta = (ClampMin = "0", ClampMax = "6"))
+	int32 m_maxTimeStepLevel{ 3 };
+
+	//Colliders are sampled into boundary particles that take part in the density and pressure sums
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
+	bool m_useBoundaryParticles{ false };
+
+	//Particles are split near the free surface and colliders and merged in the deep interior
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
+	bool m_useAdaptiveResolution{ false };
+
+	//Mass limits relative to AFluidParticle::kMass when splitting and merging
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation", meta = (ClampMin = "0.01", ClampMax = "1.0"))
+	double m_minParticleMassRatio{ 0.25 };
+
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation", meta = (ClampMin = "1.0", ClampMax = "64.0"))
+	double m_maxParticleMassRatio{ 4.0 };
+
+	//Particles older than this many seconds are removed. Zero keeps them forever.
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation", meta = (ClampMin = "0.0"))
+	double m_maxParticleLifetime{ 0.0 };
+
+	//Particles that leave the domain are removed
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
+	bool m_useSimulationDomain{ false };
+
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
+	FBox m_simulationDomain{ FVector(-100.0f), FVector(100.0f) };
+
+	//Steps between passes that take dead particles out of the particle array
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation", meta = (ClampMin = "1"))
+	int32 m_compactionInterval{ 10 };
+
+	//Records every step to a particle cache in Saved/ParticleCaches
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
+	bool m_recordParticleCache{ false };
+
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
+	FString m_particleCacheFile{ TEXT("ParticleCache.fpc") };
+
+	//16 bits per value relative to the frame bounds instead of full floats
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
+	bool m_quantiseParticleCache{ true };
+
+	//Frames between key frames, which playback can seek to without decoding the frames before them
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation", meta = (ClampMin = "1"))
+	int32 m_particleCacheKeyFrameInterval{ 30 };
+
+	//Frames that can wait for the cache writer before new ones are dropped
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation", meta = (ClampMin = "1"))
+	int32 m_particleCacheQueueLength{ 4 };
+
+	TUniquePtr<FParticleCacheWriter> m_cacheWriter;
+	//frame index of every live particle
+	TArray<int32> m_cacheFrameIndices;
+	//Compaction keeps the order of the live particles, so the frame indices only change when particles are spawned or removed.
+	//No spawns since the last recorded frame and the same live count means no particle was removed either.
+	uint64 m_numOfSpawnedParticles{ 0 };
+	uint64 m_numOfSpawnedParticlesAtCacheFrame{ 0 };
+	int32 m_numOfParticlesInCacheFrame{ INDEX_NONE };
+	double m_simulationTime{ 0.0 };
+
+	void recordCacheFrame();
+
+	//Plays this particle cache from Saved/ParticleCaches instead of simulating
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
+	FString m_playbackParticleCache;
+
+	//Frames decoded ahead of the playback time
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation", meta = (ClampMin = "1"))
+	int32 m_playbackReadAheadFrames{ 8 };
+
+	//Blends between the two cached frames around the playback time, so a cache baked at a low rate plays back smoothly
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
+	bool m_interpolatePlayback{ true };
+
+	TUniquePtr<FParticleCacheReader> m_cacheReader;
+	double m_playbackTime{ 0.0 };
+
+	void advancePlayback(double timeIntervalInSeconds);
+
+	//Checkpoint in Saved/Checkpoints to start from instead of filling the fluid volumes
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
+	FString m_startupCheckpoint;
+
+	//checkpoint being written in the background
+	TFuture<bool> m_checkpointSave;
+
+	bool restoreCheckpoint(const FString& fileName);
+
 	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
 	bool m_showDebugText{ false };
 
+	//Surface meshed from the particles every frame, if the level has one
+	UPROPERTY()
+	class AFluidSurface* m_fluidSurface{ nullptr };
+	//Spawned particles stay hidden while a surface is drawn in their place
+	bool m_areParticlesVisible{ true };
+
+	//Particles whose values every stage records from the start, by index
 	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
-	FVector2D m_simulationDimensions { FVector2D(40.0f, 10.0f) };
+	TArray<int32> m_probedParticles;
+
+	//CSV file in Saved/Probes for the probed values. They go to the log when this is empty.
+	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
+	FString m_probeFile;
+
+	TUniquePtr<FFluidProbeRecorder> m_probeRecorder;
+	uint32 m_numOfSteps{ 0 };
+
+	FFluidFieldSampler m_fieldSampler;
+	uint32 m_fieldSamplerStep{ MAX_uint32 };
 
 	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
 	TSubclassOf<class AFluidParticle> ParticleBP;
@@ -64,26 +323,125 @@ public:
 
 	void BuildNeighbourSearcher();
 	void BuildNeighbourLists();
+	//Blocks until the neighbour search running between frames is done. Anything on the game thread that reads or replaces
+	//the particles outside of Tick has to call this first.
+	void WaitForNeighbourSearch();
+	//Starts new neighbour lists for the live particles, after which the lists are built in three passes: CountNeighbours for
+	//every particle in any order, AllocateNeighbourLists once, and BuildNeighbourList for every particle in any order.
+	//The work partition is built here, from the lists of the previous step.
+	void PrepareNeighbourLists();
+	void CountNeighbours(int32 i);
+	//Turns the counts into the starts of the lists and takes the neighbour arrays from the arena
+	void AllocateNeighbourLists();
+	//FluidParallelFor over [0, num) for loops whose particles cost their neighbours. Chunked by the work partition when it
+	//was built for num particles.
+	void ParallelForNeighbourLoop(int32 num, TFunctionRef<void(int32)> body);
+	void BuildNeighbourList(int32 i);
+	void UpdateNeighbourPairStat();
+
+	//Spawns hidden particles until the live and pooled particles add up to the capacity
+	void ReserveParticles(int32 capacity);
+	//Takes a particle from the pool, or spawns one if the pool is empty
+	class AFluidParticle* SpawnParticle(const FVector& position, const FVector& velocity, double mass);
+	//Adds a particle at every position in one go. Returns the index of the first new particle.
+	int32 SpawnParticles(TArrayView<const FVector> positions, const FVector& velocity, double mass);
+	//Returns the dead particles to the pool and remaps the neighbour lists. The remaining particles keep their relative order.
+	//Returns the number of particles removed.
+	int32 CompactParticles(int32* numOfRemovedEmittedParticles);
+
+	//Copies the simulation state on the game thread and writes it to Saved/Checkpoints in the background
+	UFUNCTION(Exec, Category = "FluidSimulation")
+	void SaveCheckpoint(const FString& fileName);
+	//Returns every particle to the pool and starts the scenario from scratch with a new solver
+	void ApplyScenario(const FFluidScenario& scenario);
+
+	//Replaces every particle with the ones in the checkpoint
+	UFUNCTION(Exec, Category = "FluidSimulation")
+	void LoadCheckpoint(const FString& fileName);
+	//Records every following step to Saved/ParticleCaches
+	UFUNCTION(Exec, Category = "FluidSimulation")
+	void StartRecordingParticleCache(const FString& fileName);
+	//Finishes the cache file being recorded
+	UFUNCTION(Exec, Category = "FluidSimulation")
+	void StopRecordingParticleCache();
+	//Records the values of the particle at this index in every stage until it's removed. Its probe id is the index it had here.
+	UFUNCTION(Exec, Category = "FluidSimulation")
+	void ProbeParticle(int32 index);
+	UFUNCTION(Exec, Category = "FluidSimulation")
+	void ClearProbes();
+	//nullptr when probes are compiled out
+	FFluidProbeRecorder* GetProbeRecorder() const { return m_probeRecorder.Get(); }
+	//Jumps to a time in the particle cache being played back
+	UFUNCTION(Exec, Category = "FluidSimulation")
+	void SeekParticleCache(float timeInSeconds);
+	bool IsPlayingBack() const { return m_cacheReader.IsValid(); }
 
 	//Density computation
 	//Returns interpolated vector data. Could be used for velocity and acceleration.
 	FVector Interpolate(const FVector& origin, const TArray<FVector>& values) const;
 	//Returns interpolated scalar data. Could be used for density and pressure.
 	double Interpolate(const FVector& origin, const TArray<double>& values) const;
+	//Batched sampling of particle fields at many points, for export and analysis. Snapshot of the particles at the current step.
+	const FFluidFieldSampler& GetFieldSampler();
 	void UpdateDensities();
+	void UpdateDensity(int32 i);
+	double DensityAt(size_t i) const;
+	//Density contribution of the boundary particles next to particle i when it is at the given position
+	double BoundaryDensityAt(size_t i, const FVector& position) const;
+
+	void InitBoundaryParticles(const TArray<class ACollider*>& colliders);
 	double sumOfKernelNearby(const FVector& origin) const;
 	FVector GradientAt(size_t i, const TArray<double>& values) const;
 	double LaplacianAt(size_t i, const TArray<double>& values) const;
 
 	size_t GetNumberOfParticles() const { return m_numOfParticles; }
+	int32 GetNumberOfLiveParticles() const { return m_particles.Num(); }
 	TArray<class AFluidParticle*>* GetParticleArrayPtr() { return &m_particles; }
+	//Built from the current positions whenever the surface is updated
+	const class UNeighbourSearch* GetNeighbourSearcher() const { return m_neighbourSearcher; }
+	const TArray<FBox>& GetFluidVolumes() const { return m_fluidVolumes; }
+	FFluidStageTimings& GetStageTimings() { return m_stageTimings; }
+	FFluidWorkerTimings& GetWorkerTimings() { return m_workerTimings; }
+	//nullptr when the neighbour loops aren't balanced
+	const FFluidWorkPartition* GetWorkPartition() const { return m_balanceNeighbourWork ? &m_workPartition : nullptr; }
 	double GetTargetDensity() const { return m_targetDensity; }
 	double GetKernelRadius() const { return m_kernelRadius; }
+	//Smoothing length of the largest particle allowed, which is what the neighbour grid has to cover
+	double GetMaxKernelRadius() const;
+	//Smoothing length shared by a pair of particles
+	double GetKernelRadius(const class AFluidParticle* a, const class AFluidParticle* b) const;
 	double GetTargetSpacing() const { return m_targetSpacing; }
-	bool IsUsingPCISPH() const { return m_usePCISPHsolver; }
+	bool IsUsingPCISPH() const { return m_usePCISPHsolver && !m_useFLIPsolver; }
+	bool IsUsingFLIP() const { return m_useFLIPsolver; }
 	bool IsFluidViscous() const { return m_isFluidViscous; }
+	bool IsUsingTaskGraph() const { return m_useTaskGraph; }
+	int32 GetTaskChunkSize() const { return m_taskChunkSize; }
+	//Live and pooled particles, which the per-step buffers are sized for so that emitting doesn't grow them
+	int32 GetParticleCapacity() const { return m_particles.Num() + m_freeParticles.Num(); }
+	bool IsUsingMultiRateStepping() const { return m_useMultiRateStepping; }
+	bool IsUsingColliderBVH() const { return m_useColliderBVH; }
+	int32 GetMaxTimeStepLevel() const { return m_maxTimeStepLevel; }
 	bool IsShowingDebugText() const { return m_showDebugText; }
-	TArray<TArray<size_t>>* GetNeighbourLists() { return &m_neighbourLists; }
+	double GetMaxParticleLifetime() const { return m_maxParticleLifetime; }
+	bool IsUsingSimulationDomain() const { return m_useSimulationDomain; }
+	const FBox& GetSimulationDomain() const { return m_simulationDomain; }
+	int32 GetCompactionInterval() const { return m_compactionInterval; }
+	bool IsUsingAdaptiveResolution() const { return m_useAdaptiveResolution; }
+	double GetMinParticleMassRatio() const { return m_minParticleMassRatio; }
+	double GetMaxParticleMassRatio() const { return m_maxParticleMassRatio; }
+	const FFluidNeighbourLists* GetNeighbourLists() const { return &m_neighbourLists; }
+	bool IsUsingBoundaryParticles() const { return m_useBoundaryParticles; }
+	bool HasBoundaryParticles() const { return m_boundaryPositions.Num() > 0; }
+	const TArray<FVector>& GetBoundaryPositions() const { return m_boundaryPositions; }
+	const TArray<double>& GetBoundaryPsi() const { return m_boundaryPsi; }
+	const FFluidNeighbourLists* GetBoundaryNeighbourLists() const { return &m_boundaryNeighbourLists; }
+
+	//Counts the allocations of every following step, and asserts on those made once the steps have warmed up
+	void EnableAllocationChecks();
+	//Allocations made by the last step, or 0 when the checks are off
+	int32 GetNumOfStepAllocations() const { return m_numOfStepAllocations; }
+	//Allocations made by warmed up steps since the checks were enabled or the scenario was applied
+	int32 GetNumOfUnexpectedAllocations() const { return m_numOfUnexpectedAllocations; }
 
 	//Called every frame
 	virtual void Tick(float DeltaTime) override;
@@ -0,0 +1,73 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FluidSurface.h"
+#include "FluidSimulation_FYPGameModeBase.h"
+#include "NeighbourSearch.h"
+#include "ProceduralMeshComponent.h"
+
+// Sets default values
+AFluidSurface::AFluidSurface()
+{
+ 	// Set this actor to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
+	PrimaryActorTick.bCanEverTick = false;
+
+	//the vertices are in world space
+	m_mesh = CreateDefaultSubobject<UProceduralMeshComponent>(TEXT("Mesh"));
+	m_mesh->SetUsingAbsoluteLocation(true);
+	m_mesh->SetUsingAbsoluteRotation(true);
+	m_mesh->SetUsingAbsoluteScale(true);
+	m_mesh->bUseAsyncCooking = true;
+	m_mesh->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	RootComponent = m_mesh;
+}
+
+void AFluidSurface::UpdateSurface(AFluidSimulation_FYPGameModeBase* gameMode)
+{
+	FLUID_SCOPE(Surface);
+	const double startTime = FPlatformTime::Seconds();
+
+	if (!m_isInitialised)
+	{
+		const double targetSpacing = gameMode->GetTargetSpacing();
+		m_mesher.Initialise(m_cellSizeOverTargetSpacing * targetSpacing, m_blockSize, gameMode->GetKernelRadius(), m_isoValue, m_dirtyToleranceOverTargetSpacing * targetSpacing);
+		m_mesh->ClearAllMeshSections();
+		m_isInitialised = true;
+	}
+
+	m_mesher.Update(*gameMode->GetParticleArrayPtr(), gameMode->GetNeighbourSearcher()->GetGrid(), gameMode->GetTargetDensity(), &m_changedBlocks);
+
+	//Sections can only be uploaded on the game thread
+	const TArray<FVector2D> noUVs;
+	const TArray<FLinearColor> noColours;
+	const TArray<FProcMeshTangent> noTangents;
+	for (const FFluidSurfaceBlockMesh& block : m_changedBlocks)
+	{
+		if (block.triangles.Num() == 0)
+		{
+			m_mesh->ClearMeshSection(block.sectionIndex);
+			continue;
+		}
+		m_mesh->CreateMeshSection_LinearColor(block.sectionIndex, block.vertices, block.triangles, block.normals, noUVs, noColours, noTangents, false);
+		if (m_material)
+			m_mesh->SetMaterial(block.sectionIndex, m_material);
+	}
+
+	const double elapsedSeconds = FPlatformTime::Seconds() - startTime;
+	m_numOfUpdates++;
+	m_numOfRemeshedBlocks += m_changedBlocks.Num();
+	m_meshingSeconds += elapsedSeconds;
+	INC_DWORD_STAT_BY(STAT_FluidRemeshedBlocks, m_changedBlocks.Num());
+
+	if (gameMode->IsShowingDebugText())
+		UE_LOG(LogTemp, Warning, TEXT("Surface: %i blocks remeshed in %f ms, %i blocks, %i sections"), m_changedBlocks.Num(), elapsedSeconds * 1000.0, m_mesher.GetNumOfBlocks(), m_mesher.GetNumOfSections());
+}
+
+void AFluidSurface::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	Super::EndPlay(EndPlayReason);
+
+	if (m_numOfUpdates > 0)
+		UE_LOG(LogTemp, Warning, TEXT("Surface meshing took %f ms per frame over %i frames, %f blocks remeshed per frame"),
+			m_meshingSeconds * 1000.0 / m_numOfUpdates, m_numOfUpdates, static_cast<double>(m_numOfRemeshedBlocks) / m_numOfUpdates);
+}
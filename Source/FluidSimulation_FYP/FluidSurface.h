@@ -0,0 +1,62 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "FluidSurfaceMesher.h"
+#include "FluidSurface.generated.h"
+
+//Renders the fluid as a mesh instead of a sphere per particle. Place one in the level and the game mode updates it every frame.
+UCLASS()
+class FLUIDSIMULATION_FYP_API AFluidSurface : public AActor
+{
+	GENERATED_BODY()
+
+	UPROPERTY(VisibleAnywhere, Category = "Components")
+	class UProceduralMeshComponent* m_mesh;
+
+	//Size of the density grid cells relative to the target spacing
+	UPROPERTY(EditAnywhere, Category = "FluidSimulation", meta = (ClampMin = "0.1", ClampMax = "2.0"))
+	float m_cellSizeOverTargetSpacing{ 0.5f };
+
+	//Cells along each side of a block, the unit the surface is remeshed in
+	UPROPERTY(EditAnywhere, Category = "FluidSimulation", meta = (ClampMin = "4", ClampMax = "64"))
+	int32 m_blockSize{ 16 };
+
+	//Fraction of the rest density where the surface is drawn
+	UPROPERTY(EditAnywhere, Category = "FluidSimulation", meta = (ClampMin = "0.01", ClampMax = "1.0"))
+	float m_isoValue{ 0.5f };
+
+	//Blocks whose particles moved less than this fraction of the target spacing keep their mesh
+	UPROPERTY(EditAnywhere, Category = "FluidSimulation", meta = (ClampMin = "0.0"))
+	float m_dirtyToleranceOverTargetSpacing{ 0.05f };
+
+	UPROPERTY(EditAnywhere, Category = "FluidSimulation")
+	class UMaterialInterface* m_material{ nullptr };
+
+	//The particle spheres are hidden while the surface is drawn
+	UPROPERTY(EditAnywhere, Category = "FluidSimulation")
+	bool m_hideParticles{ true };
+
+	FFluidSurfaceMesher m_mesher;
+	TArray<FFluidSurfaceBlockMesh> m_changedBlocks;
+	bool m_isInitialised{ false };
+
+	//for the report at the end
+	int32 m_numOfUpdates{ 0 };
+	int64 m_numOfRemeshedBlocks{ 0 };
+	double m_meshingSeconds{ 0.0 };
+
+public:	
+	// Sets default values for this actor's properties
+	AFluidSurface();
+
+	bool IsHidingParticles() const { return m_hideParticles; }
+
+	//Remeshes the blocks the particles moved in and uploads their sections. Must be called on the game thread.
+	void UpdateSurface(class AFluidSimulation_FYPGameModeBase* gameMode);
+
+protected:
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+};
@@ -0,0 +1,407 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FluidSurfaceMesher.h"
+#include "FluidParticle.h"
+#include "FluidCoreTypes.h"
+#include "FluidCore/NeighbourGrid.h"
+#include "Kernels.h"
+#include "Hash/CityHash.h"
+#include "Runtime/Core/Public/Async/ParallelFor.h"
+
+namespace
+{
+	//runs of the grid's bucket order binned by one task, and tasks the changed blocks are meshed by
+	const int32 kNumOfBinningChunks = 64;
+	const int32 kNumOfMeshingChunks = 64;
+
+	//corner c of a cell is at (c & 1, (c >> 1) & 1, (c >> 2) & 1)
+	const int32 kEdgeCorners[12][2] = { {0, 1}, {2, 3}, {4, 5}, {6, 7}, {0, 2}, {1, 3}, {4, 6}, {5, 7}, {0, 4}, {1, 5}, {2, 6}, {3, 7} };
+	//the corners of every face in order, so that the two faces of an edge walk it in opposite directions
+	const int32 kFaceCorners[6][4] = { {0, 2, 3, 1}, {4, 5, 7, 6}, {0, 1, 5, 4}, {2, 6, 7, 3}, {0, 4, 6, 2}, {1, 3, 7, 5} };
+
+	FVector getCornerOffset(int32 corner)
+	{
+		return FVector(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1);
+	}
+
+	int32 getEdge(int32 a, int32 b)
+	{
+		for (int32 e = 0; e < 12; e++)
+		{
+			if ((kEdgeCorners[e][0] == a && kEdgeCorners[e][1] == b) || (kEdgeCorners[e][0] == b && kEdgeCorners[e][1] == a))
+				return e;
+		}
+		return INDEX_NONE;
+	}
+
+	/**
+	 * Triangles of every marching cubes case, built from the outlines of the surface on the faces of the cell rather than typed in.
+	 * Ambiguous faces always keep their inside corners apart, so neighbouring cells agree and the surface has no holes.
+	 */
+	struct FMarchingCubesTable
+	{
+		//up to five triangles of edges per case, ended by -1
+		int8 triangles[256][16];
+
+		FMarchingCubesTable()
+		{
+			for (int32 cellCase = 0; cellCase < 256; cellCase++)
+			{
+				auto isInside = [cellCase](int32 corner) { return ((cellCase >> corner) & 1) != 0; };
+
+				//every crossed edge starts a segment of the outline on one of its faces and ends one on the other
+				int32 nextEdge[12];
+				for (int32& e : nextEdge)
+				{
+					e = INDEX_NONE;
+				}
+				for (const auto& face : kFaceCorners)
+				{
+					for (int32 k = 0; k < 4; k++)
+					{
+						if (isInside(face[k]) || !isInside(face[(k + 1) % 4]))
+							continue;
+						//the segment comes out where the run of inside corners ends
+						int32 m = (k + 1) % 4;
+						while (isInside(face[(m + 1) % 4]))
+						{
+							m = (m + 1) % 4;
+						}
+						nextEdge[getEdge(face[k], face[(k + 1) % 4])] = getEdge(face[m], face[(m + 1) % 4]);
+					}
+				}
+
+				//the outlines are closed loops, triangulated as fans
+				int32 numOfIndices = 0;
+				bool isVisited[12] = {};
+				for (int32 start = 0; start < 12; start++)
+				{
+					if (nextEdge[start] == INDEX_NONE || isVisited[start])
+						continue;
+
+					TArray<int32, TInlineAllocator<12>> loop;
+					for (int32 e = start; !isVisited[e]; e = nextEdge[e])
+					{
+						isVisited[e] = true;
+						loop.Add(e);
+					}
+					for (int32 t = 1; t + 1 < loop.Num(); t++)
+					{
+						int32 triangle[3] = { loop[0], loop[t], loop[t + 1] };
+
+						//front faces point from the inside corners to the outside ones
+						FVector outwards(0.0f);
+						FVector points[3];
+						for (int32 v = 0; v < 3; v++)
+						{
+							const int32 a = kEdgeCorners[triangle[v]][0];
+							const int32 b = kEdgeCorners[triangle[v]][1];
+							outwards += isInside(a) ? getCornerOffset(b) - getCornerOffset(a) : getCornerOffset(a) - getCornerOffset(b);
+							points[v] = 0.5f * (getCornerOffset(a) + getCornerOffset(b));
+						}
+						if (FVector::DotProduct(FVector::CrossProduct(points[2] - points[0], points[1] - points[0]), outwards) < 0.0f)
+							Swap(triangle[1], triangle[2]);
+
+						for (int32 v = 0; v < 3; v++)
+						{
+							triangles[cellCase][numOfIndices++] = static_cast<int8>(triangle[v]);
+						}
+					}
+				}
+				check(numOfIndices <= 15);
+				triangles[cellCase][numOfIndices] = -1;
+			}
+		}
+	};
+
+	const FMarchingCubesTable& getMarchingCubesTable()
+	{
+		static const FMarchingCubesTable table;
+		return table;
+	}
+}
+
+void FFluidSurfaceMesher::Initialise(double cellSize, int32 blockSize, double kernelRadius, float isoValue, double dirtyTolerance)
+{
+	m_cellSize = cellSize;
+	m_blockSize = FMath::Max(blockSize, 2);
+	m_kernelRadius = kernelRadius;
+	m_isoValue = isoValue;
+	m_dirtyTolerance = FMath::Max(dirtyTolerance, KINDA_SMALL_NUMBER);
+	//the density grid of a block has a cell of padding, which particles of the blocks around it can reach too
+	m_blockReach = FMath::CeilToInt((m_kernelRadius + m_cellSize) / (m_blockSize * m_cellSize));
+
+	m_blocks.Reset();
+	m_freeSections.Reset();
+	m_numOfSections = 0;
+	m_numOfUpdates = 0;
+
+	getMarchingCubesTable();
+}
+
+void FFluidSurfaceMesher::binParticles(const TArray<AFluidParticle*>& particles, const FluidCore::FNeighbourGrid& grid, double targetDensity)
+{
+	const int32 n = particles.Num();
+	check(static_cast<int32>(grid.GetNumOfPoints()) == n);
+	m_volumes.SetNumUninitialized(n, false);
+	ParallelFor(n, [&](int32 i) {
+		const AFluidParticle* particle = particles[i];
+		//dead particles are left out
+		m_volumes[i] = particle->IsParticleDead() ? 0.0f : particle->GetParticleMass() / targetDensity;
+		});
+
+	//The grid keeps the particles sorted by bucket, and a bucket is smaller than a block, so neighbouring particles in its order
+	//mostly share a block. Each run of the order is summed on its own and a block is only looked up when the run moves into
+	//another one. Hashing the positions tells which blocks changed without keeping the particles of the last update.
+	const std::vector<int32_t>& bucketOrder = grid.GetPointsInBucketOrder();
+	const int64 numInOrder = static_cast<int64>(bucketOrder.size());
+	const double blockWidth = m_blockSize * m_cellSize;
+	m_chunkBlockSums.SetNum(kNumOfBinningChunks);
+	ParallelFor(kNumOfBinningChunks, [&](int32 c) {
+		TMap<FIntVector, FBlockSum>& sums = m_chunkBlockSums[c];
+		sums.Reset();
+		FIntVector lastBlock(0);
+		FBlockSum* lastSum = nullptr;
+		const int64 last = numInOrder * (c + 1) / kNumOfBinningChunks;
+		for (int64 p = numInOrder * c / kNumOfBinningChunks; p < last; p++)
+		{
+			const int32 i = bucketOrder[p];
+			if (m_volumes[i] <= 0.0f)
+				continue;
+			const FVector position = FromCore(grid.GetPoint(i));
+			const FIntVector block(FMath::FloorToInt(position.X / blockWidth), FMath::FloorToInt(position.Y / blockWidth), FMath::FloorToInt(position.Z / blockWidth));
+			//only the newest element is pointed to, so a rehash of the map can't leave it dangling
+			if (lastSum == nullptr || block != lastBlock)
+			{
+				lastSum = &sums.FindOrAdd(block);
+				lastBlock = block;
+			}
+			const FIntVector quantisedPosition(FMath::RoundToInt(position.X / m_dirtyTolerance), FMath::RoundToInt(position.Y / m_dirtyTolerance), FMath::RoundToInt(position.Z / m_dirtyTolerance));
+			lastSum->positionHash += CityHash64(reinterpret_cast<const char*>(&quantisedPosition), sizeof(quantisedPosition));
+			lastSum->numOfParticles++;
+		}
+		});
+
+	m_blockSums.Reset();
+	for (const TMap<FIntVector, FBlockSum>& sums : m_chunkBlockSums)
+	{
+		for (const TPair<FIntVector, FBlockSum>& pair : sums)
+		{
+			FBlockSum& sum = m_blockSums.FindOrAdd(pair.Key);
+			sum.numOfParticles += pair.Value.numOfParticles;
+			sum.positionHash += pair.Value.positionHash;
+		}
+	}
+}
+
+void FFluidSurfaceMesher::Update(const TArray<AFluidParticle*>& particles, const FluidCore::FNeighbourGrid& grid, double targetDensity, TArray<FFluidSurfaceBlockMesh>* changedBlocks)
+{
+	m_numOfUpdates++;
+	binParticles(particles, grid, targetDensity);
+
+	//blocks whose particles moved, arrived or left
+	m_changedBins.Reset();
+	for (const TPair<FIntVector, FBlockSum>& pair : m_blockSums)
+	{
+		FBlock& block = m_blocks.FindOrAdd(pair.Key);
+		if (block.numOfParticles != pair.Value.numOfParticles || block.positionHash != pair.Value.positionHash)
+			m_changedBins.Add(pair.Key);
+		block.numOfParticles = pair.Value.numOfParticles;
+		block.positionHash = pair.Value.positionHash;
+		block.lastUpdate = m_numOfUpdates;
+	}
+	for (TPair<FIntVector, FBlock>& pair : m_blocks)
+	{
+		if (pair.Value.lastUpdate != m_numOfUpdates && pair.Value.numOfParticles > 0)
+		{
+			pair.Value.numOfParticles = 0;
+			pair.Value.positionHash = 0;
+			m_changedBins.Add(pair.Key);
+		}
+	}
+
+	//a change reaches the surface of every block its particles can splat onto
+	m_dirtyBlocks.Reset();
+	for (const FIntVector& changed : m_changedBins)
+	{
+		for (int32 z = -m_blockReach; z <= m_blockReach; z++)
+		{
+			for (int32 y = -m_blockReach; y <= m_blockReach; y++)
+			{
+				for (int32 x = -m_blockReach; x <= m_blockReach; x++)
+				{
+					m_dirtyBlocks.Add(changed + FIntVector(x, y, z));
+				}
+			}
+		}
+	}
+
+	//the meshes of the last update are kept, so their arrays are refilled instead of allocated again
+	changedBlocks->SetNum(m_dirtyBlocks.Num(), false);
+	if (m_dirtyBlocks.Num() == 0)
+	{
+		return;
+	}
+	int32 k = 0;
+	for (const FIntVector& block : m_dirtyBlocks)
+	{
+		(*changedBlocks)[k].block = block;
+		(*changedBlocks)[k].sectionIndex = INDEX_NONE;
+		k++;
+	}
+
+	//Each task splats and meshes a run of the blocks in its own scratch
+	const int32 numOfBlocks = changedBlocks->Num();
+	const int32 numOfMeshingChunks = FMath::Min(numOfBlocks, kNumOfMeshingChunks);
+	if (m_meshScratch.Num() < numOfMeshingChunks)
+		m_meshScratch.SetNum(numOfMeshingChunks);
+	ParallelFor(numOfMeshingChunks, [&](int32 c) {
+		const int32 last = numOfBlocks * (c + 1) / numOfMeshingChunks;
+		for (int32 b = numOfBlocks * c / numOfMeshingChunks; b < last; b++)
+		{
+			meshBlock(grid, (*changedBlocks)[b].block, &(*changedBlocks)[b], &m_meshScratch[c]);
+		}
+		});
+
+	//Sections are handed out on the game thread, and blocks that lost their surface give theirs back. The sections freed here
+	//are only handed out from the next update on: the clears of this update are uploaded after its creates, and would wipe
+	//a block that took a section cleared in the same update.
+	TArray<FFluidSurfaceBlockMesh>& meshes = *changedBlocks;
+	TArray<int32, TInlineAllocator<16>> freedSections;
+	for (int32 b = meshes.Num() - 1; b >= 0; b--)
+	{
+		const FIntVector key = meshes[b].block;
+		FBlock* block = m_blocks.Find(key);
+		if (meshes[b].triangles.Num() > 0)
+		{
+			if (block == nullptr)
+				block = &m_blocks.Add(key);
+			if (block->sectionIndex == INDEX_NONE)
+				block->sectionIndex = m_freeSections.Num() > 0 ? m_freeSections.Pop(false) : m_numOfSections++;
+			meshes[b].sectionIndex = block->sectionIndex;
+			continue;
+		}
+
+		if (block == nullptr || block->sectionIndex == INDEX_NONE)
+		{
+			//nothing was drawn there before either
+			meshes.RemoveAtSwap(b, 1, false);
+		}
+		else
+		{
+			meshes[b].sectionIndex = block->sectionIndex;
+			freedSections.Add(block->sectionIndex);
+			block->sectionIndex = INDEX_NONE;
+		}
+		if (block && block->numOfParticles == 0)
+			m_blocks.Remove(key);
+	}
+	m_freeSections.Append(freedSections);
+}
+
+void FFluidSurfaceMesher::meshBlock(const FluidCore::FNeighbourGrid& grid, const FIntVector& block, FFluidSurfaceBlockMesh* mesh, FMeshScratch* scratch) const
+{
+	mesh->vertices.Reset();
+	mesh->normals.Reset();
+	mesh->triangles.Reset();
+
+	const FMarchingCubesTable& table = getMarchingCubesTable();
+	const int32 numOfCells = m_blockSize;
+	//one node of padding on each side for the central differences of the normals
+	const int32 numOfNodes = numOfCells + 3;
+	const FVector origin = FVector(block) * (numOfCells * m_cellSize) - FVector(m_cellSize);
+	auto nodeIndex = [numOfNodes](int32 x, int32 y, int32 z) { return (z * numOfNodes + y) * numOfNodes + x; };
+
+	//splat the particles that reach the nodes of this block, found through the grid
+	const int32 numOfNodesInBlock = numOfNodes * numOfNodes * numOfNodes;
+	TArray<float>& density = scratch->density;
+	density.SetNumUninitialized(numOfNodesInBlock, false);
+	FMemory::Memzero(density.GetData(), numOfNodesInBlock * sizeof(float));
+	const FSphStdKernel kernel(m_kernelRadius);
+	const double reach = m_kernelRadius / m_cellSize;
+	const FVector lastNode = origin + FVector((numOfNodes - 1) * m_cellSize);
+	bool hasParticles = false;
+	grid.ForEachPointInBox(ToCore(origin - FVector(m_kernelRadius)), ToCore(lastNode + FVector(m_kernelRadius)), [&](size_t i, const FluidCore::FVec3& position) {
+		if (m_volumes[i] <= 0.0f)
+			return;
+		const FVector local = (FromCore(position) - origin) / m_cellSize;
+		const FIntVector minNode(FMath::Max(FMath::CeilToInt(local.X - reach), 0), FMath::Max(FMath::CeilToInt(local.Y - reach), 0), FMath::Max(FMath::CeilToInt(local.Z - reach), 0));
+		const FIntVector maxNode(FMath::Min(FMath::FloorToInt(local.X + reach), numOfNodes - 1), FMath::Min(FMath::FloorToInt(local.Y + reach), numOfNodes - 1), FMath::Min(FMath::FloorToInt(local.Z + reach), numOfNodes - 1));
+		for (int32 nz = minNode.Z; nz <= maxNode.Z; nz++)
+		{
+			for (int32 ny = minNode.Y; ny <= maxNode.Y; ny++)
+			{
+				for (int32 nx = minNode.X; nx <= maxNode.X; nx++)
+				{
+					const double distance = FVector::Distance(FVector(nx, ny, nz), local) * m_cellSize;
+					if (distance < m_kernelRadius)
+					{
+						density[nodeIndex(nx, ny, nz)] += m_volumes[i] * kernel(distance);
+						hasParticles = true;
+					}
+				}
+			}
+		}
+		});
+	if (!hasParticles)
+	{
+		return;
+	}
+
+	auto gradientAt = [&](int32 x, int32 y, int32 z) {
+		return FVector(density[nodeIndex(x + 1, y, z)] - density[nodeIndex(x - 1, y, z)],
+			density[nodeIndex(x, y + 1, z)] - density[nodeIndex(x, y - 1, z)],
+			density[nodeIndex(x, y, z + 1)] - density[nodeIndex(x, y, z - 1)]);
+	};
+
+	//vertices are shared between the cells around an edge. Edges are named by their lower node and their axis.
+	const int32 numOfEdgeNodes = numOfCells + 1;
+	TArray<int32>& edgeVertices = scratch->edgeVertices;
+	edgeVertices.SetNumUninitialized(3 * numOfEdgeNodes * numOfEdgeNodes * numOfEdgeNodes, false);
+	for (int32& vertex : edgeVertices)
+	{
+		vertex = INDEX_NONE;
+	}
+	auto getVertex = [&](const FIntVector& cell, int32 edge) {
+		const int32 a = kEdgeCorners[edge][0];
+		const int32 b = kEdgeCorners[edge][1];
+		const int32 axis = (a ^ b) == 1 ? 0 : ((a ^ b) == 2 ? 1 : 2);
+		const FIntVector nodeA = cell + FIntVector(a & 1, (a >> 1) & 1, (a >> 2) & 1);
+		const FIntVector nodeB = cell + FIntVector(b & 1, (b >> 1) & 1, (b >> 2) & 1);
+		int32& vertex = edgeVertices[((axis * numOfEdgeNodes + nodeA.Z) * numOfEdgeNodes + nodeA.Y) * numOfEdgeNodes + nodeA.X];
+		if (vertex == INDEX_NONE)
+		{
+			//cells start at node 1 of the padded grid
+			const float densityA = density[nodeIndex(nodeA.X + 1, nodeA.Y + 1, nodeA.Z + 1)];
+			const float densityB = density[nodeIndex(nodeB.X + 1, nodeB.Y + 1, nodeB.Z + 1)];
+			const float t = FMath::Clamp((m_isoValue - densityA) / (densityB - densityA), 0.0f, 1.0f);
+			vertex = mesh->vertices.Add(origin + (FMath::Lerp(FVector(nodeA), FVector(nodeB), t) + FVector(1.0f)) * m_cellSize);
+			//the density falls off towards the outside
+			const FVector gradient = FMath::Lerp(gradientAt(nodeA.X + 1, nodeA.Y + 1, nodeA.Z + 1), gradientAt(nodeB.X + 1, nodeB.Y + 1, nodeB.Z + 1), t);
+			mesh->normals.Add(-gradient.GetSafeNormal());
+		}
+		return vertex;
+	};
+
+	for (int32 z = 0; z < numOfCells; z++)
+	{
+		for (int32 y = 0; y < numOfCells; y++)
+		{
+			for (int32 x = 0; x < numOfCells; x++)
+			{
+				int32 cellCase = 0;
+				for (int32 c = 0; c < 8; c++)
+				{
+					if (density[nodeIndex(x + 1 + (c & 1), y + 1 + ((c >> 1) & 1), z + 1 + ((c >> 2) & 1))] >= m_isoValue)
+						cellCase |= 1 << c;
+				}
+				const int8* triangles = table.triangles[cellCase];
+				for (int32 k = 0; triangles[k] != -1; k++)
+				{
+					mesh->triangles.Add(getVertex(FIntVector(x, y, z), triangles[k]));
+				}
+			}
+		}
+	}
+}
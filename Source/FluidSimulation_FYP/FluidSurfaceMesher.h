@@ -0,0 +1,93 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+namespace FluidCore
+{
+	class FNeighbourGrid;
+}
+
+//Mesh of one block of the fluid surface, which replaces the mesh section it names. An empty mesh clears the section.
+struct FFluidSurfaceBlockMesh
+{
+	FIntVector block{ FIntVector(0) };
+	int32 sectionIndex{ INDEX_NONE };
+	TArray<FVector> vertices;
+	TArray<FVector> normals;
+	TArray<int32> triangles;
+};
+
+/**
+ * Builds the fluid surface from the particles with marching cubes.
+ * Space is split into blocks of blockSize^3 cells. Only blocks near particles get a density grid, which the particles are splatted
+ * onto with the standard kernel. A block is only remeshed when the particles around it have moved, so a pool at rest costs
+ * little more than binning its particles. The particles are found through the simulation's neighbour grid, which has to be
+ * built from the positions to mesh.
+ */
+class FLUIDSIMULATION_FYP_API FFluidSurfaceMesher
+{
+	struct FBlock
+	{
+		//particles whose centre is in the block, and a sum of their hashed quantised positions that doesn't depend on their order
+		int32 numOfParticles{ 0 };
+		uint64 positionHash{ 0 };
+		int32 sectionIndex{ INDEX_NONE };
+		//the last update that found particles in the block
+		uint32 lastUpdate{ 0 };
+	};
+
+	double m_cellSize{ 0.5 };
+	int32 m_blockSize{ 16 };
+	double m_kernelRadius{ 1.8 };
+	float m_isoValue{ 0.5f };
+	//positions are compared at this precision to tell if a block has changed
+	double m_dirtyTolerance{ 0.05 };
+	//blocks on each side of a block whose particles can reach into it
+	int32 m_blockReach{ 1 };
+
+	//particles whose centre is in a block in this update
+	struct FBlockSum
+	{
+		int32 numOfParticles{ 0 };
+		uint64 positionHash{ 0 };
+	};
+
+	//scratch of the blocks meshed by one task
+	struct FMeshScratch
+	{
+		TArray<float> density;
+		TArray<int32> edgeVertices;
+	};
+
+	TMap<FIntVector, FBlock> m_blocks;
+	TArray<int32> m_freeSections;
+	int32 m_numOfSections{ 0 };
+	uint32 m_numOfUpdates{ 0 };
+
+	//Rebuilt every update into the memory of the last one
+	TArray<float> m_volumes;
+	//one map per run of the grid's bucket order, added up into m_blockSums
+	TArray<TMap<FIntVector, FBlockSum>> m_chunkBlockSums;
+	TMap<FIntVector, FBlockSum> m_blockSums;
+	TArray<FIntVector> m_changedBins;
+	TSet<FIntVector> m_dirtyBlocks;
+	TArray<FMeshScratch> m_meshScratch;
+
+	void binParticles(const TArray<class AFluidParticle*>& particles, const FluidCore::FNeighbourGrid& grid, double targetDensity);
+	void meshBlock(const FluidCore::FNeighbourGrid& grid, const FIntVector& block, FFluidSurfaceBlockMesh* mesh, FMeshScratch* scratch) const;
+
+public:
+	FFluidSurfaceMesher() = default;
+	~FFluidSurfaceMesher() = default;
+
+	//Forgets every block, so the next update meshes everything
+	void Initialise(double cellSize, int32 blockSize, double kernelRadius, float isoValue, double dirtyTolerance);
+	//Remeshes the blocks around particles that moved since the last update. Returns the meshes of the sections that changed.
+	//The grid has to hold the particles at their current positions.
+	void Update(const TArray<class AFluidParticle*>& particles, const FluidCore::FNeighbourGrid& grid, double targetDensity, TArray<FFluidSurfaceBlockMesh>* changedBlocks);
+
+	int32 GetNumOfBlocks() const { return m_blocks.Num(); }
+	int32 GetNumOfSections() const { return m_numOfSections - m_freeSections.Num(); }
+};
@@ -0,0 +1,220 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FluidTaskGraph.h"
+
+int32 FFluidWorkerTimings::getWorkerSlot()
+{
+	//slots are shared by every set of timings, so a thread keeps its slot across steps and scenarios
+	static TAtomic<int32> numOfSlots(0);
+	thread_local int32 slot = INDEX_NONE;
+	if (slot == INDEX_NONE)
+	{
+		//threads past the last slot share it, which only happens with more cores than anyone has
+		slot = FMath::Min(numOfSlots++, kMaxNumOfWorkers - 1);
+	}
+	return slot;
+}
+
+void FFluidWorkerTimings::Reset()
+{
+	for (TAtomic<uint64>& cycles : m_busyCycles)
+	{
+		cycles = 0;
+	}
+	m_numOfStolenChunks = 0;
+	m_stepSeconds = 0.0;
+	m_numOfSteps = 0;
+}
+
+int32 FFluidWorkerTimings::GetNumOfWorkers() const
+{
+	int32 numOfWorkers = FMath::Min(FTaskGraphInterface::Get().GetNumWorkerThreads() + 1, kMaxNumOfWorkers);
+	//some slots can be taken by threads outside the task graph, like the commandlet's
+	for (int32 worker = numOfWorkers; worker < kMaxNumOfWorkers; worker++)
+	{
+		if (m_busyCycles[worker].Load() > 0)
+			numOfWorkers = worker + 1;
+	}
+	return numOfWorkers;
+}
+
+double FFluidWorkerTimings::GetBusyMillisecondsPerStep(int32 worker) const
+{
+	return m_numOfSteps > 0 ? FPlatformTime::ToMilliseconds64(m_busyCycles[worker].Load()) / m_numOfSteps : 0.0;
+}
+
+double FFluidWorkerTimings::GetIdleMillisecondsPerStep(int32 worker) const
+{
+	if (m_numOfSteps == 0)
+	{
+		return 0.0;
+	}
+	return FMath::Max(m_stepSeconds * 1000.0 / m_numOfSteps - GetBusyMillisecondsPerStep(worker), 0.0);
+}
+
+double FFluidWorkerTimings::GetMeanIdleMillisecondsPerStep() const
+{
+	const int32 numOfWorkers = GetNumOfWorkers();
+	double sum = 0.0;
+	for (int32 worker = 0; worker < numOfWorkers; worker++)
+	{
+		sum += GetIdleMillisecondsPerStep(worker);
+	}
+	return sum / numOfWorkers;
+}
+
+double FFluidWorkerTimings::GetBusyImbalance() const
+{
+	const int32 numOfWorkers = GetNumOfWorkers();
+	double sum = 0.0;
+	double maximum = 0.0;
+	for (int32 worker = 0; worker < numOfWorkers; worker++)
+	{
+		const double busy = GetBusyMillisecondsPerStep(worker);
+		sum += busy;
+		maximum = FMath::Max(maximum, busy);
+	}
+	return sum > 0.0 ? maximum * numOfWorkers / sum : 1.0;
+}
+
+double FFluidWorkerTimings::GetStolenChunksPerStep() const
+{
+	return m_numOfSteps > 0 ? static_cast<double>(m_numOfStolenChunks.Load()) / m_numOfSteps : 0.0;
+}
+
+void FFluidWorkPartition::Build(int32 num, int32 numOfChunks, FFluidWorkerTimings* timings, TFunctionRef<int32(int32)> getCost)
+{
+	m_num = num;
+	numOfChunks = FMath::Clamp(numOfChunks, 1, FMath::Max(num, 1));
+
+	//the blocks are summed in parallel, and only the blocks the chunk boundaries fall into are walked particle by particle
+	const int32 numOfBlocks = FMath::DivideAndRoundUp(num, kBlockSize);
+	m_blockCosts.SetNumUninitialized(numOfBlocks + 1, false);
+	m_blockCosts[0] = 0;
+	FluidParallelFor(numOfBlocks, 1, timings, [&](int32 block) {
+		const int32 end = FMath::Min(num, (block + 1) * kBlockSize);
+		int64 cost = 0;
+		for (int32 i = block * kBlockSize; i < end; i++)
+		{
+			cost += getCost(i);
+		}
+		m_blockCosts[block + 1] = cost;
+		});
+	for (int32 block = 0; block < numOfBlocks; block++)
+	{
+		m_blockCosts[block + 1] += m_blockCosts[block];
+	}
+
+	//chunk c starts at the first particle whose costs before it reach c / numOfChunks of the total
+	const int64 totalCost = m_blockCosts[numOfBlocks];
+	m_chunkStarts.SetNumUninitialized(numOfChunks + 1, false);
+	m_chunkStarts[0] = 0;
+	int32 block = 0;
+	int32 i = 0;
+	int64 cost = 0;
+	for (int32 chunk = 1; chunk < numOfChunks; chunk++)
+	{
+		const int64 targetCost = totalCost * chunk / numOfChunks;
+		while (block < numOfBlocks && m_blockCosts[block + 1] <= targetCost)
+		{
+			block++;
+		}
+		if (i < block * kBlockSize)
+		{
+			i = block * kBlockSize;
+			cost = m_blockCosts[block];
+		}
+		while (i < num)
+		{
+			const int32 particleCost = getCost(i);
+			if (cost + particleCost > targetCost)
+				break;
+			cost += particleCost;
+			i++;
+		}
+		m_chunkStarts[chunk] = i;
+	}
+	m_chunkStarts[numOfChunks] = num;
+}
+
+void FFluidWorkPartition::Reset()
+{
+	m_chunkStarts.Reset();
+	m_num = 0;
+}
+
+FFluidChunkQueues::FFluidChunkQueues(int32 numOfChunks, int32 numOfWorkers)
+	: m_numOfWorkers(FMath::Min(numOfWorkers, static_cast<int32>(FFluidWorkerTimings::kMaxNumOfWorkers)))
+{
+	for (int32 worker = 0; worker < m_numOfWorkers; worker++)
+	{
+		const uint64 front = static_cast<uint64>(numOfChunks) * worker / m_numOfWorkers;
+		const uint64 back = static_cast<uint64>(numOfChunks) * (worker + 1) / m_numOfWorkers;
+		m_runs[worker] = (front << 32) | back;
+	}
+}
+
+int32 FFluidChunkQueues::TakeChunk(int32 worker, bool* isStolen)
+{
+	//the worker's own run from the front, then the other runs from the back, where their owners get to last
+	for (int32 k = 0; k < m_numOfWorkers; k++)
+	{
+		TAtomic<uint64>& run = m_runs[(worker + k) % m_numOfWorkers];
+		uint64 value = run.Load();
+		while (true)
+		{
+			const int32 front = static_cast<int32>(value >> 32);
+			const int32 back = static_cast<int32>(value & MAX_uint32);
+			if (front >= back)
+				break;
+			const bool isOwnRun = k == 0;
+			const uint64 newValue = isOwnRun ? value + (uint64(1) << 32) : value - 1;
+			//on failure value is reloaded, and the run is looked at again
+			if (run.CompareExchange(value, newValue))
+			{
+				*isStolen = !isOwnRun;
+				return isOwnRun ? front : back - 1;
+			}
+		}
+	}
+	return INDEX_NONE;
+}
+
+FFluidTaskGraph::FFluidTaskGraph(int32 chunkSize, FFluidWorkerTimings* workerTimings, FFluidStageTimings* stageTimings, const FFluidWorkPartition* partition)
+	: m_chunkSize(FMath::Max(chunkSize, 1)), m_partition(partition), m_workerTimings(workerTimings), m_stageTimings(stageTimings)
+{
+	for (TAtomic<uint64>& cycles : m_stageCycles)
+	{
+		cycles = 0;
+	}
+}
+
+void FFluidTaskGraph::addBusyCycles(EFluidStage stage, uint64 cycles)
+{
+	m_stageCycles[static_cast<int32>(stage)] += cycles;
+	if (m_workerTimings)
+		m_workerTimings->AddBusyCycles(cycles);
+}
+
+FGraphEventRef FFluidTaskGraph::Join(const FGraphEventArray& events)
+{
+	FFluidAllocationScope dispatchScope(false);
+	return TGraphTask<FNullGraphTask>::CreateTask(&events).ConstructAndDispatchWhenReady(TStatId(), ENamedThreads::AnyThread);
+}
+
+void FFluidTaskGraph::Wait()
+{
+	FFluidAllocationScope waitScope(false);
+	FTaskGraphInterface::Get().WaitUntilTasksComplete(m_tasks, ENamedThreads::GameThread);
+	m_tasks.Reset();
+
+	if (m_stageTimings)
+	{
+		const double numOfWorkers = FTaskGraphInterface::Get().GetNumWorkerThreads();
+		for (int32 s = 0; s < static_cast<int32>(EFluidStage::NumOfStages); s++)
+		{
+			m_stageTimings->seconds[s] += FPlatformTime::ToSeconds64(m_stageCycles[s].Exchange(0)) / FMath::Max(numOfWorkers, 1.0);
+		}
+	}
+}
@@ -0,0 +1,243 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "Async/ParallelFor.h"
+#include "FluidSimulationStats.h"
+#include "FluidAllocationCounter.h"
+#include <initializer_list>
+
+//Time every worker thread spent running simulation chunks, so the time each core sat idle during the steps can be reported
+class FLUIDSIMULATION_FYP_API FFluidWorkerTimings
+{
+public:
+	static constexpr int32 kMaxNumOfWorkers = 64;
+
+private:
+	//indexed by worker slot, which every thread takes the first time it runs a chunk
+	TAtomic<uint64> m_busyCycles[kMaxNumOfWorkers];
+	TAtomic<uint64> m_numOfStolenChunks;
+	double m_stepSeconds{ 0.0 };
+	int32 m_numOfSteps{ 0 };
+
+	static int32 getWorkerSlot();
+
+public:
+	FFluidWorkerTimings() { Reset(); }
+
+	void Reset();
+	void AddBusyCycles(uint64 cycles) { m_busyCycles[getWorkerSlot()] += cycles; }
+	void AddStolenChunk() { m_numOfStolenChunks++; }
+	//Wall time of a step, which is the time every worker could have been busy for
+	void AddStep(double seconds) { m_stepSeconds += seconds; m_numOfSteps++; }
+
+	//Task graph workers plus the game thread, which runs ParallelFor chunks too
+	int32 GetNumOfWorkers() const;
+	int32 GetNumOfSteps() const { return m_numOfSteps; }
+	double GetBusyMillisecondsPerStep(int32 worker) const;
+	//Average time per step the worker didn't spend running chunks, in milliseconds
+	double GetIdleMillisecondsPerStep(int32 worker) const;
+	double GetMeanIdleMillisecondsPerStep() const;
+	//Busy time of the busiest worker over the mean busy time. 1 when every worker did the same amount of work.
+	double GetBusyImbalance() const;
+	//Chunks a worker took from another worker's run because it had none left, per step
+	double GetStolenChunksPerStep() const;
+};
+
+//ParallelFor over chunks of the range instead of single indices. Each chunk is timed for the worker timings.
+//The chunks count their allocations if the caller does. What ParallelFor allocates to hand them out is the engine's.
+template <typename Body>
+void FluidParallelFor(int32 num, int32 chunkSize, FFluidWorkerTimings* timings, const Body& body)
+{
+	const int32 numOfChunks = FMath::DivideAndRoundUp(num, FMath::Max(chunkSize, 1));
+	const bool isCountingAllocations = FFluidAllocationScope::IsCounting();
+	FFluidAllocationScope dispatchScope(false);
+	ParallelFor(numOfChunks, [&](int32 chunk) {
+		FFluidAllocationScope chunkScope(isCountingAllocations);
+		const uint64 startCycles = FPlatformTime::Cycles64();
+		const int32 end = FMath::Min(num, (chunk + 1) * chunkSize);
+		for (int32 i = chunk * chunkSize; i < end; i++)
+		{
+			body(i);
+		}
+		if (timings)
+			timings->AddBusyCycles(FPlatformTime::Cycles64() - startCycles);
+		});
+}
+
+/**
+ * Split of a range of particles into chunks that cost about the same, instead of chunks with the same number of particles.
+ * A splashing particle has a couple of neighbours and one deep in a pool forty, so with equal ranges the cores that got
+ * the pool are still working long after the others are done. The cost of a particle is its neighbour count from the
+ * previous step, which is close to the one it has now.
+ */
+class FLUIDSIMULATION_FYP_API FFluidWorkPartition
+{
+	//particles whose costs are summed on one worker while the chunks are found
+	static constexpr int32 kBlockSize = 1024;
+
+	//sum of the costs before each block, and the total at the end
+	TArray<int64> m_blockCosts;
+	//first particle of each chunk, and the number of particles at the end
+	TArray<int32> m_chunkStarts;
+	int32 m_num{ 0 };
+
+public:
+	//Splits [0, num) into numOfChunks chunks. getCost has to be at least 1 for every particle.
+	void Build(int32 num, int32 numOfChunks, FFluidWorkerTimings* timings, TFunctionRef<int32(int32)> getCost);
+	void Reset();
+
+	//A partition only fits loops over the number of particles it was built for
+	bool IsValidFor(int32 num) const { return m_num == num && m_chunkStarts.Num() > 1; }
+	int32 GetNumOfChunks() const { return FMath::Max(m_chunkStarts.Num() - 1, 0); }
+	int32 GetChunkStart(int32 chunk) const { return m_chunkStarts[chunk]; }
+	int32 GetChunkEnd(int32 chunk) const { return m_chunkStarts[chunk + 1]; }
+};
+
+/**
+ * Chunks dealt out to the workers in contiguous runs, so each worker walks its own part of the particles. A worker whose run
+ * is done takes chunks from the end of another worker's run, which evens out the last chunks of a loop.
+ */
+class FLUIDSIMULATION_FYP_API FFluidChunkQueues
+{
+	//front and back of every run in one word, so the owner and a thief taking from either end is one compare and swap
+	TAtomic<uint64> m_runs[FFluidWorkerTimings::kMaxNumOfWorkers];
+	int32 m_numOfWorkers;
+
+public:
+	FFluidChunkQueues(int32 numOfChunks, int32 numOfWorkers);
+
+	//Next chunk of the worker's own run, or the last one of another worker's if its run is done.
+	//INDEX_NONE once every chunk has been taken.
+	int32 TakeChunk(int32 worker, bool* isStolen);
+};
+
+//Runs body(i) for every particle of the partition, chunk by chunk, with idle workers stealing the chunks that are left.
+//Like the ParallelFor above, the chunks are timed and count their allocations if the caller does.
+template <typename Body>
+void FluidParallelFor(const FFluidWorkPartition& partition, FFluidWorkerTimings* timings, const Body& body)
+{
+	const int32 numOfWorkers = FMath::Min(FMath::Min(FTaskGraphInterface::Get().GetNumWorkerThreads() + 1, partition.GetNumOfChunks()),
+		static_cast<int32>(FFluidWorkerTimings::kMaxNumOfWorkers));
+	FFluidChunkQueues queues(partition.GetNumOfChunks(), numOfWorkers);
+	const bool isCountingAllocations = FFluidAllocationScope::IsCounting();
+	FFluidAllocationScope dispatchScope(false);
+	ParallelFor(numOfWorkers, [&](int32 worker) {
+		FFluidAllocationScope workerScope(isCountingAllocations);
+		bool isStolen = false;
+		for (int32 chunk = queues.TakeChunk(worker, &isStolen); chunk != INDEX_NONE; chunk = queues.TakeChunk(worker, &isStolen))
+		{
+			const uint64 startCycles = FPlatformTime::Cycles64();
+			const int32 end = partition.GetChunkEnd(chunk);
+			for (int32 i = partition.GetChunkStart(chunk); i < end; i++)
+			{
+				body(i);
+			}
+			if (timings)
+			{
+				timings->AddBusyCycles(FPlatformTime::Cycles64() - startCycles);
+				if (isStolen)
+					timings->AddStolenChunk();
+			}
+		}
+		});
+}
+
+/**
+ * Stages of a step as chunks of particles on the task graph. A chunk starts as soon as the chunks it reads from are done
+ * instead of waiting for the whole previous stage, and stages that don't depend on each other run side by side.
+ * Chunk k of every stage covers the same particles, so a stage that only reads the values its own particles got from
+ * another stage can wait for that stage chunk by chunk.
+ * Stages overlap, so their wall time means little. Each stage gets its time summed over the workers divided by the number
+ * of workers instead, which is what it would take with every core on it.
+ * Like FluidParallelFor, the tasks count their allocations if the thread launching them does, and launching them doesn't.
+ * Given a work partition, loops over the particles it was built for are chunked by it, so chunk k is still the same particles
+ * in every stage. The task graph already hands ready chunks to whichever worker is free, so nothing has to be stolen.
+ */
+class FLUIDSIMULATION_FYP_API FFluidTaskGraph
+{
+	int32 m_chunkSize;
+	const FFluidWorkPartition* m_partition;
+	FFluidWorkerTimings* m_workerTimings;
+	FFluidStageTimings* m_stageTimings;
+	TAtomic<uint64> m_stageCycles[static_cast<int32>(EFluidStage::NumOfStages)];
+	//every task launched, for Wait
+	FGraphEventArray m_tasks;
+
+	void addBusyCycles(EFluidStage stage, uint64 cycles);
+	bool isPartitioned(int32 num) const { return m_partition && m_partition->IsValidFor(num); }
+
+public:
+	FFluidTaskGraph(int32 chunkSize, FFluidWorkerTimings* workerTimings, FFluidStageTimings* stageTimings, const FFluidWorkPartition* partition = nullptr);
+
+	int32 GetNumOfChunks(int32 num) const { return isPartitioned(num) ? m_partition->GetNumOfChunks() : FMath::DivideAndRoundUp(num, m_chunkSize); }
+
+	//One task that starts once the prerequisites are done. Its time isn't added to any stage.
+	template <typename Body>
+	FGraphEventRef Launch(Body body, const FGraphEventArray& prerequisites = FGraphEventArray());
+
+	//Runs body(i) for every i in [0, num), a chunk per task. Chunk k waits for chunk k of every stage in the chunk
+	//prerequisites and for all the prerequisites. Returns the events of the chunks.
+	template <typename Body>
+	FGraphEventArray LaunchChunks(EFluidStage stage, int32 num, Body body,
+		std::initializer_list<const FGraphEventArray*> chunkPrerequisites = {}, const FGraphEventArray& prerequisites = FGraphEventArray());
+
+	//Single event for the end of all of them. Waiting on it is cheaper than every chunk of the next stage waiting on every chunk.
+	static FGraphEventRef Join(const FGraphEventArray& events);
+
+	//Blocks until every task has run, then adds the stage times
+	void Wait();
+};
+
+template <typename Body>
+FGraphEventRef FFluidTaskGraph::Launch(Body body, const FGraphEventArray& prerequisites)
+{
+	const bool isCountingAllocations = FFluidAllocationScope::IsCounting();
+	FFluidAllocationScope dispatchScope(false);
+	FGraphEventRef task = FFunctionGraphTask::CreateAndDispatchWhenReady([this, body, isCountingAllocations]() {
+		FFluidAllocationScope taskScope(isCountingAllocations);
+		const uint64 startCycles = FPlatformTime::Cycles64();
+		body();
+		if (m_workerTimings)
+			m_workerTimings->AddBusyCycles(FPlatformTime::Cycles64() - startCycles);
+		}, TStatId(), &prerequisites, ENamedThreads::AnyThread);
+	m_tasks.Add(task);
+	return task;
+}
+
+template <typename Body>
+FGraphEventArray FFluidTaskGraph::LaunchChunks(EFluidStage stage, int32 num, Body body,
+	std::initializer_list<const FGraphEventArray*> chunkPrerequisites, const FGraphEventArray& prerequisites)
+{
+	const int32 numOfChunks = GetNumOfChunks(num);
+	const bool isCountingAllocations = FFluidAllocationScope::IsCounting();
+	FFluidAllocationScope dispatchScope(false);
+	FGraphEventArray chunks;
+	chunks.Reserve(numOfChunks);
+	FGraphEventArray chunkEvents;
+	for (int32 chunk = 0; chunk < numOfChunks; chunk++)
+	{
+		chunkEvents = prerequisites;
+		for (const FGraphEventArray* events : chunkPrerequisites)
+		{
+			check(events->Num() == numOfChunks);
+			chunkEvents.Add((*events)[chunk]);
+		}
+
+		const int32 begin = isPartitioned(num) ? m_partition->GetChunkStart(chunk) : chunk * m_chunkSize;
+		const int32 end = isPartitioned(num) ? m_partition->GetChunkEnd(chunk) : FMath::Min(num, begin + m_chunkSize);
+		chunks.Add(FFunctionGraphTask::CreateAndDispatchWhenReady([this, stage, begin, end, body, isCountingAllocations]() {
+			FFluidAllocationScope taskScope(isCountingAllocations);
+			const uint64 startCycles = FPlatformTime::Cycles64();
+			for (int32 i = begin; i < end; i++)
+			{
+				body(i);
+			}
+			addBusyCycles(stage, FPlatformTime::Cycles64() - startCycles);
+			}, TStatId(), &chunkEvents, ENamedThreads::AnyThread));
+	}
+	m_tasks.Append(chunks);
+	return chunks;
+}
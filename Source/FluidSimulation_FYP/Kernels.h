@@ -3,38 +3,37 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "FluidCore/Kernels.h"
 #include "Kernels.generated.h"
 
-//This Gaussian-like kernel will be used for the interpolation and field calculation
+//This Gaussian-like kernel will be used for the interpolation and field calculation. The maths is FluidCore::FStdKernel.
 USTRUCT()
 struct FSphStdKernel
 {
 	GENERATED_BODY()
 
-		//kernel radius
-		double h, h2, h3, h5;
+	FluidCore::FStdKernel m_kernel;
 
-	FSphStdKernel();
-	explicit FSphStdKernel(double kernelRadius);
-	FSphStdKernel(const FSphStdKernel& other);
-	double operator()(double distance) const;
-	double FirstDerivative(double distance) const;
-	double SecondDerivative(double distance) const;
+	FSphStdKernel() = default;
+	explicit FSphStdKernel(double kernelRadius) : m_kernel(kernelRadius) {}
+	double operator()(double distance) const { return m_kernel(distance); }
+	double FirstDerivative(double distance) const { return m_kernel.FirstDerivative(distance); }
+	double SecondDerivative(double distance) const { return m_kernel.SecondDerivative(distance); }
 	FVector Gradient(double distance, const FVector& directionToCentre) const;
 };
 
-//This Mueller's kernel will only be used for the gradient and Laplacian calculation
+//This Mueller's kernel will only be used for the gradient and Laplacian calculation. The maths is FluidCore::FSpikyKernel.
 USTRUCT()
 struct FSphSpikyKernel
 {
 	GENERATED_BODY()
 
-		double h, h2, h3, h4, h5;
+	FluidCore::FSpikyKernel m_kernel;
 
-	FSphSpikyKernel();
-	explicit FSphSpikyKernel(double kernelRadius);
-	double operator()(double distance) const;
-	double FirstDerivative(double distance) const;
-	double SecondDerivative(double distance) const;
+	FSphSpikyKernel() = default;
+	explicit FSphSpikyKernel(double kernelRadius) : m_kernel(kernelRadius) {}
+	double operator()(double distance) const { return m_kernel(distance); }
+	double FirstDerivative(double distance) const { return m_kernel.FirstDerivative(distance); }
+	double SecondDerivative(double distance) const { return m_kernel.SecondDerivative(distance); }
 	FVector Gradient(double distance, const FVector& directionToCentre) const;
-};
\ No newline at end of file
+};
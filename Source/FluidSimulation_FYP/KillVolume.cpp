@@ -0,0 +1,33 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "KillVolume.h"
+#include "Components/BoxComponent.h"
+
+bool FKillVolumeSnapshot::Contains(const FVector& point) const
+{
+	const FVector localPoint = inverseTransform.TransformPosition(point).GetAbs();
+	return localPoint.X <= extent.X && localPoint.Y <= extent.Y && localPoint.Z <= extent.Z;
+}
+
+// Sets default values
+AKillVolume::AKillVolume()
+{
+ 	// Set this actor to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
+	PrimaryActorTick.bCanEverTick = false;
+
+	m_box = CreateDefaultSubobject<UBoxComponent>(TEXT("Box"));
+	m_box->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	RootComponent = m_box;
+}
+
+FKillVolumeSnapshot AKillVolume::GetSnapshot() const
+{
+	FKillVolumeSnapshot snapshot;
+	FTransform transform = m_box->GetComponentTransform();
+	//the scale goes into the extent so that the inverse transform stays rigid
+	snapshot.extent = m_box->GetScaledBoxExtent();
+	transform.SetScale3D(FVector(1.0f));
+	snapshot.inverseTransform = transform.Inverse();
+	return snapshot;
+}
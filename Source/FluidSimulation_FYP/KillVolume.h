@@ -0,0 +1,33 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "KillVolume.generated.h"
+
+//Kill volume box for one simulation step, safe to read from worker threads
+struct FLUIDSIMULATION_FYP_API FKillVolumeSnapshot
+{
+	FTransform inverseTransform;
+	FVector extent;
+
+	bool Contains(const FVector& point) const;
+};
+
+//Particles that enter the box are removed from the simulation (drains, the floor below a fountain...)
+UCLASS()
+class FLUIDSIMULATION_FYP_API AKillVolume : public AActor
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditDefaultsOnly, Category = "Components")
+	class UBoxComponent* m_box;
+
+public:	
+	// Sets default values for this actor's properties
+	AKillVolume();
+
+	//Must be called on the game thread
+	FKillVolumeSnapshot GetSnapshot() const;
+};
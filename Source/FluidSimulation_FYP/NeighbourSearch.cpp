@@ -3,101 +3,7 @@
 
 #include "NeighbourSearch.h"
 #include "FluidParticle.h"
-
-size_t UNeighbourSearch::getHashKeyFromPosition(const FVector& pos) const
-{
-	FIntVector bucketIndex;
-
-	//get the bucket index
-	bucketIndex = getBucketIndex(pos);
-
-	//get the hash key from the bucket index
-	return getHashKeyFromBucketIndex(bucketIndex);
-}
-
-FIntVector UNeighbourSearch::getBucketIndex(const FVector& pos) const
-{
-	FIntVector bucketIndex;
-	bucketIndex.X = FMath::Floor(pos.X / m_gridSpacing);
-	bucketIndex.Y = FMath::Floor(pos.Y / m_gridSpacing);
-	bucketIndex.Z = FMath::Floor(pos.Z / m_gridSpacing);
-	return bucketIndex;
-}
-
-size_t UNeighbourSearch::getHashKeyFromBucketIndex(const FIntVector& bucketIndex) const
-{
-	FIntVector wrappedIndex = bucketIndex;
-	wrappedIndex.X = bucketIndex.X % m_resolution.X;
-	wrappedIndex.Y = bucketIndex.Y % m_resolution.Y;
-	wrappedIndex.Z = bucketIndex.Z % m_resolution.Z;
-
-	if (wrappedIndex.X < 0) { wrappedIndex.X += m_resolution.X; }
-	if (wrappedIndex.Y < 0) { wrappedIndex.Y += m_resolution.Y; }
-	if (wrappedIndex.Z < 0) { wrappedIndex.Z += m_resolution.Z; }
-
-	return static_cast<size_t>((wrappedIndex.Y * m_resolution.Z + wrappedIndex.Z) * m_resolution.X + wrappedIndex.X);
-}
-
-void UNeighbourSearch::getNearbyKeys(const FVector& pos, size_t* nearbyKeys) const
-{
-	FIntVector originIndex = getBucketIndex(pos);
-	FIntVector nearbyBucketIndices[8];
-
-	for (int i = 0; i < 8; i++)
-	{
-		nearbyBucketIndices[i] = originIndex;
-	}
-
-	if ((originIndex.X + 0.5f) * m_gridSpacing <= pos.X)
-	{
-		nearbyBucketIndices[4].X += 1;
-		nearbyBucketIndices[5].X += 1;
-		nearbyBucketIndices[6].X += 1;
-		nearbyBucketIndices[7].X += 1;
-	}
-	else
-	{
-		nearbyBucketIndices[4].X -= 1;
-		nearbyBucketIndices[5].X -= 1;
-		nearbyBucketIndices[6].X -= 1;
-		nearbyBucketIndices[7].X -= 1;
-	}
-
-	if ((originIndex.Z + 0.5f) * m_gridSpacing <= pos.Z)
-	{
-		nearbyBucketIndices[2].Z += 1;
-		nearbyBucketIndices[3].Z += 1;
-		nearbyBucketIndices[6].Z += 1;
-		nearbyBucketIndices[7].Z += 1;
-	}
-	else
-	{
-		nearbyBucketIndices[2].Z -= 1;
-		nearbyBucketIndices[3].Z -= 1;
-		nearbyBucketIndices[6].Z -= 1;
-		nearbyBucketIndices[7].Z -= 1;
-	}
-
-	if ((originIndex.Y + 0.5f) * m_gridSpacing <= pos.Y)
-	{
-		nearbyBucketIndices[1].Y += 1;
-		nearbyBucketIndices[3].Y += 1;
-		nearbyBucketIndices[5].Y += 1;
-		nearbyBucketIndices[7].Y += 1;
-	}
-	else
-	{
-		nearbyBucketIndices[1].Y -= 1;
-		nearbyBucketIndices[3].Y -= 1;
-		nearbyBucketIndices[5].Y -= 1;
-		nearbyBucketIndices[7].Y -= 1;
-	}
-
-	for (int i = 0; i < 8; i++)
-	{
-		nearbyKeys[i] = getHashKeyFromBucketIndex(nearbyBucketIndices[i]);
-	}
-}
+#include "FluidCoreTypes.h"
 
 // Sets default values for this component's properties
 UNeighbourSearch::UNeighbourSearch()
@@ -111,59 +17,26 @@ UNeighbourSearch::UNeighbourSearch()
 
 void UNeighbourSearch::initialiseNeighbourSearcher(const FIntVector& resolution, double gridSpacing)
 {
-	m_resolution = resolution;
-	m_gridSpacing = gridSpacing;
+	m_grid.Initialise(resolution.X, resolution.Y, resolution.Z, gridSpacing);
 }
 
 void UNeighbourSearch::build(const TArray<class AFluidParticle*>& points)
 {
-	m_buckets.Empty();
-	m_particlePositions.Empty();
-
-	if (points.Num() == 0)
-	{
-		return;
-	}
-
-	//Allocate memory chuncks
-	m_buckets.Reserve(m_resolution.X * m_resolution.Y * m_resolution.Z);
-	m_buckets.SetNumZeroed(m_resolution.X * m_resolution.Y * m_resolution.Z);
-	m_particlePositions.Reserve(points.Num());
-
-	//Put points into buckets
-	for (size_t i = 0; i < points.Num(); i++)
-	{
-		m_particlePositions.Add(points[i]->GetParticlePosition());
-		size_t key = getHashKeyFromPosition(m_particlePositions[i]);
-		m_buckets[key].Push(i);
-	}
+	m_grid.Build(points.Num(), [&](size_t i) {
+		return ToCore(points[i]->GetParticlePosition());
+		});
 }
 
-void UNeighbourSearch::forEachNearbyPoint(const FVector& origin, double radius, const ForEachNearbyPointCallback& callback)
+void UNeighbourSearch::build(const TArray<FVector>& points)
 {
-	if (m_buckets.Num() == 0)
-	{
-		return;
-	}
-
-	size_t nearbyKeys[8];
-	getNearbyKeys(origin, nearbyKeys);
-
-	const double queryRadiusSquared = radius * radius;
-
-	for (int i = 0; i < 8; i++)
-	{
-		const auto& bucket = m_buckets[nearbyKeys[i]];
-		size_t numberOfPointsInBucket = bucket.Num();
+	m_grid.Build(points.Num(), [&](size_t i) {
+		return ToCore(points[i]);
+		});
+}
 
-		for (size_t j = 0; j < numberOfPointsInBucket; ++j)
-		{
-			size_t pointIndex = bucket[j];
-			double rSquared = (m_particlePositions[pointIndex] - origin).SizeSquared();
-			if (rSquared <= queryRadiusSquared)
-			{
-				callback(pointIndex, m_particlePositions[pointIndex]);
-			}
-		}
-	}
-}
\ No newline at end of file
+void UNeighbourSearch::forEachNearbyPoint(const FVector& origin, double radius, ForEachNearbyPointCallback callback) const
+{
+	m_grid.ForEachNearbyPoint(ToCore(origin), radius, [&](size_t pointIndex, const FluidCore::FVec3& position) {
+		callback(pointIndex, FromCore(position));
+		});
+}
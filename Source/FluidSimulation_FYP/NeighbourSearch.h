@@ -4,26 +4,19 @@
 
 #include "CoreMinimal.h"
 #include "Components/ActorComponent.h"
+#include "FluidCore/NeighbourGrid.h"
 #include "NeighbourSearch.generated.h"
 
-//grid based hashing algorithm
+//grid based hashing algorithm. The grid is FluidCore::FNeighbourGrid; this component feeds it the particles of the game.
 UCLASS( ClassGroup=(Custom), meta=(BlueprintSpawnableComponent) )
 class FLUIDSIMULATION_FYP_API UNeighbourSearch : public UActorComponent
 {
 	GENERATED_BODY()
 public:
-	typedef TFunction<void(size_t, const FVector&)> ForEachNearbyPointCallback;
+	typedef TFunctionRef<void(size_t, const FVector&)> ForEachNearbyPointCallback;
 
 private:
-	double m_gridSpacing = 2.0; //radius * 2
-	FIntVector m_resolution = FIntVector(64, 64, 64); //the higher the resolution the better
-	TArray<TArray<size_t>> m_buckets;
-	TArray<FVector> m_particlePositions;
-
-	size_t getHashKeyFromPosition(const FVector& pos) const;
-	FIntVector getBucketIndex(const FVector& pos) const;
-	size_t getHashKeyFromBucketIndex(const FIntVector& bucketIndex) const;
-	void getNearbyKeys(const FVector& pos, size_t* nearbyKeys) const;
+	FluidCore::FNeighbourGrid m_grid;
 
 public:	
 	// Sets default values for this component's properties
@@ -31,5 +24,7 @@ public:
 
 	void initialiseNeighbourSearcher(const FIntVector& resolution, double gridSpacing);
 	void build(const TArray<class AFluidParticle*>& points);
-	void forEachNearbyPoint(const FVector& origin, double radius, const ForEachNearbyPointCallback& callback);	
-};
\ No newline at end of file
+	void build(const TArray<FVector>& points);
+	void forEachNearbyPoint(const FVector& origin, double radius, ForEachNearbyPointCallback callback) const;
+	const FluidCore::FNeighbourGrid& GetGrid() const { return m_grid; }
+};
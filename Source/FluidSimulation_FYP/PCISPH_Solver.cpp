@@ -4,8 +4,8 @@
 #include "PCISPH_Solver.h"
 #include "FluidSimulation_FYPGameModeBase.h"
 #include "FluidParticle.h"
-#include "BCCLatticePointsGenerator.h"
 #include "Kernels.h"
+#include "FluidCore/SphStages.h"
 
 APCISPH_Solver::APCISPH_Solver()
 {
@@ -15,129 +15,73 @@ APCISPH_Solver::APCISPH_Solver()
 double APCISPH_Solver::computeDelta(double timeStepInSeconds)
 {
 	const double kernelRadius = m_gameMode->GetKernelRadius();
-	TArray<FVector> points;
-	FVector origin = FVector(0.0f);
-
-	FVector lowercorner = FVector(0.0f);
-	FVector uppercorner = FVector(0.0f);
-	lowercorner -= FVector(1.5 * kernelRadius);
-	uppercorner += FVector(1.5 * kernelRadius);
-
-	BCCLatticePointsGenerator pointsGenerator; //find a way to generate points in the body-centered cubic pattern. 
-	//(This pattern has one point in the center of the unit cube and eight corner points.)
-
-	pointsGenerator.generate(lowercorner, uppercorner, m_gameMode->GetTargetSpacing(), &points);
-
-	FSphSpikyKernel kernel(kernelRadius);
-	double denom = 0;
-	FVector denom1;
-	double denom2 = 0;
-
-	size_t n = points.Num();
-
-	ParallelFor(n, [&](size_t i) {
-		const FVector& point = points[i];
-		double distanceSquared = point.SizeSquared();
-
-		if (distanceSquared < kernelRadius * kernelRadius)
-		{
-			double distance = FMath::Sqrt(distanceSquared);
-			FVector direction = (distance > 0.0) ? point / distance : FVector(0.0f);
-
-			//grad(Wij)
-			FVector gradWij = kernel.Gradient(distance, direction);
-			denom1 += gradWij;
-			denom2 += FVector::DotProduct(gradWij, gradWij);
-		}
-	});	
-
-	denom += FVector::DotProduct(-denom1, denom1) - denom2;
-
-	return (FMath::Abs(denom) > 0.0) ? -1 / (computeBeta(timeStepInSeconds) * denom) : 0.0;
-}
+	if (kernelRadius != m_deltaKernelRadius || m_gameMode->GetTargetSpacing() != m_deltaTargetSpacing)
+	{
+		m_deltaKernelRadius = kernelRadius;
+		m_deltaTargetSpacing = m_gameMode->GetTargetSpacing();
+		//a few hundred lattice points, summed on one thread so the sums don't race
+		m_deltaDenominator = FluidCore::ComputePcisphDenominator(kernelRadius, m_deltaTargetSpacing);
+	}
 
-double APCISPH_Solver::computeBeta(double timeStepInSeconds)
-{
-	return 2.0 * FMath::Square((*m_ptrParticles)[0]->kMass * timeStepInSeconds / m_gameMode->GetTargetDensity());
+	//delta is computed for a particle at the base resolution and rescaled per particle
+	return FluidCore::ComputePcisphDelta(m_deltaDenominator, AFluidParticle::kMass, m_gameMode->GetTargetDensity(), timeStepInSeconds);
 }
 
-void APCISPH_Solver::computePressureGradientForce(double timeStepInSeconds, const TArray<double>& densities)
+void APCISPH_Solver::computePressureGradientForce(double timeStepInSeconds, TArrayView<const double> densities)
 {
 	//do the accumulatepressureforce function here
 	size_t n = m_ptrParticles->Num();
 
-	const double massSquared = (*m_ptrParticles)[0]->kMass * (*m_ptrParticles)[0]->kMass;
-	const FSphSpikyKernel kernel(m_gameMode->GetKernelRadius());
-
-	FCriticalSection Mutex;
-	ParallelFor(n, [&](size_t i) {
+	m_gameMode->ParallelForNeighbourLoop(n, [&](int32 i) {
 		const auto& neighbours = (*m_gameMode->GetNeighbourLists())[i];
 		for (size_t j : neighbours)
 		{
 			double dist = FVector::Distance((*m_ptrParticles)[i]->GetParticlePosition(), (*m_ptrParticles)[j]->GetParticlePosition());
 			if (dist > 0.0)
 			{
+				const double massSquared = (*m_ptrParticles)[i]->GetParticleMass() * (*m_ptrParticles)[j]->GetParticleMass();
+				const FSphSpikyKernel kernel(m_gameMode->GetKernelRadius((*m_ptrParticles)[i], (*m_ptrParticles)[j]));
 				FVector dir = ((*m_ptrParticles)[j]->GetParticlePosition() - (*m_ptrParticles)[i]->GetParticlePosition()) / dist;
 				FVector pressureForceResult = m_tempPressureForces[i] - massSquared *
 					((*m_ptrParticles)[i]->GetParticlePressure() / (densities[i] * densities[i]) +
 						(*m_ptrParticles)[j]->GetParticlePressure() / (densities[j] * densities[j])) *
 					kernel.Gradient(dist, dir);
-				//Mutex.Lock();
 				m_tempPressureForces[i] = pressureForceResult;
-				//Mutex.Unlock();
 			}
 		}
-		if (m_showDebugText)
-		{
-			if (i == 723)
-				UE_LOG(LogTemp, Warning, TEXT("Particle 723 predict pressure FORCE: %s"), *m_tempPressureForces[i].ToString());
-		}
+		m_tempPressureForces[i] += computeBoundaryPressureForce(i, (*m_ptrParticles)[i]->GetParticlePosition(), (*m_ptrParticles)[i]->GetParticlePressure(), densities[i]);
+		FLUID_PROBE(m_probes, (*m_ptrParticles)[i], PredictedPressureForce, m_tempPressureForces[i]);
 		});
 }
 
 void APCISPH_Solver::onBeginAdvanceTimeStep()
 {
-	size_t n = m_gameMode->GetNumberOfParticles();
+	size_t n = m_ptrParticles->Num();
+	const int32 capacity = m_gameMode->GetParticleCapacity();
 
 	//Initialise buffers
-	//m_tempPositions.Reserve(n);
-	//m_tempVelocities.Reserve(n);
-	//m_tempPressureForces.Reserve(n);
-	//m_densityErrors.Reserve(n);
-
-	m_tempPositions.SetNumZeroed(n);
-	m_tempVelocities.SetNumZeroed(n);
-	m_tempPressureForces.SetNumZeroed(n);
-	m_densityErrors.SetNumZeroed(n);
+	m_tempPositions = m_scratch.AllocateZeroed<FVector>(n, capacity);
+	m_tempVelocities = m_scratch.AllocateZeroed<FVector>(n, capacity);
+	m_tempPressureForces = m_scratch.AllocateZeroed<FVector>(n, capacity);
+	m_densityErrors = m_scratch.AllocateZeroed<double>(n, capacity);
 }
 
 void APCISPH_Solver::accumulatePressureForce(double timeStepInSeconds)
 {
-	size_t n = m_gameMode->GetNumberOfParticles();
+	FLUID_STAGE_SCOPE(m_gameMode->GetStageTimings(), Pressure);
+	size_t n = m_ptrParticles->Num();
 	const double targetDensity = m_gameMode->GetTargetDensity();
-	const double mass = (*m_ptrParticles)[0]->kMass;
 	const double delta = computeDelta(timeStepInSeconds); //the scalar maps the density to the optimal pressure that cancels out density error.
 	if (m_showDebugText)
 		UE_LOG(LogTemp, Warning, TEXT("delta: %f"), delta);
 	//Predicted density ds
-	TArray<double> ds;
-	FSphStdKernel kernel(m_gameMode->GetKernelRadius());
-
-	//Initialise buffers
-	//ds.Reserve(n);
-	ds.SetNumZeroed(n);
+	const TArrayView<double> ds = m_scratch.Allocate<double>(n, m_gameMode->GetParticleCapacity());
 
-	n = m_ptrParticles->Num();
-
-	FCriticalSection Mutex;
-	ParallelFor(n, [&](size_t i) {
-		Mutex.Lock();
+	parallelFor(n, [&](size_t i) {
 		(*m_ptrParticles)[i]->SetParticlePressure(0.0);
-		Mutex.Unlock();
 		m_tempPressureForces[i] = FVector(0.0f);
 		m_densityErrors[i] = 0.0;
 		ds[i] = (*m_ptrParticles)[i]->GetParticleDensity();
-		//Mutex.Unlock();
 		});
 
 	unsigned int maxNumberIter = 0;
@@ -146,43 +90,41 @@ void APCISPH_Solver::accumulatePressureForce(double timeStepInSeconds)
 
 	for (unsigned int k = 0; k < m_maxNumberOfIterations; ++k)
 	{
+		FLUID_SCOPE(PCISPHIteration);
 		//Predict velocity and position (perform time integration from the current state to the temp state)
-		ParallelFor(n, [&](size_t i) {
+		parallelFor(n, [&](size_t i) {
 			FVector predictVel = (*m_ptrParticles)[i]->GetParticleVelocity() + timeStepInSeconds *
-				((*m_ptrParticles)[i]->GetParticleForce() + m_tempPressureForces[i]) / mass;
+				((*m_ptrParticles)[i]->GetParticleForce() + m_tempPressureForces[i]) / (*m_ptrParticles)[i]->GetParticleMass();
 
 			FVector predictPos = (*m_ptrParticles)[i]->GetParticlePosition() + timeStepInSeconds * predictVel;
 
 			m_tempVelocities[i] = predictVel;
 			m_tempPositions[i] = predictPos;
 
-			if (m_showDebugText)
-			{
-				if (i == 723)
-				{
-					UE_LOG(LogTemp, Warning, TEXT("Particle 723 predict VELOCITY: %s"), *predictVel.ToString());
-					UE_LOG(LogTemp, Warning, TEXT("Particle 723 predict POSITION: %s"), *predictPos.ToString());
-				}
-			}
+			FLUID_PROBE(m_probes, (*m_ptrParticles)[i], PredictedVelocity, predictVel);
+			FLUID_PROBE(m_probes, (*m_ptrParticles)[i], PredictedPosition, predictPos);
 			});
 
 		//Resolve collisions. DISABLED THIS FOR NOW. IT'S CAUSING FREEZE
 		//resolveCollision(&m_tempPositions, &m_tempVelocities); 
 
 		//Compute pressure from density error
-		ParallelFor(n, [&](size_t i) {
-			double weightSum = 0.0;
+		m_gameMode->ParallelForNeighbourLoop(n, [&](int32 i) {
+			const AFluidParticle* particle = (*m_ptrParticles)[i];
+			double density = particle->GetParticleMass() * FSphStdKernel(m_gameMode->GetKernelRadius() * particle->GetParticleScale())(0.0);
 			const auto& neighbours = (*m_gameMode->GetNeighbourLists())[i];
 			for (size_t j : neighbours)
 			{
 				double dist = FVector::Distance(m_tempPositions[j], m_tempPositions[i]);
-				weightSum += kernel(dist);
+				FSphStdKernel kernel(m_gameMode->GetKernelRadius(particle, (*m_ptrParticles)[j]));
+				density += (*m_ptrParticles)[j]->GetParticleMass() * kernel(dist);
 			}
-			weightSum += kernel(0);
+			density += m_gameMode->BoundaryDensityAt(i, m_tempPositions[i]);
 
-			double density = mass * weightSum;
+			//delta scales with 1 / mass^2 through beta and with h^8 through the squared spiky gradients
+			const double particleDelta = delta * FMath::Square(AFluidParticle::kMass / particle->GetParticleMass()) * FMath::Pow(particle->GetParticleScale(), 8.0);
 			double densityError = (density - targetDensity);
-			double pressure = delta * densityError;
+			double pressure = particleDelta * densityError;
 
 			if (pressure < 0.0)
 			{
@@ -192,25 +134,17 @@ void APCISPH_Solver::accumulatePressureForce(double timeStepInSeconds)
 			double newParticlePressure = (*m_ptrParticles)[i]->GetParticlePressure() + pressure;
 			newParticlePressure /= 100.0; //PRESSURE VALUE IS TOO HIGH!!!!! THIS IS A HACK FIX!!! 
 
-			Mutex.Lock();
 			(*m_ptrParticles)[i]->SetParticlePressure(newParticlePressure);
-			Mutex.Unlock();
 			ds[i] = density;
 			m_densityErrors[i] = densityError;
 
-			if (m_showDebugText)
-			{
-				if (i == 723)
-				{
-					UE_LOG(LogTemp, Warning, TEXT("Particle 723 predict DENSITY: %f"), density);
-					UE_LOG(LogTemp, Warning, TEXT("Particle 723 predict DENSITY ERROR: %f"), densityError);
-					UE_LOG(LogTemp, Warning, TEXT("Particle 723 predict PRESSURE: %f"), newParticlePressure);
-				}
-			}
+			FLUID_PROBE(m_probes, particle, PredictedDensity, density);
+			FLUID_PROBE(m_probes, particle, DensityError, densityError);
+			FLUID_PROBE(m_probes, particle, PredictedPressure, newParticlePressure);
 			});
 
 		//Compute pressure gradient force
-		m_tempPressureForces.SetNumZeroed(n);
+		FMemory::Memzero(m_tempPressureForces.GetData(), n * sizeof(FVector));
 		computePressureGradientForce(timeStepInSeconds, ds);
 
 		//Compute max density error
@@ -228,6 +162,7 @@ void APCISPH_Solver::accumulatePressureForce(double timeStepInSeconds)
 		}
 	}
 
+	SET_DWORD_STAT(STAT_FluidPCISPHIterations, maxNumberIter);
 	if (m_showDebugText)
 	{
 		UE_LOG(LogTemp, Warning, TEXT("Number of PCI iterations: %i"), maxNumberIter);
@@ -240,17 +175,11 @@ void APCISPH_Solver::accumulatePressureForce(double timeStepInSeconds)
 	}
 
 	//Accumulate pressure force
-	ParallelFor(n, [&](size_t i) {
+	parallelFor(n, [&](size_t i) {
 		FVector newPressureForce = (*m_ptrParticles)[i]->GetParticleForce() + m_tempPressureForces[i];
 
-		Mutex.Lock();
 		(*m_ptrParticles)[i]->SetParticleForce(newPressureForce);
-		Mutex.Unlock();
-		if (m_showDebugText)
-		{
-			if (i == 723)
-				UE_LOG(LogTemp, Warning, TEXT("Particle 723 compute pressure FORCE: %s"), *newPressureForce.ToString());
-		}
+		FLUID_PROBE(m_probes, (*m_ptrParticles)[i], PressureForce, newPressureForce);
 		});
 }
 
@@ -17,14 +17,20 @@ class FLUIDSIMULATION_FYP_API APCISPH_Solver : public AParticleSystemSolver
 	double m_maxDensityErrorRatio{ 0.1 };
 	unsigned int m_maxNumberOfIterations{ 5 };
 
-	TArray<FVector> m_tempPositions;
-	TArray<FVector> m_tempVelocities;
-	TArray<FVector> m_tempPressureForces;
-	TArray<double> m_densityErrors;
+	//scratch buffers of the step
+	TArrayView<FVector> m_tempPositions;
+	TArrayView<FVector> m_tempVelocities;
+	TArrayView<FVector> m_tempPressureForces;
+	TArrayView<double> m_densityErrors;
+
+	//Sum over the lattice around a particle that delta comes from. It only depends on the kernel radius and the spacing,
+	//so it's kept until either of them changes.
+	double m_deltaDenominator{ 0.0 };
+	double m_deltaKernelRadius{ 0.0 };
+	double m_deltaTargetSpacing{ 0.0 };
 	
 	double computeDelta(double timeStepInSeconds);
-	double computeBeta(double timeStepInSeconds);
-	void computePressureGradientForce(double timeStepInSeconds, const TArray<double>& densities);
+	void computePressureGradientForce(double timeStepInSeconds, TArrayView<const double> densities);
 
 protected:
 	void onBeginAdvanceTimeStep() override;
@@ -0,0 +1,130 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ParticleCache.h"
+#include "Runtime/Core/Public/Async/ParallelFor.h"
+
+//"FPCH"
+const uint32 FParticleCacheFrame::kFileMagic = 0x48435046;
+const uint32 FParticleCacheFrame::kFileVersion = 2;
+
+namespace
+{
+	//Small differences of either sign become small unsigned numbers, which take a single byte as a varint
+	uint16 zigZagEncode(int16 value) { return static_cast<uint16>((value << 1) ^ (value >> 15)); }
+	int16 zigZagDecode(uint16 value) { return static_cast<int16>((value >> 1) ^ -static_cast<int16>(value & 1)); }
+}
+
+void FParticleCacheFrame::SetNumOfParticles(int32 numOfParticles)
+{
+	header.numOfParticles = numOfParticles;
+	values.SetNumUninitialized(FParticleCacheFrameHeader::NumOfChannels * numOfParticles, false);
+}
+
+FVector FParticleCacheFrame::GetPosition(int32 i) const
+{
+	return FVector(GetValue(FParticleCacheFrameHeader::PositionX, i), GetValue(FParticleCacheFrameHeader::PositionY, i), GetValue(FParticleCacheFrameHeader::PositionZ, i));
+}
+
+FVector FParticleCacheFrame::GetVelocity(int32 i) const
+{
+	return FVector(GetValue(FParticleCacheFrameHeader::VelocityX, i), GetValue(FParticleCacheFrameHeader::VelocityY, i), GetValue(FParticleCacheFrameHeader::VelocityZ, i));
+}
+
+void FParticleCacheFrame::Quantise()
+{
+	const int32 n = header.numOfParticles;
+	quantisedValues.SetNumUninitialized(values.Num(), false);
+	ParallelFor(FParticleCacheFrameHeader::NumOfChannels, [&](int32 c) {
+		const float* channel = values.GetData() + c * n;
+		float minValue = n > 0 ? channel[0] : 0.0f;
+		float maxValue = minValue;
+		for (int32 i = 1; i < n; i++)
+		{
+			minValue = FMath::Min(minValue, channel[i]);
+			maxValue = FMath::Max(maxValue, channel[i]);
+		}
+		header.channelMin[c] = minValue;
+		header.channelMax[c] = maxValue;
+
+		const float scale = (maxValue > minValue) ? 65535.0f / (maxValue - minValue) : 0.0f;
+		uint16* quantisedChannel = quantisedValues.GetData() + c * n;
+		for (int32 i = 0; i < n; i++)
+		{
+			quantisedChannel[i] = static_cast<uint16>(FMath::RoundToInt((channel[i] - minValue) * scale));
+		}
+		});
+}
+
+void FParticleCacheFrame::Encode(bool isQuantised, const FParticleCacheFrame* previousFrame, TArray<uint8>* bytes) const
+{
+	if (!isQuantised)
+	{
+		bytes->Append(reinterpret_cast<const uint8*>(values.GetData()), values.Num() * sizeof(float));
+		return;
+	}
+
+	const bool isDelta = !header.isKeyFrame && previousFrame != nullptr;
+	for (int32 k = 0; k < quantisedValues.Num(); k++)
+	{
+		//the difference wraps around, which the decoder undoes exactly
+		const uint16 value = isDelta ? static_cast<uint16>(quantisedValues[k] - previousFrame->quantisedValues[k]) : quantisedValues[k];
+		uint32 zigZag = zigZagEncode(static_cast<int16>(value));
+		while (zigZag >= 0x80)
+		{
+			bytes->Add(static_cast<uint8>(zigZag | 0x80));
+			zigZag >>= 7;
+		}
+		bytes->Add(static_cast<uint8>(zigZag));
+	}
+}
+
+bool FParticleCacheFrame::Decode(bool isQuantised, const uint8* data, const FParticleCacheFrame* previousFrame)
+{
+	const int32 n = header.numOfParticles;
+	SetNumOfParticles(n);
+	if (!isQuantised)
+	{
+		if (header.dataSize != values.Num() * sizeof(float))
+		{
+			return false;
+		}
+		FMemory::Memcpy(values.GetData(), data, header.dataSize);
+		return true;
+	}
+
+	const bool isDelta = !header.isKeyFrame;
+	if (isDelta && (previousFrame == nullptr || previousFrame->quantisedValues.Num() != values.Num()))
+	{
+		return false;
+	}
+
+	quantisedValues.SetNumUninitialized(values.Num(), false);
+	const uint8* end = data + header.dataSize;
+	for (int32 k = 0; k < quantisedValues.Num(); k++)
+	{
+		uint32 zigZag = 0;
+		for (int32 shift = 0; ; shift += 7)
+		{
+			if (data >= end || shift > 14)
+			{
+				return false;
+			}
+			const uint8 byte = *data++;
+			zigZag |= static_cast<uint32>(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0)
+				break;
+		}
+		const uint16 value = static_cast<uint16>(zigZagDecode(static_cast<uint16>(zigZag)));
+		quantisedValues[k] = isDelta ? static_cast<uint16>(previousFrame->quantisedValues[k] + value) : value;
+	}
+
+	ParallelFor(FParticleCacheFrameHeader::NumOfChannels, [&](int32 c) {
+		const float step = (header.channelMax[c] - header.channelMin[c]) / 65535.0f;
+		for (int32 i = 0; i < n; i++)
+		{
+			values[c * n + i] = header.channelMin[c] + quantisedValues[c * n + i] * step;
+		}
+		});
+	return data == end;
+}
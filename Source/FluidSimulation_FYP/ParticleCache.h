@@ -0,0 +1,85 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Particle cache file layout, shared by the writer and the playback reader:
+ * file header, then one frame header plus encoded channels per frame, then the frame index.
+ * Channels are stored one after another (every position X, then every position Y...) so neighbouring values are alike.
+ */
+struct FLUIDSIMULATION_FYP_API FParticleCacheFileHeader
+{
+	enum EFlags : uint32
+	{
+		//channels are 16-bit values relative to each frame's channel bounds instead of 32-bit floats
+		Quantised = 1 << 0
+	};
+
+	uint32 magic{ 0 };
+	uint32 version{ 0 };
+	uint32 flags{ 0 };
+	int32 keyFrameInterval{ 0 };
+	int32 numOfFrames{ 0 };
+	int32 padding{ 0 };
+	//offset of the frame index, written when the cache is closed
+	uint64 indexOffset{ 0 };
+};
+
+struct FLUIDSIMULATION_FYP_API FParticleCacheFrameHeader
+{
+	enum EChannel
+	{
+		PositionX,
+		PositionY,
+		PositionZ,
+		VelocityX,
+		VelocityY,
+		VelocityZ,
+		Density,
+		NumOfChannels
+	};
+
+	double time{ 0.0 };
+	int32 numOfParticles{ 0 };
+	//key frames don't depend on the previous frame, so playback can start decoding from them
+	uint32 isKeyFrame{ 1 };
+	//Particles were added or removed since the previous frame, so particle i may be another particle there.
+	//Such frames are key frames, and playback doesn't blend into them.
+	uint32 isMembershipChanged{ 1 };
+	float channelMin[NumOfChannels] = {};
+	float channelMax[NumOfChannels] = {};
+	//size of the encoded channels that follow the header
+	uint64 dataSize{ 0 };
+};
+
+struct FLUIDSIMULATION_FYP_API FParticleCacheIndexEntry
+{
+	uint64 offset;
+	double time;
+};
+
+//One frame in memory
+struct FLUIDSIMULATION_FYP_API FParticleCacheFrame
+{
+	static const uint32 kFileMagic;
+	static const uint32 kFileVersion;
+
+	FParticleCacheFrameHeader header;
+	//NumOfChannels * numOfParticles values, channel after channel
+	TArray<float> values;
+	TArray<uint16> quantisedValues;
+
+	void SetNumOfParticles(int32 numOfParticles);
+	float GetValue(FParticleCacheFrameHeader::EChannel channel, int32 i) const { return values[channel * header.numOfParticles + i]; }
+	FVector GetPosition(int32 i) const;
+	FVector GetVelocity(int32 i) const;
+
+	//Finds the channel bounds and quantises the values to them
+	void Quantise();
+	//Appends the encoded channels. Quantised frames that aren't key frames are stored as differences from the previous frame.
+	void Encode(bool isQuantised, const FParticleCacheFrame* previousFrame, TArray<uint8>* bytes) const;
+	//Reads the channels of a frame whose header is already set. previousFrame has to be the decoded frame before it unless this is a key frame.
+	bool Decode(bool isQuantised, const uint8* data, const FParticleCacheFrame* previousFrame);
+};
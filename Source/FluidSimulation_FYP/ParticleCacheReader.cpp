@@ -0,0 +1,210 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ParticleCacheReader.h"
+#include "HAL/RunnableThread.h"
+#include "HAL/PlatformFilemanager.h"
+#include "Misc/FileHelper.h"
+#include "Algo/BinarySearch.h"
+
+FParticleCacheReader::~FParticleCacheReader()
+{
+	Close();
+}
+
+bool FParticleCacheReader::Open(const FString& filename, int32 numOfReadAheadFrames)
+{
+	Close();
+
+	m_file.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*filename));
+	if (m_file)
+	{
+		m_region.Reset(m_file->MapRegion(0, m_file->GetFileSize()));
+	}
+	if (m_region)
+	{
+		m_data = m_region->GetMappedPtr();
+		m_size = m_region->GetMappedSize();
+	}
+	else if (FFileHelper::LoadFileToArray(m_fileBytes, *filename, FILEREAD_Silent))
+	{
+		m_data = m_fileBytes.GetData();
+		m_size = m_fileBytes.Num();
+	}
+
+	if (!readFrameIndex())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s isn't a complete particle cache"), *filename);
+		Close();
+		return false;
+	}
+
+	m_numOfReadAheadFrames = FMath::Max(numOfReadAheadFrames, 1);
+	m_requestedFrame.Set(0);
+	m_isStopping = false;
+	m_frameRequestedEvent = FPlatformProcess::GetSynchEventFromPool();
+	m_thread = FRunnableThread::Create(this, TEXT("ParticleCacheReader"));
+	return true;
+}
+
+void FParticleCacheReader::Close()
+{
+	if (m_thread)
+	{
+		Stop();
+		m_thread->WaitForCompletion();
+		delete m_thread;
+		m_thread = nullptr;
+	}
+	if (m_frameRequestedEvent)
+	{
+		FPlatformProcess::ReturnSynchEventToPool(m_frameRequestedEvent);
+		m_frameRequestedEvent = nullptr;
+	}
+
+	m_decodedFrames.Reset();
+	m_decodedFrameIndex = INDEX_NONE;
+	m_frameIndex = TArrayView<const FParticleCacheIndexEntry>();
+	m_data = nullptr;
+	m_size = 0;
+	//the region has to be unmapped before its file is closed
+	m_region.Reset();
+	m_file.Reset();
+	m_fileBytes.Empty();
+}
+
+bool FParticleCacheReader::readFrameIndex()
+{
+	if (m_data == nullptr || m_size < static_cast<int64>(sizeof(FParticleCacheFileHeader)))
+	{
+		return false;
+	}
+	const FParticleCacheFileHeader& header = getFileHeader();
+	if (header.magic != FParticleCacheFrame::kFileMagic || header.version != FParticleCacheFrame::kFileVersion || header.numOfFrames <= 0 ||
+		header.indexOffset + header.numOfFrames * sizeof(FParticleCacheIndexEntry) > static_cast<uint64>(m_size))
+	{
+		//a cache that was never closed has no index
+		return false;
+	}
+
+	m_frameIndex = TArrayView<const FParticleCacheIndexEntry>(reinterpret_cast<const FParticleCacheIndexEntry*>(m_data + header.indexOffset), header.numOfFrames);
+	for (const FParticleCacheIndexEntry& entry : m_frameIndex)
+	{
+		if (entry.offset + sizeof(FParticleCacheFrameHeader) > header.indexOffset ||
+			entry.offset + sizeof(FParticleCacheFrameHeader) + reinterpret_cast<const FParticleCacheFrameHeader*>(m_data + entry.offset)->dataSize > header.indexOffset)
+		{
+			return false;
+		}
+	}
+	return getFrameHeader(0).isKeyFrame != 0;
+}
+
+int32 FParticleCacheReader::FindFrame(double time) const
+{
+	//index of the first frame after the time, minus one
+	const int32 next = Algo::UpperBoundBy(m_frameIndex, time, [](const FParticleCacheIndexEntry& entry) { return entry.time; });
+	return FMath::Clamp(next - 1, 0, GetNumOfFrames() - 1);
+}
+
+FParticleCacheReader::FFramePtr FParticleCacheReader::findDecodedFrame(int32 k)
+{
+	FScopeLock lock(&m_cacheLock);
+	const FFramePtr* frame = m_decodedFrames.Find(k);
+	return frame ? *frame : FFramePtr();
+}
+
+FParticleCacheReader::FFramePtr FParticleCacheReader::GetFrame(int32 k)
+{
+	k = FMath::Clamp(k, 0, GetNumOfFrames() - 1);
+	m_requestedFrame.Set(k);
+	m_frameRequestedEvent->Trigger();
+
+	FFramePtr frame = findDecodedFrame(k);
+	if (!frame.IsValid())
+	{
+		m_numOfPrefetchMisses.Increment();
+		frame = decodeFrame(k);
+	}
+	return frame;
+}
+
+FParticleCacheReader::FFramePtr FParticleCacheReader::decodeFrame(int32 k)
+{
+	FScopeLock decoderLock(&m_decoderLock);
+
+	//Carry on from the decoder state when it is on the way to k, otherwise start again from the key frame before k
+	int32 keyFrame = k;
+	while (keyFrame > 0 && !getFrameHeader(keyFrame).isKeyFrame)
+	{
+		keyFrame--;
+	}
+	const int32 first = (m_decodedFrameIndex >= keyFrame && m_decodedFrameIndex <= k) ? m_decodedFrameIndex + 1 : keyFrame;
+
+	const bool isQuantised = (getFileHeader().flags & FParticleCacheFileHeader::Quantised) != 0;
+	for (int32 f = first; f <= k; f++)
+	{
+		const FParticleCacheFrame& previousFrame = m_decoderFrames[m_currentDecoderFrame];
+		FParticleCacheFrame& frame = m_decoderFrames[1 - m_currentDecoderFrame];
+		frame.header = getFrameHeader(f);
+		if (!frame.Decode(isQuantised, m_data + m_frameIndex[f].offset + sizeof(FParticleCacheFrameHeader), &previousFrame))
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Particle cache frame %i is corrupted"), f);
+			m_decodedFrameIndex = INDEX_NONE;
+			return FFramePtr();
+		}
+		m_currentDecoderFrame = 1 - m_currentDecoderFrame;
+		m_decodedFrameIndex = f;
+	}
+
+	TSharedRef<FParticleCacheFrame, ESPMode::ThreadSafe> decodedFrame = MakeShared<FParticleCacheFrame, ESPMode::ThreadSafe>();
+	decodedFrame->header = m_decoderFrames[m_currentDecoderFrame].header;
+	decodedFrame->values = m_decoderFrames[m_currentDecoderFrame].values;
+	FFramePtr frame = decodedFrame;
+
+	FScopeLock cacheLock(&m_cacheLock);
+	m_decodedFrames.Add(k, frame);
+	return frame;
+}
+
+uint32 FParticleCacheReader::Run()
+{
+	while (!m_isStopping)
+	{
+		const int32 requestedFrame = m_requestedFrame.GetValue();
+		const int32 lastFrame = FMath::Min(requestedFrame + m_numOfReadAheadFrames, GetNumOfFrames() - 1);
+
+		//Keep the frame before the requested one as well, playback interpolates between the two
+		{
+			FScopeLock lock(&m_cacheLock);
+			for (auto it = m_decodedFrames.CreateIterator(); it; ++it)
+			{
+				if (it.Key() < requestedFrame - 1 || it.Key() > lastFrame)
+					it.RemoveCurrent();
+			}
+		}
+
+		bool isAhead = true;
+		for (int32 k = requestedFrame; k <= lastFrame && !m_isStopping; k++)
+		{
+			if (m_requestedFrame.GetValue() != requestedFrame)
+			{
+				//playback moved on (or seeked), start again from the new frame
+				isAhead = false;
+				break;
+			}
+			if (!findDecodedFrame(k).IsValid())
+				decodeFrame(k);
+		}
+
+		if (isAhead)
+			m_frameRequestedEvent->Wait(100);
+	}
+	return 0;
+}
+
+void FParticleCacheReader::Stop()
+{
+	m_isStopping = true;
+	if (m_frameRequestedEvent)
+		m_frameRequestedEvent->Trigger();
+}
@@ -0,0 +1,75 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/Runnable.h"
+#include "HAL/ThreadSafeBool.h"
+#include "HAL/Event.h"
+#include "ParticleCache.h"
+
+class FRunnableThread;
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+/**
+ * Plays back a particle cache. The file is memory mapped and frames are found through its index.
+ * A worker thread decodes the frames after the last requested one, so playback rarely has to decode on the game thread.
+ */
+class FLUIDSIMULATION_FYP_API FParticleCacheReader : public FRunnable
+{
+public:
+	typedef TSharedPtr<const FParticleCacheFrame, ESPMode::ThreadSafe> FFramePtr;
+
+private:
+	TUniquePtr<IMappedFileHandle> m_file;
+	TUniquePtr<IMappedFileRegion> m_region;
+	//only used on platforms that can't map files
+	TArray<uint8> m_fileBytes;
+	const uint8* m_data{ nullptr };
+	int64 m_size{ 0 };
+	TArrayView<const FParticleCacheIndexEntry> m_frameIndex;
+
+	//Frames depend on the ones before them back to a key frame, so the decoder keeps the last frame it decoded
+	FCriticalSection m_decoderLock;
+	FParticleCacheFrame m_decoderFrames[2];
+	int32 m_currentDecoderFrame{ 0 };
+	int32 m_decodedFrameIndex{ INDEX_NONE };
+
+	FCriticalSection m_cacheLock;
+	TMap<int32, FFramePtr> m_decodedFrames;
+	int32 m_numOfReadAheadFrames{ 8 };
+
+	FThreadSafeCounter m_requestedFrame;
+	FEvent* m_frameRequestedEvent{ nullptr };
+	FRunnableThread* m_thread{ nullptr };
+	FThreadSafeBool m_isStopping{ false };
+	FThreadSafeCounter m_numOfPrefetchMisses;
+
+	const FParticleCacheFileHeader& getFileHeader() const { return *reinterpret_cast<const FParticleCacheFileHeader*>(m_data); }
+	const FParticleCacheFrameHeader& getFrameHeader(int32 k) const { return *reinterpret_cast<const FParticleCacheFrameHeader*>(m_data + m_frameIndex[k].offset); }
+	//Checks the file and finds its frame index
+	bool readFrameIndex();
+	FFramePtr decodeFrame(int32 k);
+	FFramePtr findDecodedFrame(int32 k);
+
+public:
+	FParticleCacheReader() = default;
+	~FParticleCacheReader();
+
+	bool Open(const FString& filename, int32 numOfReadAheadFrames);
+	void Close();
+
+	int32 GetNumOfFrames() const { return m_frameIndex.Num(); }
+	double GetFrameTime(int32 k) const { return m_frameIndex[k].time; }
+	double GetDuration() const { return GetNumOfFrames() > 0 ? m_frameIndex.Last().time : 0.0; }
+	//Last frame at or before the time
+	int32 FindFrame(double time) const;
+	int32 GetNumOfPrefetchMisses() const { return m_numOfPrefetchMisses.GetValue(); }
+
+	//Returns a decoded frame and asks the worker to read ahead from it. Decodes on the calling thread if the worker hasn't got there yet.
+	FFramePtr GetFrame(int32 k);
+
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+};
@@ -0,0 +1,165 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ParticleCacheWriter.h"
+#include "HAL/RunnableThread.h"
+#include "HAL/PlatformFilemanager.h"
+#include "Misc/Paths.h"
+
+FParticleCacheWriter::~FParticleCacheWriter()
+{
+	Close();
+}
+
+bool FParticleCacheWriter::Open(const FString& filename, bool isQuantised, int32 keyFrameInterval, int32 numOfFrameBuffers)
+{
+	Close();
+
+	IPlatformFile& platformFile = FPlatformFileManager::Get().GetPlatformFile();
+	platformFile.CreateDirectoryTree(*FPaths::GetPath(filename));
+	m_file.Reset(platformFile.OpenWrite(*filename));
+	if (!m_file)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Couldn't create the particle cache %s"), *filename);
+		return false;
+	}
+	m_filename = filename;
+
+	//the header is written again with the frame count and index offset when the cache is closed
+	m_fileHeader = FParticleCacheFileHeader();
+	m_fileHeader.magic = FParticleCacheFrame::kFileMagic;
+	m_fileHeader.version = FParticleCacheFrame::kFileVersion;
+	m_fileHeader.flags = isQuantised ? FParticleCacheFileHeader::Quantised : 0;
+	m_fileHeader.keyFrameInterval = FMath::Max(keyFrameInterval, 1);
+	m_file->Write(reinterpret_cast<const uint8*>(&m_fileHeader), sizeof(m_fileHeader));
+
+	m_frameIndex.Reset();
+	m_hasPreviousFrame = false;
+	m_numOfFramesSinceKeyFrame = 0;
+	m_numOfSubmittedFrames = 0;
+	m_numOfDroppedFrames = 0;
+	m_numOfParticleFrames = 0;
+	m_numOfBytesWritten = sizeof(m_fileHeader);
+	m_busyTime = 0.0;
+
+	m_frameBuffers.Reset();
+	for (int32 i = 0; i < FMath::Max(numOfFrameBuffers, 1); i++)
+	{
+		m_frameBuffers.Add(MakeUnique<FParticleCacheFrame>());
+		m_freeFrames.Enqueue(m_frameBuffers.Last().Get());
+	}
+
+	m_isStopping = false;
+	m_frameQueuedEvent = FPlatformProcess::GetSynchEventFromPool();
+	m_thread = FRunnableThread::Create(this, TEXT("ParticleCacheWriter"));
+	return m_thread != nullptr;
+}
+
+void FParticleCacheWriter::Close()
+{
+	if (m_thread == nullptr)
+	{
+		return;
+	}
+
+	//Run drains the queue before returning
+	Stop();
+	m_thread->WaitForCompletion();
+	delete m_thread;
+	m_thread = nullptr;
+	FPlatformProcess::ReturnSynchEventToPool(m_frameQueuedEvent);
+	m_frameQueuedEvent = nullptr;
+
+	m_fileHeader.numOfFrames = m_frameIndex.Num();
+	m_fileHeader.indexOffset = m_file->Tell();
+	m_file->Write(reinterpret_cast<const uint8*>(m_frameIndex.GetData()), m_frameIndex.Num() * sizeof(FParticleCacheIndexEntry));
+	m_file->Seek(0);
+	m_file->Write(reinterpret_cast<const uint8*>(&m_fileHeader), sizeof(m_fileHeader));
+	m_file.Reset();
+
+	FParticleCacheFrame* frame;
+	while (m_freeFrames.Dequeue(frame)) {}
+	m_frameBuffers.Reset();
+
+	const double bytesPerParticleFrame = m_numOfParticleFrames > 0 ? static_cast<double>(m_numOfBytesWritten) / m_numOfParticleFrames : 0.0;
+	const double throughput = m_busyTime > 0.0 ? m_numOfBytesWritten / (m_busyTime * 1024.0 * 1024.0) : 0.0;
+	UE_LOG(LogTemp, Warning, TEXT("Particle cache %s: %i frames (%i dropped), %f bytes per particle per frame, %f MB/s"),
+		*m_filename, m_frameIndex.Num(), m_numOfDroppedFrames, bytesPerParticleFrame, throughput);
+}
+
+FParticleCacheFrame* FParticleCacheWriter::BeginFrame()
+{
+	FParticleCacheFrame* frame = nullptr;
+	if (!IsOpen() || !m_freeFrames.Dequeue(frame))
+	{
+		m_numOfDroppedFrames++;
+		return nullptr;
+	}
+	return frame;
+}
+
+void FParticleCacheWriter::SubmitFrame(FParticleCacheFrame* frame)
+{
+	m_numOfSubmittedFrames++;
+	m_queuedFrames.Enqueue(frame);
+	m_frameQueuedEvent->Trigger();
+}
+
+uint32 FParticleCacheWriter::Run()
+{
+	while (true)
+	{
+		FParticleCacheFrame* frame;
+		if (m_queuedFrames.Dequeue(frame))
+		{
+			writeFrame(frame);
+			m_freeFrames.Enqueue(frame);
+		}
+		else if (m_isStopping)
+		{
+			break;
+		}
+		else
+		{
+			m_frameQueuedEvent->Wait(100);
+		}
+	}
+	return 0;
+}
+
+void FParticleCacheWriter::Stop()
+{
+	m_isStopping = true;
+	if (m_frameQueuedEvent)
+		m_frameQueuedEvent->Trigger();
+}
+
+void FParticleCacheWriter::writeFrame(FParticleCacheFrame* frame)
+{
+	const double startTime = FPlatformTime::Seconds();
+	const bool isQuantised = (m_fileHeader.flags & FParticleCacheFileHeader::Quantised) != 0;
+
+	//Differences only make sense between frames with the same particles, so a change in them forces a key frame
+	frame->header.isKeyFrame = !m_hasPreviousFrame || m_numOfFramesSinceKeyFrame >= m_fileHeader.keyFrameInterval ||
+		frame->header.isMembershipChanged || m_previousFrame.header.numOfParticles != frame->header.numOfParticles;
+	m_numOfFramesSinceKeyFrame = frame->header.isKeyFrame ? 1 : m_numOfFramesSinceKeyFrame + 1;
+
+	if (isQuantised)
+		frame->Quantise();
+	m_encodedBytes.Reset();
+	frame->Encode(isQuantised, m_hasPreviousFrame ? &m_previousFrame : nullptr, &m_encodedBytes);
+	frame->header.dataSize = m_encodedBytes.Num();
+
+	m_frameIndex.Add({ static_cast<uint64>(m_file->Tell()), frame->header.time });
+	m_file->Write(reinterpret_cast<const uint8*>(&frame->header), sizeof(frame->header));
+	m_file->Write(m_encodedBytes.GetData(), m_encodedBytes.Num());
+
+	//only the quantised values are needed for the next difference
+	m_previousFrame.header = frame->header;
+	m_previousFrame.quantisedValues = frame->quantisedValues;
+	m_hasPreviousFrame = true;
+
+	m_numOfParticleFrames += frame->header.numOfParticles;
+	m_numOfBytesWritten += sizeof(frame->header) + m_encodedBytes.Num();
+	m_busyTime += FPlatformTime::Seconds() - startTime;
+}
@@ -0,0 +1,66 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/Runnable.h"
+#include "HAL/ThreadSafeBool.h"
+#include "HAL/Event.h"
+#include "Containers/Queue.h"
+#include "ParticleCache.h"
+
+class FRunnableThread;
+class IFileHandle;
+
+/**
+ * Streams particle frames to a cache file on its own thread.
+ * Frames go through a fixed number of buffers: when the writer falls behind, new frames are dropped instead of stalling the simulation.
+ */
+class FLUIDSIMULATION_FYP_API FParticleCacheWriter : public FRunnable
+{
+	TUniquePtr<IFileHandle> m_file;
+	FString m_filename;
+	FParticleCacheFileHeader m_fileHeader;
+	TArray<FParticleCacheIndexEntry> m_frameIndex;
+
+	//Every buffer is either free (owned by the game thread) or queued (owned by the writer thread)
+	TArray<TUniquePtr<FParticleCacheFrame>> m_frameBuffers;
+	TQueue<FParticleCacheFrame*, EQueueMode::Spsc> m_freeFrames;
+	TQueue<FParticleCacheFrame*, EQueueMode::Spsc> m_queuedFrames;
+	FEvent* m_frameQueuedEvent{ nullptr };
+	FRunnableThread* m_thread{ nullptr };
+	FThreadSafeBool m_isStopping{ false };
+
+	//only touched by the writer thread
+	FParticleCacheFrame m_previousFrame;
+	bool m_hasPreviousFrame{ false };
+	TArray<uint8> m_encodedBytes;
+	int32 m_numOfFramesSinceKeyFrame{ 0 };
+
+	//stats
+	int32 m_numOfSubmittedFrames{ 0 };
+	int32 m_numOfDroppedFrames{ 0 };
+	uint64 m_numOfParticleFrames{ 0 };
+	uint64 m_numOfBytesWritten{ 0 };
+	double m_busyTime{ 0.0 };
+
+	void writeFrame(FParticleCacheFrame* frame);
+
+public:
+	FParticleCacheWriter() = default;
+	~FParticleCacheWriter();
+
+	//Creates the file and starts the writer thread. Quantised caches store 16 bits per value instead of 32.
+	bool Open(const FString& filename, bool isQuantised, int32 keyFrameInterval, int32 numOfFrameBuffers);
+	//Waits for the queued frames, writes the frame index and closes the file
+	void Close();
+	bool IsOpen() const { return m_thread != nullptr; }
+
+	//Returns a free frame buffer to fill, or nullptr when every buffer is queued (the frame is then dropped). Game thread only.
+	FParticleCacheFrame* BeginFrame();
+	//Hands a filled buffer from BeginFrame to the writer thread
+	void SubmitFrame(FParticleCacheFrame* frame);
+
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+};
@@ -5,9 +5,15 @@
 #include "FluidSimulation_FYPGameModeBase.h"
 #include "FluidParticle.h"
 #include "Kernels.h"
+#include "FluidCoreTypes.h"
+#include "FluidCore/SphStages.h"
 #include "BCCLatticePointsGenerator.h"
 #include "Collider.h"
 #include "PointParticleEmitter.h"
+#include "KillVolume.h"
+#include "VectorFieldVolume.h"
+#include "SimulationCheckpoint.h"
+#include "FluidTaskGraph.h"
 #include "Kismet/GameplayStatics.h"
 #include "Kismet/KismetMathLibrary.h"
 #include "Runtime/Core/Public/Async/ParallelFor.h"
@@ -19,21 +25,9 @@ void AParticleSystemSolver::onBeginAdvanceTimeStep()
 
 void AParticleSystemSolver::beginAdvanceTimeStep()
 {
-	//Allocate buffers
-	size_t n = m_gameMode->GetNumberOfParticles();
-	//m_newPositions.Reserve(n);
-	//m_newVelocities.Reserve(n);
-	m_newPositions.SetNumZeroed(n);
-	m_newVelocities.SetNumZeroed(n);
-
-	n = m_ptrParticles->Num();
-
 	//Clear forces
-	FCriticalSection Mutex;
-	ParallelFor(n, [&](size_t i) {
-		Mutex.Lock();
+	parallelForActiveParticles([&](size_t i) {
 		(*m_ptrParticles)[i]->SetParticleForce(FVector(0.0f));
-		Mutex.Unlock();
 		});
 
 	if (m_gameMode->IsUsingPCISPH())
@@ -44,18 +38,22 @@ void AParticleSystemSolver::beginAdvanceTimeStep()
 
 void AParticleSystemSolver::endAdvanceTimeStep(double timeIntervalInSeconds)
 {
-	//Update data
-	size_t n = m_ptrParticles->Num();
-
-	FCriticalSection Mutex;
-	ParallelFor(n, [&](size_t i) {
-		Mutex.Lock();
+	//Update data. Each particle only writes its own state.
+	parallelForActiveParticles([&](size_t i) {
 		(*m_ptrParticles)[i]->SetParticlePosition(m_newPositions[i]);
-		(*m_ptrParticles)[i]->SetActorLocation(m_newPositions[i]);
 		(*m_ptrParticles)[i]->SetParticleVelocity(m_newVelocities[i]);
-		Mutex.Unlock();
 		});
 
+	//moving the actors is the engine's business, and it isn't safe off the game thread
+	FFluidAllocationScope actorScope(false);
+	const int32 numOfMovedParticles = m_isMultiRate ? m_numActiveParticles : m_ptrParticles->Num();
+	for (int32 k = 0; k < numOfMovedParticles; k++)
+	{
+		AFluidParticle* particle = (*m_ptrParticles)[m_isMultiRate ? m_particlesByLevel[k] : k];
+		if (!particle->IsParticleDead())
+			particle->SetActorLocation(particle->GetParticlePosition());
+	}
+
 	//this will dampen any noticeable noises (DISABLED FOR NOW BECAUSE IT'S CAUSING ISSUES)
 	//if (m_isViscous)
 	//	computePseudoViscosity(timeIntervalInSeconds);
@@ -63,35 +61,29 @@ void AParticleSystemSolver::endAdvanceTimeStep(double timeIntervalInSeconds)
 
 void AParticleSystemSolver::timeIntegration(double timeIntervalInSeconds)
 {
+	FLUID_STAGE_SCOPE(m_gameMode->GetStageTimings(), Integration);
 	//STAGE 6 - PERFORM TIME INTEGRATION
-
-	//Async(EAsyncExecution::Thread, [&]() {
-	size_t n = m_ptrParticles->Num();
-
-	ParallelFor(n, [&](size_t i) {
-	//for(size_t i = 0; i < n; i++)
-		
-		//Integrate velocity first
-		FVector& newVelocity = m_newVelocities[i];
-		newVelocity = (*m_ptrParticles)[i]->GetParticleVelocity() + timeIntervalInSeconds *
-			(*m_ptrParticles)[i]->GetParticleForce() / (*m_ptrParticles)[i]->kMass;
-		if (m_showDebugText)
-		{
-			if (i == 723)
-				UE_LOG(LogTemp, Warning, TEXT("Particle 723 NEW VELOCITY: %s"), *newVelocity.ToString());
-		}
-
-		//Integrate position.
-		FVector& newPosition = m_newPositions[i];
-		newPosition = (*m_ptrParticles)[i]->GetParticlePosition() + timeIntervalInSeconds * newVelocity;
-		if (m_showDebugText)
-		{
-			if (i == 723)
-				UE_LOG(LogTemp, Warning, TEXT("Particle 723 NEW POSITION: %s"), *(*m_ptrParticles)[i]->GetParticlePosition().ToString());
-		}
+	parallelForActiveParticles([&](size_t i) {
+		integrateParticle(i, getParticleTimeStep(i, timeIntervalInSeconds));
 	});	
 }
 
+void AParticleSystemSolver::integrateParticle(size_t i, double timeStepInSeconds)
+{
+	const AFluidParticle* particle = (*m_ptrParticles)[i];
+
+	//Integrate velocity first, then position
+	FluidCore::FVec3 newPosition;
+	FluidCore::FVec3 newVelocity;
+	FluidCore::IntegrateParticle(ToCore(particle->GetParticlePosition()), ToCore(particle->GetParticleVelocity()), ToCore(particle->GetParticleForce()),
+		particle->GetParticleMass(), timeStepInSeconds, &newPosition, &newVelocity);
+
+	m_newVelocities[i] = FromCore(newVelocity);
+	FLUID_PROBE(m_probes, particle, NewVelocity, m_newVelocities[i]);
+	m_newPositions[i] = FromCore(newPosition);
+	FLUID_PROBE(m_probes, particle, NewPosition, m_newPositions[i]);
+}
+
 // Sets default values for this component's properties
 AParticleSystemSolver::AParticleSystemSolver()
 {
@@ -108,6 +100,19 @@ void AParticleSystemSolver::initPhysicsSolver(TArray<AFluidParticle*>* ptrPartic
 	{
 		m_isViscous = m_gameMode->IsFluidViscous();
 		m_showDebugText = m_gameMode->IsShowingDebugText();
+		m_probes = m_gameMode->GetProbeRecorder();
+		m_isAdaptive = m_gameMode->IsUsingAdaptiveResolution() && NeedsNeighbourLists();
+		m_maxTimeStepLevel = m_gameMode->GetMaxTimeStepLevel();
+		m_useColliderBVH = m_gameMode->IsUsingColliderBVH();
+		//PCISPH corrects the pressure of every particle together, so it always uses a global time step. So does a grid solver.
+		const bool isGlobalSolver = m_gameMode->IsUsingPCISPH() || !NeedsNeighbourLists();
+		m_isMultiRate = m_gameMode->IsUsingMultiRateStepping() && !isGlobalSolver;
+		//PCISPH iterates over every particle until the densities settle, which doesn't split into a fixed graph. Neither do sub-steps.
+		m_useTaskGraph = m_gameMode->IsUsingTaskGraph() && !isGlobalSolver && !m_isMultiRate;
+		if (m_gameMode->IsUsingMultiRateStepping() && isGlobalSolver)
+			UE_LOG(LogTemp, Warning, TEXT("Multi-rate time stepping is not supported by the %s solver. Using a global time step"), NeedsNeighbourLists() ? TEXT("PCISPH") : TEXT("FLIP"));
+		if (m_gameMode->IsUsingAdaptiveResolution() && !NeedsNeighbourLists())
+			UE_LOG(LogTemp, Warning, TEXT("Adaptive resolution needs the neighbour lists, which the FLIP solver doesn't build. Keeping the base resolution"));
 	}
 
 	TArray<AActor*> foundColliders;
@@ -119,12 +124,35 @@ void AParticleSystemSolver::initPhysicsSolver(TArray<AFluidParticle*>* ptrPartic
 		m_colliders.Push(castCollider);
 	}
 
+	TArray<AActor*> foundKillVolumes;
+	UGameplayStatics::GetAllActorsOfClass(GetWorld(), AKillVolume::StaticClass(), foundKillVolumes);
+	for (AActor* a : foundKillVolumes)
+	{
+		m_killVolumes.Push(Cast<AKillVolume>(a));
+	}
+
+	//the fields are baked here rather than in the first step
+	TArray<AActor*> foundVectorFields;
+	UGameplayStatics::GetAllActorsOfClass(GetWorld(), AVectorFieldVolume::StaticClass(), foundVectorFields);
+	for (AActor* a : foundVectorFields)
+	{
+		AVectorFieldVolume* castVectorField = Cast<AVectorFieldVolume>(a);
+		castVectorField->InitialiseField();
+		m_vectorFields.Push(castVectorField);
+	}
+
 	AActor* foundEmitter = UGameplayStatics::GetActorOfClass(GetWorld(), APointParticleEmitter::StaticClass());
+	if (m_gameMode && m_gameMode->IsUsingBoundaryParticles())
+		m_gameMode->InitBoundaryParticles(m_colliders);
+
 	if (foundEmitter)
 	{
 		APointParticleEmitter* castEmitter = Cast<APointParticleEmitter>(foundEmitter);
 		m_emitter = castEmitter;
-		m_emitter->Initialise(ptrParticles);
+		m_emitter->Initialise(m_gameMode);
+		//Emitted particles come from the pool, so there's no spawning while the emitter runs
+		if (m_gameMode)
+			m_gameMode->ReserveParticles(m_ptrParticles->Num() + m_emitter->GetMaxNumOfParticles());
 	}
 	if (m_showDebugText)
 		UE_LOG(LogTemp, Warning, TEXT("we have %i colliders in the world"), m_colliders.Num());
@@ -132,6 +160,7 @@ void AParticleSystemSolver::initPhysicsSolver(TArray<AFluidParticle*>* ptrPartic
 
 void AParticleSystemSolver::OnAdvanceTimeStep(double timeIntervalInSeconds)
 {
+	FLUID_SCOPE(SolverStep);
 	if (m_ptrParticles == nullptr)
 	{
 		UE_LOG(LogTemp, Warning, TEXT("particles pointer isn't initialised"));
@@ -139,7 +168,11 @@ void AParticleSystemSolver::OnAdvanceTimeStep(double timeIntervalInSeconds)
 	}
 	if (m_ptrParticles->Num() == 0)
 	{
-		UE_LOG(LogTemp, Warning, TEXT("particles array is empty"));
+		//an emitter can still refill a scene whose particles have all been removed
+		if (m_emitter)
+			m_emitter->EmitParticles(timeIntervalInSeconds);
+		else
+			UE_LOG(LogTemp, Warning, TEXT("particles array is empty"));
 		return;
 	}
 	if (m_gameMode == nullptr)
@@ -147,81 +180,522 @@ void AParticleSystemSolver::OnAdvanceTimeStep(double timeIntervalInSeconds)
 		UE_LOG(LogTemp, Warning, TEXT("game mode pointer isn't initialised"));
 		return;
 	}
-	beginAdvanceTimeStep();
+	updateColliderSnapshots(timeIntervalInSeconds);
+	updateVectorFieldSnapshots(timeIntervalInSeconds);
 
-	//FOR SOME REASON, CRASHES BY TRYING TO ACCESS A FUNCTION. IT SAYS ACCESS VIOLATION
-	accumulateForces(timeIntervalInSeconds);
-	timeIntegration(timeIntervalInSeconds);
-	
-	resolveCollision(&m_newPositions, &m_newVelocities);
+	//Buffers of the step, with room for the pooled particles too so that emitting doesn't grow them
+	m_scratch.Reset();
+	const int32 capacity = m_gameMode->GetParticleCapacity();
+	m_newPositions = m_scratch.Allocate<FVector>(m_ptrParticles->Num(), capacity);
+	m_newVelocities = m_scratch.Allocate<FVector>(m_ptrParticles->Num(), capacity);
 
-	endAdvanceTimeStep(timeIntervalInSeconds);
+	if (m_isMultiRate)
+	{
+		advanceMultiRate(timeIntervalInSeconds);
+	}
+	else if (m_useTaskGraph)
+	{
+		advanceTaskGraph(timeIntervalInSeconds);
+	}
+	else
+	{
+		beginAdvanceTimeStep();
+
+		//FOR SOME REASON, CRASHES BY TRYING TO ACCESS A FUNCTION. IT SAYS ACCESS VIOLATION
+		accumulateForces(timeIntervalInSeconds);
+		timeIntegration(timeIntervalInSeconds);
+
+		resolveCollision(m_newPositions, m_newVelocities);
+
+		endAdvanceTimeStep(timeIntervalInSeconds);
+	}
+
+	//The neighbour lists are rebuilt at the start of the next step, so particles can be added and removed from here on
+	markDeadParticles(timeIntervalInSeconds);
+
+	if (m_isAdaptive && ++m_stepsSinceAdaptivity >= m_adaptivityInterval)
+	{
+		m_stepsSinceAdaptivity = 0;
+		adaptParticleResolution();
+	}
+
+	if (++m_stepsSinceCompaction >= m_gameMode->GetCompactionInterval())
+	{
+		m_stepsSinceCompaction = 0;
+		compactParticles();
+	}
+
+	if (m_emitter)
+		m_emitter->EmitParticles(timeIntervalInSeconds);
 }
 
-const FVector AParticleSystemSolver::SampleVectorField(const FVector& _subject, const FVector& _vectorField) const
+void AParticleSystemSolver::SaveCheckpointState(FSimulationCheckpointHeader* header) const
 {
-	//this uses radians
-	return FVector(FMath::Sin(_subject.X) * FMath::Sin(_vectorField.Z),
-		FMath::Sin(_subject.Z) * FMath::Sin(_vectorField.Y),
-		FMath::Sin(_subject.Y) * FMath::Sin(_vectorField.X));
+	header->stepsSinceAdaptivity = m_stepsSinceAdaptivity;
+	header->stepsSinceCompaction = m_stepsSinceCompaction;
+	header->numOfLiveEmittedParticles = m_emitter ? m_emitter->GetNumOfLiveParticles() : 0;
+	header->pendingEmission = m_emitter ? m_emitter->GetPendingEmission() : 0.0;
+}
 
-	/*return FVector(UKismetMathLibrary::DegSin(_subject.X) * UKismetMathLibrary::DegSin(_vectorField.Y),
-		UKismetMathLibrary::DegSin(_subject.Y) * UKismetMathLibrary::DegSin(_vectorField.Z),
-		UKismetMathLibrary::DegSin(_subject.Z) * UKismetMathLibrary::DegSin(_vectorField.X));*/
+void AParticleSystemSolver::RestoreCheckpointState(const FSimulationCheckpointHeader& header)
+{
+	m_stepsSinceAdaptivity = header.stepsSinceAdaptivity;
+	m_stepsSinceCompaction = header.stepsSinceCompaction;
+	if (m_emitter)
+		m_emitter->RestoreEmissionState(header.numOfLiveEmittedParticles, header.pendingEmission);
 }
 
-const double AParticleSystemSolver::SampleScalarField(const FVector& _subject) const
+void AParticleSystemSolver::markDeadParticles(double timeIntervalInSeconds)
 {
-	return FMath::Sin(_subject.X) * FMath::Sin(_subject.Y) * FMath::Sin(_subject.Z);
+	FLUID_SCOPE(ParticleRemoval);
+	m_killVolumeSnapshots.Reset();
+	for (const AKillVolume* volume : m_killVolumes)
+	{
+		m_killVolumeSnapshots.Add(volume->GetSnapshot());
+	}
+
+	const double maxLifetime = m_gameMode->GetMaxParticleLifetime();
+	const bool useDomain = m_gameMode->IsUsingSimulationDomain();
+	const FBox domain = m_gameMode->GetSimulationDomain();
+	parallelFor(m_ptrParticles->Num(), [&](int32 i) {
+		AFluidParticle* particle = (*m_ptrParticles)[i];
+		if (particle->IsParticleDead())
+			return;
+
+		const double age = particle->GetParticleAge() + timeIntervalInSeconds;
+		particle->SetParticleAge(age);
+		const FVector& position = particle->GetParticlePosition();
+		bool isDead = (maxLifetime > 0.0 && age > maxLifetime) || (useDomain && !domain.IsInsideOrOn(position));
+		for (const FKillVolumeSnapshot& volume : m_killVolumeSnapshots)
+		{
+			isDead = isDead || volume.Contains(position);
+		}
+		particle->SetParticleDead(isDead);
+		});
+
+	//Removed particles wait for the next compaction, which can be several steps away, so they are hidden straight away.
+	//Actors can only be hidden on the game thread.
+	FFluidAllocationScope actorScope(false);
+	for (AFluidParticle* particle : *m_ptrParticles)
+	{
+		if (particle->IsParticleDead() && !particle->IsHidden())
+			particle->SetActorHiddenInGame(true);
+	}
 }
 
-void AParticleSystemSolver::accumulateForces(double timeStepInSeconds)
+void AParticleSystemSolver::compactParticles()
 {
-	//STAGE 2 & 3	
-	accumulatePressureForce(timeStepInSeconds);
-	//STAGE 4
-	if (m_isViscous)
-		accumulateNonPressureForces(timeStepInSeconds);
-	//STAGE 5
-	accumulateExternalForces(timeStepInSeconds);
+	FLUID_SCOPE(ParticleRemoval);
+	int32 numOfRemovedEmittedParticles = 0;
+	const int32 numOfRemovedParticles = m_gameMode->CompactParticles(&numOfRemovedEmittedParticles);
+	if (m_emitter && numOfRemovedEmittedParticles > 0)
+		m_emitter->OnParticlesRemoved(numOfRemovedEmittedParticles);
+
+	if (m_showDebugText && numOfRemovedParticles > 0)
+		UE_LOG(LogTemp, Warning, TEXT("Removed %i particles (%i emitted)"), numOfRemovedParticles, numOfRemovedEmittedParticles);
 }
 
-void AParticleSystemSolver::accumulateExternalForces(double timeStepInSeconds)
+void AParticleSystemSolver::adaptParticleResolution()
 {
-	//STAGE 5 - COMPUTE THE GRAVITY AND OTHER EXTERNAL FORCES
+	FLUID_SCOPE(AdaptiveResolution);
+	enum class EResolutionAction : uint8 { Keep, Split, Merge };
+
+	const size_t n = m_ptrParticles->Num();
+	const auto& neighbourLists = *m_gameMode->GetNeighbourLists();
+	const double minMass = AFluidParticle::kMass * m_gameMode->GetMinParticleMassRatio();
+	const double maxMass = AFluidParticle::kMass * m_gameMode->GetMaxParticleMassRatio();
+
+	//Particles on the free surface or close to a collider need the fine resolution
+	const TArrayView<bool> isBoundary = m_scratch.Allocate<bool>(n);
+	parallelFor(n, [&](size_t i) {
+		const AFluidParticle* particle = (*m_ptrParticles)[i];
+		bool boundary = neighbourLists[i].Num() < m_surfaceNeighbourThreshold;
+		const double colliderBand = m_colliderBandScale * m_gameMode->GetKernelRadius() * particle->GetParticleScale();
+		for (const FColliderSnapshot& collider : m_colliderSnapshots)
+		{
+			if (boundary)
+				break;
+			boundary = collider.ClosestDistance(particle->GetParticlePosition()) < colliderBand;
+		}
+		isBoundary[i] = boundary;
+		});
 
-	//Async(EAsyncExecution::Thread, [&]() {
-	size_t n = m_ptrParticles->Num();
+	//Boundary particles split, particles with no boundary neighbour are deep enough to merge
+	const TArrayView<EResolutionAction> actions = m_scratch.Allocate<EResolutionAction>(n);
+	parallelFor(n, [&](size_t i) {
+		const double mass = (*m_ptrParticles)[i]->GetParticleMass();
+		if ((*m_ptrParticles)[i]->IsParticleDead())
+		{
+			actions[i] = EResolutionAction::Keep;
+			return;
+		}
+		if (isBoundary[i])
+		{
+			actions[i] = (0.5 * mass >= minMass) ? EResolutionAction::Split : EResolutionAction::Keep;
+			return;
+		}
+		bool isDeep = 2.0 * mass <= maxMass;
+		for (size_t j : neighbourLists[i])
+		{
+			isDeep = isDeep && !isBoundary[j];
+		}
+		actions[i] = isDeep ? EResolutionAction::Merge : EResolutionAction::Keep;
+		});
 
-	FCriticalSection Mutex;
-	ParallelFor(n, [&](size_t i) {
-	//for(size_t i = 0; i < n; i++)
-		//Gravity
-		FVector force = (*m_ptrParticles)[i]->kMass * m_kGravity;
+	//the actors of merged and split particles are the engine's to update
+	FFluidAllocationScope actorScope(false);
 
-		//Wind forces
-		FVector sampleVectorFieldResult = SampleVectorField((*m_ptrParticles)[i]->GetParticlePosition(), m_kWind);
+	//Merge pairs of equal mass, each particle with its closest available neighbour. Momentum and centre of mass are conserved.
+	const TArrayView<bool> isClaimed = m_scratch.AllocateZeroed<bool>(n);
+	int32 numOfMerges = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		if (actions[i] != EResolutionAction::Merge || isClaimed[i])
+			continue;
 
-		if (m_showDebugText)
+		AFluidParticle* particle = (*m_ptrParticles)[i];
+		int32 partner = INDEX_NONE;
+		double closestDistSquared = TNumericLimits<double>::Max();
+		for (size_t j : neighbourLists[i])
 		{
-			if (i == 723)
-				UE_LOG(LogTemp, Warning, TEXT("The vector field result for particle %i is x: %f y: %f z: %f"), i, sampleVectorFieldResult.X, sampleVectorFieldResult.Y, sampleVectorFieldResult.Z);
+			const AFluidParticle* neighbour = (*m_ptrParticles)[j];
+			if (actions[j] != EResolutionAction::Merge || isClaimed[j] || neighbour->GetParticleMass() != particle->GetParticleMass())
+				continue;
+			const double distSquared = FVector::DistSquared(particle->GetParticlePosition(), neighbour->GetParticlePosition());
+			if (distSquared < closestDistSquared)
+			{
+				closestDistSquared = distSquared;
+				partner = j;
+			}
 		}
-		FVector relativeVelocity = (*m_ptrParticles)[i]->GetParticleVelocity() - sampleVectorFieldResult;
+		if (partner == INDEX_NONE)
+			continue;
+
+		isClaimed[i] = true;
+		isClaimed[partner] = true;
+		const AFluidParticle* other = (*m_ptrParticles)[partner];
+		const double mass = particle->GetParticleMass() + other->GetParticleMass();
+		const FVector position = (particle->GetParticleMass() * particle->GetParticlePosition() + other->GetParticleMass() * other->GetParticlePosition()) / mass;
+		const FVector velocity = (particle->GetParticleMass() * particle->GetParticleVelocity() + other->GetParticleMass() * other->GetParticleVelocity()) / mass;
+		particle->SetParticlePosition(position);
+		particle->SetActorLocation(position);
+		particle->SetParticleVelocity(velocity);
+		particle->SetParticleMass(mass);
+		//the partner is returned to the pool by the next compaction, and isn't drawn until then
+		(*m_ptrParticles)[partner]->SetParticleDead(true);
+		(*m_ptrParticles)[partner]->SetActorHiddenInGame(true);
+		numOfMerges++;
+	}
+
+	//Split into two children placed one child spacing apart along a random axis. New particles are appended, so indices stay valid.
+	int32 numOfSplits = 0;
+	int32 numOfEmittedSplits = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		if (actions[i] != EResolutionAction::Split)
+			continue;
+
+		AFluidParticle* particle = (*m_ptrParticles)[i];
+		const FVector position = particle->GetParticlePosition();
+		particle->SetParticleMass(0.5 * particle->GetParticleMass());
+		const FVector offset = 0.5 * m_gameMode->GetTargetSpacing() * particle->GetParticleScale() * FMath::VRand();
+		particle->SetParticlePosition(position + offset);
+		particle->SetActorLocation(position + offset);
+		//the child of an emitted particle counts towards the emitter's cap, and frees room under it when removed
+		m_gameMode->SpawnParticle(position - offset, particle->GetParticleVelocity(), particle->GetParticleMass())->SetParticleEmitted(particle->IsParticleEmitted());
+		numOfEmittedSplits += particle->IsParticleEmitted() ? 1 : 0;
+		numOfSplits++;
+	}
+	if (m_emitter && numOfEmittedSplits > 0)
+		m_emitter->OnParticlesAdded(numOfEmittedSplits);
+
+	if (m_showDebugText)
+		UE_LOG(LogTemp, Warning, TEXT("Adaptive resolution: %i splits, %i merges, %i particles"), numOfSplits, numOfMerges, m_ptrParticles->Num());
+}
+
+void AParticleSystemSolver::advanceMultiRate(double timeIntervalInSeconds)
+{
+	//Every particle is synchronised at the start of the frame step, so this is the only place where levels can change
+	const int32 finestLevel = assignTimeStepLevels(timeIntervalInSeconds);
+	const int32 numOfSubSteps = 1 << finestLevel;
+	uint64 numOfParticleUpdates = 0;
+
+	for (int32 k = 0; k < numOfSubSteps; ++k)
+	{
+		//Level L is due every 2^(finestLevel - L) sub-steps, so sub-step k advances every level from
+		//finestLevel - trailingZeros(k) up to the finest one. Every level is due on the first sub-step.
+		const int32 coarsestActiveLevel = (k == 0) ? 0 : finestLevel - static_cast<int32>(FMath::CountTrailingZeros(static_cast<uint32>(k)));
+		m_numActiveParticles = m_numParticlesUpToLevel[coarsestActiveLevel];
+		numOfParticleUpdates += m_numActiveParticles;
+
+		//Densities were measured by the game mode for the first sub-step, afterwards the finer particles have moved
+		if (k > 0)
+			updateActiveDensities();
+
+		beginAdvanceTimeStep();
+		accumulateForces(timeIntervalInSeconds);
+		timeIntegration(timeIntervalInSeconds);
+		resolveCollision(m_newPositions, m_newVelocities);
+		endAdvanceTimeStep(timeIntervalInSeconds);
+	}
+
+	if (m_showDebugText)
+	{
+		//A global time step would have to advance every particle with the finest time step in use
+		const uint64 numOfGlobalUpdates = static_cast<uint64>(m_ptrParticles->Num()) * numOfSubSteps;
+		UE_LOG(LogTemp, Warning, TEXT("Multi-rate step: finest level %i, %llu particle updates instead of %llu. Effective speedup: %.2fx"),
+			finestLevel, numOfParticleUpdates, numOfGlobalUpdates, static_cast<double>(numOfGlobalUpdates) / FMath::Max<uint64>(numOfParticleUpdates, 1));
+	}
+}
+
+int32 AParticleSystemSolver::assignTimeStepLevels(double timeIntervalInSeconds)
+{
+	const size_t n = m_ptrParticles->Num();
+	m_cflTimeStepLevels.SetNumUninitialized(n, false);
+	m_timeStepLevels.SetNumUninitialized(n, false);
+
+	//Local CFL condition plus the force condition from Monaghan (1992)
+	parallelFor(n, [&](size_t i) {
+		const double kernelRadius = m_gameMode->GetKernelRadius() * (*m_ptrParticles)[i]->GetParticleScale();
+		const double speed = (*m_ptrParticles)[i]->GetParticleVelocity().Size();
+		const double acceleration = (*m_ptrParticles)[i]->GetParticleForce().Size() / (*m_ptrParticles)[i]->GetParticleMass();
+
+		double maxTimeStep = timeIntervalInSeconds;
+		if (speed > 0.0)
+			maxTimeStep = FMath::Min(maxTimeStep, m_cflFactor * kernelRadius / speed);
+		if (acceleration > 0.0)
+			maxTimeStep = FMath::Min(maxTimeStep, m_cflFactor * FMath::Sqrt(kernelRadius / acceleration));
+
+		const int32 level = FMath::CeilToInt(FMath::Log2(timeIntervalInSeconds / maxTimeStep));
+		m_cflTimeStepLevels[i] = FMath::Clamp(level, 0, m_maxTimeStepLevel);
+		});
+
+	//A particle can't be more than one level coarser than its neighbours, otherwise fast neighbours could run through it.
+	//Raising a particle can leave its own neighbours too coarse, so the passes repeat until nothing changes.
+	//A fine level spreads one neighbour further per pass and runs out after m_maxTimeStepLevel of them.
+	for (int32 pass = 0; pass < m_maxTimeStepLevel; pass++)
+	{
+		TAtomic<bool> isChanged(false);
+		parallelFor(n, [&](size_t i) {
+			int32 level = m_cflTimeStepLevels[i];
+			const auto& neighbours = (*m_gameMode->GetNeighbourLists())[i];
+			for (size_t j : neighbours)
+			{
+				level = FMath::Max(level, m_cflTimeStepLevels[j] - 1);
+			}
+			m_timeStepLevels[i] = level;
+			if (level != m_cflTimeStepLevels[i])
+				isChanged = true;
+			});
+		//the levels of this pass are what the next one reads
+		Swap(m_cflTimeStepLevels, m_timeStepLevels);
+		if (!isChanged)
+			break;
+	}
+	Swap(m_cflTimeStepLevels, m_timeStepLevels);
+
+	//Counting sort from the finest level to the coarsest one
+	TArray<int32, TInlineAllocator<16>> levelCounts;
+	levelCounts.SetNumZeroed(m_maxTimeStepLevel + 1);
+	int32 finestLevel = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		levelCounts[m_timeStepLevels[i]]++;
+		finestLevel = FMath::Max(finestLevel, m_timeStepLevels[i]);
+	}
 
-		force += -m_dragCoefficient * relativeVelocity;
+	//m_numParticlesUpToLevel[L] is the number of particles on level L or finer
+	m_numParticlesUpToLevel.SetNumZeroed(m_maxTimeStepLevel + 2);
+	for (int32 level = m_maxTimeStepLevel; level >= 0; --level)
+	{
+		m_numParticlesUpToLevel[level] = m_numParticlesUpToLevel[level + 1] + levelCounts[level];
+	}
 
-		Mutex.Lock();
-		(*m_ptrParticles)[i]->SetParticleForce((*m_ptrParticles)[i]->GetParticleForce() + force);
-		Mutex.Unlock();
-		if (m_showDebugText)
+	m_particlesByLevel.SetNumUninitialized(n, false);
+	for (size_t i = 0; i < n; i++)
+	{
+		const int32 level = m_timeStepLevels[i];
+		m_particlesByLevel[m_numParticlesUpToLevel[level] - levelCounts[level]] = i;
+		levelCounts[level]--;
+	}
+
+	return finestLevel;
+}
+
+void AParticleSystemSolver::updateActiveDensities()
+{
+	FLUID_STAGE_SCOPE(m_gameMode->GetStageTimings(), Density);
+	parallelForActiveParticles([&](size_t i) {
+		(*m_ptrParticles)[i]->SetParticleDensity(m_gameMode->DensityAt(i));
+		}, true);
+}
+
+double AParticleSystemSolver::getParticleTimeStep(size_t i, double timeIntervalInSeconds) const
+{
+	if (m_isMultiRate)
+	{
+		return timeIntervalInSeconds / (1 << m_timeStepLevels[i]);
+	}
+	return timeIntervalInSeconds;
+}
+
+void AParticleSystemSolver::parallelForActiveParticles(TFunctionRef<void(size_t)> body, bool isNeighbourLoop) const
+{
+	if (m_isMultiRate)
+	{
+		FluidParallelFor(m_numActiveParticles, m_gameMode->GetTaskChunkSize(), &m_gameMode->GetWorkerTimings(), [&](int32 k) {
+			const int32 i = m_particlesByLevel[k];
+			if (!(*m_ptrParticles)[i]->IsParticleDead())
+				body(i);
+			});
+	}
+	else if (isNeighbourLoop)
+	{
+		m_gameMode->ParallelForNeighbourLoop(m_ptrParticles->Num(), [&](int32 i) {
+			if (!(*m_ptrParticles)[i]->IsParticleDead())
+				body(i);
+			});
+	}
+	else
+	{
+		FluidParallelFor(m_ptrParticles->Num(), m_gameMode->GetTaskChunkSize(), &m_gameMode->GetWorkerTimings(), [&](int32 i) {
+			if (!(*m_ptrParticles)[i]->IsParticleDead())
+				body(i);
+			});
+	}
+}
+
+void AParticleSystemSolver::parallelFor(int32 num, TFunctionRef<void(int32)> body, int32 chunkSize) const
+{
+	FluidParallelFor(num, chunkSize > 0 ? chunkSize : m_gameMode->GetTaskChunkSize(), &m_gameMode->GetWorkerTimings(), body);
+}
+
+void AParticleSystemSolver::advanceTaskGraph(double timeIntervalInSeconds)
+{
+	const int32 n = m_ptrParticles->Num();
+	m_externalForces = m_scratch.Allocate<FVector>(n, m_gameMode->GetParticleCapacity());
+	m_gameMode->PrepareNeighbourLists();
+
+	const double targetDensity = m_gameMode->GetTargetDensity();
+	const double eosScale = targetDensity * (m_speedOfSound * m_speedOfSound);
+	auto forLiveParticles = [this](auto body) {
+		return [this, body](int32 i) {
+			if (!(*m_ptrParticles)[i]->IsParticleDead())
+				body(i);
+		};
+	};
+#if STATS
+	FThreadSafeCounter numOfCollisions;
+#endif
+
+	//Everything below runs before Wait returns, so the tasks can hold on to the locals
+	//PrepareNeighbourLists has just built the partition for these particles
+	FFluidTaskGraph graph(m_gameMode->GetTaskChunkSize(), &m_gameMode->GetWorkerTimings(), &m_gameMode->GetStageTimings(), m_gameMode->GetWorkPartition());
+
+	//only reads the particles, so it runs alongside the grid build and the neighbour search
+	const FGraphEventArray externalForces = graph.LaunchChunks(EFluidStage::ExternalForces, n, forLiveParticles([&](int32 i) {
+		m_externalForces[i] = computeExternalForce(i);
+		}));
+
+	const FGraphEventRef gridBuild = graph.Launch([&]() { m_gameMode->BuildNeighbourSearcher(); });
+	//the lists are counted, given their room in one go, then filled
+	const FGraphEventArray neighbourCounts = graph.LaunchChunks(EFluidStage::NeighbourLists, n, [&](int32 i) {
+		m_gameMode->CountNeighbours(i);
+		}, {}, { gridBuild });
+	const FGraphEventRef neighbourListAllocation = graph.Launch([&]() { m_gameMode->AllocateNeighbourLists(); }, { FFluidTaskGraph::Join(neighbourCounts) });
+	const FGraphEventArray neighbourLists = graph.LaunchChunks(EFluidStage::NeighbourLists, n, [&](int32 i) {
+		m_gameMode->BuildNeighbourList(i);
+		}, {}, { neighbourListAllocation });
+
+	//the density only needs the particle's own list and the pressure its own density, so they follow chunk by chunk
+	const FGraphEventArray densities = graph.LaunchChunks(EFluidStage::Density, n, [&](int32 i) {
+		m_gameMode->UpdateDensity(i);
+		}, { &neighbourLists });
+	const FGraphEventArray pressures = graph.LaunchChunks(EFluidStage::Pressure, n, forLiveParticles([&](int32 i) {
+		updateParticlePressure(i, targetDensity, eosScale);
+		}), { &densities });
+
+	//the forces read the pressures and densities of neighbours in any chunk, which is the only barrier of the step
+	FGraphEventArray forces = graph.LaunchChunks(EFluidStage::Pressure, n, forLiveParticles([&](int32 i) {
+		(*m_ptrParticles)[i]->SetParticleForce(computePressureForce(i));
+		}), {}, { FFluidTaskGraph::Join(pressures) });
+	if (m_isViscous)
+	{
+		forces = graph.LaunchChunks(EFluidStage::Viscosity, n, forLiveParticles([&](int32 i) {
+			AFluidParticle* particle = (*m_ptrParticles)[i];
+			particle->SetParticleForce(particle->GetParticleForce() + computeViscosityForce(i));
+			}), { &forces });
+	}
+
+	const FGraphEventArray integration = graph.LaunchChunks(EFluidStage::Integration, n, forLiveParticles([&](int32 i) {
+		AFluidParticle* particle = (*m_ptrParticles)[i];
+		particle->SetParticleForce(particle->GetParticleForce() + m_externalForces[i]);
+		integrateParticle(i, timeIntervalInSeconds);
+		}), { &forces, &externalForces });
+	graph.LaunchChunks(EFluidStage::Collision, n, forLiveParticles([&](int32 i) {
+		if (resolveParticleCollision(i, &m_newPositions[i], &m_newVelocities[i]))
 		{
-			if (i == 723)
-				UE_LOG(LogTemp, Warning, TEXT("Particle 723 external FORCE: %s"), *(*m_ptrParticles)[i]->GetParticleForce().ToString());
+#if STATS
+			numOfCollisions.Increment();
+#endif
 		}
+		}), { &integration });
+	graph.Wait();
+
+#if STATS
+	INC_DWORD_STAT_BY(STAT_FluidCollisions, numOfCollisions.GetValue());
+#endif
+	m_gameMode->UpdateNeighbourPairStat();
+	//actors are moved on the game thread
+	endAdvanceTimeStep(timeIntervalInSeconds);
+}
+
+const FVector AParticleSystemSolver::SampleVectorField(const FVector& _subject) const
+{
+	FVector sum(0.0f);
+	for (const FVectorFieldSnapshot& field : m_vectorFieldSnapshots)
+	{
+		sum += field.Sample(_subject);
+	}
+	return sum;
+}
+
+void AParticleSystemSolver::accumulateForces(double timeStepInSeconds)
+{
+	//STAGE 2 & 3	
+	accumulatePressureForce(timeStepInSeconds);
+	//STAGE 4
+	if (m_isViscous)
+		accumulateNonPressureForces(timeStepInSeconds);
+	//STAGE 5
+	accumulateExternalForces(timeStepInSeconds);
+}
+
+void AParticleSystemSolver::accumulateExternalForces(double timeStepInSeconds)
+{
+	FLUID_STAGE_SCOPE(m_gameMode->GetStageTimings(), ExternalForces);
+	//STAGE 5 - COMPUTE THE GRAVITY AND OTHER EXTERNAL FORCES
+	parallelForActiveParticles([&](size_t i) {
+		(*m_ptrParticles)[i]->SetParticleForce((*m_ptrParticles)[i]->GetParticleForce() + computeExternalForce(i));
 	});
 }
 
+FVector AParticleSystemSolver::computeExternalForce(size_t i) const
+{
+	const AFluidParticle* particle = (*m_ptrParticles)[i];
+	//Gravity
+	FVector force = particle->GetParticleMass() * m_kGravity;
+
+	//Wind forces
+	FVector sampleVectorFieldResult = SampleVectorField(particle->GetParticlePosition());
+	FLUID_PROBE(m_probes, particle, VectorField, sampleVectorFieldResult);
+	FVector relativeVelocity = particle->GetParticleVelocity() - sampleVectorFieldResult;
+
+	force += -m_dragCoefficient * relativeVelocity;
+	FLUID_PROBE(m_probes, particle, ExternalForce, force);
+	return force;
+}
+
 void AParticleSystemSolver::accumulateNonPressureForces(double timeStepInSeconds)
 {
 	accumulateViscosityForce();
@@ -229,130 +703,132 @@ void AParticleSystemSolver::accumulateNonPressureForces(double timeStepInSeconds
 
 void AParticleSystemSolver::accumulatePressureForce(double timeStepInSeconds)
 {
+	FLUID_STAGE_SCOPE(m_gameMode->GetStageTimings(), Pressure);
 	computePressure();
 
 	//STAGE 3 - COMPUTE THE GRADIENT PRESSURE FORCE
+	parallelForActiveParticles([&](size_t i) {
+		(*m_ptrParticles)[i]->SetParticleForce((*m_ptrParticles)[i]->GetParticleForce() + computePressureForce(i));
+	}, true);	
+}
 
-	//do the accumulatepressureforce function here
+FVector AParticleSystemSolver::computePressureForce(size_t i) const
+{
+	const AFluidParticle* particle = (*m_ptrParticles)[i];
+	const FVector& position = particle->GetParticlePosition();
+	const FluidCore::FVec3 corePosition = ToCore(position);
+	const double pressureOverDensitySquared = particle->GetParticlePressure() / (particle->GetParticleDensity() * particle->GetParticleDensity());
+	FluidCore::FVec3 coreForce;
+
+	const auto& neighbours = (*m_gameMode->GetNeighbourLists())[i];
+	for (size_t j : neighbours)
+	{
+		const AFluidParticle* neighbour = (*m_ptrParticles)[j];
+		const FluidCore::FSpikyKernel kernel(m_gameMode->GetKernelRadius(particle, neighbour));
+		coreForce += FluidCore::PressureForceTerm(particle->GetParticleMass(), neighbour->GetParticleMass(), pressureOverDensitySquared,
+			neighbour->GetParticlePressure() / (neighbour->GetParticleDensity() * neighbour->GetParticleDensity()),
+			corePosition, ToCore(neighbour->GetParticlePosition()), kernel);
+	}
+	const FVector force = FromCore(coreForce) + computeBoundaryPressureForce(i, position, particle->GetParticlePressure(), particle->GetParticleDensity());
+	FLUID_PROBE(m_probes, particle, PressureForce, force);
+	return force;
+}
 
-	//Async(EAsyncExecution::Thread, [&]() {
-	size_t n = m_ptrParticles->Num();
+FVector AParticleSystemSolver::computeBoundaryPressureForce(size_t i, const FVector& position, double pressure, double density) const
+{
+	FVector force(0.0f);
+	if (!m_gameMode->HasBoundaryParticles())
+	{
+		return force;
+	}
 
-	const double massSquared = (*m_ptrParticles)[0]->kMass * (*m_ptrParticles)[0]->kMass;
-	const FSphSpikyKernel kernel(m_gameMode->GetKernelRadius());
+	//Boundary particles mirror the pressure of the fluid particle (Akinci et al. 2012), so only p_i / rho_i^2 appears
+	const AFluidParticle* particle = (*m_ptrParticles)[i];
+	const FSphSpikyKernel kernel(m_gameMode->GetKernelRadius() * particle->GetParticleScale());
+	const TArray<FVector>& boundaryPositions = m_gameMode->GetBoundaryPositions();
+	const TArray<double>& boundaryPsi = m_gameMode->GetBoundaryPsi();
+	const double pressureOverDensitySquared = pressure / (density * density);
 
-	FCriticalSection Mutex;
-	ParallelFor(n, [&](size_t i) {
-	//for(size_t i = 0; i < n; i++)
-		const auto& neighbours = (*m_gameMode->GetNeighbourLists())[i];
-		for (size_t j : neighbours)
+	for (size_t b : (*m_gameMode->GetBoundaryNeighbourLists())[i])
+	{
+		double dist = FVector::Distance(position, boundaryPositions[b]);
+		if (dist > 0.0)
 		{
-			double dist = FVector::Distance((*m_ptrParticles)[i]->GetParticlePosition(), (*m_ptrParticles)[j]->GetParticlePosition());
-			if (dist > 0.0)
-			{
-				FVector dir = ((*m_ptrParticles)[j]->GetParticlePosition() - (*m_ptrParticles)[i]->GetParticlePosition()) / dist;
-				FVector pressureForceResult = (*m_ptrParticles)[i]->GetParticleForce() - massSquared *
-					((*m_ptrParticles)[i]->GetParticlePressure() / ((*m_ptrParticles)[i]->GetParticleDensity() * (*m_ptrParticles)[i]->GetParticleDensity()) +
-						(*m_ptrParticles)[j]->GetParticlePressure() / ((*m_ptrParticles)[j]->GetParticleDensity() * (*m_ptrParticles)[j]->GetParticleDensity())) *
-					kernel.Gradient(dist, dir);
-				Mutex.Lock();
-				(*m_ptrParticles)[i]->SetParticleForce(pressureForceResult);
-				Mutex.Unlock();
-			}
+			FVector dir = (boundaryPositions[b] - position) / dist;
+			force -= particle->GetParticleMass() * boundaryPsi[b] * pressureOverDensitySquared * kernel.Gradient(dist, dir);
 		}
-		if (m_showDebugText)
-		{
-			if (i == 723)
-				UE_LOG(LogTemp, Warning, TEXT("Particle 723 pressure FORCE: %s"), *(*m_ptrParticles)[i]->GetParticleForce().ToString());
-		}	
-		
-	});	
+	}
+	return force;
 }
 
 void AParticleSystemSolver::computePressure()
 {
 	//STAGE 2 - COMPUTE THE PRESSURE BASED ON THE DENSITY
-
-	//Async(EAsyncExecution::Thread, [&]() {
-	size_t n = m_ptrParticles->Num();
 	const double targetDensity = m_gameMode->GetTargetDensity();
 	const double eosScale = targetDensity * (m_speedOfSound * m_speedOfSound);
 
-	FCriticalSection Mutex;
-	ParallelFor(n, [&](size_t i) {
-	//for (size_t i = 0; i < n; i++)
-		double pressure = computePressureFromEOS((*m_ptrParticles)[i]->GetParticleDensity(), targetDensity, eosScale, m_eosExponent, m_negaitvePressureScale);
-		pressure /= 100.0; //PRESSURE VALUE IS TOO HIGH!!!!! THIS IS A HACK FIX!!! 
-		Mutex.Lock();
-		(*m_ptrParticles)[i]->SetParticlePressure(pressure);
-		Mutex.Unlock();
-		if (m_showDebugText)
-		{
-			if (i == 723)
-				UE_LOG(LogTemp, Warning, TEXT("Particle 723 PRESSURE: %f"), (*m_ptrParticles)[i]->GetParticlePressure());
-		}
-		
+	parallelForActiveParticles([&](size_t i) {
+		updateParticlePressure(i, targetDensity, eosScale);
 	});	
 }
 
+void AParticleSystemSolver::updateParticlePressure(size_t i, double targetDensity, double eosScale)
+{
+	double pressure = computePressureFromEOS((*m_ptrParticles)[i]->GetParticleDensity(), targetDensity, eosScale, m_eosExponent, m_negaitvePressureScale);
+	pressure /= 100.0; //PRESSURE VALUE IS TOO HIGH!!!!! THIS IS A HACK FIX!!! 
+	(*m_ptrParticles)[i]->SetParticlePressure(pressure);
+	FLUID_PROBE(m_probes, (*m_ptrParticles)[i], Pressure, pressure);
+}
+
 void AParticleSystemSolver::accumulateViscosityForce()
 {
+	FLUID_STAGE_SCOPE(m_gameMode->GetStageTimings(), Viscosity);
 	//STAGE 4 - COMPUTE THE VISCOSITY FORCE
+	parallelForActiveParticles([&](size_t i) {
+		(*m_ptrParticles)[i]->SetParticleForce((*m_ptrParticles)[i]->GetParticleForce() + computeViscosityForce(i));
+	}, true);
+}
 
-	//Async(EAsyncExecution::Thread, [&]() {
-	size_t n = m_ptrParticles->Num();
-
-	const double massSquared = (*m_ptrParticles)[0]->kMass * (*m_ptrParticles)[0]->kMass;
-	const FSphSpikyKernel kernel(m_gameMode->GetKernelRadius());
+FVector AParticleSystemSolver::computeViscosityForce(size_t i) const
+{
+	const AFluidParticle* particle = (*m_ptrParticles)[i];
+	const FluidCore::FVec3 velocity = ToCore(particle->GetParticleVelocity());
+	FluidCore::FVec3 coreForce;
 
-	FCriticalSection Mutex;
-	ParallelFor(n, [&](size_t i) {
-	//for (size_t i = 0; i < n; i++)
-		const auto& neighbours = (*m_gameMode->GetNeighbourLists())[i];
-		for (size_t j : neighbours)
-		{
-			double dist = FVector::Distance((*m_ptrParticles)[i]->GetParticlePosition(), (*m_ptrParticles)[j]->GetParticlePosition());
-			FVector viscosityForceResult = (*m_ptrParticles)[i]->GetParticleForce() + m_viscosityCoefficient * massSquared *
-				((*m_ptrParticles)[j]->GetParticleVelocity() - (*m_ptrParticles)[i]->GetParticleVelocity()) / (*m_ptrParticles)[j]->GetParticleDensity() *
-				kernel.SecondDerivative(dist);
-			Mutex.Lock();
-			(*m_ptrParticles)[i]->SetParticleForce(viscosityForceResult);
-			Mutex.Unlock();
-		}
-		if (m_showDebugText)
-		{
-			if (i == 723)
-				UE_LOG(LogTemp, Warning, TEXT("Particle 723 viscosity FORCE: %s"), *(*m_ptrParticles)[i]->GetParticleForce().ToString());
-		}
-						
-	});
+	const auto& neighbours = (*m_gameMode->GetNeighbourLists())[i];
+	for (size_t j : neighbours)
+	{
+		const AFluidParticle* neighbour = (*m_ptrParticles)[j];
+		double dist = FVector::Distance(particle->GetParticlePosition(), neighbour->GetParticlePosition());
+		const FluidCore::FSpikyKernel kernel(m_gameMode->GetKernelRadius(particle, neighbour));
+		coreForce += FluidCore::ViscosityForceTerm(m_viscosityCoefficient, particle->GetParticleMass(), neighbour->GetParticleMass(),
+			velocity, ToCore(neighbour->GetParticleVelocity()), neighbour->GetParticleDensity(), dist, kernel);
+	}
+	const FVector force = FromCore(coreForce);
+	FLUID_PROBE(m_probes, particle, ViscosityForce, force);
+	return force;
 }
 
 void AParticleSystemSolver::computePseudoViscosity(double timeStepInSeconds)
 {
-	size_t n = m_gameMode->GetNumberOfParticles();
-	const double mass = (*m_ptrParticles)[0]->kMass;
-	const FSphSpikyKernel kernel(m_gameMode->GetKernelRadius());
-	TArray<FVector> smoothedVelocities;
-	smoothedVelocities.Reserve(n);
-	smoothedVelocities.SetNumZeroed(n);
-
-	n = m_ptrParticles->Num();
+	size_t n = m_ptrParticles->Num();
+	const TArrayView<FVector> smoothedVelocities = m_scratch.Allocate<FVector>(n);
 
-	ParallelFor(n, [&](size_t i) {
+	parallelFor(n, [&](size_t i) {
 		double weightSum = 0.0f;
-		FVector smoothedVelocity;
+		FVector smoothedVelocity(0.0f);
 
 		const auto& neighbours = (*m_gameMode->GetNeighbourLists())[i];
 		for (size_t j : neighbours)
 		{
 			double dist = FVector::Distance((*m_ptrParticles)[i]->GetParticlePosition(), (*m_ptrParticles)[j]->GetParticlePosition());
-			double wj = mass / (*m_ptrParticles)[j]->GetParticleDensity() * kernel(dist);
+			const FSphSpikyKernel kernel(m_gameMode->GetKernelRadius((*m_ptrParticles)[i], (*m_ptrParticles)[j]));
+			double wj = (*m_ptrParticles)[j]->GetParticleMass() / (*m_ptrParticles)[j]->GetParticleDensity() * kernel(dist);
 			weightSum += wj;
 			smoothedVelocity += wj * (*m_ptrParticles)[j]->GetParticleVelocity();
 		}
 
-		double wi = mass / (*m_ptrParticles)[i]->GetParticleDensity();
+		double wi = (*m_ptrParticles)[i]->GetParticleMass() / (*m_ptrParticles)[i]->GetParticleDensity();
 		weightSum += wi;
 		smoothedVelocity += wi * (*m_ptrParticles)[i]->GetParticleVelocity();
 
@@ -367,45 +843,137 @@ void AParticleSystemSolver::computePseudoViscosity(double timeStepInSeconds)
 	double factor = timeStepInSeconds * m_pseudoViscosityCoefficient;
 	factor = FMath::Clamp(factor, 0.0, 1.0);
 
-	FCriticalSection Mutex;
-	ParallelFor(n, [&](size_t i) {
+	parallelFor(n, [&](size_t i) {
 		FVector newVelocity = FMath::Lerp((*m_ptrParticles)[i]->GetParticleVelocity(), smoothedVelocities[i], factor);
-		Mutex.Lock();
 		(*m_ptrParticles)[i]->SetParticleVelocity(newVelocity);
-		Mutex.Unlock();
 		});
 }
 
 double AParticleSystemSolver::computePressureFromEOS(double density, double targetDensity, double eosScale, double eosExponent, double negativePressureScale)
 {
-	// See Murnaghan-Tait equation of state from
-	// https://en.wikipedia.org/wiki/Tait_equation
+	return FluidCore::PressureFromEos(density, targetDensity, eosScale, eosExponent, negativePressureScale);
+}
 
-	double p = eosScale / eosExponent * (FMath::Pow((density / targetDensity), eosExponent) - 1.0);
+void AParticleSystemSolver::resolveCollision(TArrayView<FVector> positions, TArrayView<FVector> velocities)
+{
+	//whitebox function
+	FLUID_STAGE_SCOPE(m_gameMode->GetStageTimings(), Collision);
 
-	//Negative pressure scaling
-	if (p < 0)
-	{
-		p *= negativePressureScale;
-	}
+	const double startTime = FPlatformTime::Seconds();
+#if STATS
+	const bool isCountingCollisions = FThreadStats::IsCollectingData();
+	FThreadSafeCounter numOfCollisions;
+#endif
 
-	return p;
+	parallelForActiveParticles([&](size_t i) {
+		if (resolveParticleCollision(i, &positions[i], &velocities[i]))
+		{
+#if STATS
+			if (isCountingCollisions)
+				numOfCollisions.Increment();
+#endif
+		}
+		});
+#if STATS
+	//multi-rate sub-steps and PCISPH both resolve more than once a step, so this adds up
+	INC_DWORD_STAT_BY(STAT_FluidCollisions, numOfCollisions.GetValue());
+#endif
+
+	if (m_showDebugText)
+		UE_LOG(LogTemp, Warning, TEXT("Collision resolve time: %f ms for %i particles, %i bounded and %i unbounded colliders"),
+			(FPlatformTime::Seconds() - startTime) * 1000.0, m_ptrParticles->Num(), m_boundedColliders.Num(), m_unboundedColliders.Num());
 }
 
-void AParticleSystemSolver::resolveCollision(TArray<FVector>* positions, TArray<FVector>* velocities)
+bool AParticleSystemSolver::resolveParticleCollision(size_t i, FVector* position, FVector* velocity) const
 {
-	//whitebox function
+	const double radius = (*m_ptrParticles)[i]->GetParticleRadius();
+	bool hasCollided = false;
 
-	size_t n = m_ptrParticles->Num();
-	const float kParticleRadius = (*m_ptrParticles)[0]->kRadius;
+	for (int32 c : m_unboundedColliders)
+	{
+		hasCollided |= m_colliderSnapshots[c].ResolveCollision(radius, m_restitutionCoefficient, position, velocity);
+	}
+	//narrow phase only against the colliders whose bounds contain the particle
+	m_colliderBVH.ForEachOverlap(*position, [&](int32 k) {
+		hasCollided |= m_colliderSnapshots[m_boundedColliders[k]].ResolveCollision(radius, m_restitutionCoefficient, position, velocity);
+		});
+	return hasCollided;
+}
+
+bool AParticleSystemSolver::isInsideCollider(const FVector& point, FVector* colliderVelocity) const
+{
+	bool isInside = false;
+	auto testCollider = [&](const FColliderSnapshot& collider) {
+		if (isInside)
+			return;
+		//the closest point is on the surface, so the side the point is on is the sign of the distance
+		FColliderSnapshot::FQueryResult result;
+		collider.GetQueryResult(point, &result);
+		if (FVector::DotProduct(point - result.point, result.normal) < 0.0f)
+		{
+			isInside = true;
+			*colliderVelocity = result.velocity;
+		}
+	};
+	for (int32 c : m_unboundedColliders)
+	{
+		testCollider(m_colliderSnapshots[c]);
+	}
+	m_colliderBVH.ForEachOverlap(point, [&](int32 k) {
+		testCollider(m_colliderSnapshots[m_boundedColliders[k]]);
+		});
+	return isInside;
+}
 
+void AParticleSystemSolver::updateColliderSnapshots(double timeIntervalInSeconds)
+{
+	//The only place where collider actors are read during a step, on the game thread
+	m_colliderSnapshots.Reset();
 	for (ACollider* c : m_colliders)
 	{
 		if (c != nullptr)
 		{
-			ParallelFor(n, [&](size_t i) {
-				c->ResolveCollision(kParticleRadius, m_restitutionCoefficient, &(*positions)[i], &(*velocities)[i]);
-				});
+			c->UpdateSnapshot(timeIntervalInSeconds);
+			m_colliderSnapshots.Add(c->GetSnapshot());
 		}
 	}
+
+	buildCollisionBroadPhase();
+}
+
+void AParticleSystemSolver::updateVectorFieldSnapshots(double timeIntervalInSeconds)
+{
+	m_vectorFieldSnapshots.Reset();
+	//animated fields stream their frames in from disk, which isn't the step's memory
+	FFluidAllocationScope streamingScope(false);
+	for (AVectorFieldVolume* v : m_vectorFields)
+	{
+		if (v != nullptr)
+			m_vectorFieldSnapshots.Add(v->UpdateSnapshot(timeIntervalInSeconds));
+	}
+}
+
+void AParticleSystemSolver::buildCollisionBroadPhase()
+{
+	//Rebuilt every step so moving colliders are supported. With a few dozen colliders this is negligible.
+	const double maxParticleRadius = AFluidParticle::kRadius * m_gameMode->GetMaxKernelRadius() / m_gameMode->GetKernelRadius();
+	m_colliderBounds.Reset();
+	m_boundedColliders.Reset();
+	m_unboundedColliders.Reset();
+
+	for (int32 c = 0; c < m_colliderSnapshots.Num(); c++)
+	{
+		FBox bounds;
+		if (m_useColliderBVH && m_colliderSnapshots[c].GetCollisionBounds(&bounds))
+		{
+			m_colliderBounds.Add(bounds.ExpandBy(maxParticleRadius));
+			m_boundedColliders.Add(c);
+		}
+		else
+		{
+			m_unboundedColliders.Add(c);
+		}
+	}
+
+	m_colliderBVH.Build(m_colliderBounds);
 }
\ No newline at end of file
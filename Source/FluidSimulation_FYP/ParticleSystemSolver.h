@@ -4,6 +4,10 @@
 
 #include "CoreMinimal.h"
 #include "GameFramework/Actor.h"
+#include "ColliderBVH.h"
+#include "ColliderSnapshot.h"
+#include "VectorFieldVolume.h"
+#include "FluidScratchArena.h"
 #include "ParticleSystemSolver.generated.h"
 
 UCLASS()
@@ -16,8 +20,8 @@ class FLUIDSIMULATION_FYP_API AParticleSystemSolver : public AActor
 	void endAdvanceTimeStep(double timeIntervalInSeconds);
 
 	void timeIntegration(double timeIntervalInSeconds);
+	void integrateParticle(size_t i, double timeStepInSeconds);
 
-	const FVector m_kWind{ FVector(10.0f, 25.0f, 0.0f) }; //test wind (vector field)
 	const FVector m_kGravity{ FVector(0.0f, 0.0f, -9.8f) };
 	double m_restitutionCoefficient{ 0.0 };
 	double m_dragCoefficient{ 1e-4 };
@@ -31,14 +35,70 @@ class FLUIDSIMULATION_FYP_API AParticleSystemSolver : public AActor
 	//This should be the actual speed of sound in the fluid but a lower value is better to trace-off performance and compressibility
 	double m_speedOfSound{ 100.0 };
 
-	//these are needed for post processing
-	TArray<FVector> m_newPositions;
-	TArray<FVector> m_newVelocities;
+	//these are needed for post processing. Scratch buffers of the step, shared by its multi-rate sub-steps.
+	TArrayView<FVector> m_newPositions;
+	TArrayView<FVector> m_newVelocities;
+
+	//TASK GRAPH
+	//The WCSPH step as chunked tasks, from the grid build to the collisions. The external forces only read the particles,
+	//so they are computed into their own array next to the neighbour search and added in the integration.
+	bool m_useTaskGraph{ false };
+	TArrayView<FVector> m_externalForces;
+
+	void advanceTaskGraph(double timeIntervalInSeconds);
+
+	//MULTI-RATE TIME STEPPING
+	//Level 0 advances once with the full time step, level L advances 2^L times with timeInterval / 2^L.
+	bool m_isMultiRate{ false };
+	int32 m_maxTimeStepLevel{ 3 };
+	double m_cflFactor{ 0.4 };
+	TArray<int32> m_timeStepLevels;
+	TArray<int32> m_cflTimeStepLevels;
+	//particle indices sorted from the finest level to the coarsest one, so the active particles of a sub-step are always a prefix
+	TArray<int32> m_particlesByLevel;
+	TArray<int32> m_numParticlesUpToLevel;
+	int32 m_numActiveParticles{ 0 };
+
+	int32 assignTimeStepLevels(double timeIntervalInSeconds);
+	void advanceMultiRate(double timeIntervalInSeconds);
+	void updateActiveDensities();
+	double getParticleTimeStep(size_t i, double timeIntervalInSeconds) const;
+
+	//ADAPTIVE RESOLUTION
+	//Particles are split near the free surface and colliders and merged in the deep interior
+	bool m_isAdaptive{ false };
+	unsigned int m_adaptivityInterval{ 10 }; //steps between split/merge passes
+	unsigned int m_stepsSinceAdaptivity{ 0 };
+	int32 m_surfaceNeighbourThreshold{ 12 }; //particles with fewer neighbours than this are on the free surface
+	double m_colliderBandScale{ 2.0 }; //particles closer to a collider than this many smoothing lengths are refined
+
+	void adaptParticleResolution();
+
+	//PARTICLE REMOVAL
+	//Particles die in kill volumes, outside the simulation domain or of old age. They are taken out of the arrays every few steps.
+	TArray<class AKillVolume*> m_killVolumes;
+	TArray<struct FKillVolumeSnapshot> m_killVolumeSnapshots;
+	int32 m_stepsSinceCompaction{ 0 };
+
+	void markDeadParticles(double timeIntervalInSeconds);
+	void compactParticles();
 
 	//rigid body obstacle in the simulation
 	TArray<class ACollider*> m_colliders;
+	//Collider state for the current step. Collisions only read these, never the actors.
+	TArray<FColliderSnapshot> m_colliderSnapshots;
+	//Collision broad phase over the snapshots. Bounded colliders go into the BVH, infinite planes are checked against every particle.
+	TArray<int32> m_boundedColliders;
+	TArray<int32> m_unboundedColliders;
+	TArray<FBox> m_colliderBounds;
+	FColliderBVH m_colliderBVH;
+	//off treats every collider as unbounded, for comparing against the brute force
+	bool m_useColliderBVH{ true };
+	//Air the particles are dragged towards. Overlapping fields add up.
+	TArray<class AVectorFieldVolume*> m_vectorFields;
+	TArray<FVectorFieldSnapshot> m_vectorFieldSnapshots;
 	//Where the particles spawn from (like a fountain)
-	class APointParticleEmitter* m_emitter;
+	class APointParticleEmitter* m_emitter{ nullptr };
 
 public:	
 	// Sets default values for this component's properties
@@ -47,11 +107,19 @@ public:
 
 	void initPhysicsSolver(TArray<class AFluidParticle*>* ptrParticles, class AFluidSimulation_FYPGameModeBase* gameMode);
 	void OnAdvanceTimeStep(double timeIntervalInSeconds);
+	//The game mode leaves the neighbour lists and densities to the step when it runs on the task graph
+	bool IsUsingTaskGraph() const { return m_useTaskGraph; }
+
+	class APointParticleEmitter* GetEmitter() const { return m_emitter; }
+	//The SPH solvers need the neighbour lists and densities the game mode builds before every step
+	virtual bool NeedsNeighbourLists() const { return true; }
 
-	//Vector fields include wind, water current... even colours
-	const FVector SampleVectorField(const FVector& _subject, const FVector& _vectorField) const;
-	//Scalar fields include temperature, pressure
-	const double SampleScalarField(const FVector& _subject) const;
+	//Counters of the solver and its emitter that a restored simulation has to continue from
+	void SaveCheckpointState(struct FSimulationCheckpointHeader* header) const;
+	void RestoreCheckpointState(const struct FSimulationCheckpointHeader& header);
+
+	//Vector fields include wind, water current... even colours. Sums every field volume's baked grid for the current step.
+	const FVector SampleVectorField(const FVector& _subject) const;
 
 protected:
 	TArray<class AFluidParticle*>* m_ptrParticles;
@@ -60,6 +128,17 @@ protected:
 	double m_negaitvePressureScale{ 0.0 };
 	bool m_isViscous{ false };
 	bool m_showDebugText{ false };
+	//values of probed particles are recorded here. nullptr when probes are compiled out.
+	class FFluidProbeRecorder* m_probes{ nullptr };
+	//Temporaries of the current step. Reset when a step starts, so the memory of one step is reused by the next.
+	FFluidScratchArena m_scratch;
+
+	//Runs the body for every live particle advancing in the current step (all of them unless multi-rate stepping is on).
+	//Loops over the neighbour lists say so, which splits the particles by their neighbours instead of their number.
+	void parallelForActiveParticles(TFunctionRef<void(size_t)> body, bool isNeighbourLoop = false) const;
+	//ParallelFor that hands out the indices in chunks and times them with the rest of the step. The chunks are the game mode's
+	//task chunk size unless one is given, like 1 for loops whose indices are rows or chunks already.
+	void parallelFor(int32 num, TFunctionRef<void(int32)> body, int32 chunkSize = 0) const;
 
 	virtual void onBeginAdvanceTimeStep();
 	virtual void accumulateForces(double timeStepInSeconds);
@@ -68,9 +147,23 @@ protected:
 	virtual void accumulatePressureForce(double timeStepInSeconds);
 	void accumulateViscosityForce();
 	void computePressure();
+	//Per particle parts of the stages. Nothing but particle i is written, so chunks of particles can run at the same time.
+	FVector computeExternalForce(size_t i) const;
+	FVector computePressureForce(size_t i) const;
+	FVector computeViscosityForce(size_t i) const;
+	void updateParticlePressure(size_t i, double targetDensity, double eosScale);
+	//Pressure force from the boundary particles around particle i
+	FVector computeBoundaryPressureForce(size_t i, const FVector& position, double pressure, double density) const;
 	void computePseudoViscosity(double timeStepInSeconds);
 	double computePressureFromEOS(double density, double targetDensity, double eosScale, double eosExponent, double negativePressureScale);
 
 	//only external forces will be taken into account here.
-	void resolveCollision(TArray<FVector>* positions, TArray<FVector>* velocities);		
+	void resolveCollision(TArrayView<FVector> positions, TArrayView<FVector> velocities);
+	//Returns whether the particle hit anything
+	bool resolveParticleCollision(size_t i, FVector* position, FVector* velocity) const;
+	//Whether the point is inside a collider of this step, and the collider's velocity there
+	bool isInsideCollider(const FVector& point, FVector* colliderVelocity) const;
+	void updateColliderSnapshots(double timeIntervalInSeconds);
+	void updateVectorFieldSnapshots(double timeIntervalInSeconds);
+	void buildCollisionBroadPhase();		
 };
\ No newline at end of file
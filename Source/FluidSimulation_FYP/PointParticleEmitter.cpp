@@ -3,6 +3,9 @@
 
 #include "PointParticleEmitter.h"
 #include "FluidParticle.h"
+#include "FluidSimulation_FYPGameModeBase.h"
+#include "FluidCoreTypes.h"
+#include "FluidCore/Emission.h"
 #include "Components/ArrowComponent.h"
 
 // Sets default values
@@ -17,49 +20,81 @@ APointParticleEmitter::APointParticleEmitter()
 	m_arrow = CreateDefaultSubobject<UArrowComponent>(TEXT("Arrow"));
 }
 
-void APointParticleEmitter::Initialise(TArray<class AFluidParticle*>* ptrParticles)
+void APointParticleEmitter::Initialise(AFluidSimulation_FYPGameModeBase* gameMode)
 {
-	m_ptrParticles = ptrParticles;
-
-	//Setup timer event
-	UWorld* const World = GetWorld();
-	if (World == nullptr)
-	{
-		UE_LOG(LogTemp, Warning, TEXT("Apparently the world doesn't exist"));
-		return;
-	}
+	m_gameMode = gameMode;
+	m_pendingEmission = 0.0;
+	m_numOfLiveParticles = 0;
+	m_isAtCapacity = false;
+}
 
-	float timeInterval = 1.0f / m_maxNumOfParticlesPerSecond;
-	UE_LOG(LogTemp, Warning, TEXT("the time interval for the timed event is: %f"), timeInterval);
-	World->GetTimerManager().SetTimer(loopTimeHandle, this, &APointParticleEmitter::Emit, timeInterval, true);
+void APointParticleEmitter::SetEmission(int32 particlesPerSecond, int32 maxNumOfParticles)
+{
+	m_maxNumOfParticlesPerSecond = particlesPerSecond;
+	m_maxNumOfParticles = maxNumOfParticles;
+	m_isEnabled = particlesPerSecond > 0;
 }
 
-void APointParticleEmitter::Emit()
+void APointParticleEmitter::EmitParticles(double timeIntervalInSeconds)
 {
-	if (m_ptrParticles == nullptr)
+	FLUID_SCOPE(Emission);
+	if (!m_isEnabled)
 	{
-		UE_LOG(LogTemp, Warning, TEXT("Array of particles didn't load properly in the emitter"));
-		GetWorldTimerManager().ClearTimer(loopTimeHandle);
 		return;
 	}
-	if (m_numOfEmittedParticles >= m_maxNumOfParticles)
+	if (m_gameMode == nullptr)
 	{
-		UE_LOG(LogTemp, Warning, TEXT("Teapot will stop spawning particles"));
-		GetWorldTimerManager().ClearTimer(loopTimeHandle);
+		UE_LOG(LogTemp, Warning, TEXT("Game mode didn't load properly in the emitter"));
+		m_isEnabled = false;
 		return;
 	}
+	if (m_numOfLiveParticles >= m_maxNumOfParticles)
+	{
+		if (!m_isAtCapacity)
+			UE_LOG(LogTemp, Warning, TEXT("Teapot will stop spawning particles until some are removed"));
+		m_isAtCapacity = true;
+		m_pendingEmission = 0.0;
+		return;
+	}
+	m_isAtCapacity = false;
 
-	//Spawn a particle
-	FCriticalSection Mutex;
-	FVector newParticleLocation = m_arrow->GetComponentLocation();
-	AFluidParticle* newParticle = GetWorld()->SpawnActor<AFluidParticle>(ParticleBP, newParticleLocation, FRotator().ZeroRotator);
-	FVector newParticleVelocity = m_speed * (FMath::VRandCone(m_arrow->GetForwardVector(), (m_spreadAngleInDegrees * 3.14 / 180.0)));
-	Mutex.Lock();
-	newParticle->SetParticlePosition(newParticleLocation);
-	newParticle->SetParticleVelocity(newParticleVelocity);
-	m_ptrParticles->Push(newParticle);
-	Mutex.Unlock();
-	m_numOfEmittedParticles++;
+	//The rate doesn't depend on the frame rate. Whatever fraction of a particle is left over carries into the next step.
+	const double pendingEmissionAtStart = m_pendingEmission;
+	m_pendingEmission += timeIntervalInSeconds * m_maxNumOfParticlesPerSecond;
+	const int32 numOfParticlesDue = FMath::FloorToInt(m_pendingEmission);
+	m_pendingEmission -= numOfParticlesDue;
+	const int32 numToEmit = FMath::Min(numOfParticlesDue, m_maxNumOfParticles - m_numOfLiveParticles);
+
+	//Every particle has travelled from the nozzle since it came due during the step, so the particles of a step don't start
+	//on top of each other
+	const FluidCore::FVec3 nozzleLocation = ToCore(m_arrow->GetComponentLocation());
+	const FVector direction = m_arrow->GetForwardVector();
+	const float spreadAngle = FMath::DegreesToRadians(m_spreadAngleInDegrees);
+	for (int32 i = 0; i < numToEmit; i++)
+	{
+		const FVector newParticleVelocity = m_speed * FMath::VRandCone(direction, spreadAngle);
+		const FVector newParticleLocation = FromCore(FluidCore::EmissionPosition(nozzleLocation, ToCore(newParticleVelocity), i, pendingEmissionAtStart,
+			m_maxNumOfParticlesPerSecond, timeIntervalInSeconds));
+		m_gameMode->SpawnParticle(newParticleLocation, newParticleVelocity, AFluidParticle::kMass)->SetParticleEmitted(true);
+	}
+	m_numOfLiveParticles += numToEmit;
+}
+
+void APointParticleEmitter::OnParticlesRemoved(int32 numOfParticles)
+{
+	m_numOfLiveParticles = FMath::Max(m_numOfLiveParticles - numOfParticles, 0);
+}
+
+void APointParticleEmitter::OnParticlesAdded(int32 numOfParticles)
+{
+	m_numOfLiveParticles += numOfParticles;
+}
+
+void APointParticleEmitter::RestoreEmissionState(int32 numOfLiveParticles, double pendingEmission)
+{
+	m_numOfLiveParticles = numOfLiveParticles;
+	m_pendingEmission = pendingEmission;
+	m_isAtCapacity = false;
 }
 
 FVector APointParticleEmitter::UniformSampleCone(double rand1, double rand2, const FVector& axis, double angle)
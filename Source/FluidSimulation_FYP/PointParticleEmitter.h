@@ -17,19 +17,27 @@ class FLUIDSIMULATION_FYP_API APointParticleEmitter : public AActor
 	UPROPERTY(EditDefaultsOnly, Category = "Components")
 	class UArrowComponent* m_arrow;
 
-	UPROPERTY(EditDefaultsOnly, Category = "FluidSimulation")
-	TSubclassOf<class AFluidParticle> ParticleBP;
-
 	bool m_isEnabled{ true };
-	TArray<class AFluidParticle*>* m_ptrParticles;
+	class AFluidSimulation_FYPGameModeBase* m_gameMode{ nullptr };
+
+	//Particles that were due but not emitted yet. Only the fraction of a particle carries over between steps.
+	double m_pendingEmission{ 0.0 };
 
-	FTimerHandle loopTimeHandle;
+	//emitted particles that haven't been removed yet
+	int32 m_numOfLiveParticles{ 0 };
+	bool m_isAtCapacity{ false };
 
-	size_t m_numOfEmittedParticles{ 0 };
-	size_t m_maxNumOfParticlesPerSecond{ 25 };
-	size_t m_maxNumOfParticles{ 2000 };
+	UPROPERTY(EditAnywhere, Category = "FluidSimulation", meta = (ClampMin = "0"))
+	int32 m_maxNumOfParticlesPerSecond{ 25 };
 
+	//Emission pauses while this many emitted particles are alive
+	UPROPERTY(EditAnywhere, Category = "FluidSimulation", meta = (ClampMin = "0"))
+	int32 m_maxNumOfParticles{ 2000 };
+
+	UPROPERTY(EditAnywhere, Category = "FluidSimulation")
 	double m_speed{ 10.0 };
+
+	UPROPERTY(EditAnywhere, Category = "FluidSimulation")
 	double m_spreadAngleInDegrees{ 20.0 };
 
 public:	
@@ -37,8 +45,23 @@ public:
 	APointParticleEmitter();
 	~APointParticleEmitter() = default;
 
-	void Initialise(TArray<class AFluidParticle*>* ptrParticles);
-	void Emit();
+	void Initialise(class AFluidSimulation_FYPGameModeBase* gameMode);
+	//Emits every particle that was due during the time step, each as far from the nozzle as it has travelled since it was due
+	void EmitParticles(double timeIntervalInSeconds);
+
+	//Overrides the rate and cap set in the level
+	void SetEmission(int32 particlesPerSecond, int32 maxNumOfParticles);
+
+	//Frees room under the particle cap when emitted particles are removed
+	void OnParticlesRemoved(int32 numOfParticles);
+	//Counts particles split from emitted ones against the particle cap
+	void OnParticlesAdded(int32 numOfParticles);
+
+	int32 GetMaxNumOfParticles() const { return m_maxNumOfParticles; }
+	int32 GetNumOfLiveParticles() const { return m_numOfLiveParticles; }
+	double GetPendingEmission() const { return m_pendingEmission; }
+	//Continues emitting from a checkpoint
+	void RestoreEmissionState(int32 numOfLiveParticles, double pendingEmission);
 
 	//Returns a randomly sampled direction within a cone. 
 	FVector UniformSampleCone(double rand1, double rand2, const FVector& axis, double angle);
@@ -0,0 +1,225 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "SignedDistanceField.h"
+#include "Misc/FileHelper.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+#include "Runtime/Core/Public/Async/ParallelFor.h"
+
+const uint32 FSignedDistanceField::kFileMagic = 0x46445353; //"SSDF"
+const uint32 FSignedDistanceField::kFileVersion = 1;
+
+void FSignedDistanceField::Bake(const TArray<FVector>& vertices, const TArray<uint32>& indices, double cellSize, int32 padding, uint32 sourceKey)
+{
+	m_distances.Empty();
+	m_gradients.Empty();
+
+	const int32 numOfTriangles = indices.Num() / 3;
+	if (numOfTriangles == 0 || cellSize <= 0.0)
+	{
+		return;
+	}
+
+	struct FTriangle
+	{
+		FVector a, b, c;
+		FVector normal;
+		FBox bounds;
+	};
+
+	//Precompute the triangles. The winding is detected from the signed volume so the normals always point outwards.
+	TArray<FTriangle> triangles;
+	triangles.Reserve(numOfTriangles);
+	double signedVolume = 0.0;
+	for (int32 t = 0; t < numOfTriangles; ++t)
+	{
+		FTriangle triangle;
+		triangle.a = vertices[indices[3 * t]];
+		triangle.b = vertices[indices[3 * t + 1]];
+		triangle.c = vertices[indices[3 * t + 2]];
+		const FVector cross = FVector::CrossProduct(triangle.c - triangle.a, triangle.b - triangle.a);
+		signedVolume += FVector::DotProduct(triangle.a, cross);
+		triangle.normal = cross.GetSafeNormal();
+		triangle.bounds = FBox(triangle.a, triangle.a);
+		triangle.bounds += triangle.b;
+		triangle.bounds += triangle.c;
+		triangles.Add(triangle);
+	}
+	if (signedVolume < 0.0)
+	{
+		for (FTriangle& triangle : triangles)
+		{
+			triangle.normal = -triangle.normal;
+		}
+	}
+
+	const FBox meshBounds(vertices);
+	m_cellSize = cellSize;
+	m_sourceKey = sourceKey;
+	m_origin = meshBounds.Min - FVector(padding * cellSize);
+	const FVector size = meshBounds.GetSize() + FVector(2.0 * padding * cellSize);
+	m_resolution = FIntVector(FMath::CeilToInt(size.X / cellSize) + 1, FMath::CeilToInt(size.Y / cellSize) + 1, FMath::CeilToInt(size.Z / cellSize) + 1);
+	m_distances.SetNumUninitialized(m_resolution.X * m_resolution.Y * m_resolution.Z);
+
+	//One row along X per task. Each sample starts from the closest triangle of the previous one,
+	//so the bounding box test rejects most triangles without the closest point query.
+	ParallelFor(m_resolution.Y * m_resolution.Z, [&](int32 row) {
+		const int32 y = row % m_resolution.Y;
+		const int32 z = row / m_resolution.Y;
+		int32 closestTriangle = 0;
+
+		for (int32 x = 0; x < m_resolution.X; ++x)
+		{
+			const FVector point = m_origin + FVector(x, y, z) * m_cellSize;
+			const FTriangle& first = triangles[closestTriangle];
+			double minDistSquared = FVector::DistSquared(point, FMath::ClosestPointOnTriangleToPoint(point, first.a, first.b, first.c));
+
+			for (int32 t = 0; t < numOfTriangles; ++t)
+			{
+				const FTriangle& triangle = triangles[t];
+				if (triangle.bounds.ComputeSquaredDistanceToPoint(point) >= minDistSquared)
+					continue;
+
+				const double distSquared = FVector::DistSquared(point, FMath::ClosestPointOnTriangleToPoint(point, triangle.a, triangle.b, triangle.c));
+				if (distSquared < minDistSquared)
+				{
+					minDistSquared = distSquared;
+					closestTriangle = t;
+				}
+			}
+
+			//The closest point can be on an edge or a vertex shared by several triangles. Summing the normals of all of them
+			//approximates the pseudo-normal there, where a single face normal could give the wrong sign.
+			const double minDist = FMath::Sqrt(minDistSquared);
+			const double toleranceSquared = FMath::Square(minDist + 1e-4 * m_cellSize);
+			const FTriangle& closest = triangles[closestTriangle];
+			const FVector closestPoint = FMath::ClosestPointOnTriangleToPoint(point, closest.a, closest.b, closest.c);
+			FVector normalSum(0.0f);
+			for (const FTriangle& triangle : triangles)
+			{
+				if (triangle.bounds.ComputeSquaredDistanceToPoint(point) > toleranceSquared)
+					continue;
+				if (FVector::DistSquared(point, FMath::ClosestPointOnTriangleToPoint(point, triangle.a, triangle.b, triangle.c)) <= toleranceSquared)
+					normalSum += triangle.normal;
+			}
+
+			const double sign = (FVector::DotProduct(point - closestPoint, normalSum) < 0.0) ? -1.0 : 1.0;
+			m_distances[getSampleIndex(x, y, z)] = sign * minDist;
+		}
+		});
+
+	computeGradients();
+}
+
+void FSignedDistanceField::computeGradients()
+{
+	m_gradients.SetNumUninitialized(m_distances.Num());
+
+	//Central differences, one-sided on the borders
+	ParallelFor(m_resolution.Z, [&](int32 z) {
+		const int32 z0 = FMath::Max(z - 1, 0);
+		const int32 z1 = FMath::Min(z + 1, m_resolution.Z - 1);
+		for (int32 y = 0; y < m_resolution.Y; ++y)
+		{
+			const int32 y0 = FMath::Max(y - 1, 0);
+			const int32 y1 = FMath::Min(y + 1, m_resolution.Y - 1);
+			for (int32 x = 0; x < m_resolution.X; ++x)
+			{
+				const int32 x0 = FMath::Max(x - 1, 0);
+				const int32 x1 = FMath::Min(x + 1, m_resolution.X - 1);
+				m_gradients[getSampleIndex(x, y, z)] = FVector(
+					(m_distances[getSampleIndex(x1, y, z)] - m_distances[getSampleIndex(x0, y, z)]) / ((x1 - x0) * m_cellSize),
+					(m_distances[getSampleIndex(x, y1, z)] - m_distances[getSampleIndex(x, y0, z)]) / ((y1 - y0) * m_cellSize),
+					(m_distances[getSampleIndex(x, y, z1)] - m_distances[getSampleIndex(x, y, z0)]) / ((z1 - z0) * m_cellSize));
+			}
+		}
+		});
+}
+
+bool FSignedDistanceField::Sample(const FVector& point, double* distance, FVector* gradient) const
+{
+	if (!IsValid())
+	{
+		return false;
+	}
+
+	const FVector gridPoint = (point - m_origin) / m_cellSize;
+	if (gridPoint.X < 0.0f || gridPoint.Y < 0.0f || gridPoint.Z < 0.0f ||
+		gridPoint.X > m_resolution.X - 1 || gridPoint.Y > m_resolution.Y - 1 || gridPoint.Z > m_resolution.Z - 1)
+	{
+		return false;
+	}
+
+	const int32 x = FMath::Min(FMath::FloorToInt(gridPoint.X), m_resolution.X - 2);
+	const int32 y = FMath::Min(FMath::FloorToInt(gridPoint.Y), m_resolution.Y - 2);
+	const int32 z = FMath::Min(FMath::FloorToInt(gridPoint.Z), m_resolution.Z - 2);
+	const float fx = gridPoint.X - x;
+	const float fy = gridPoint.Y - y;
+	const float fz = gridPoint.Z - z;
+
+	//Trilinear interpolation of both fields
+	const int32 i000 = getSampleIndex(x, y, z);
+	const int32 i100 = i000 + 1;
+	const int32 i010 = i000 + m_resolution.X;
+	const int32 i110 = i010 + 1;
+	const int32 i001 = i000 + m_resolution.X * m_resolution.Y;
+	const int32 i101 = i001 + 1;
+	const int32 i011 = i001 + m_resolution.X;
+	const int32 i111 = i011 + 1;
+
+	*distance = FMath::Lerp(
+		FMath::Lerp(FMath::Lerp(m_distances[i000], m_distances[i100], fx), FMath::Lerp(m_distances[i010], m_distances[i110], fx), fy),
+		FMath::Lerp(FMath::Lerp(m_distances[i001], m_distances[i101], fx), FMath::Lerp(m_distances[i011], m_distances[i111], fx), fy), fz);
+	*gradient = FMath::Lerp(
+		FMath::Lerp(FMath::Lerp(m_gradients[i000], m_gradients[i100], fx), FMath::Lerp(m_gradients[i010], m_gradients[i110], fx), fy),
+		FMath::Lerp(FMath::Lerp(m_gradients[i001], m_gradients[i101], fx), FMath::Lerp(m_gradients[i011], m_gradients[i111], fx), fy), fz);
+	return true;
+}
+
+bool FSignedDistanceField::SaveToFile(const FString& filename) const
+{
+	TArray<uint8> bytes;
+	FMemoryWriter writer(bytes);
+	uint32 magic = kFileMagic;
+	uint32 version = kFileVersion;
+	writer << magic << version;
+	writer << const_cast<FSignedDistanceField&>(*this);
+	return FFileHelper::SaveArrayToFile(bytes, *filename);
+}
+
+bool FSignedDistanceField::LoadFromFile(const FString& filename)
+{
+	TArray<uint8> bytes;
+	if (!FFileHelper::LoadFileToArray(bytes, *filename, FILEREAD_Silent))
+	{
+		return false;
+	}
+
+	FMemoryReader reader(bytes);
+	uint32 magic = 0;
+	uint32 version = 0;
+	reader << magic << version;
+	if (magic != kFileMagic || version != kFileVersion)
+	{
+		return false;
+	}
+
+	FSignedDistanceField field;
+	reader << field;
+	if (reader.IsError() || field.m_distances.Num() != field.m_resolution.X * field.m_resolution.Y * field.m_resolution.Z ||
+		field.m_gradients.Num() != field.m_distances.Num())
+	{
+		return false;
+	}
+
+	*this = MoveTemp(field);
+	return true;
+}
+
+FArchive& operator<<(FArchive& archive, FSignedDistanceField& field)
+{
+	archive << field.m_resolution << field.m_origin << field.m_cellSize << field.m_sourceKey;
+	archive << field.m_distances << field.m_gradients;
+	return archive;
+}
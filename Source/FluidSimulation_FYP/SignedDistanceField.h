@@ -0,0 +1,50 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Signed distance field sampled on a regular grid, plus its gradient.
+ * Distances are negative inside the surface. Sampling is a trilinear lookup that never touches UObjects,
+ * so it is safe to use from worker threads.
+ */
+class FLUIDSIMULATION_FYP_API FSignedDistanceField
+{
+	static const uint32 kFileMagic;
+	static const uint32 kFileVersion;
+
+	//number of samples along each axis
+	FIntVector m_resolution{ FIntVector(0) };
+	//position of the first sample and distance between samples
+	FVector m_origin{ FVector(0.0f) };
+	double m_cellSize{ 0.0 };
+	//identifies the source the field was baked from, to tell if a cache file is stale
+	uint32 m_sourceKey{ 0 };
+
+	TArray<float> m_distances;
+	TArray<FVector> m_gradients;
+
+	int32 getSampleIndex(int32 x, int32 y, int32 z) const { return (z * m_resolution.Y + y) * m_resolution.X + x; }
+	void computeGradients();
+
+public:
+	FSignedDistanceField() = default;
+	~FSignedDistanceField() = default;
+
+	//Bakes the field of a triangle mesh. cellSize is the spacing between samples and padding the number of samples around the mesh bounds.
+	void Bake(const TArray<FVector>& vertices, const TArray<uint32>& indices, double cellSize, int32 padding, uint32 sourceKey);
+
+	//Returns false when the point is outside the sampled bounds, where there is nothing to collide with
+	bool Sample(const FVector& point, double* distance, FVector* gradient) const;
+
+	bool IsValid() const { return m_distances.Num() > 0; }
+	FBox GetBounds() const { return FBox(m_origin, m_origin + FVector(m_resolution - FIntVector(1)) * m_cellSize); }
+	uint32 GetSourceKey() const { return m_sourceKey; }
+
+	//Cache files
+	bool SaveToFile(const FString& filename) const;
+	bool LoadFromFile(const FString& filename);
+
+	friend FArchive& operator<<(FArchive& archive, FSignedDistanceField& field);
+};
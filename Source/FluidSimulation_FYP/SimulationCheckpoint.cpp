@@ -0,0 +1,137 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "SimulationCheckpoint.h"
+#include "HAL/PlatformFilemanager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+//"FSCP"
+const uint32 FSimulationCheckpoint::kFileMagic = 0x50435346;
+const uint32 FSimulationCheckpoint::kFileVersion = 1;
+
+namespace
+{
+	const uint64 kBlockAlignment = 16;
+
+	//size of one element of every block, in the order of FSimulationCheckpointHeader::EBlock
+	const uint64 kElementSizes[FSimulationCheckpointHeader::NumOfBlocks] = {
+		sizeof(FVector), sizeof(FVector), sizeof(FVector), sizeof(double), sizeof(double), sizeof(double), sizeof(double), sizeof(uint8)
+	};
+}
+
+void FSimulationCheckpoint::SetNumOfParticles(int32 numOfParticles)
+{
+	header.numOfParticles = numOfParticles;
+	positions.SetNumUninitialized(numOfParticles);
+	velocities.SetNumUninitialized(numOfParticles);
+	forces.SetNumUninitialized(numOfParticles);
+	densities.SetNumUninitialized(numOfParticles);
+	pressures.SetNumUninitialized(numOfParticles);
+	masses.SetNumUninitialized(numOfParticles);
+	ages.SetNumUninitialized(numOfParticles);
+	flags.SetNumUninitialized(numOfParticles);
+}
+
+bool FSimulationCheckpoint::SaveToFile(const FString& filename) const
+{
+	FSimulationCheckpointHeader fileHeader = header;
+	fileHeader.magic = kFileMagic;
+	fileHeader.version = kFileVersion;
+	fileHeader.numOfParticles = positions.Num();
+
+	uint64 offset = Align(sizeof(FSimulationCheckpointHeader), kBlockAlignment);
+	for (int32 b = 0; b < FSimulationCheckpointHeader::NumOfBlocks; b++)
+	{
+		fileHeader.blockOffsets[b] = offset;
+		offset = Align(offset + kElementSizes[b] * fileHeader.numOfParticles, kBlockAlignment);
+	}
+	const uint8* blocks[FSimulationCheckpointHeader::NumOfBlocks] = {
+		reinterpret_cast<const uint8*>(positions.GetData()), reinterpret_cast<const uint8*>(velocities.GetData()), reinterpret_cast<const uint8*>(forces.GetData()),
+		reinterpret_cast<const uint8*>(densities.GetData()), reinterpret_cast<const uint8*>(pressures.GetData()), reinterpret_cast<const uint8*>(masses.GetData()),
+		reinterpret_cast<const uint8*>(ages.GetData()), flags.GetData()
+	};
+
+	IPlatformFile& platformFile = FPlatformFileManager::Get().GetPlatformFile();
+	platformFile.CreateDirectoryTree(*FPaths::GetPath(filename));
+	const FString temporaryFilename = filename + TEXT(".tmp");
+	{
+		TUniquePtr<IFileHandle> file(platformFile.OpenWrite(*temporaryFilename));
+		if (!file)
+		{
+			return false;
+		}
+
+		static const uint8 kZeros[kBlockAlignment] = {};
+		bool isWritten = file->Write(reinterpret_cast<const uint8*>(&fileHeader), sizeof(fileHeader));
+		for (int32 b = 0; b < FSimulationCheckpointHeader::NumOfBlocks && isWritten; b++)
+		{
+			isWritten = file->Write(kZeros, fileHeader.blockOffsets[b] - file->Tell());
+			isWritten = isWritten && file->Write(blocks[b], kElementSizes[b] * fileHeader.numOfParticles);
+		}
+		if (!isWritten || !file->Flush())
+		{
+			return false;
+		}
+	}
+
+	platformFile.DeleteFile(*filename);
+	return platformFile.MoveFile(*filename, *temporaryFilename);
+}
+
+FMappedSimulationCheckpoint::~FMappedSimulationCheckpoint()
+{
+	//the region has to be unmapped before its file is closed
+	m_region.Reset();
+	m_file.Reset();
+}
+
+bool FMappedSimulationCheckpoint::Open(const FString& filename)
+{
+	m_region.Reset();
+	m_file.Reset();
+	m_fileBytes.Reset();
+	m_data = nullptr;
+	m_size = 0;
+
+	m_file.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*filename));
+	if (m_file)
+	{
+		m_region.Reset(m_file->MapRegion(0, m_file->GetFileSize(), true));
+	}
+	if (m_region)
+	{
+		m_data = m_region->GetMappedPtr();
+		m_size = m_region->GetMappedSize();
+	}
+	else if (FFileHelper::LoadFileToArray(m_fileBytes, *filename, FILEREAD_Silent))
+	{
+		m_data = m_fileBytes.GetData();
+		m_size = m_fileBytes.Num();
+	}
+
+	return isValid();
+}
+
+bool FMappedSimulationCheckpoint::isValid() const
+{
+	if (m_data == nullptr || m_size < static_cast<int64>(sizeof(FSimulationCheckpointHeader)))
+	{
+		return false;
+	}
+
+	const FSimulationCheckpointHeader& header = GetHeader();
+	if (header.magic != FSimulationCheckpoint::kFileMagic || header.version != FSimulationCheckpoint::kFileVersion || header.numOfParticles < 0)
+	{
+		return false;
+	}
+	for (int32 b = 0; b < FSimulationCheckpointHeader::NumOfBlocks; b++)
+	{
+		const uint64 offset = header.blockOffsets[b];
+		if (!IsAligned(offset, kBlockAlignment) || offset + kElementSizes[b] * header.numOfParticles > static_cast<uint64>(m_size))
+		{
+			return false;
+		}
+	}
+	return true;
+}
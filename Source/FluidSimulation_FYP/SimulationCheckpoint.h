@@ -0,0 +1,109 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+//Fixed-size start of a checkpoint file. Every field has an explicit size so the header can be read in place.
+struct FLUIDSIMULATION_FYP_API FSimulationCheckpointHeader
+{
+	enum EBlock
+	{
+		Positions,
+		Velocities,
+		Forces,
+		Densities,
+		Pressures,
+		Masses,
+		Ages,
+		Flags,
+		NumOfBlocks
+	};
+
+	uint32 magic{ 0 };
+	uint32 version{ 0 };
+	int32 numOfParticles{ 0 };
+	uint32 isPCISPH{ 0 };
+	double targetDensity{ 0.0 };
+	double targetSpacing{ 0.0 };
+	double kernelRadius{ 0.0 };
+	//solver and emitter counters
+	int32 stepsSinceAdaptivity{ 0 };
+	int32 stepsSinceCompaction{ 0 };
+	int32 numOfLiveEmittedParticles{ 0 };
+	int32 padding{ 0 };
+	double pendingEmission{ 0.0 };
+	//offset of every particle block from the start of the file
+	uint64 blockOffsets[NumOfBlocks];
+};
+
+/**
+ * Complete state of a simulation: every particle attribute plus the solver and emitter counters.
+ * The file is the header followed by one aligned block per attribute, so a restore can read a mapped file in place.
+ * PCISPH starts its pressure iterations from zero every step, so the particle pressures are all it carries over.
+ */
+class FLUIDSIMULATION_FYP_API FSimulationCheckpoint
+{
+public:
+	static const uint32 kFileMagic;
+	static const uint32 kFileVersion;
+
+	enum EParticleFlags : uint8
+	{
+		Dead = 1 << 0,
+		Emitted = 1 << 1
+	};
+
+	FSimulationCheckpointHeader header;
+	TArray<FVector> positions;
+	TArray<FVector> velocities;
+	TArray<FVector> forces;
+	TArray<double> densities;
+	TArray<double> pressures;
+	TArray<double> masses;
+	TArray<double> ages;
+	TArray<uint8> flags;
+
+	void SetNumOfParticles(int32 numOfParticles);
+
+	//Writes to a temporary file that replaces the old checkpoint once complete. Safe to call from any thread.
+	bool SaveToFile(const FString& filename) const;
+};
+
+//Checkpoint file mapped into memory. The particle blocks are read straight from the mapping.
+class FLUIDSIMULATION_FYP_API FMappedSimulationCheckpoint
+{
+	TUniquePtr<IMappedFileHandle> m_file;
+	TUniquePtr<IMappedFileRegion> m_region;
+	//only used on platforms that can't map files
+	TArray<uint8> m_fileBytes;
+
+	const uint8* m_data{ nullptr };
+	int64 m_size{ 0 };
+
+	template<typename T>
+	TArrayView<const T> getBlock(FSimulationCheckpointHeader::EBlock block) const
+	{
+		return TArrayView<const T>(reinterpret_cast<const T*>(m_data + GetHeader().blockOffsets[block]), GetHeader().numOfParticles);
+	}
+	bool isValid() const;
+
+public:
+	FMappedSimulationCheckpoint() = default;
+	~FMappedSimulationCheckpoint();
+
+	bool Open(const FString& filename);
+
+	const FSimulationCheckpointHeader& GetHeader() const { return *reinterpret_cast<const FSimulationCheckpointHeader*>(m_data); }
+	TArrayView<const FVector> GetPositions() const { return getBlock<FVector>(FSimulationCheckpointHeader::Positions); }
+	TArrayView<const FVector> GetVelocities() const { return getBlock<FVector>(FSimulationCheckpointHeader::Velocities); }
+	TArrayView<const FVector> GetForces() const { return getBlock<FVector>(FSimulationCheckpointHeader::Forces); }
+	TArrayView<const double> GetDensities() const { return getBlock<double>(FSimulationCheckpointHeader::Densities); }
+	TArrayView<const double> GetPressures() const { return getBlock<double>(FSimulationCheckpointHeader::Pressures); }
+	TArrayView<const double> GetMasses() const { return getBlock<double>(FSimulationCheckpointHeader::Masses); }
+	TArrayView<const double> GetAges() const { return getBlock<double>(FSimulationCheckpointHeader::Ages); }
+	TArrayView<const uint8> GetFlags() const { return getBlock<uint8>(FSimulationCheckpointHeader::Flags); }
+};
@@ -0,0 +1,152 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VectorFieldGrid.h"
+#include "Misc/FileHelper.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+#include "Runtime/Core/Public/Async/ParallelFor.h"
+
+const uint32 FVectorFieldGrid::kFileMagic = 0x47465646; //"FVFG"
+const uint32 FVectorFieldGrid::kFileVersion = 1;
+
+void FVectorFieldGrid::Bake(const FBox& bounds, double cellSize, TFunctionRef<FVector(const FVector&)> field, float zeroTolerance)
+{
+	m_brickIndices.Empty();
+	m_values.Empty();
+	if (!bounds.IsValid || cellSize <= 0.0)
+	{
+		return;
+	}
+
+	m_origin = bounds.Min;
+	m_cellSize = cellSize;
+	const FVector size = bounds.GetSize();
+	m_resolution = FIntVector(FMath::CeilToInt(size.X / cellSize) + 1, FMath::CeilToInt(size.Y / cellSize) + 1, FMath::CeilToInt(size.Z / cellSize) + 1);
+	m_numOfBricks = FIntVector(FMath::DivideAndRoundUp(m_resolution.X, kBrickSize), FMath::DivideAndRoundUp(m_resolution.Y, kBrickSize), FMath::DivideAndRoundUp(m_resolution.Z, kBrickSize));
+	const int32 numOfBricks = m_numOfBricks.X * m_numOfBricks.Y * m_numOfBricks.Z;
+
+	//every brick is evaluated on its own, then the non-zero ones are packed in brick order
+	TArray<TArray<FVector>> brickValues;
+	brickValues.SetNum(numOfBricks);
+	ParallelFor(numOfBricks, [&](int32 b) {
+		const FIntVector brick(b % m_numOfBricks.X, (b / m_numOfBricks.X) % m_numOfBricks.Y, b / (m_numOfBricks.X * m_numOfBricks.Y));
+		TArray<FVector>& values = brickValues[b];
+		values.SetNumUninitialized(kBrickSamples);
+		bool isZero = true;
+		for (int32 s = 0; s < kBrickSamples; s++)
+		{
+			const FIntVector sample = brick * kBrickSize + FIntVector(s % kBrickSize, (s / kBrickSize) % kBrickSize, s / (kBrickSize * kBrickSize));
+			values[s] = field(m_origin + FVector(sample) * m_cellSize);
+			isZero = isZero && values[s].SizeSquared() <= zeroTolerance * zeroTolerance;
+		}
+		if (isZero)
+			values.Empty();
+		});
+
+	m_brickIndices.SetNumUninitialized(numOfBricks);
+	int32 numOfStoredBricks = 0;
+	for (int32 b = 0; b < numOfBricks; b++)
+	{
+		m_brickIndices[b] = brickValues[b].Num() > 0 ? numOfStoredBricks++ : INDEX_NONE;
+	}
+	m_values.SetNumUninitialized(numOfStoredBricks * kBrickSamples);
+	ParallelFor(numOfBricks, [&](int32 b) {
+		if (m_brickIndices[b] != INDEX_NONE)
+			FMemory::Memcpy(&m_values[m_brickIndices[b] * kBrickSamples], brickValues[b].GetData(), kBrickSamples * sizeof(FVector));
+		});
+}
+
+FVector FVectorFieldGrid::getValue(int32 x, int32 y, int32 z) const
+{
+	const int32 brick = ((z / kBrickSize) * m_numOfBricks.Y + y / kBrickSize) * m_numOfBricks.X + x / kBrickSize;
+	const int32 brickIndex = m_brickIndices[brick];
+	if (brickIndex == INDEX_NONE)
+	{
+		return FVector(0.0f);
+	}
+	const int32 sample = ((z % kBrickSize) * kBrickSize + y % kBrickSize) * kBrickSize + x % kBrickSize;
+	return m_values[brickIndex * kBrickSamples + sample];
+}
+
+FVector FVectorFieldGrid::Sample(const FVector& point) const
+{
+	if (!IsValid())
+	{
+		return FVector(0.0f);
+	}
+
+	const FVector gridPoint = (point - m_origin) / m_cellSize;
+	if (gridPoint.X < 0.0f || gridPoint.Y < 0.0f || gridPoint.Z < 0.0f ||
+		gridPoint.X > m_resolution.X - 1 || gridPoint.Y > m_resolution.Y - 1 || gridPoint.Z > m_resolution.Z - 1)
+	{
+		return FVector(0.0f);
+	}
+
+	const int32 x = FMath::Min(FMath::FloorToInt(gridPoint.X), FMath::Max(m_resolution.X - 2, 0));
+	const int32 y = FMath::Min(FMath::FloorToInt(gridPoint.Y), FMath::Max(m_resolution.Y - 2, 0));
+	const int32 z = FMath::Min(FMath::FloorToInt(gridPoint.Z), FMath::Max(m_resolution.Z - 2, 0));
+	const float fx = gridPoint.X - x;
+	const float fy = gridPoint.Y - y;
+	const float fz = gridPoint.Z - z;
+
+	//the samples past the last one are inside the last brick, so the corners never leave the brick table
+	const FVector v00 = FMath::Lerp(getValue(x, y, z), getValue(x + 1, y, z), fx);
+	const FVector v10 = FMath::Lerp(getValue(x, y + 1, z), getValue(x + 1, y + 1, z), fx);
+	const FVector v01 = FMath::Lerp(getValue(x, y, z + 1), getValue(x + 1, y, z + 1), fx);
+	const FVector v11 = FMath::Lerp(getValue(x, y + 1, z + 1), getValue(x + 1, y + 1, z + 1), fx);
+	return FMath::Lerp(FMath::Lerp(v00, v10, fy), FMath::Lerp(v01, v11, fy), fz);
+}
+
+bool FVectorFieldGrid::SaveToFile(const FString& filename) const
+{
+	TArray<uint8> bytes;
+	FMemoryWriter writer(bytes);
+	uint32 magic = kFileMagic;
+	uint32 version = kFileVersion;
+	writer << magic << version;
+	writer << const_cast<FVectorFieldGrid&>(*this);
+	return FFileHelper::SaveArrayToFile(bytes, *filename);
+}
+
+bool FVectorFieldGrid::LoadFromFile(const FString& filename)
+{
+	TArray<uint8> bytes;
+	if (!FFileHelper::LoadFileToArray(bytes, *filename, FILEREAD_Silent))
+	{
+		return false;
+	}
+
+	FMemoryReader reader(bytes);
+	uint32 magic = 0;
+	uint32 version = 0;
+	reader << magic << version;
+	if (magic != kFileMagic || version != kFileVersion)
+	{
+		return false;
+	}
+
+	FVectorFieldGrid field;
+	reader << field;
+	const FIntVector numOfBricks(FMath::DivideAndRoundUp(field.m_resolution.X, kBrickSize), FMath::DivideAndRoundUp(field.m_resolution.Y, kBrickSize), FMath::DivideAndRoundUp(field.m_resolution.Z, kBrickSize));
+	if (reader.IsError() || field.m_numOfBricks != numOfBricks || field.m_brickIndices.Num() != numOfBricks.X * numOfBricks.Y * numOfBricks.Z ||
+		field.m_values.Num() % kBrickSamples != 0)
+	{
+		return false;
+	}
+	for (int32 brickIndex : field.m_brickIndices)
+	{
+		if (brickIndex != INDEX_NONE && (brickIndex < 0 || brickIndex >= field.GetNumOfStoredBricks()))
+			return false;
+	}
+
+	*this = MoveTemp(field);
+	return true;
+}
+
+FArchive& operator<<(FArchive& archive, FVectorFieldGrid& field)
+{
+	archive << field.m_resolution << field.m_origin << field.m_cellSize << field.m_numOfBricks;
+	archive << field.m_brickIndices << field.m_values;
+	return archive;
+}
@@ -0,0 +1,52 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Vector field baked on a regular grid, stored in bricks of kBrickSize^3 samples.
+ * Bricks where the field is zero aren't stored, so a gust in the corner of a large volume only costs memory where it blows.
+ * Sampling is a trilinear lookup that never touches UObjects, so it is safe to use from worker threads.
+ */
+class FLUIDSIMULATION_FYP_API FVectorFieldGrid
+{
+	static const uint32 kFileMagic;
+	static const uint32 kFileVersion;
+	static const int32 kBrickSize = 8;
+	static const int32 kBrickSamples = kBrickSize * kBrickSize * kBrickSize;
+
+	//number of samples along each axis
+	FIntVector m_resolution{ FIntVector(0) };
+	//position of the first sample and distance between samples
+	FVector m_origin{ FVector(0.0f) };
+	double m_cellSize{ 0.0 };
+
+	FIntVector m_numOfBricks{ FIntVector(0) };
+	//index of every brick in m_values, INDEX_NONE where the field is zero
+	TArray<int32> m_brickIndices;
+	TArray<FVector> m_values;
+
+	FVector getValue(int32 x, int32 y, int32 z) const;
+
+public:
+	FVectorFieldGrid() = default;
+	~FVectorFieldGrid() = default;
+
+	//Evaluates the field at every sample in the bounds. Bricks whose values are all shorter than the tolerance are left out.
+	void Bake(const FBox& bounds, double cellSize, TFunctionRef<FVector(const FVector&)> field, float zeroTolerance);
+
+	//Zero outside the sampled bounds
+	FVector Sample(const FVector& point) const;
+
+	bool IsValid() const { return m_brickIndices.Num() > 0; }
+	FBox GetBounds() const { return FBox(m_origin, m_origin + FVector(m_resolution - FIntVector(1)) * m_cellSize); }
+	int32 GetNumOfBricks() const { return m_brickIndices.Num(); }
+	int32 GetNumOfStoredBricks() const { return m_values.Num() / kBrickSamples; }
+
+	//Field files. Time-varying fields are one file per frame.
+	bool SaveToFile(const FString& filename) const;
+	bool LoadFromFile(const FString& filename);
+
+	friend FArchive& operator<<(FArchive& archive, FVectorFieldGrid& field);
+};
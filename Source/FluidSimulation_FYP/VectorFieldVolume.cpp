@@ -0,0 +1,225 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VectorFieldVolume.h"
+#include "Components/BoxComponent.h"
+#include "Async/Async.h"
+#include "Misc/Paths.h"
+
+FVector FVectorFieldSnapshot::Sample(const FVector& point) const
+{
+	if (frame == nullptr)
+	{
+		return FVector(0.0f);
+	}
+	const FVector localPoint = inverseTransform.TransformPosition(point);
+	FVector value = frame->Sample(localPoint);
+	if (nextFrame != nullptr && blend > 0.0f)
+		value = FMath::Lerp(value, nextFrame->Sample(localPoint), blend);
+	return strength * transform.TransformVectorNoScale(value);
+}
+
+// Sets default values
+AVectorFieldVolume::AVectorFieldVolume()
+{
+ 	// Set this actor to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
+	PrimaryActorTick.bCanEverTick = false;
+
+	m_box = CreateDefaultSubobject<UBoxComponent>(TEXT("Box"));
+	m_box->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	RootComponent = m_box;
+}
+
+FVector AVectorFieldVolume::evaluateProcedural(const FVector& worldPoint) const
+{
+	switch (m_source)
+	{
+	case EVectorFieldSource::SineWind:
+		//this uses radians
+		return FVector(FMath::Sin(worldPoint.X) * FMath::Sin(m_vector.Z),
+			FMath::Sin(worldPoint.Z) * FMath::Sin(m_vector.Y),
+			FMath::Sin(worldPoint.Y) * FMath::Sin(m_vector.X));
+	case EVectorFieldSource::Vortex:
+	{
+		//solid body rotation in the middle, fading to nothing at the sides of the box
+		const FTransform& transform = m_box->GetComponentTransform();
+		const FVector localPoint = transform.InverseTransformPositionNoScale(worldPoint);
+		const float radius = FVector2D(localPoint).Size();
+		const float maxRadius = FVector2D(m_box->GetScaledBoxExtent()).GetMin();
+		if (radius <= KINDA_SMALL_NUMBER || maxRadius <= KINDA_SMALL_NUMBER)
+			return FVector(0.0f);
+		const float speed = m_vector.Size() * FMath::Min(radius / (0.5f * maxRadius), FMath::Max(2.0f - 2.0f * radius / maxRadius, 0.0f));
+		return transform.TransformVectorNoScale(FVector(-localPoint.Y, localPoint.X, 0.0f) / radius * speed);
+	}
+	default:
+		return m_vector;
+	}
+}
+
+FString AVectorFieldVolume::getFramePath(int32 frame) const
+{
+	if (m_numOfFrames <= 1)
+	{
+		return FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("VectorFields"), m_fieldFile);
+	}
+	return FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("VectorFields"),
+		FString::Printf(TEXT("%s_%04i%s"), *FPaths::GetBaseFilename(m_fieldFile), frame, *FPaths::GetExtension(m_fieldFile, true)));
+}
+
+void AVectorFieldVolume::loadFrameAsync(int32 frame)
+{
+	const FString path = getFramePath(frame);
+	m_nextFrameLoad = Async(EAsyncExecution::ThreadPool, [path]() {
+		TSharedPtr<FVectorFieldGrid> grid = MakeShared<FVectorFieldGrid>();
+		if (!grid->LoadFromFile(path))
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Couldn't load the vector field frame %s"), *path);
+			grid.Reset();
+		}
+		return grid;
+		});
+}
+
+void AVectorFieldVolume::InitialiseField()
+{
+	if (m_isInitialised)
+	{
+		return;
+	}
+	m_isInitialised = true;
+	m_time = 0.0;
+	m_currentFrame = 0;
+	m_numOfStalledSteps = 0;
+
+	//the grid is in the box's space, so moving the volume moves the field with it
+	FTransform transform = m_box->GetComponentTransform();
+	transform.SetScale3D(FVector(1.0f));
+	const FVector extent = m_box->GetScaledBoxExtent();
+	const FBox localBounds(-extent, extent);
+
+	if (m_source == EVectorFieldSource::File)
+	{
+		m_frames[0] = MakeShared<FVectorFieldGrid>();
+		if (!m_frames[0]->LoadFromFile(getFramePath(0)))
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Couldn't load the vector field %s for %s"), *getFramePath(0), *GetName());
+			m_frames[0].Reset();
+			return;
+		}
+		if (m_numOfFrames > 1)
+		{
+			m_frames[1] = MakeShared<FVectorFieldGrid>();
+			if (!m_frames[1]->LoadFromFile(getFramePath(1)))
+				m_frames[1].Reset();
+			loadFrameAsync(2 % m_numOfFrames);
+		}
+		UE_LOG(LogTemp, Warning, TEXT("Loaded vector field %s for %s: %i of %i bricks stored"),
+			*getFramePath(0), *GetName(), m_frames[0]->GetNumOfStoredBricks(), m_frames[0]->GetNumOfBricks());
+	}
+	else
+	{
+		const double startTime = FPlatformTime::Seconds();
+		m_frames[0] = MakeShared<FVectorFieldGrid>();
+		m_frames[0]->Bake(localBounds, m_cellSize, [&](const FVector& localPoint) {
+			return transform.InverseTransformVectorNoScale(evaluateProcedural(transform.TransformPositionNoScale(localPoint)));
+			}, KINDA_SMALL_NUMBER);
+		UE_LOG(LogTemp, Warning, TEXT("Baked vector field for %s in %f s: %i of %i bricks stored"),
+			*GetName(), FPlatformTime::Seconds() - startTime, m_frames[0]->GetNumOfStoredBricks(), m_frames[0]->GetNumOfBricks());
+		measureSamplingCost(localBounds, transform);
+
+		if (!m_fieldFile.IsEmpty() && !m_frames[0]->SaveToFile(getFramePath(0)))
+			UE_LOG(LogTemp, Warning, TEXT("Couldn't write the vector field %s"), *getFramePath(0));
+	}
+}
+
+void AVectorFieldVolume::measureSamplingCost(const FBox& localBounds, const FTransform& transform) const
+{
+	const int32 numOfSamples = 1 << 16;
+	TArray<FVector> points;
+	points.SetNumUninitialized(numOfSamples);
+	FRandomStream random(numOfSamples);
+	for (FVector& point : points)
+	{
+		point = transform.TransformPositionNoScale(FVector(random.FRandRange(localBounds.Min.X, localBounds.Max.X),
+			random.FRandRange(localBounds.Min.Y, localBounds.Max.Y), random.FRandRange(localBounds.Min.Z, localBounds.Max.Z)));
+	}
+
+	//the sums stop the compiler from dropping the loops
+	FVector analyticSum(0.0f);
+	double startTime = FPlatformTime::Seconds();
+	for (const FVector& point : points)
+	{
+		analyticSum += evaluateProcedural(point);
+	}
+	const double analyticTime = FPlatformTime::Seconds() - startTime;
+
+	FVectorFieldSnapshot snapshot;
+	snapshot.transform = transform;
+	snapshot.inverseTransform = transform.Inverse();
+	snapshot.frame = m_frames[0].Get();
+	FVector gridSum(0.0f);
+	startTime = FPlatformTime::Seconds();
+	for (const FVector& point : points)
+	{
+		gridSum += snapshot.Sample(point);
+	}
+	const double gridTime = FPlatformTime::Seconds() - startTime;
+
+	UE_LOG(LogTemp, Warning, TEXT("Vector field %s sampling: analytic %f ns, grid %f ns per particle (mean difference %f)"),
+		*GetName(), analyticTime * 1e9 / numOfSamples, gridTime * 1e9 / numOfSamples, ((analyticSum - gridSum) / numOfSamples).Size());
+}
+
+FVectorFieldSnapshot AVectorFieldVolume::UpdateSnapshot(double timeIntervalInSeconds)
+{
+	InitialiseField();
+
+	FVectorFieldSnapshot snapshot;
+	FTransform transform = m_box->GetComponentTransform();
+	transform.SetScale3D(FVector(1.0f));
+	snapshot.transform = transform;
+	snapshot.inverseTransform = transform.Inverse();
+	snapshot.strength = m_strength;
+
+	if (m_numOfFrames > 1 && m_frames[0] && m_frames[1])
+	{
+		m_time += timeIntervalInSeconds;
+		const double frameTime = m_time * m_framesPerSecond;
+		const int32 frame = FMath::FloorToInt(frameTime) % m_numOfFrames;
+
+		//the next frame can only move up once the one after it has streamed in
+		if (frame != m_currentFrame && m_nextFrameLoad.IsValid() && m_nextFrameLoad.IsReady())
+		{
+			TSharedPtr<FVectorFieldGrid> loadedFrame = m_nextFrameLoad.Get();
+			if (loadedFrame)
+			{
+				m_frames[0] = m_frames[1];
+				m_frames[1] = loadedFrame;
+				m_currentFrame = (m_currentFrame + 1) % m_numOfFrames;
+				loadFrameAsync((m_currentFrame + 2) % m_numOfFrames);
+			}
+			else
+			{
+				//a missing frame stops the stream on the frames it already has
+				m_nextFrameLoad = TFuture<TSharedPtr<FVectorFieldGrid>>();
+			}
+		}
+		if (frame != m_currentFrame)
+			m_numOfStalledSteps++;
+
+		//a stalled stream holds the latest frame it has
+		snapshot.blend = frame == m_currentFrame ? static_cast<float>(FMath::Frac(frameTime)) : 1.0f;
+		snapshot.nextFrame = m_frames[1].Get();
+	}
+	snapshot.frame = m_frames[0].Get();
+	return snapshot;
+}
+
+void AVectorFieldVolume::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	Super::EndPlay(EndPlayReason);
+
+	if (m_nextFrameLoad.IsValid())
+		m_nextFrameLoad.Wait();
+	if (m_numOfStalledSteps > 0)
+		UE_LOG(LogTemp, Warning, TEXT("Vector field %s waited for frames to stream in for %i steps"), *GetName(), m_numOfStalledSteps);
+}
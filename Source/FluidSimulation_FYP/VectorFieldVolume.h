@@ -0,0 +1,94 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "Async/Future.h"
+#include "VectorFieldGrid.h"
+#include "VectorFieldVolume.generated.h"
+
+UENUM()
+enum class EVectorFieldSource : uint8
+{
+	//the same vector everywhere
+	Uniform,
+	//the solver's old analytic test wind, with the vector as its parameters
+	SineWind,
+	//swirls around the volume's up axis with the length of the vector as its speed
+	Vortex,
+	//baked grids from Saved/VectorFields
+	File
+};
+
+//Vector field of one volume for one simulation step, safe to read from worker threads
+struct FLUIDSIMULATION_FYP_API FVectorFieldSnapshot
+{
+	FTransform transform;
+	FTransform inverseTransform;
+	//the field blends from the frame to the next one, both owned by the volume
+	const FVectorFieldGrid* frame{ nullptr };
+	const FVectorFieldGrid* nextFrame{ nullptr };
+	float blend{ 0.0f };
+	float strength{ 1.0f };
+
+	FVector Sample(const FVector& point) const;
+};
+
+//Air velocity the particles are dragged towards inside the box. Overlapping volumes add up.
+UCLASS()
+class FLUIDSIMULATION_FYP_API AVectorFieldVolume : public AActor
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditDefaultsOnly, Category = "Components")
+	class UBoxComponent* m_box;
+
+	UPROPERTY(EditAnywhere, Category = "FluidSimulation")
+	EVectorFieldSource m_source{ EVectorFieldSource::SineWind };
+
+	UPROPERTY(EditAnywhere, Category = "FluidSimulation")
+	FVector m_vector{ FVector(10.0f, 25.0f, 0.0f) };
+
+	UPROPERTY(EditAnywhere, Category = "FluidSimulation")
+	float m_strength{ 1.0f };
+
+	//Spacing of the baked samples for the procedural sources
+	UPROPERTY(EditAnywhere, Category = "FluidSimulation", meta = (ClampMin = "0.01"))
+	float m_cellSize{ 1.0f };
+
+	//File in Saved/VectorFields. Time-varying fields are Name_0000.vfg, Name_0001.vfg... for a file called Name.vfg.
+	UPROPERTY(EditAnywhere, Category = "FluidSimulation")
+	FString m_fieldFile;
+
+	UPROPERTY(EditAnywhere, Category = "FluidSimulation", meta = (ClampMin = "1"))
+	int32 m_numOfFrames{ 1 };
+
+	UPROPERTY(EditAnywhere, Category = "FluidSimulation", meta = (ClampMin = "0.01"))
+	float m_framesPerSecond{ 30.0f };
+
+	//the frame being played and the one after it. The frame after that streams in on the thread pool.
+	TSharedPtr<FVectorFieldGrid> m_frames[2];
+	int32 m_currentFrame{ 0 };
+	TFuture<TSharedPtr<FVectorFieldGrid>> m_nextFrameLoad;
+	double m_time{ 0.0 };
+	int32 m_numOfStalledSteps{ 0 };
+	bool m_isInitialised{ false };
+
+	FVector evaluateProcedural(const FVector& worldPoint) const;
+	FString getFramePath(int32 frame) const;
+	void loadFrameAsync(int32 frame);
+	void measureSamplingCost(const FBox& localBounds, const FTransform& transform) const;
+
+public:	
+	// Sets default values for this actor's properties
+	AVectorFieldVolume();
+
+	//Bakes the procedural field or loads the first frames. Does nothing the second time.
+	void InitialiseField();
+	//Advances time-varying fields. Must be called on the game thread, once per step.
+	FVectorFieldSnapshot UpdateSnapshot(double timeIntervalInSeconds);
+
+protected:
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+};
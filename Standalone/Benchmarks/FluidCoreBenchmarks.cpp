@@ -0,0 +1,176 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+//Micro benchmarks of the core's hot loops, and a macro benchmark of whole WCSPH steps. Single threaded, so the numbers
+//compare the numerics themselves; the game mode's parallel loops and task graph are measured by FluidBenchmarkCommandlet.
+
+#include "FluidCore/Collision.h"
+#include "FluidCore/Kernels.h"
+#include "FluidCore/Lattice.h"
+#include "FluidCore/NeighbourGrid.h"
+#include "FluidCore/SphStages.h"
+#include "FluidCore/WcsphSolver.h"
+#include <benchmark/benchmark.h>
+#include <random>
+
+using namespace FluidCore;
+
+namespace
+{
+	const double kKernelRadius = 1.8;
+
+	//a block of fluid at the target spacing, side points per axis
+	std::vector<FVec3> makeFluidBlock(int side)
+	{
+		std::vector<FVec3> points;
+		GenerateBccLattice(FVec3(0.0), FVec3(side - 1.0), 1.0, &points);
+		return points;
+	}
+
+	std::vector<double> makeDistances(size_t num)
+	{
+		std::mt19937 random(3);
+		std::uniform_real_distribution<double> distance(0.0, kKernelRadius * 1.1);
+		std::vector<double> distances(num);
+		for (double& r : distances)
+		{
+			r = distance(random);
+		}
+		return distances;
+	}
+}
+
+static void BM_StdKernel(benchmark::State& state)
+{
+	const FStdKernel kernel(kKernelRadius);
+	const std::vector<double> distances = makeDistances(4096);
+	for (auto _ : state)
+	{
+		double sum = 0.0;
+		for (double r : distances)
+		{
+			sum += kernel(r);
+		}
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(state.iterations() * distances.size());
+}
+BENCHMARK(BM_StdKernel);
+
+static void BM_SpikyKernelGradient(benchmark::State& state)
+{
+	const FSpikyKernel kernel(kKernelRadius);
+	const std::vector<double> distances = makeDistances(4096);
+	const FVec3 direction = FVec3(1.0, 2.0, 3.0).GetSafeNormal();
+	for (auto _ : state)
+	{
+		FVec3 sum;
+		for (double r : distances)
+		{
+			sum += kernel.Gradient(r, direction);
+		}
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(state.iterations() * distances.size());
+}
+BENCHMARK(BM_SpikyKernelGradient);
+
+static void BM_NeighbourGridBuild(benchmark::State& state)
+{
+	const std::vector<FVec3> points = makeFluidBlock(static_cast<int>(state.range(0)));
+	FNeighbourGrid grid;
+	grid.Initialise(64, 64, 64, kKernelRadius);
+	for (auto _ : state)
+	{
+		grid.Build(points.data(), points.size());
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * points.size());
+	state.counters["particles"] = static_cast<double>(points.size());
+}
+BENCHMARK(BM_NeighbourGridBuild)->Arg(10)->Arg(20)->Arg(30);
+
+static void BM_NeighbourGridQuery(benchmark::State& state)
+{
+	const std::vector<FVec3> points = makeFluidBlock(static_cast<int>(state.range(0)));
+	FNeighbourGrid grid;
+	grid.Initialise(64, 64, 64, kKernelRadius);
+	grid.Build(points.data(), points.size());
+	size_t numOfPairs = 0;
+	for (auto _ : state)
+	{
+		numOfPairs = 0;
+		for (const FVec3& point : points)
+		{
+			grid.ForEachNearbyPoint(point, kKernelRadius, [&](size_t, const FVec3&) { numOfPairs++; });
+		}
+		benchmark::DoNotOptimize(numOfPairs);
+	}
+	state.SetItemsProcessed(state.iterations() * points.size());
+	state.counters["pairsPerParticle"] = static_cast<double>(numOfPairs) / points.size();
+}
+BENCHMARK(BM_NeighbourGridQuery)->Arg(10)->Arg(20)->Arg(30);
+
+static void BM_PressureForcePairs(benchmark::State& state)
+{
+	const FSpikyKernel kernel(kKernelRadius);
+	const std::vector<FVec3> points = makeFluidBlock(8);
+	for (auto _ : state)
+	{
+		FVec3 sum;
+		for (size_t i = 0; i < points.size(); i++)
+		{
+			for (size_t j = 0; j < points.size(); j++)
+			{
+				sum += PressureForceTerm(1.0, 1.0, 0.5, 0.5, points[i], points[j], kernel);
+			}
+		}
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(state.iterations() * points.size() * points.size());
+}
+BENCHMARK(BM_PressureForcePairs);
+
+static void BM_ResolveContact(benchmark::State& state)
+{
+	const std::vector<FVec3> points = makeFluidBlock(16);
+	for (auto _ : state)
+	{
+		size_t numOfCollisions = 0;
+		for (const FVec3& point : points)
+		{
+			FVec3 position = point;
+			FVec3 velocity(0.5, 0.0, -1.0);
+			numOfCollisions += ResolveContact(PlaneContact(FVec3(0.0, 0.0, 2.0), FVec3(0.0, 0.0, 1.0), position), 1.0, 0.3, 0.2,
+				&position, &velocity);
+			benchmark::DoNotOptimize(velocity);
+		}
+		benchmark::DoNotOptimize(numOfCollisions);
+	}
+	state.SetItemsProcessed(state.iterations() * points.size());
+}
+BENCHMARK(BM_ResolveContact);
+
+//Whole steps of a dam break, the same shape of scene as the commandlet's DamBreak scenario
+static void BM_WcsphDamBreakStep(benchmark::State& state)
+{
+	const double side = static_cast<double>(state.range(0));
+	FWcsphSettings settings;
+	settings.domainLower = FVec3(-1.0);
+	settings.domainUpper = FVec3(3.0 * side, side + 1.0, 2.0 * side);
+	FWcsphSolver solver(settings);
+	solver.FillBox(FVec3(0.0), FVec3(side - 1.0));
+	//settle into a splashing state first, so the steps measured have the neighbour counts of a running scene
+	for (int step = 0; step < 20; step++)
+	{
+		solver.Step(0.005);
+	}
+
+	for (auto _ : state)
+	{
+		solver.Step(0.005);
+	}
+	state.SetItemsProcessed(state.iterations() * solver.GetNumOfParticles());
+	state.counters["particles"] = static_cast<double>(solver.GetNumOfParticles());
+	state.counters["neighbourPairs"] = static_cast<double>(solver.GetNumOfNeighbourPairs());
+}
+BENCHMARK(BM_WcsphDamBreakStep)->Arg(8)->Arg(12)->Arg(16)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,80 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FluidCore/WcsphSolver.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace FluidCore;
+
+//Every allocation of this test executable goes through the counting operators below. Only those made while counting is on are counted,
+//so gtest's own allocations don't get in the way.
+namespace
+{
+	std::atomic<bool> isCounting{ false };
+	std::atomic<int> numOfAllocations{ 0 };
+
+	void* countedAllocate(std::size_t size)
+	{
+		if (isCounting)
+		{
+			numOfAllocations++;
+		}
+		if (void* memory = std::malloc(size != 0 ? size : 1))
+		{
+			return memory;
+		}
+		throw std::bad_alloc();
+	}
+
+	//Counts the allocations made by the steps run inside it
+	class FAllocationCountScope
+	{
+	public:
+		FAllocationCountScope() { numOfAllocations = 0; isCounting = true; }
+		~FAllocationCountScope() { isCounting = false; }
+		int GetNumOfAllocations() const { return numOfAllocations; }
+	};
+}
+
+void* operator new(std::size_t size) { return countedAllocate(size); }
+void* operator new[](std::size_t size) { return countedAllocate(size); }
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::size_t) noexcept { std::free(memory); }
+
+TEST(Allocations, CountingCatchesAnAllocation)
+{
+	FAllocationCountScope scope;
+	//called directly, since a new expression whose result isn't used may be left out by the compiler
+	::operator delete(::operator new(sizeof(int)));
+	EXPECT_EQ(scope.GetNumOfAllocations(), 1);
+}
+
+TEST(Allocations, NonePerStepOnceWarmedUp)
+{
+	FWcsphSettings settings;
+	settings.domainLower = FVec3(-4.0, -4.0, -4.0);
+	settings.domainUpper = FVec3(4.0, 4.0, 8.0);
+	FWcsphSolver solver(settings);
+	solver.FillBox(FVec3(-3.0, -3.0, -3.0), FVec3(3.0, 3.0, 3.0));
+
+	//the first steps grow the grid and the neighbour lists to their working size
+	for (int step = 0; step < 10; step++)
+	{
+		solver.Step(0.002);
+	}
+
+	int numOfAllocations = 0;
+	{
+		FAllocationCountScope scope;
+		for (int step = 0; step < 50; step++)
+		{
+			solver.Step(0.002);
+		}
+		numOfAllocations = scope.GetNumOfAllocations();
+	}
+	EXPECT_EQ(numOfAllocations, 0);
+}
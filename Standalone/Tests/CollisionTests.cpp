@@ -0,0 +1,96 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FluidCore/Collision.h"
+#include <gtest/gtest.h>
+
+using namespace FluidCore;
+
+namespace
+{
+	const FVec3 kUp(0.0, 0.0, 1.0);
+}
+
+TEST(PlaneContact, ProjectsOntoThePlane)
+{
+	const FContact contact = PlaneContact(FVec3(0.0, 0.0, 1.0), kUp, FVec3(3.0, -2.0, 4.0));
+	EXPECT_DOUBLE_EQ(contact.point.X, 3.0);
+	EXPECT_DOUBLE_EQ(contact.point.Y, -2.0);
+	EXPECT_DOUBLE_EQ(contact.point.Z, 1.0);
+	EXPECT_DOUBLE_EQ(contact.distance, 3.0);
+}
+
+TEST(ResolveContact, LeavesParticlesAwayFromTheSurfaceAlone)
+{
+	FVec3 position(0.0, 0.0, 2.0);
+	FVec3 velocity(1.0, 0.0, -1.0);
+	EXPECT_FALSE(ResolveContact(PlaneContact(FVec3(), kUp, position), 1.0, 0.5, 0.5, &position, &velocity));
+	EXPECT_EQ(position.Z, 2.0);
+	EXPECT_EQ(velocity.Z, -1.0);
+}
+
+TEST(ResolveContact, MovesPenetratingParticlesOutByTheirRadius)
+{
+	for (double depth : { 0.5, -0.5 })
+	{
+		FVec3 position(1.0, 2.0, depth);
+		FVec3 velocity;
+		EXPECT_TRUE(ResolveContact(PlaneContact(FVec3(), kUp, position), 1.0, 0.0, 0.0, &position, &velocity));
+		EXPECT_DOUBLE_EQ(position.X, 1.0);
+		EXPECT_DOUBLE_EQ(position.Y, 2.0);
+		EXPECT_DOUBLE_EQ(position.Z, 1.0);
+	}
+}
+
+TEST(ResolveContact, AppliesRestitutionToTheNormalVelocity)
+{
+	FVec3 position(0.0, 0.0, 0.5);
+	FVec3 velocity(0.0, 0.0, -2.0);
+	ResolveContact(PlaneContact(FVec3(), kUp, position), 1.0, 0.5, 0.0, &position, &velocity);
+	EXPECT_DOUBLE_EQ(velocity.Z, 1.0);
+
+	position = FVec3(0.0, 0.0, 0.5);
+	velocity = FVec3(0.0, 0.0, -2.0);
+	ResolveContact(PlaneContact(FVec3(), kUp, position), 1.0, 0.0, 0.0, &position, &velocity);
+	EXPECT_DOUBLE_EQ(velocity.Z, 0.0);
+}
+
+TEST(ResolveContact, KeepsVelocitiesLeavingTheSurface)
+{
+	FVec3 position(0.0, 0.0, 0.5);
+	FVec3 velocity(1.0, 0.0, 2.0);
+	ResolveContact(PlaneContact(FVec3(), kUp, position), 1.0, 0.0, 1.0, &position, &velocity);
+	EXPECT_DOUBLE_EQ(velocity.X, 1.0);
+	EXPECT_DOUBLE_EQ(velocity.Z, 2.0);
+}
+
+TEST(ResolveContact, FrictionSlowsTheTangentialVelocity)
+{
+	//|delta vn| = 1, so a friction of 0.5 takes 0.5 off a tangential speed of 2, and a friction of 4 stops it
+	FVec3 position(0.0, 0.0, 0.5);
+	FVec3 velocity(2.0, 0.0, -1.0);
+	ResolveContact(PlaneContact(FVec3(), kUp, position), 1.0, 0.0, 0.5, &position, &velocity);
+	EXPECT_DOUBLE_EQ(velocity.X, 1.5);
+
+	position = FVec3(0.0, 0.0, 0.5);
+	velocity = FVec3(2.0, 0.0, -1.0);
+	ResolveContact(PlaneContact(FVec3(), kUp, position), 1.0, 0.0, 4.0, &position, &velocity);
+	EXPECT_DOUBLE_EQ(velocity.X, 0.0);
+}
+
+TEST(ResolveContact, UsesTheVelocityRelativeToTheCollider)
+{
+	FContact contact = PlaneContact(FVec3(), kUp, FVec3(0.0, 0.0, 0.5));
+	contact.velocity = FVec3(0.0, 0.0, 1.0);
+	FVec3 position(0.0, 0.0, 0.5);
+	FVec3 velocity;
+	ResolveContact(contact, 1.0, 0.0, 0.0, &position, &velocity);
+	//a rising floor carries the particle at rest with it
+	EXPECT_DOUBLE_EQ(velocity.Z, 1.0);
+}
+
+TEST(RigidVelocityAt, AddsTheRotation)
+{
+	const FVec3 velocity = RigidVelocityAt(FVec3(1.0, 0.0, 0.0), FVec3(0.0, 0.0, 2.0), FVec3(), FVec3(0.0, 1.0, 0.0));
+	EXPECT_DOUBLE_EQ(velocity.X, -1.0);
+	EXPECT_DOUBLE_EQ(velocity.Y, 0.0);
+}
@@ -0,0 +1,31 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FluidCore/Emission.h"
+#include <gtest/gtest.h>
+
+using namespace FluidCore;
+
+TEST(Emission, ParticlesOfOneStepAreSpacedByTheRate)
+{
+	//a step of 0.1 s at 25 particles per second with 0.3 of a particle pending makes 2 particles, due at 0.028 s and 0.068 s
+	EXPECT_NEAR(EmissionAge(0, 0.3, 25.0, 0.1), 0.072, 1e-12);
+	EXPECT_NEAR(EmissionAge(1, 0.3, 25.0, 0.1), 0.032, 1e-12);
+}
+
+TEST(Emission, TwoParticlesEmittedInOneStepAreNotCoincident)
+{
+	const FVec3 origin(1.0, 2.0, 3.0);
+	const FVec3 velocity(0.0, 0.0, 10.0);
+	const FVec3 first = EmissionPosition(origin, velocity, 0, 0.0, 1000.0, 1.0 / 60.0);
+	const FVec3 second = EmissionPosition(origin, velocity, 1, 0.0, 1000.0, 1.0 / 60.0);
+	//a particle every millisecond at 10 units per second
+	EXPECT_NEAR(FVec3::Distance(first, second), 0.01, 1e-12);
+	EXPECT_GT(first.Z, second.Z);
+}
+
+TEST(Emission, TheLastParticleDueCanBeAtTheOrigin)
+{
+	EXPECT_EQ(EmissionAge(0, 0.0, 10.0, 0.1), 0.0);
+	const FVec3 position = EmissionPosition(FVec3(1.0), FVec3(5.0), 0, 0.0, 10.0, 0.1);
+	EXPECT_EQ(position.X, 1.0);
+}
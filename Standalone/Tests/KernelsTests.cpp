@@ -0,0 +1,90 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FluidCore/Kernels.h"
+#include <gtest/gtest.h>
+
+using namespace FluidCore;
+
+namespace
+{
+	//integral of the kernel over the ball of its radius, by the midpoint rule on shells
+	template <typename Kernel>
+	double integrateOverBall(const Kernel& kernel, double kernelRadius)
+	{
+		const int numOfShells = 20000;
+		const double dr = kernelRadius / numOfShells;
+		double sum = 0.0;
+		for (int k = 0; k < numOfShells; k++)
+		{
+			const double r = (k + 0.5) * dr;
+			sum += 4.0 * kPi * r * r * kernel(r) * dr;
+		}
+		return sum;
+	}
+
+	template <typename Kernel>
+	void expectDerivativesMatchDifferences(const Kernel& kernel, double kernelRadius)
+	{
+		const double step = 1e-5 * kernelRadius;
+		for (double r = 0.05 * kernelRadius; r < 0.95 * kernelRadius; r += 0.1 * kernelRadius)
+		{
+			const double first = (kernel(r + step) - kernel(r - step)) / (2.0 * step);
+			EXPECT_NEAR(kernel.FirstDerivative(r), first, 1e-5 * std::abs(first) + 1e-9) << "r = " << r;
+			const double second = (kernel.FirstDerivative(r + step) - kernel.FirstDerivative(r - step)) / (2.0 * step);
+			EXPECT_NEAR(kernel.SecondDerivative(r), second, 1e-5 * std::abs(second) + 1e-9) << "r = " << r;
+		}
+	}
+}
+
+TEST(StdKernel, IsNormalised)
+{
+	for (double h : { 0.5, 1.8, 4.0 })
+	{
+		EXPECT_NEAR(integrateOverBall(FStdKernel(h), h), 1.0, 1e-6) << "h = " << h;
+	}
+}
+
+TEST(StdKernel, VanishesAtAndBeyondTheRadius)
+{
+	const FStdKernel kernel(1.8);
+	EXPECT_EQ(kernel(1.8), 0.0);
+	EXPECT_EQ(kernel(2.5), 0.0);
+	EXPECT_EQ(kernel.FirstDerivative(1.8), 0.0);
+	EXPECT_EQ(kernel.SecondDerivative(3.0), 0.0);
+	EXPECT_GT(kernel(0.0), kernel(0.9));
+}
+
+TEST(StdKernel, DerivativesMatchFiniteDifferences)
+{
+	expectDerivativesMatchDifferences(FStdKernel(1.8), 1.8);
+}
+
+TEST(SpikyKernel, IsNormalised)
+{
+	for (double h : { 0.5, 1.8, 4.0 })
+	{
+		EXPECT_NEAR(integrateOverBall(FSpikyKernel(h), h), 1.0, 1e-6) << "h = " << h;
+	}
+}
+
+TEST(SpikyKernel, DerivativesMatchFiniteDifferences)
+{
+	expectDerivativesMatchDifferences(FSpikyKernel(1.8), 1.8);
+}
+
+TEST(SpikyKernel, GradientPointsAwayFromTheNeighbour)
+{
+	//the kernel falls with distance, so its gradient along the direction to the neighbour points back from it
+	const FSpikyKernel kernel(2.0);
+	const FVec3 gradient = kernel.Gradient(1.0, FVec3(0.0, 0.0, 1.0));
+	EXPECT_EQ(gradient.X, 0.0);
+	EXPECT_EQ(gradient.Y, 0.0);
+	EXPECT_GT(gradient.Z, 0.0);
+	EXPECT_DOUBLE_EQ(gradient.Z, -kernel.FirstDerivative(1.0));
+}
+
+TEST(Kernels, DefaultConstructedKernelsAreZero)
+{
+	EXPECT_EQ(FStdKernel()(0.5), 0.0);
+	EXPECT_EQ(FSpikyKernel()(0.5), 0.0);
+}
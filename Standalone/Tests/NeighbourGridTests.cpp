@@ -0,0 +1,164 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FluidCore/NeighbourGrid.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+
+using namespace FluidCore;
+
+namespace
+{
+	std::vector<FVec3> makeRandomPoints(size_t num, double lower, double upper, unsigned seed)
+	{
+		std::mt19937 random(seed);
+		std::uniform_real_distribution<double> coordinate(lower, upper);
+		std::vector<FVec3> points(num);
+		for (FVec3& point : points)
+		{
+			point = FVec3(coordinate(random), coordinate(random), coordinate(random));
+		}
+		return points;
+	}
+
+	std::vector<size_t> queryGrid(const FNeighbourGrid& grid, const FVec3& origin, double radius)
+	{
+		std::vector<size_t> found;
+		grid.ForEachNearbyPoint(origin, radius, [&](size_t i, const FVec3& position) {
+			EXPECT_EQ(position.X, grid.GetPoint(i).X);
+			found.push_back(i);
+		});
+		std::sort(found.begin(), found.end());
+		return found;
+	}
+
+	std::vector<size_t> queryBruteForce(const std::vector<FVec3>& points, const FVec3& origin, double radius)
+	{
+		std::vector<size_t> found;
+		for (size_t i = 0; i < points.size(); i++)
+		{
+			if (FVec3::DistSquared(points[i], origin) <= radius * radius)
+			{
+				found.push_back(i);
+			}
+		}
+		return found;
+	}
+
+	void expectMatchesBruteForce(int32_t resolution, double gridSpacing, double radius, double extent)
+	{
+		const std::vector<FVec3> points = makeRandomPoints(2000, -extent, extent, 7);
+		FNeighbourGrid grid;
+		grid.Initialise(resolution, resolution, resolution, gridSpacing);
+		grid.Build(points.data(), points.size());
+
+		for (size_t q = 0; q < points.size(); q += 37)
+		{
+			const std::vector<size_t> found = queryGrid(grid, points[q], radius);
+			//every point is reported once
+			EXPECT_TRUE(std::adjacent_find(found.begin(), found.end()) == found.end());
+			EXPECT_EQ(found, queryBruteForce(points, points[q], radius)) << "query " << q;
+		}
+	}
+}
+
+TEST(NeighbourGrid, MatchesBruteForceWhenTheRadiusIsHalfTheSpacing)
+{
+	expectMatchesBruteForce(64, 2.0, 1.0, 20.0);
+}
+
+TEST(NeighbourGrid, MatchesBruteForceWhenTheRadiusIsTheSpacing)
+{
+	//the game spaces the grid by the kernel radius
+	expectMatchesBruteForce(64, 1.8, 1.8, 20.0);
+}
+
+TEST(NeighbourGrid, MatchesBruteForceWhenTheRadiusSpansSeveralBuckets)
+{
+	expectMatchesBruteForce(64, 0.5, 1.8, 10.0);
+}
+
+TEST(NeighbourGrid, MatchesBruteForceWhenBucketsWrapAround)
+{
+	//points far beyond the grid share buckets with points near the query
+	expectMatchesBruteForce(8, 1.0, 1.5, 30.0);
+}
+
+TEST(NeighbourGrid, VisitsEveryBucketOnceWhenTheQueryIsWiderThanTheGrid)
+{
+	expectMatchesBruteForce(4, 1.0, 5.0, 6.0);
+}
+
+TEST(NeighbourGrid, IncludesPointsOnTheQuerySphere)
+{
+	const FVec3 points[] = { FVec3(0.0, 0.0, 0.0), FVec3(1.0, 0.0, 0.0), FVec3(0.0, -1.0, 0.0) };
+	FNeighbourGrid grid;
+	grid.Initialise(64, 64, 64, 1.0);
+	grid.Build(points, 3);
+	EXPECT_EQ(queryGrid(grid, FVec3(), 1.0), std::vector<size_t>({ 0, 1, 2 }));
+}
+
+TEST(NeighbourGrid, EmptyGridFindsNothing)
+{
+	FNeighbourGrid grid;
+	EXPECT_TRUE(queryGrid(grid, FVec3(), 10.0).empty());
+	grid.Build(nullptr, 0);
+	EXPECT_TRUE(queryGrid(grid, FVec3(), 10.0).empty());
+}
+
+TEST(NeighbourGrid, RebuildForgetsTheOldPoints)
+{
+	std::vector<FVec3> points = makeRandomPoints(500, -5.0, 5.0, 11);
+	FNeighbourGrid grid;
+	grid.Initialise(16, 16, 16, 1.0);
+	grid.Build(points.data(), points.size());
+
+	points.resize(100);
+	grid.Build(points.size(), [&](size_t i) { return points[i]; });
+	EXPECT_EQ(grid.GetNumOfPoints(), 100u);
+	EXPECT_EQ(queryGrid(grid, FVec3(), 20.0).size(), 100u);
+}
+
+TEST(NeighbourGrid, BoxQueryMatchesBruteForce)
+{
+	//the surface mesher asks for the points around each of its blocks, which are wider than the buckets
+	const std::vector<FVec3> points = makeRandomPoints(2000, -20.0, 20.0, 13);
+	FNeighbourGrid grid;
+	grid.Initialise(16, 16, 16, 1.8);
+	grid.Build(points.data(), points.size());
+
+	const FVec3 lower(-6.0, -2.5, 1.0);
+	const FVec3 upper(3.0, 7.5, 9.0);
+	std::vector<size_t> found;
+	grid.ForEachPointInBox(lower, upper, [&](size_t i, const FVec3&) { found.push_back(i); });
+	std::sort(found.begin(), found.end());
+	EXPECT_TRUE(std::adjacent_find(found.begin(), found.end()) == found.end());
+
+	std::vector<size_t> expected;
+	for (size_t i = 0; i < points.size(); i++)
+	{
+		const FVec3& point = points[i];
+		if (point.X >= lower.X && point.Y >= lower.Y && point.Z >= lower.Z && point.X <= upper.X && point.Y <= upper.Y && point.Z <= upper.Z)
+		{
+			expected.push_back(i);
+		}
+	}
+	EXPECT_FALSE(expected.empty());
+	EXPECT_EQ(found, expected);
+}
+
+TEST(NeighbourGrid, BucketOrderHoldsEveryPointOnce)
+{
+	std::vector<FVec3> points = makeRandomPoints(500, -5.0, 5.0, 17);
+	FNeighbourGrid grid;
+	grid.Initialise(16, 16, 16, 1.0);
+	grid.Build(points.data(), points.size());
+
+	std::vector<int32_t> order = grid.GetPointsInBucketOrder();
+	std::sort(order.begin(), order.end());
+	ASSERT_EQ(order.size(), points.size());
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		EXPECT_EQ(order[i], static_cast<int32_t>(i));
+	}
+}
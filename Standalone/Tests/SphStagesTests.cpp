@@ -0,0 +1,122 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FluidCore/Lattice.h"
+#include "FluidCore/SphStages.h"
+#include <gtest/gtest.h>
+
+using namespace FluidCore;
+
+TEST(PressureFromEos, IsZeroAtTheTargetDensity)
+{
+	EXPECT_EQ(PressureFromEos(1000.0, 1000.0, 1e7, 7.0, 0.0), 0.0);
+}
+
+TEST(PressureFromEos, FollowsTait)
+{
+	const double eosScale = 1.0 * 100.0 * 100.0;
+	EXPECT_DOUBLE_EQ(PressureFromEos(1.1, 1.0, eosScale, 7.0, 0.0), eosScale / 7.0 * (std::pow(1.1, 7.0) - 1.0));
+	EXPECT_NEAR(PressureFromEos(1.1, 1.0, eosScale, 1.0, 0.0), eosScale * 0.1, 1e-9 * eosScale);
+}
+
+TEST(PressureFromEos, ScalesNegativePressures)
+{
+	EXPECT_EQ(PressureFromEos(0.9, 1.0, 100.0, 1.0, 0.0), 0.0);
+	EXPECT_DOUBLE_EQ(PressureFromEos(0.9, 1.0, 100.0, 1.0, 0.5), 0.5 * 100.0 * (0.9 - 1.0));
+}
+
+TEST(PressureForceTerm, IsAntisymmetric)
+{
+	const FSpikyKernel kernel(1.8);
+	const FVec3 a(0.1, 0.2, 0.3);
+	const FVec3 b(0.9, -0.4, 0.5);
+	const FVec3 ab = PressureForceTerm(1.0, 2.0, 0.3, 0.7, a, b, kernel);
+	const FVec3 ba = PressureForceTerm(2.0, 1.0, 0.7, 0.3, b, a, kernel);
+	EXPECT_NEAR(ab.X + ba.X, 0.0, 1e-12);
+	EXPECT_NEAR(ab.Y + ba.Y, 0.0, 1e-12);
+	EXPECT_NEAR(ab.Z + ba.Z, 0.0, 1e-12);
+}
+
+TEST(PressureForceTerm, PositivePressurePushesParticlesApart)
+{
+	const FVec3 force = PressureForceTerm(1.0, 1.0, 1.0, 1.0, FVec3(), FVec3(1.0, 0.0, 0.0), FSpikyKernel(1.8));
+	EXPECT_LT(force.X, 0.0);
+	EXPECT_EQ(force.Y, 0.0);
+	EXPECT_EQ(force.Z, 0.0);
+}
+
+TEST(PressureForceTerm, IsZeroForCoincidentParticles)
+{
+	const FVec3 force = PressureForceTerm(1.0, 1.0, 1.0, 1.0, FVec3(1.0), FVec3(1.0), FSpikyKernel(1.8));
+	EXPECT_EQ(force.SizeSquared(), 0.0);
+}
+
+TEST(ViscosityForceTerm, PullsTowardsTheNeighbourVelocity)
+{
+	const FVec3 force = ViscosityForceTerm(3.0, 1.0, 1.0, FVec3(), FVec3(0.0, 2.0, 0.0), 1.0, 1.0, FSpikyKernel(1.8));
+	EXPECT_GT(force.Y, 0.0);
+	EXPECT_EQ(ViscosityForceTerm(3.0, 1.0, 1.0, FVec3(), FVec3(0.0, 2.0, 0.0), 1.0, 2.0, FSpikyKernel(1.8)).SizeSquared(), 0.0);
+}
+
+TEST(IntegrateParticle, IsSemiImplicit)
+{
+	FVec3 position;
+	FVec3 velocity;
+	IntegrateParticle(FVec3(1.0, 0.0, 0.0), FVec3(0.0, 1.0, 0.0), FVec3(0.0, 0.0, -4.0), 2.0, 0.5, &position, &velocity);
+	EXPECT_DOUBLE_EQ(velocity.Y, 1.0);
+	EXPECT_DOUBLE_EQ(velocity.Z, -1.0);
+	//the position moves with the new velocity
+	EXPECT_DOUBLE_EQ(position.X, 1.0);
+	EXPECT_DOUBLE_EQ(position.Y, 0.5);
+	EXPECT_DOUBLE_EQ(position.Z, -0.5);
+}
+
+TEST(BccLattice, HasTwoInterleavedCubicLattices)
+{
+	std::vector<FVec3> points;
+	GenerateBccLattice(FVec3(0.0), FVec3(2.0), 1.0, &points);
+	//five layers along Y: three of 3x3 points and two of 2x2 points offset by half a spacing
+	EXPECT_EQ(points.size(), 3u * 9u + 2u * 4u);
+	EXPECT_DOUBLE_EQ(points[9].X, 0.5);
+	EXPECT_DOUBLE_EQ(points[9].Y, 0.5);
+	EXPECT_DOUBLE_EQ(points[9].Z, 0.5);
+}
+
+TEST(CubicLattice, FillsTheBoxInclusive)
+{
+	std::vector<FVec3> points;
+	GenerateCubicLattice(FVec3(-1.0), FVec3(1.0), 0.5, &points);
+	EXPECT_EQ(points.size(), 125u);
+	EXPECT_DOUBLE_EQ(points.back().X, 1.0);
+}
+
+TEST(BccLattice, LayersFilledByThreadsMatchTheLayout)
+{
+	//big enough to be split between threads
+	const FBccLatticeLayout layout(FVec3(0.0), FVec3(60.0, 40.0, 50.0), 1.0);
+	std::vector<FVec3> points(3);
+	GenerateBccLattice(FVec3(0.0), FVec3(60.0, 40.0, 50.0), 1.0, &points);
+	ASSERT_EQ(points.size(), 3u + layout.GetNumOfPoints());
+	for (int k = 0; k < layout.GetNumOfLayers(); k++)
+	{
+		layout.ForEachPointOfLayer(k, [&](size_t index, const FVec3& point) {
+			EXPECT_EQ(points[3 + index].X, point.X);
+			EXPECT_EQ(points[3 + index].Y, point.Y);
+			EXPECT_EQ(points[3 + index].Z, point.Z);
+			});
+	}
+	EXPECT_EQ(layout.GetFirstPointOfLayer(1), 61u * 51u);
+}
+
+TEST(Pcisph, DenominatorIsNegativeAndDeltaPositive)
+{
+	const double denominator = ComputePcisphDenominator(1.8, 1.0);
+	EXPECT_LT(denominator, 0.0);
+	EXPECT_GT(ComputePcisphDelta(denominator, 1.0, 1.0, 0.01), 0.0);
+}
+
+TEST(Pcisph, DeltaScalesWithTheInverseSquareOfTheTimeStep)
+{
+	const double denominator = ComputePcisphDenominator(1.8, 1.0);
+	EXPECT_NEAR(ComputePcisphDelta(denominator, 1.0, 1.0, 0.01) / ComputePcisphDelta(denominator, 1.0, 1.0, 0.02), 4.0, 1e-9);
+	EXPECT_EQ(ComputePcisphDelta(0.0, 1.0, 1.0, 0.01), 0.0);
+}
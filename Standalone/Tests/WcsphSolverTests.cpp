@@ -0,0 +1,77 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FluidCore/WcsphSolver.h"
+#include <gtest/gtest.h>
+#include <cmath>
+
+using namespace FluidCore;
+
+namespace
+{
+	FVec3 totalMomentum(const FWcsphSolver& solver)
+	{
+		FVec3 momentum;
+		for (const FVec3& velocity : solver.GetVelocities())
+		{
+			momentum += solver.GetSettings().particleMass * velocity;
+		}
+		return momentum;
+	}
+}
+
+TEST(WcsphSolver, ConservesMomentumWithoutExternalForces)
+{
+	FWcsphSettings settings;
+	settings.gravity = FVec3();
+	//the viscosity term divides by the neighbour's density only, so it isn't symmetric between particles of different densities
+	settings.viscosityCoefficient = 0.0;
+	settings.domainLower = FVec3(-100.0);
+	settings.domainUpper = FVec3(100.0);
+	FWcsphSolver solver(settings);
+	solver.FillBox(FVec3(0.0), FVec3(3.0));
+	solver.AddParticle(FVec3(1.5, 1.5, 3.6), FVec3(0.0, 0.0, -5.0));
+
+	const FVec3 before = totalMomentum(solver);
+	for (int step = 0; step < 20; step++)
+	{
+		solver.Step(0.005);
+	}
+	const FVec3 after = totalMomentum(solver);
+	EXPECT_NEAR(after.X, before.X, 1e-9);
+	EXPECT_NEAR(after.Y, before.Y, 1e-9);
+	EXPECT_NEAR(after.Z, before.Z, 1e-9);
+}
+
+TEST(WcsphSolver, NeighbourListsAreSymmetric)
+{
+	FWcsphSolver solver;
+	solver.FillBox(FVec3(-2.0), FVec3(2.0));
+	solver.Step(0.001);
+	EXPECT_GT(solver.GetNumOfNeighbourPairs(), 0u);
+	EXPECT_EQ(solver.GetNumOfNeighbourPairs() % 2, 0u);
+}
+
+TEST(WcsphSolver, KeepsADamBreakInsideTheDomain)
+{
+	FWcsphSettings settings;
+	settings.domainLower = FVec3(-6.0, -3.0, -3.0);
+	settings.domainUpper = FVec3(6.0, 3.0, 9.0);
+	FWcsphSolver solver(settings);
+	solver.FillBox(FVec3(-5.0, -2.0, -2.0), FVec3(-1.0, 2.0, 4.0));
+	ASSERT_GT(solver.GetNumOfParticles(), 100u);
+
+	for (int step = 0; step < 200; step++)
+	{
+		solver.Step(0.005);
+	}
+
+	for (size_t i = 0; i < solver.GetNumOfParticles(); i++)
+	{
+		const FVec3& position = solver.GetPositions()[i];
+		ASSERT_TRUE(std::isfinite(position.X) && std::isfinite(position.Y) && std::isfinite(position.Z)) << "particle " << i;
+		EXPECT_GE(position.Z, settings.domainLower.Z + settings.particleRadius - 1e-9);
+		EXPECT_LE(position.X, settings.domainUpper.X - settings.particleRadius + 1e-9);
+		EXPECT_GT(solver.GetDensities()[i], 0.0);
+	}
+	EXPECT_TRUE(std::isfinite(solver.GetKineticEnergy()));
+}